@@ -14,6 +14,7 @@ struct keyboard {
 	struct keyboard_state state;
 	unsigned long phys_base;  /* Physical address of device */
 	int irq_no;	/* IRQ number of device */
+	int slot;	/* Notify slot on utcb */
 };
 
 #endif /* __KEYBOARD_H__ */
@@ -11,6 +11,7 @@ struct mouse {
 	unsigned long base;	/* Virtual base address */
 	unsigned long phys_base;  /* Physical address of device */
 	int irq_no;	/* IRQ number of device */
+	int slot;	/* Notify slot on utcb */
 };
 
 #endif /* __MOUSE_H__ */
@@ -44,90 +44,51 @@ int cap_share_all_with_space()
 	return 0;
 }
 
-int keyboard_irq_handler(void *arg)
+/*
+ * Irqs of all devices come to the main thread as
+ * notification bits, one bit for each notify slot.
+ */
+void keyboard_irq_handler(struct keyboard *keyboard)
 {
-	int err;
-	struct keyboard *keyboard = (struct keyboard *)arg;
-	const int slot = 0;
-
-	/*
-	 * For versatile, KMI refernce clock = 24MHz
-	 * KMI manual says we need 8MHz clock,
-	 * so divide by 3
-	 */
-	kmi_keyboard_init(keyboard->base, 3);
-	printf("%s: Keyboard initialization done..\n", __CONTAINER_NAME__);
-
-	/* Register self for timer irq, using notify slot 0 */
-	if ((err = l4_irq_control(IRQ_CONTROL_REGISTER, slot,
-				  keyboard->irq_no)) < 0) {
-		printf("%s: FATAL: Keyboard irq could not be registered. "
-		       "err=%d\n", __FUNCTION__, err);
-		BUG();
-	}
+	int data = l4_irq_read(keyboard->slot);
+	char c;
 
-	/* Handle irqs forever */
-	while (1) {
-		char c;
+	if (!data)
+		return;
 
-		/* Block on irq */
-		int data = l4_irq_wait(slot, keyboard->irq_no);
-		while (data--)
-			if ((c = kmi_keyboard_read(keyboard->base, &keyboard->state)))
-				printf("%c", c);
+	while (data--)
+		if ((c = kmi_keyboard_read(keyboard->base, &keyboard->state)))
+			printf("%c", c);
 
-		/*
-		 * Kernel has disabled irq for keyboard
-		 * We need to enable it
-		 */
-		kmi_rx_irq_enable(keyboard->base);
-	}
+	/*
+	 * Kernel has disabled irq for keyboard
+	 * We need to enable it
+	 */
+	kmi_rx_irq_enable(keyboard->base);
 }
 
-int mouse_irq_handler(void *arg)
+void mouse_irq_handler(struct mouse *mouse)
 {
-	int err;
-	struct mouse *mouse = (struct mouse *)arg;
-	const int slot = 0;
+	int data = l4_irq_read(mouse->slot);
+	int c;
 
-	/*
-	 * For versatile, KMI refernce clock = 24MHz
-	 * KMI manual says we need 8MHz clock,
-	 * so divide by 3
-	 */
-	kmi_mouse_init(mouse->base, 3);
-	printf("%s: Mouse initialization done..\n", __CONTAINER_NAME__);
-
-	/* Register self for timer irq, using notify slot 0 */
-	if ((err = l4_irq_control(IRQ_CONTROL_REGISTER, slot,
-				  mouse->irq_no)) < 0) {
-		printf("%s: FATAL: Mouse irq could not be registered. "
-		       "err=%d\n", __FUNCTION__, err);
-		BUG();
-	}
-
-	/* Handle irqs forever */
-	while (1) {
-		int c;
+	if (!data)
+		return;
 
-		/* Block on irq */
-		int data = l4_irq_wait(slot, mouse->irq_no);
-		while (data--)
-			if ((c = kmi_data_read(mouse->base)))
-				printf("mouse data: %d\n", c);
+	while (data--)
+		if ((c = kmi_data_read(mouse->base)))
+			printf("mouse data: %d\n", c);
 
-		/*
-		 * Kernel has disabled irq for mouse
-		 * We need to enable it
-		 */
-		kmi_rx_irq_enable(mouse->base);
-	}
+	/*
+	 * Kernel has disabled irq for mouse
+	 * We need to enable it
+	 */
+	kmi_rx_irq_enable(mouse->base);
 }
 
 int kmi_setup_devices(void)
 {
-	struct l4_thread thread;
-	struct l4_thread *tptr = &thread;
+	int slot = 0;
 	int err;
 
 	kbd[0].phys_base = PLATFORM_KEYBOARD0_BASE;
@@ -139,6 +100,7 @@ int kmi_setup_devices(void)
 		kbd[i].state.shift = 0;
 		kbd[i].state.caps_lock = 0;
 		kbd[i].state.keyup = 0;
+		kbd[i].slot = slot++;
 
 		/* Map timer to a virtual address region */
 		if (IS_ERR(l4_map((void *)kbd[i].phys_base,
@@ -151,17 +113,19 @@ int kmi_setup_devices(void)
 		}
 
 		/*
-		 * Create new keyboard irq handler thread.
-		 *
-		 * This will initialize its keyboard argument, register
-		 * itself as its irq handler, initiate keyboard and
-		 * wait on irqs.
+		 * For versatile, KMI refernce clock = 24MHz
+		 * KMI manual says we need 8MHz clock,
+		 * so divide by 3
 		 */
-		if ((err = thread_create(keyboard_irq_handler, &kbd[i],
-					 TC_SHARE_SPACE,
-					 &tptr)) < 0) {
-			printf("FATAL: Creation of irq handler "
-			       "thread failed.\n");
+		kmi_keyboard_init(kbd[i].base, 3);
+		printf("%s: Keyboard initialization done..\n",
+		       __CONTAINER_NAME__);
+
+		/* Register for keyboard irq on its notify slot */
+		if ((err = l4_irq_control(IRQ_CONTROL_REGISTER, kbd[i].slot,
+					  kbd[i].irq_no)) < 0) {
+			printf("%s: FATAL: Keyboard irq could not be "
+			       "registered. err=%d\n", __FUNCTION__, err);
 			BUG();
 		}
 	}
@@ -172,6 +136,7 @@ int kmi_setup_devices(void)
         for (int i = 0; i < MOUSE_TOTAL; i++) {
 		/* Get one page from address pool */
 		mouse[i].base = (unsigned long)l4_new_virtual(1);
+		mouse[i].slot = slot++;
 
 		/* Map timer to a virtual address region */
 		if (IS_ERR(l4_map((void *)mouse[i].phys_base,
@@ -183,17 +148,15 @@ int kmi_setup_devices(void)
 			BUG();
 		}
 
-		/*
-		 * Create new mouse irq handler thread.
-		 *
-		 * This will initialize its mouse argument, register
-		 * itself as its irq handler, initiate mouse and
-		 * wait on irqs.
-		 */
-		if ((err = thread_create(mouse_irq_handler, &mouse[i],
-					 TC_SHARE_SPACE, &tptr)) < 0) {
-			printf("FATAL: Creation of irq handler "
-			       "thread failed.\n");
+		kmi_mouse_init(mouse[i].base, 3);
+		printf("%s: Mouse initialization done..\n",
+		       __CONTAINER_NAME__);
+
+		/* Register for mouse irq on its notify slot */
+		if ((err = l4_irq_control(IRQ_CONTROL_REGISTER, mouse[i].slot,
+					  mouse[i].irq_no)) < 0) {
+			printf("%s: FATAL: Mouse irq could not be "
+			       "registered. err=%d\n", __FUNCTION__, err);
 			BUG();
 		}
 	}
@@ -268,7 +231,8 @@ void handle_requests(void)
 	int ret;
 
 	printf("%s: Initiating ipc.\n", __CONTAINER__);
-	if ((ret = l4_receive(L4_ANYTHREAD)) < 0) {
+	/* Requests, or notification bits of device irqs */
+	if ((ret = l4_receive_notify(L4_ANYTHREAD, L4_TIMEOUT_NEVER)) < 0) {
 		printf("%s: %s: IPC Error: %d. Quitting...\n", __CONTAINER__,
 		       __FUNCTION__, ret);
 		BUG();
@@ -278,6 +242,19 @@ void handle_requests(void)
 	tag = l4_get_tag();
 	senderid = l4_get_sender();
 
+	/* Irqs don't come from a thread, there is nobody to reply */
+	if (tag == L4_IPC_TAG_NOTIFY) {
+		unsigned int bits = l4_get_notify();
+
+		for (int i = 0; i < KEYBOARDS_TOTAL; i++)
+			if (bits & (1 << kbd[i].slot))
+				keyboard_irq_handler(&kbd[i]);
+		for (int i = 0; i < MOUSE_TOTAL; i++)
+			if (bits & (1 << mouse[i].slot))
+				mouse_irq_handler(&mouse[i]);
+		return;
+	}
+
 	/* Read mrs not used by syslib */
 	for (int i = 0; i < MR_UNUSED_TOTAL; i++)
 		mr[i] = read_mr(MR_UNUSED_START + i);
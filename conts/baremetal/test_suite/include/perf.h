@@ -59,11 +59,17 @@ void platform_measure_cpu_cycles(void);
 void perf_measure_getid_ticks(void);
 void perf_measure_cpu_cycles(void);
 void perf_measure_getid(void);
+void perf_measure_tswitch(void);
 void perf_measure_tctrl(void);
+void perf_measure_thread_create_scaling(void);
 int perf_measure_exregs(void);
 void perf_measure_ipc(void);
+void perf_measure_ipc_scaling(void);
+void perf_measure_cap_scaling(void);
+void perf_measure_pager_wakeup(void);
 void perf_measure_map(void);
 void perf_measure_unmap(void);
 void perf_measure_mutex(void);
+void perf_measure_balance_scaling(void);
 
 #endif /* __PERF_TESTS_H__ */
@@ -10,6 +10,7 @@
 #include L4LIB_INC_ARCH(syscalls.h)
 #include <l4lib/lib/thread.h>
 #include <l4lib/ipcdefs.h>
+#include <l4/api/errno.h>
 #include <tests.h>
 #include <macros.h>
 #include <fault.h>
@@ -523,6 +524,217 @@ int test_ipc_short(void)
 	return 0;
 }
 
+int ipc_timeout_thread(void *arg)
+{
+	return 0;
+}
+
+/*
+ * Ipc to and from a thread that never runs must give up, at
+ * once when polling, and after the timeout otherwise.
+ */
+int test_ipc_timeout(void)
+{
+	struct l4_thread *thread;
+	int err, ret = -1;
+
+	if ((err = thread_create(ipc_timeout_thread, 0,
+				 TC_SHARE_SPACE | TC_NOSTART,
+				 &thread)) < 0) {
+		dbg_printf("Thread create failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	if ((err = l4_receive_timeout(L4_ANYTHREAD,
+				      L4_TIMEOUT_POLL)) != -ETIMEDOUT) {
+		dbg_printf("Polling receive did not time out. "
+			   "err=%d\n", err);
+		goto out;
+	}
+
+	if ((err = l4_send_timeout(thread->ids.tid, 0,
+				   L4_TIMEOUT_POLL)) != -ETIMEDOUT) {
+		dbg_printf("Polling send did not time out. "
+			   "err=%d\n", err);
+		goto out;
+	}
+
+	if ((err = l4_receive_timeout(thread->ids.tid,
+				      L4_TIMEOUT_MSEC_LOG2(4)))
+	    != -ETIMEDOUT) {
+		dbg_printf("Timed receive did not time out. "
+			   "err=%d\n", err);
+		goto out;
+	}
+
+	if ((err = l4_send_timeout(thread->ids.tid, 0,
+				   L4_TIMEOUT_MSEC_LOG2(4)))
+	    != -ETIMEDOUT) {
+		dbg_printf("Timed send did not time out. "
+			   "err=%d\n", err);
+		goto out;
+	}
+
+	ret = 0;
+	dbg_printf("IPC timeouts successful.\n");
+out:
+	thread_destroy(thread);
+	return ret;
+}
+
+/* Sends a notification to the thread in arg, in two parts */
+int ipc_notify_thread(void *arg)
+{
+	l4id_t parent = (l4id_t)arg;
+	int err;
+
+	if ((err = l4_notify(parent, 0x2)) < 0)
+		return err;
+
+	return l4_notify(parent, 0x4);
+}
+
+/* Takes pending notifications, expecting exactly the given bits */
+static int ipc_notify_check(unsigned int timeout, unsigned int bits)
+{
+	int err;
+
+	if ((err = l4_receive_notify(L4_ANYTHREAD, timeout)) < 0) {
+		dbg_printf("Notify receive failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	if (l4_get_tag() != L4_IPC_TAG_NOTIFY || l4_get_notify() != bits) {
+		dbg_printf("Notify receive got tag %d, bits 0x%x, "
+			   "expected 0x%x\n", l4_get_tag(),
+			   l4_get_notify(), bits);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Notifications must not block on a thread that never receives,
+ * and sends before a receive must add up until it is done.
+ */
+int test_ipc_notify(void)
+{
+	struct l4_thread *thread;
+	int err, ret = -1;
+
+	if ((err = thread_create(ipc_notify_thread, (void *)self_tid(),
+				 TC_SHARE_SPACE | TC_NOSTART,
+				 &thread)) < 0) {
+		dbg_printf("Thread create failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	/* Never started, so a send would block here */
+	if ((err = l4_notify(thread->ids.tid, 0x1)) < 0) {
+		dbg_printf("Notify of idle thread failed. "
+			   "err=%d\n", err);
+		goto out;
+	}
+
+	/* Let it notify us in two parts and exit */
+	l4_thread_control(THREAD_RUN, &thread->ids);
+	if ((err = thread_wait(thread)) < 0) {
+		dbg_printf("THREAD_WAIT failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	/* Pending bits come back even when polling, all at once */
+	if (ipc_notify_check(L4_TIMEOUT_POLL, 0x6) < 0)
+		return -1;
+
+	/* And have all been taken */
+	if ((err = l4_receive_notify(L4_ANYTHREAD,
+				     L4_TIMEOUT_POLL)) != -ETIMEDOUT) {
+		dbg_printf("Notify receive with nothing pending "
+			   "did not time out. err=%d\n", err);
+		return -1;
+	}
+
+	dbg_printf("IPC notifications successful.\n");
+	return 0;
+out:
+	thread_destroy(thread);
+	return ret;
+}
+
+/* Set by the group client to the reply it got */
+static int ipc_group_reply;
+
+/* Calls the thread in arg, the reply comes from another thread */
+int ipc_group_client(void *arg)
+{
+	l4id_t server = (l4id_t)arg;
+
+	if (l4_sendrecv(server, server, 0) < 0)
+		ipc_group_reply = -1;
+	else
+		ipc_group_reply = l4_get_retval();
+	return 0;
+}
+
+/* Replies to the client in arg, on behalf of its group's first thread */
+int ipc_group_helper(void *arg)
+{
+	l4_set_sender((l4id_t)arg);
+	return l4_ipc_return(1);
+}
+
+/*
+ * A call to a thread may be replied to by any thread in its group,
+ * as multi-threaded servers do.
+ */
+int test_ipc_group_reply(void)
+{
+	struct l4_thread *client, *helper;
+	int err;
+
+	ipc_group_reply = 0;
+	if ((err = thread_create(ipc_group_client, (void *)self_tid(),
+				 TC_SHARE_SPACE, &client)) < 0) {
+		dbg_printf("Thread create failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	if ((err = l4_receive(client->ids.tid)) < 0) {
+		dbg_printf("Receive from group client failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	/* The reply comes from a new thread in our group */
+	if ((err = thread_create(ipc_group_helper,
+				 (void *)client->ids.tid,
+				 TC_SHARE_SPACE | TC_SHARE_GROUP,
+				 &helper)) < 0) {
+		dbg_printf("Thread create failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	thread_wait(helper);
+	thread_wait(client);
+
+	if (ipc_group_reply != 1) {
+		dbg_printf("Group client got reply %d, expected 1\n",
+			   ipc_group_reply);
+		return -1;
+	}
+
+	dbg_printf("IPC group reply successful.\n");
+	return 0;
+}
+
 int test_api_ipc(void)
 {
 	int err;
@@ -536,6 +748,15 @@ int test_api_ipc(void)
 	if ((err = test_ipc_full()) < 0)
 		goto out_err;
 
+	if ((err = test_ipc_timeout()) < 0)
+		goto out_err;
+
+	if ((err = test_ipc_notify()) < 0)
+		goto out_err;
+
+	if ((err = test_ipc_group_reply()) < 0)
+		goto out_err;
+
 	printf("IPC:                           -- PASSED --\n");
 	return 0;
 
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2010 B Labs Ltd.
+ *
+ * SMP load balancing throughput tests
+ *
+ * Author: Bahadir Balban
+ */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/exregs.h>
+#include <perf.h>
+#include <timer.h>
+#include <tests.h>
+#include <string.h>
+
+#define PERFTEST_BALANCE_LOOPS		1000000
+#define PERFTEST_BALANCE_MAX		8
+
+/* Number of busy threads at which throughput is sampled */
+static const int balance_scale_points[] = { 1, 2, 4, 8 };
+
+/* Pure cpu work, so that only the cpus it gets matter */
+int perf_balance_thread(void *arg)
+{
+	volatile unsigned int count = 0;
+
+	for (int i = 0; i < PERFTEST_BALANCE_LOOPS; i++)
+		count++;
+
+	return 0;
+}
+
+static int perf_balance_set_affinity(struct l4_thread *thread, int cpu)
+{
+	struct exregs_data exregs;
+
+	memset(&exregs, 0, sizeof(exregs));
+	exregs_set_affinity(&exregs, cpu);
+	return l4_exchange_registers(&exregs, thread->ids.tid);
+}
+
+/*
+ * Starts nthreads busy threads all on cpu 0 and returns the time
+ * it takes for all of them to finish. If they are left pinned, this
+ * is the time of a single cpu, otherwise the balancer should spread
+ * them over the other cpus.
+ */
+static int perf_balance_run(int nthreads, int pinned, unsigned int *usec)
+{
+	struct l4_thread *thread[PERFTEST_BALANCE_MAX];
+	unsigned int start;
+	int err;
+
+	for (int i = 0; i < nthreads; i++) {
+		if ((err = thread_create(perf_balance_thread, 0,
+					 TC_SHARE_SPACE | TC_NOSTART,
+					 &thread[i])) < 0 ||
+		    (err = perf_balance_set_affinity(thread[i], 0)) < 0) {
+			printf("%s: Thread setup failed. err=%d\n",
+			       __FUNCTION__, err);
+			for (int j = 0; j < i; j++)
+				thread_destroy(thread[j]);
+			return err;
+		}
+	}
+
+	timer_stop(timer_base);
+	timer_init_oneshot(timer_base);
+	timer_load(0xFFFFFFFF, timer_base);
+	timer_start(timer_base);
+	start = timer_read(timer_base);
+
+	for (int i = 0; i < nthreads; i++) {
+		l4_thread_control(THREAD_RUN, &thread[i]->ids);
+		if (!pinned)
+			perf_balance_set_affinity(thread[i], -1);
+	}
+
+	for (int i = 0; i < nthreads; i++)
+		thread_wait(thread[i]);
+
+	/* Timer counts down */
+	*usec = start - timer_read(timer_base);
+
+	return 0;
+}
+
+/*
+ * Runs 1 to N busy threads, first pinned to one cpu, then free to be
+ * moved around. On SMP, unpinned throughput should grow with the
+ * number of threads up to the number of cpus, while pinned
+ * throughput stays that of a single cpu.
+ */
+void perf_measure_balance_scaling(void)
+{
+	unsigned int usec, loops;
+	int nthreads;
+
+	for (int i = 0; i < sizeof(balance_scale_points) /
+			    sizeof(balance_scale_points[0]); i++) {
+		nthreads = balance_scale_points[i];
+		loops = nthreads * (PERFTEST_BALANCE_LOOPS / 1000);
+
+		for (int pinned = 1; pinned >= 0; pinned--) {
+			if (perf_balance_run(nthreads, pinned, &usec) < 0)
+				return;
+
+			printf("BALANCE with %d %s threads took "
+			       "%u microseconds, %u kloops per msec.\n",
+			       nthreads, pinned ? "pinned" : "unpinned", usec,
+			       usec ? loops * 1000 / usec : 0);
+		}
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * Syscall capability check cost against number of capabilities
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ *
+ * Author: Bahadir Balban
+ */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/perfmon.h>
+#include <l4lib/exregs.h>
+#include <l4lib/lib/cap.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
+
+struct perfmon_cycles cap_scale_cycles;
+
+#define PERFTEST_CAP_SCALE_COUNT		100
+
+/*
+ * Measures l4_exchange_registers on a dormant thread, which is
+ * dominated by the capability check for a small write, and
+ * reports it along with the number of capabilities we have.
+ *
+ * Capabilities are given to us by the container configuration
+ * and can't be grown at run-time. Run this under configurations
+ * with e.g. 4, 64 and 512 capabilities to compare. With indexed
+ * capability lookup, the cost should stay flat among them.
+ */
+void perf_measure_cap_scaling(void)
+{
+	struct exregs_data exregs;
+	struct task_ids ids;
+	int ncaps, err;
+
+	if ((err = l4_capability_control(CAP_CONTROL_NCAPS,
+					 0, &ncaps)) < 0) {
+		printf("%s: Reading number of capabilities failed. "
+		       "err=%d\n", __FUNCTION__, err);
+		return;
+	}
+
+	l4_getid(&ids);
+	if ((err = l4_thread_control(THREAD_CREATE | TC_SHARE_SPACE,
+				     &ids)) < 0) {
+		printf("%s: Thread create failed. err=%d\n",
+		       __FUNCTION__, err);
+		return;
+	}
+
+	memset(&cap_scale_cycles, 0, sizeof(cap_scale_cycles));
+	cap_scale_cycles.min = ~0; /* Init as maximum possible */
+
+	/* Write a single register, so that the check dominates */
+	memset(&exregs, 0, sizeof(exregs));
+	exregs_set_pc(&exregs, 0);
+
+	for (int i = 0; i < PERFTEST_CAP_SCALE_COUNT; i++) {
+		perfmon_reset_start_cyccnt();
+		if ((err = l4_exchange_registers(&exregs, ids.tid)) < 0) {
+			printf("%s: Exregs failed. err=%d\n",
+			       __FUNCTION__, err);
+			goto out;
+		}
+		perfmon_record_cycles(&cap_scale_cycles, "CAP_SCALE");
+	}
+
+	cap_scale_cycles.avg = cap_scale_cycles.total / cap_scale_cycles.ops;
+
+	printf("EXREGS_CAP_CHECK with %d caps took %llu min, %llu max, "
+	       "%llu avg cycles, in %llu ops.\n",
+	       ncaps,
+	       cap_scale_cycles.min,
+	       cap_scale_cycles.max,
+	       cap_scale_cycles.avg,
+	       cap_scale_cycles.ops);
+
+out:
+	l4_thread_control(THREAD_DESTROY, &ids);
+}
@@ -3,10 +3,354 @@
  *
  * l4_ipc performance tests
  *
+ * Round trips are measured for each ipc type, with the server in
+ * the same or in a copied space, on the same or on another cpu.
+ * Each case prints a single line of key=value pairs starting with
+ * PERF_IPC, so that runs can be compared from their logs.
+ *
  * Author: Bahadir Balban
  */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/exregs.h>
+#include <l4lib/perfmon.h>
+#include <l4/api/errno.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
+
+#define PERFTEST_IPC_COUNT		1000
+#define PERFTEST_IPC_WARMUP		10
+#define PERFTEST_IPC_EXIT		1
+#define PERFTEST_IPC_EXT_SIZE		1024
+#define PERFTEST_IPC_HIST_BUCKETS	32
+
+enum perf_ipc_type {
+	PERF_IPC_SHORT,
+	PERF_IPC_FULL,
+	PERF_IPC_EXTENDED,
+};
+
+static const char *perf_ipc_type_names[] = {
+	[PERF_IPC_SHORT] = "short",
+	[PERF_IPC_FULL] = "full",
+	[PERF_IPC_EXTENDED] = "extended",
+};
+
+struct perf_ipc_test {
+	int type;		/* One of enum perf_ipc_type */
+	int copy_space;		/* Server has a space of its own */
+	int cross_cpu;		/* Server runs on another cpu */
+	int reply_wait;		/* Server replies and waits in one call */
+	l4id_t client;
+	l4id_t server;
+	int err;		/* Set by the client if it failed */
+	struct perfmon_cycles cycles;
+	u64 samples[PERFTEST_IPC_COUNT];
+};
+
+static struct perf_ipc_test ipc_test;
+
+/* Extended ipc payload, its contents are of no interest */
+static char perf_ipc_buf[PERFTEST_IPC_EXT_SIZE];
+
+/* Client side of a round trip */
+static int perf_ipc_call(struct perf_ipc_test *test, unsigned int tag)
+{
+	int err;
+
+	switch (test->type) {
+	case PERF_IPC_SHORT:
+		return l4_sendrecv(test->server, test->server, tag);
+	case PERF_IPC_FULL:
+		return l4_sendrecv_full(test->server, test->server, tag);
+	case PERF_IPC_EXTENDED:
+		/* There is no extended sendrecv, it takes two calls */
+		if ((err = l4_send_extended(test->server, tag,
+					    PERFTEST_IPC_EXT_SIZE,
+					    perf_ipc_buf)) < 0)
+			return err;
+		return l4_receive_extended(test->server,
+					   PERFTEST_IPC_EXT_SIZE,
+					   perf_ipc_buf);
+	}
+	return -EINVAL;
+}
+
+/* Tells the server to exit, it does not reply to this */
+static int perf_ipc_exit(struct perf_ipc_test *test)
+{
+	switch (test->type) {
+	case PERF_IPC_SHORT:
+		return l4_send(test->server, PERFTEST_IPC_EXIT);
+	case PERF_IPC_FULL:
+		return l4_send_full(test->server, PERFTEST_IPC_EXIT);
+	case PERF_IPC_EXTENDED:
+		return l4_send_extended(test->server, PERFTEST_IPC_EXIT,
+					PERFTEST_IPC_EXT_SIZE,
+					perf_ipc_buf);
+	}
+	return -EINVAL;
+}
+
+static int perf_ipc_receive(struct perf_ipc_test *test)
+{
+	switch (test->type) {
+	case PERF_IPC_SHORT:
+		return l4_receive(test->client);
+	case PERF_IPC_FULL:
+		return l4_receive_full(test->client);
+	case PERF_IPC_EXTENDED:
+		return l4_receive_extended(test->client,
+					   PERFTEST_IPC_EXT_SIZE,
+					   perf_ipc_buf);
+	}
+	return -EINVAL;
+}
+
+/* Server side, replies and then waits for the next request */
+static int perf_ipc_reply(struct perf_ipc_test *test)
+{
+	int err;
+
+	if (test->reply_wait) {
+		switch (test->type) {
+		case PERF_IPC_SHORT:
+			return l4_sendrecv(test->client, test->client, 0);
+		case PERF_IPC_FULL:
+			return l4_sendrecv_full(test->client,
+						test->client, 0);
+		}
+	}
+
+	switch (test->type) {
+	case PERF_IPC_SHORT:
+		err = l4_send(test->client, 0);
+		break;
+	case PERF_IPC_FULL:
+		err = l4_send_full(test->client, 0);
+		break;
+	case PERF_IPC_EXTENDED:
+		err = l4_send_extended(test->client, 0,
+				       PERFTEST_IPC_EXT_SIZE,
+				       perf_ipc_buf);
+		break;
+	default:
+		err = -EINVAL;
+	}
+
+	if (err < 0)
+		return err;
+
+	return perf_ipc_receive(test);
+}
+
+/*
+ * Replies to each request from the client until told to exit.
+ * In a copied space, this works on its own copy of the test.
+ */
+int perf_ipc_server_thread(void *arg)
+{
+	struct perf_ipc_test *test = arg;
+	int err;
+
+	if ((err = perf_ipc_receive(test)) < 0)
+		return err;
+
+	while (l4_get_tag() != PERFTEST_IPC_EXIT)
+		if ((err = perf_ipc_reply(test)) < 0)
+			return err;
+
+	return 0;
+}
+
+/* Makes the calls, and records the cycles of each one */
+int perf_ipc_client_thread(void *arg)
+{
+	struct perf_ipc_test *test = arg;
+	int err;
+
+	/* Fault in buffers and caches before measuring */
+	for (int i = 0; i < PERFTEST_IPC_WARMUP; i++)
+		if ((err = perf_ipc_call(test, 0)) < 0)
+			goto out;
+
+	for (int i = 0; i < PERFTEST_IPC_COUNT; i++) {
+		perfmon_reset_start_cyccnt();
+		err = perf_ipc_call(test, 0);
+		perfmon_record_cycles(&test->cycles, "IPC");
+		if (err < 0)
+			goto out;
+		test->samples[i] = test->cycles.last;
+	}
+	err = 0;
+
+out:
+	test->err = err;
+
+	/* Server is waiting for us, whatever happened */
+	perf_ipc_exit(test);
+	return err;
+}
+
+static int perf_ipc_set_affinity(struct l4_thread *thread, int cpu)
+{
+	struct exregs_data exregs;
+
+	memset(&exregs, 0, sizeof(exregs));
+	exregs_set_affinity(&exregs, cpu);
+	return l4_exchange_registers(&exregs, thread->ids.tid);
+}
+
+/* Sorts samples for percentiles. Few enough for an insertion sort */
+static void perf_ipc_sort(u64 *samples, int n)
+{
+	u64 val;
+	int j;
+
+	for (int i = 1; i < n; i++) {
+		val = samples[i];
+		for (j = i - 1; j >= 0 && samples[j] > val; j--)
+			samples[j + 1] = samples[j];
+		samples[j + 1] = val;
+	}
+}
+
+static int perf_ipc_log2(u64 val)
+{
+	int log2 = 0;
+
+	while (val >>= 1)
+		log2++;
+	return log2;
+}
+
+/*
+ * Prints a test's results on one line: min, avg, max and
+ * percentiles in cycles, then a histogram of samples over
+ * power of two buckets as bucket:count pairs.
+ */
+static void perf_ipc_print(struct perf_ipc_test *test)
+{
+	unsigned int hist[PERFTEST_IPC_HIST_BUCKETS];
+	u64 *s = test->samples;
+	int n = PERFTEST_IPC_COUNT;
+	int first = 1, bucket;
+
+	perf_ipc_sort(s, n);
+
+	memset(hist, 0, sizeof(hist));
+	for (int i = 0; i < n; i++) {
+		bucket = perf_ipc_log2(s[i]);
+		if (bucket >= PERFTEST_IPC_HIST_BUCKETS)
+			bucket = PERFTEST_IPC_HIST_BUCKETS - 1;
+		hist[bucket]++;
+	}
+
+	/* Cycles are all zero without a cycle counter */
+	if (test->cycles.ops)
+		test->cycles.avg = test->cycles.total / test->cycles.ops;
+	else
+		test->cycles.min = 0;
+
+	printf("PERF_IPC type=%s space=%s cpu=%s server=%s ops=%llu "
+	       "min=%llu avg=%llu max=%llu p50=%llu p90=%llu p99=%llu "
+	       "hist_log2=",
+	       perf_ipc_type_names[test->type],
+	       test->copy_space ? "cross" : "same",
+	       test->cross_cpu ? "cross" : "same",
+	       test->reply_wait ? "replywait" : "recvsend",
+	       (u64)n, test->cycles.min,
+	       test->cycles.avg, test->cycles.max,
+	       s[(n - 1) * 50 / 100], s[(n - 1) * 90 / 100],
+	       s[(n - 1) * 99 / 100]);
+
+	for (int i = 0; i < PERFTEST_IPC_HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		printf("%s%d:%u", first ? "" : ",", i, hist[i]);
+		first = 0;
+	}
+	printf("\n");
+}
+
+/*
+ * Runs one case. Client and server are both new threads, as only
+ * those can be placed on a cpu. The client is on cpu 0, and the
+ * server on cpu 1 for the cross cpu cases.
+ */
+static void perf_ipc_run(int type, int copy_space, int cross_cpu,
+			 int reply_wait)
+{
+	struct perf_ipc_test *test = &ipc_test;
+	struct l4_thread *client, *server;
+	int err;
+
+	memset(test, 0, sizeof(*test));
+	test->type = type;
+	test->copy_space = copy_space;
+	test->cross_cpu = cross_cpu;
+	test->reply_wait = reply_wait;
+	test->cycles.min = ~0; /* Init as maximum possible */
+
+	if ((err = thread_create(perf_ipc_client_thread, test,
+				 TC_SHARE_SPACE | TC_NOSTART,
+				 &client)) < 0) {
+		printf("%s: Thread create failed. err=%d\n",
+		       __FUNCTION__, err);
+		return;
+	}
+	test->client = client->ids.tid;
+
+	/* A copied space gets the test as it is now */
+	if ((err = thread_create(perf_ipc_server_thread, test,
+				 (copy_space ? TC_COPY_SPACE :
+				  TC_SHARE_SPACE) | TC_NOSTART,
+				 &server)) < 0) {
+		printf("%s: Thread create failed. err=%d\n",
+		       __FUNCTION__, err);
+		thread_destroy(client);
+		return;
+	}
+	test->server = server->ids.tid;
+
+	if ((err = perf_ipc_set_affinity(client, 0)) < 0 ||
+	    (err = perf_ipc_set_affinity(server, cross_cpu)) < 0) {
+		printf("PERF_IPC type=%s space=%s cpu=%s skipped err=%d\n",
+		       perf_ipc_type_names[type],
+		       copy_space ? "cross" : "same",
+		       cross_cpu ? "cross" : "same", err);
+		thread_destroy(server);
+		thread_destroy(client);
+		return;
+	}
+
+	l4_thread_control(THREAD_RUN, &server->ids);
+	l4_thread_control(THREAD_RUN, &client->ids);
+
+	thread_wait(client);
+	thread_wait(server);
+
+	if (test->err < 0) {
+		printf("%s: IPC failed. err=%d\n", __FUNCTION__, test->err);
+		return;
+	}
+
+	perf_ipc_print(test);
+}
 
 void perf_measure_ipc(void)
 {
+	for (int type = PERF_IPC_SHORT; type <= PERF_IPC_EXTENDED; type++)
+		for (int space = 0; space <= 1; space++)
+			for (int cpu = 0; cpu <= 1; cpu++)
+				perf_ipc_run(type, space, cpu, 0);
 
+	/* Servers usually reply and wait for the next call at once */
+	for (int type = PERF_IPC_SHORT; type <= PERF_IPC_FULL; type++)
+		for (int space = 0; space <= 1; space++)
+			for (int cpu = 0; cpu <= 1; cpu++)
+				perf_ipc_run(type, space, cpu, 1);
 }
@@ -0,0 +1,116 @@
+/*
+ * l4_ipc latency against number of threads in container
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ *
+ * Author: Bahadir Balban
+ */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/perfmon.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
+
+struct perfmon_cycles ipc_scale_cycles;
+
+#define PERFTEST_IPC_SCALE_ROUNDS		100
+#define PERFTEST_IPC_SCALE_MAX_THREADS		1000
+#define PERFTEST_IPC_SCALE_EXIT			1
+
+/* Thread counts at which ipc latency is sampled */
+static const int ipc_scale_points[] = { 8, 64, 256, 1000 };
+
+/* Threads that are created but never run */
+static struct task_ids dormant_ids[PERFTEST_IPC_SCALE_MAX_THREADS];
+
+int ipc_scale_echo_thread(void *arg)
+{
+	l4id_t parent = *((l4id_t *)arg);
+	int err;
+
+	for (;;) {
+		if ((err = l4_receive(parent)) < 0)
+			return err;
+		if (l4_get_tag() == PERFTEST_IPC_SCALE_EXIT)
+			return 0;
+		if ((err = l4_send(parent, 0)) < 0)
+			return err;
+	}
+}
+
+/*
+ * Creates an echo thread first, then fills up the container
+ * with dormant threads so that the echo thread ends up deepest
+ * in the container thread list. Ipc round trip to the echo
+ * thread is measured at each sample point. Thread lookup must
+ * not depend on the number of threads, so the average should
+ * stay flat from first to last sample.
+ */
+void perf_measure_ipc_scaling(void)
+{
+	struct task_ids selfids, ids;
+	struct l4_thread *echo;
+	int ndormant = 0, err;
+
+	l4_getid(&selfids);
+
+	if ((err = thread_create(ipc_scale_echo_thread,
+				 &selfids.tid,
+				 TC_SHARE_SPACE,
+				 &echo)) < 0) {
+		printf("%s: Thread create failed. err=%d\n",
+		       __FUNCTION__, err);
+		return;
+	}
+
+	memcpy(&ids, &selfids, sizeof(ids));
+
+	for (int i = 0; i < sizeof(ipc_scale_points) /
+			    sizeof(ipc_scale_points[0]); i++) {
+		/* Grow the container up to next sample point */
+		while (ndormant < ipc_scale_points[i]) {
+			if ((err = l4_thread_control(THREAD_CREATE |
+						     TC_SHARE_SPACE,
+						     &ids)) < 0) {
+				printf("%s: Stopped at %d threads. "
+				       "Thread pool exhausted? err=%d\n",
+				       __FUNCTION__, ndormant, err);
+				goto out;
+			}
+			memcpy(&dormant_ids[ndormant++], &ids,
+			       sizeof(ids));
+		}
+
+		memset(&ipc_scale_cycles, 0, sizeof(ipc_scale_cycles));
+		ipc_scale_cycles.min = ~0; /* Init as maximum possible */
+
+		for (int j = 0; j < PERFTEST_IPC_SCALE_ROUNDS; j++) {
+			perfmon_reset_start_cyccnt();
+			l4_sendrecv(echo->ids.tid, echo->ids.tid, 0);
+			perfmon_record_cycles(&ipc_scale_cycles,
+					      "IPC_SCALE");
+		}
+
+		ipc_scale_cycles.avg =
+			ipc_scale_cycles.total / ipc_scale_cycles.ops;
+
+		printf("IPC_SENDRECV with %d threads took %llu min, "
+		       "%llu max, %llu avg cycles, in %llu ops.\n",
+		       ndormant,
+		       ipc_scale_cycles.min,
+		       ipc_scale_cycles.max,
+		       ipc_scale_cycles.avg,
+		       ipc_scale_cycles.ops);
+	}
+
+out:
+	/* Let the echo thread quit */
+	l4_send(echo->ids.tid, PERFTEST_IPC_SCALE_EXIT);
+	thread_wait(echo);
+
+	for (int i = 0; i < ndormant; i++)
+		l4_thread_control(THREAD_DESTROY, &dormant_ids[i]);
+}
@@ -5,13 +5,96 @@
  *
  * Author: Bahadir Balban
  */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/perfmon.h>
+#include INC_GLUE(memory.h)
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
 
+struct perfmon_cycles l4_map_cycles;
+struct perfmon_cycles l4_unmap_cycles;
+
+#define PERFTEST_MAP_COUNT		20
+#define PERFTEST_MAP_PAGES		256
+
+/* A range at the end of the pager's memory, as in the api tests */
+#define PERFTEST_MAP_PHYS	(CONFIG_CONT0_PAGER_PHYS0_END - \
+				 PAGE_SIZE * PERFTEST_MAP_PAGES)
+#define PERFTEST_MAP_VIRT	(CONFIG_CONT0_PAGER_VIRT0_END - \
+				 PAGE_SIZE * PERFTEST_MAP_PAGES)
+
+static void perf_cycles_print(struct perfmon_cycles *cyc, char *name)
+{
+	if (cyc->ops)
+		cyc->avg = cyc->total / cyc->ops;
+
+	printf("%s (cycle counter): took %llu cycles, %llu min, %llu max, "
+	       "%llu avg, %llu total microseconds in %llu ops of %d pages.\n",
+	       name, cyc->min,
+	       cyc->min * USEC_MULTIPLIER,
+	       cyc->max * USEC_MULTIPLIER,
+	       cyc->avg * USEC_MULTIPLIER,
+	       cyc->total * USEC_MULTIPLIER,
+	       cyc->ops, PERFTEST_MAP_PAGES);
+}
+
+/*
+ * Maps a large range, the cost of which is
+ * mostly cache and tlb maintenance
+ */
 void perf_measure_map(void)
 {
+	l4id_t self = self_tid();
+	int err;
+
+	memset(&l4_map_cycles, 0, sizeof (l4_map_cycles));
+	l4_map_cycles.min = ~0;
+
+	for (int i = 0; i < PERFTEST_MAP_COUNT; i++) {
+		perfmon_reset_start_cyccnt();
+		err = l4_map((void *)PERFTEST_MAP_PHYS,
+			     (void *)PERFTEST_MAP_VIRT,
+			     PERFTEST_MAP_PAGES, MAP_USR_RW, self);
+		perfmon_record_cycles(&l4_map_cycles, "l4_map");
+
+		if (err < 0) {
+			printf("%s: l4_map failed. err=%d\n",
+			       __FUNCTION__, err);
+			return;
+		}
+		l4_unmap((void *)PERFTEST_MAP_VIRT,
+			 PERFTEST_MAP_PAGES, self);
+	}
 
+	perf_cycles_print(&l4_map_cycles, "L4_MAP");
 }
 
 void perf_measure_unmap(void)
 {
+	l4id_t self = self_tid();
+	int err;
+
+	memset(&l4_unmap_cycles, 0, sizeof (l4_unmap_cycles));
+	l4_unmap_cycles.min = ~0;
+
+	for (int i = 0; i < PERFTEST_MAP_COUNT; i++) {
+		if ((err = l4_map((void *)PERFTEST_MAP_PHYS,
+				  (void *)PERFTEST_MAP_VIRT,
+				  PERFTEST_MAP_PAGES, MAP_USR_RW,
+				  self)) < 0) {
+			printf("%s: l4_map failed. err=%d\n",
+			       __FUNCTION__, err);
+			return;
+		}
+
+		perfmon_reset_start_cyccnt();
+		l4_unmap((void *)PERFTEST_MAP_VIRT,
+			 PERFTEST_MAP_PAGES, self);
+		perfmon_record_cycles(&l4_unmap_cycles, "l4_unmap");
+	}
 
+	perf_cycles_print(&l4_unmap_cycles, "L4_UNMAP");
 }
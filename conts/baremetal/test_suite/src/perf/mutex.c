@@ -5,8 +5,132 @@
  *
  * Author: Bahadir Balban
  */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/perfmon.h>
+#include <l4lib/mutex.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
 
+struct perfmon_cycles mutex_cycles;
+
+#define PERFTEST_MUTEX_ROUNDS			50
+#define PERFTEST_MUTEX_MAX			4
+#define PERFTEST_MUTEX_THREADS_PER_MUTEX	2
+
+/* Number of mutexes at which contended unlock is sampled */
+static const int mutex_scale_points[] = { 1, 2, 4 };
+
+static struct l4_mutex perf_mutex[PERFTEST_MUTEX_MAX];
+
+/* Each thread keeps its own cycles, they are merged after the join */
+static struct perf_mutex_client {
+	struct l4_mutex *mutex;
+	struct perfmon_cycles cycles;
+} perf_mutex_client[PERFTEST_MUTEX_MAX * PERFTEST_MUTEX_THREADS_PER_MUTEX];
+
+/*
+ * Yields while holding the lock, so that the other thread
+ * on the same mutex always contends and both lock and
+ * unlock go to the kernel. Only the unlock is measured,
+ * since it never sleeps once the contender is waiting.
+ */
+int perf_mutex_thread(void *arg)
+{
+	struct perf_mutex_client *client = arg;
+	struct l4_mutex *m = client->mutex;
+	int err;
+
+	for (int i = 0; i < PERFTEST_MUTEX_ROUNDS; i++) {
+		if ((err = l4_mutex_lock(m)) < 0)
+			return err;
+
+		l4_thread_switch(0);
+
+		perfmon_reset_start_cyccnt();
+		if ((err = l4_mutex_unlock(m)) < 0)
+			return err;
+		perfmon_record_cycles(&client->cycles, "MUTEX_UNLOCK");
+	}
+	return 0;
+}
+
+/*
+ * Runs pairs of threads contending on 1 to N separate
+ * mutexes. Each mutex is looked up in the kernel by its
+ * physical address on every contended operation. Unrelated
+ * mutexes should not slow each other down, so the average
+ * should stay flat as the number of mutexes grows.
+ */
 void perf_measure_mutex(void)
 {
+	struct l4_thread *thread[PERFTEST_MUTEX_MAX *
+				 PERFTEST_MUTEX_THREADS_PER_MUTEX];
+	struct perfmon_cycles *cyc;
+	int nmutex, nthreads, err;
+
+	for (int i = 0; i < sizeof(mutex_scale_points) /
+			    sizeof(mutex_scale_points[0]); i++) {
+		nmutex = mutex_scale_points[i];
+		nthreads = 0;
+
+		memset(&mutex_cycles, 0, sizeof(mutex_cycles));
+		mutex_cycles.min = ~0; /* Init as maximum possible */
+
+		for (int j = 0; j < nmutex; j++)
+			l4_mutex_init(&perf_mutex[j]);
+
+		for (int j = 0; j < nmutex *
+				    PERFTEST_MUTEX_THREADS_PER_MUTEX; j++) {
+			memset(&perf_mutex_client[j], 0,
+			       sizeof(perf_mutex_client[j]));
+			perf_mutex_client[j].mutex = &perf_mutex[j % nmutex];
+			perf_mutex_client[j].cycles.min = ~0;
+			if ((err = thread_create(perf_mutex_thread,
+						 &perf_mutex_client[j],
+						 TC_SHARE_SPACE,
+						 &thread[nthreads])) < 0) {
+				printf("%s: Thread create failed. "
+				       "err=%d\n", __FUNCTION__, err);
+				goto out;
+			}
+			nthreads++;
+		}
+
+		for (int j = 0; j < nthreads; j++)
+			thread_wait(thread[j]);
+
+		for (int j = 0; j < nthreads; j++) {
+			cyc = &perf_mutex_client[j].cycles;
+			if (!cyc->ops)
+				continue;
+			mutex_cycles.ops += cyc->ops;
+			mutex_cycles.total += cyc->total;
+			if (mutex_cycles.min > cyc->min)
+				mutex_cycles.min = cyc->min;
+			if (mutex_cycles.max < cyc->max)
+				mutex_cycles.max = cyc->max;
+		}
+
+		if (!mutex_cycles.ops)
+			continue;
+
+		mutex_cycles.avg = mutex_cycles.total / mutex_cycles.ops;
+
+		printf("MUTEX_UNLOCK with %d mutexes and %d threads took "
+		       "%llu min, %llu max, %llu avg cycles, in %llu ops.\n",
+		       nmutex, nthreads,
+		       mutex_cycles.min,
+		       mutex_cycles.max,
+		       mutex_cycles.avg,
+		       mutex_cycles.ops);
+	}
+	return;
 
+out:
+	for (int j = 0; j < nthreads; j++)
+		thread_wait(thread[j]);
 }
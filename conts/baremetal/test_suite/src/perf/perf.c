@@ -22,11 +22,16 @@ int test_performance(void)
 	perf_measure_getid();
 	perf_measure_tswitch();
 	perf_measure_tctrl();
+	perf_measure_thread_create_scaling();
 	perf_measure_exregs();
 	perf_measure_ipc();
+	perf_measure_ipc_scaling();
+	perf_measure_cap_scaling();
+	perf_measure_pager_wakeup();
 	perf_measure_map();
 	perf_measure_unmap();
 	perf_measure_mutex();
+	perf_measure_balance_scaling();
 
 	return 0;
 }
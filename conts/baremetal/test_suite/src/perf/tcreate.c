@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2010 B Labs Ltd.
+ *
+ * Concurrent thread creation throughput tests
+ *
+ * Author: Bahadir Balban
+ */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <perf.h>
+#include <timer.h>
+#include <tests.h>
+#include <string.h>
+
+#define PERFTEST_TCREATE_ROUNDS		100
+#define PERFTEST_TCREATE_MAX		4
+
+/* Number of concurrent creators at which throughput is sampled */
+static const int tcreate_scale_points[] = { 1, 2, 4 };
+
+/*
+ * Creates and destroys a dormant thread in a loop. Each
+ * round allocates and frees a ktcb from the kernel cache.
+ */
+int perf_tcreate_thread(void *arg)
+{
+	struct task_ids ids;
+	int err;
+
+	for (int i = 0; i < PERFTEST_TCREATE_ROUNDS; i++) {
+		l4_getid(&ids);
+		if ((err = l4_thread_control(THREAD_CREATE | TC_SHARE_SPACE,
+					     &ids)) < 0)
+			return err;
+		if ((err = l4_thread_control(THREAD_DESTROY, &ids)) < 0)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * Runs 1 to N threads creating and destroying threads at the
+ * same time, and measures the total time by the platform timer,
+ * which unlike cycle counters is common to all cpus. With kernel
+ * object caches that don't serialize cpus, total operations per
+ * millisecond should grow with the number of creators on SMP.
+ */
+void perf_measure_thread_create_scaling(void)
+{
+	struct l4_thread *thread[PERFTEST_TCREATE_MAX];
+	unsigned int start, usec, ops;
+	int ncreators, err;
+
+	for (int i = 0; i < sizeof(tcreate_scale_points) /
+			    sizeof(tcreate_scale_points[0]); i++) {
+		ncreators = tcreate_scale_points[i];
+
+		timer_stop(timer_base);
+		timer_init_oneshot(timer_base);
+		timer_load(0xFFFFFFFF, timer_base);
+		timer_start(timer_base);
+		start = timer_read(timer_base);
+
+		for (int j = 0; j < ncreators; j++) {
+			if ((err = thread_create(perf_tcreate_thread, 0,
+						 TC_SHARE_SPACE,
+						 &thread[j])) < 0) {
+				printf("%s: Thread create failed. "
+				       "err=%d\n", __FUNCTION__, err);
+				for (int k = 0; k < j; k++)
+					thread_wait(thread[k]);
+				return;
+			}
+		}
+
+		for (int j = 0; j < ncreators; j++)
+			thread_wait(thread[j]);
+
+		/* Timer counts down */
+		usec = start - timer_read(timer_base);
+		ops = ncreators * PERFTEST_TCREATE_ROUNDS;
+
+		printf("THREAD_CREATE/DESTROY with %d creators took %u "
+		       "microseconds for %u ops, %u ops per msec.\n",
+		       ncreators, usec, ops,
+		       usec ? ops * 1000 / usec : 0);
+	}
+}
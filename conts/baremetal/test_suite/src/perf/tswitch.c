@@ -137,9 +137,71 @@ void perf_measure_thread_switch(void)
 }
 
 
-void perf_measure_space_switch(void)
+#define PERFTEST_SWITCH_COUNT		100
+
+static int switch_back_stop;
+
+/* Switches back to parent until told to stop */
+int perf_switch_back_thread(void *arg)
+{
+	l4id_t parent = *((l4id_t *)arg);
+
+	while (!switch_back_stop)
+		l4_thread_switch(parent);
+
+	return 0;
+}
+
+/*
+ * Measures round trips of switching to a thread that switches
+ * straight back, with the thread in a shared or copied space.
+ */
+static void perf_measure_switch_round_trip(unsigned int flags,
+					   const char *name)
 {
+	struct perfmon_cycles cycles;
+	struct task_ids selfids;
+	struct l4_thread *thread;
+	int err;
+
+	l4_getid(&selfids);
+
+	memset(&cycles, 0, sizeof(cycles));
+	cycles.min = ~0; /* Init as maximum possible */
+	switch_back_stop = 0;
+
+	if ((err = thread_create(perf_switch_back_thread,
+				 &selfids.tid, flags, &thread)) < 0) {
+		printf("%s: Thread create failed. err=%d\n",
+		       __FUNCTION__, err);
+		return;
+	}
+
+	for (int i = 0; i < PERFTEST_SWITCH_COUNT; i++) {
+		perfmon_reset_start_cyccnt();
+		l4_thread_switch(thread->ids.tid);
+		perfmon_record_cycles(&cycles, name);
+	}
+
+	cycles.avg = cycles.total / cycles.ops;
+
+	printf("%s took %llu min, %llu max, %llu avg cycles, "
+	       "in %llu round trips.\n", name,
+	       cycles.min, cycles.max, cycles.avg, cycles.ops);
+
+	switch_back_stop = 1;
+	thread_wait(thread);
+}
 
+/*
+ * Switching to a thread in another space costs the same as one in
+ * the same space plus the address space switch. With tagged tlbs
+ * the difference should be small, as nothing is flushed.
+ */
+void perf_measure_space_switch(void)
+{
+	perf_measure_switch_round_trip(TC_SHARE_SPACE, "THREAD_SWITCH");
+	perf_measure_switch_round_trip(TC_COPY_SPACE, "SPACE_SWITCH");
 }
 
 
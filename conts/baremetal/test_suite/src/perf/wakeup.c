@@ -0,0 +1,104 @@
+/*
+ * Pager wakeup-to-run latency under load
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ *
+ * Author: Bahadir Balban
+ */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/perfmon.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
+
+struct perfmon_cycles wakeup_cycles;
+
+#define PERFTEST_WAKEUP_COUNT			50
+#define PERFTEST_WAKEUP_WORKERS			6
+
+static volatile int wakeup_test_done;
+
+/* Keeps the cpu busy at normal priority until the test ends */
+int wakeup_busy_worker(void *arg)
+{
+	while (!wakeup_test_done)
+		;
+	return 0;
+}
+
+/*
+ * Starts the clock and wakes up the pager, which is
+ * blocked on receiving from us.
+ */
+int wakeup_waker_thread(void *arg)
+{
+	l4id_t pager = *((l4id_t *)arg);
+
+	for (int i = 0; i < PERFTEST_WAKEUP_COUNT; i++) {
+		perfmon_reset_start_cyccnt();
+		l4_send(pager, 0);
+	}
+	return 0;
+}
+
+/*
+ * Measures the cycles between a normal priority thread waking
+ * up the pager and the pager actually running, while the cpu
+ * is loaded with busy normal priority workers. The pager has
+ * higher priority than all of them, so it should be dispatched
+ * straight away rather than queueing behind the workers.
+ */
+void perf_measure_pager_wakeup(void)
+{
+	struct l4_thread *worker[PERFTEST_WAKEUP_WORKERS];
+	struct l4_thread *waker;
+	struct task_ids selfids;
+	int err;
+
+	l4_getid(&selfids);
+
+	memset(&wakeup_cycles, 0, sizeof(wakeup_cycles));
+	wakeup_cycles.min = ~0; /* Init as maximum possible */
+	wakeup_test_done = 0;
+
+	for (int i = 0; i < PERFTEST_WAKEUP_WORKERS; i++) {
+		if ((err = thread_create(wakeup_busy_worker, 0,
+					 TC_SHARE_SPACE,
+					 &worker[i])) < 0) {
+			printf("%s: Thread create failed. err=%d\n",
+			       __FUNCTION__, err);
+			BUG();
+		}
+	}
+
+	if ((err = thread_create(wakeup_waker_thread, &selfids.tid,
+				 TC_SHARE_SPACE, &waker)) < 0) {
+		printf("%s: Thread create failed. err=%d\n",
+		       __FUNCTION__, err);
+		BUG();
+	}
+
+	for (int i = 0; i < PERFTEST_WAKEUP_COUNT; i++) {
+		l4_receive(waker->ids.tid);
+		perfmon_record_cycles(&wakeup_cycles, "PAGER_WAKEUP");
+	}
+
+	wakeup_cycles.avg = wakeup_cycles.total / wakeup_cycles.ops;
+
+	printf("PAGER_WAKEUP with %d busy threads took %llu min, "
+	       "%llu max, %llu avg cycles, in %llu ops.\n",
+	       PERFTEST_WAKEUP_WORKERS,
+	       wakeup_cycles.min,
+	       wakeup_cycles.max,
+	       wakeup_cycles.avg,
+	       wakeup_cycles.ops);
+
+	/* Release and collect all threads */
+	wakeup_test_done = 1;
+	thread_wait(waker);
+	for (int i = 0; i < PERFTEST_WAKEUP_WORKERS; i++)
+		thread_wait(worker[i]);
+}
@@ -4,7 +4,6 @@
 #ifndef __TIMER_H__
 #define	__TIMER_H__
 
-#include <l4lib/mutex.h>
 #include <l4/lib/list.h>
 #include <l4lib/types.h>
 
@@ -15,13 +14,6 @@ struct sleeper_task {
 	int retval;	/* return value on wakeup */
 };
 
-/* list of tasks to be woken up */
-struct wake_task_list {
-	struct link head;
-	struct link *end; /* optimization */
-	struct l4_mutex wake_list_lock; /* lock for sanity of head */
-};
-
 #define BUCKET_BASE_LEVEL_BITS		8
 #define BUCKET_HIGHER_LEVEL_BITS	6
 
@@ -77,7 +69,6 @@ struct timer {
 	unsigned long base;	/* Virtual base address */
 	unsigned int count;		/* Counter/jiffies */
 	struct sleeper_task_bucket task_list;	/* List of sleeping tasks */
-	struct l4_mutex task_list_lock;	/* Lock for sleeper_task_bucket */
 	unsigned long phys_base;	/* Physical address of Device */
 	int irq_no;	/* IRQ number of device */
 };
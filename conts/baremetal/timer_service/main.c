@@ -29,12 +29,6 @@ static struct timer global_timer[TIMERS_TOTAL];
 /* Deafult timer to be used for sleep/wake etc purposes */
 #define SLEEP_WAKE_TIMER	0
 
-/* tasks whose sleep time has finished */
-struct wake_task_list wake_tasks;
-
-/* tid of handle_request thread */
-l4id_t tid_ipc_handler;
-
 /*
  * Initialize timer devices
  */
@@ -43,7 +37,6 @@ void timer_struct_init(struct timer* timer, unsigned long base)
 	timer->base = base;
 	timer->count = 0;
 	timer->slot = 0;
-	l4_mutex_init(&timer->task_list_lock);
 
 	for (int i = 0; i < BUCKET_BASE_LEVEL_SIZE ; ++i) {
 		link_init(&timer->task_list.bucket_level0[i]);
@@ -57,16 +50,6 @@ void timer_struct_init(struct timer* timer, unsigned long base)
 	}
 }
 
-/*
- * Initialize wake list head structure
- */
-void wake_task_list_init(void)
-{
-	link_init(&wake_tasks.head);
-	wake_tasks.end = &wake_tasks.head;
-	l4_mutex_init(&wake_tasks.wake_list_lock);
-}
-
 /*
  * Allocate new sleeper task struct
  */
@@ -119,118 +102,64 @@ struct link* find_bucket_list(unsigned long seconds)
 }
 
 /*
- * Irq handler for timer interrupts
+ * Wakes up the tasks on a bucket list, replying
+ * to the sleep requests that they are blocked on
  */
-int timer_irq_handler(void *arg)
+void task_wake(struct link *vector)
 {
-	int err;
-	struct timer *timer = (struct timer *)arg;
-	struct link *vector;
-	const int slot = 0;
+	struct sleeper_task *struct_ptr, *temp_ptr;
+	int ret;
 
-	/*
-	  * Initialise timer
-	  * 1 interrupt per second
-	  */
-	timer_init(timer->base, 1000000);
+	list_foreach_removable_struct(struct_ptr, temp_ptr,
+				      vector, list) {
+		list_remove(&struct_ptr->list);
 
-	/* Register self for timer irq, using notify slot 0 */
-	if ((err = l4_irq_control(IRQ_CONTROL_REGISTER, slot,
-				  timer->irq_no)) < 0) {
-		printf("%s: FATAL: Timer irq could not be registered. "
-		       "err=%d\n", __FUNCTION__, err);
-		BUG();
-	}
-
-	/* Enable Timer */
-	timer_start(timer->base);
+		/* Set sender correctly */
+		l4_set_sender(struct_ptr->tid);
 
-	/* Handle irqs forever */
-	while (1) {
-		int count;
-		struct link *task_list;
+		printf("%s : Waking thread 0x%x at time 0x%x\n", __CONTAINER_NAME__,
+			    struct_ptr->tid, global_timer[SLEEP_WAKE_TIMER].count);
 
-		/* Block on irq */
-		if((count = l4_irq_wait(slot, timer->irq_no)) < 0) {
-			printf("l4_irq_wait() returned with negative value\n");
+		/* send wake ipc */
+		if ((ret = l4_ipc_return(struct_ptr->retval)) < 0) {
+			printf("%s: IPC return error: %d.\n",
+			       __FUNCTION__, ret);
 			BUG();
 		}
 
-		/*
-		  * Update timer count
-		  * TODO: Overflow check, we have 1 interrupt/sec from timer
-		  * with 32bit count it will take 9years to overflow
-		  */
-		timer->count += count;
-		printf("Got timer irq, current count = 0x%x\n", timer->count);
-
-		/* find bucket list of taks to be woken for current count */
-		vector = find_bucket_list(timer->count);
-		l4_send(tid_ipc_handler,L4_IPC_TAG_TIMER_WAKE_THREADS);
-
-		if (!list_empty(vector)) {
-			/* Removing tasks from sleeper list */
-			l4_mutex_lock(&global_timer[SLEEP_WAKE_TIMER].task_list_lock);
-			task_list = list_detach(vector);
-			l4_mutex_unlock(&global_timer[SLEEP_WAKE_TIMER].task_list_lock);
-
-			/* Add tasks to wake_task_list */
-			l4_mutex_lock(&wake_tasks.wake_list_lock);
-			list_attach(task_list, &wake_tasks.head, wake_tasks.end);
-			l4_mutex_unlock(&wake_tasks.wake_list_lock);
-
-			/*
-			 * Send ipc to handle_request
-			 * thread to send wake signals
-			 */
-			l4_send(tid_ipc_handler,L4_IPC_TAG_TIMER_WAKE_THREADS);
-		}
+		/* free allocated sleeper task struct */
+		free_sleeper_task(struct_ptr);
 	}
 }
 
 /*
- * Helper routine to wake tasks from wake list
+ * Handles timer irqs, which arrive as notification
+ * bits on the same receive as sleep requests
  */
-void task_wake(void)
+void timer_irq_handler(struct timer *timer)
 {
-	struct sleeper_task *struct_ptr, *temp_ptr;
-	int ret;
+	int count;
 
-	if (!list_empty(&wake_tasks.head)) {
-		list_foreach_removable_struct(struct_ptr, temp_ptr,
-					      &wake_tasks.head, list) {
-			/* Remove task from wake list */
-			l4_mutex_lock(&wake_tasks.wake_list_lock);
-			list_remove(&struct_ptr->list);
-			l4_mutex_unlock(&wake_tasks.wake_list_lock);
+	/* Take the irqs that came since the last time */
+	if (!(count = l4_irq_read(timer->slot)))
+		return;
 
-			/* Set sender correctly */
-			l4_set_sender(struct_ptr->tid);
-
-			printf("%s : Waking thread 0x%x at time 0x%x\n", __CONTAINER_NAME__,
-				    struct_ptr->tid, global_timer[SLEEP_WAKE_TIMER].count);
-
-			/* send wake ipc */
-			if ((ret = l4_ipc_return(struct_ptr->retval)) < 0) {
-				printf("%s: IPC return error: %d.\n",
-				       __FUNCTION__, ret);
-				BUG();
-			}
+	/*
+	  * Update timer count
+	  * TODO: Overflow check, we have 1 interrupt/sec from timer
+	  * with 32bit count it will take 9years to overflow
+	  */
+	while (count--) {
+		timer->count++;
 
-			/* free allocated sleeper task struct */
-			free_sleeper_task(struct_ptr);
-		}
+		/* Wake tasks whose time has come at this count */
+		task_wake(find_bucket_list(timer->count));
 	}
-	/* If wake list is empty set end = start */
-	if (list_empty(&wake_tasks.head))
-		wake_tasks.end = &wake_tasks.head;
-
+	printf("Got timer irq, current count = 0x%x\n", timer->count);
 }
 
 int timer_setup_devices(void)
 {
-	struct l4_thread thread;
-	struct l4_thread *tptr = &thread;
 	int err;
 
 	global_timer[0].phys_base = PLATFORM_TIMER1_BASE;
@@ -251,20 +180,28 @@ int timer_setup_devices(void)
 			BUG();
 		}
 
+		global_timer[i].slot = i;
+
+		/*
+		  * Initialise timer
+		  * 1 interrupt per second
+		  */
+		timer_init(global_timer[i].base, 1000000);
+
 		/*
-		 * Create new timer irq handler thread.
-		 *
-		 * This will initialize its timer argument, register
-		 * itself as its irq handler, initiate the timer and
-		 * wait on irqs.
+		 * Register for timer irq. Irqs come to us as
+		 * notification bits, along with the requests.
 		 */
-		if ((err = thread_create(timer_irq_handler, &global_timer[i],
-					 TC_SHARE_SPACE,
-					 &tptr)) < 0) {
-			printf("FATAL: Creation of irq handler "
-			       "thread failed.\n");
+		if ((err = l4_irq_control(IRQ_CONTROL_REGISTER,
+					  global_timer[i].slot,
+					  global_timer[i].irq_no)) < 0) {
+			printf("%s: FATAL: Timer irq could not be registered. "
+			       "err=%d\n", __FUNCTION__, err);
 			BUG();
 		}
+
+		/* Enable Timer */
+		timer_start(global_timer[i].base);
 	}
 
 	return 0;
@@ -341,21 +278,9 @@ void task_sleep(l4id_t tid, unsigned long seconds, int ret)
 	/* can overflow happen here?, timer is in 32bit mode */
 	seconds += global_timer[SLEEP_WAKE_TIMER].count;
 
-	printf("sleep wake timer lock is present at address %lx\n",
-		    ( (unsigned long)&global_timer[SLEEP_WAKE_TIMER].task_list_lock.lock));
-
 	vector = find_bucket_list(seconds);
 
-	printf("Acquiring lock for sleep wake timer\n");
-	l4_mutex_lock(&global_timer[SLEEP_WAKE_TIMER].task_list_lock);
-	printf("got lock for sleep wake timer\n");
-
 	list_insert(&task->list, vector);
-
-	printf("Releasing lock for sleep wake timer\n");
-	l4_mutex_unlock(&global_timer[SLEEP_WAKE_TIMER].task_list_lock);
-	printf("released lock for sleep wake timer\n");
-
 }
 
 void handle_requests(void)
@@ -365,7 +290,8 @@ void handle_requests(void)
 	u32 tag;
 	int ret;
 
-	if ((ret = l4_receive(L4_ANYTHREAD)) < 0) {
+	/* Requests, or notification bits of timer irqs */
+	if ((ret = l4_receive_notify(L4_ANYTHREAD, L4_TIMEOUT_NEVER)) < 0) {
 		printf("%s: %s: IPC Error: %d. Quitting...\n",
 		       __CONTAINER__, __FUNCTION__, ret);
 		BUG();
@@ -375,6 +301,16 @@ void handle_requests(void)
 	tag = l4_get_tag();
 	senderid = l4_get_sender();
 
+	/* Irqs don't come from a thread, there is nobody to reply */
+	if (tag == L4_IPC_TAG_NOTIFY) {
+		unsigned int bits = l4_get_notify();
+
+		for (int i = 0; i < TIMERS_TOTAL; i++)
+			if (bits & (1 << global_timer[i].slot))
+				timer_irq_handler(&global_timer[i]);
+		return;
+	}
+
 	/* Read mrs not used by syslib */
 	for (int i = 0; i < MR_UNUSED_TOTAL; i++)
 		mr[i] = read_mr(MR_UNUSED_START + i);
@@ -424,11 +360,6 @@ void handle_requests(void)
 		}
 		break;
 
-	/* Intra container ipc by irq_thread */
-	case L4_IPC_TAG_TIMER_WAKE_THREADS:
-		task_wake();
-		break;
-
 	default:
 		printf("%s: Error received ipc from 0x%x residing "
 		       "in container %x with an unrecognized tag: "
@@ -448,15 +379,9 @@ void main(void)
 	/* Initialize virtual address pool for timers */
 	init_vaddr_pool();
 
-	/* initialise timed_out_task list */
-	wake_task_list_init();
-
 	/* Map and initialize timer devices */
 	timer_setup_devices();
 
-	/* Set the tid of ipc handler */
-	tid_ipc_handler = self_tid();
-
 	/* Listen for timer requests */
 	while (1)
 		handle_requests();
@@ -5,15 +5,23 @@
 #include <l4/macros.h>
 #include <bootdesc.h>
 #include <memfs/memfs.h>
+#include L4LIB_INC_ARCH(syscalls.h)
 #include L4LIB_INC_ARCH(syslib.h)
 
 void *vfs_rootdev_open(void)
 {
 	struct svc_image *rootfs_img = bootdesc_get_image_byname("rootfs");
 	unsigned long rootfs_size = rootfs_img->phys_end - rootfs_img->phys_start;
-	
+
 	BUG_ON(rootfs_size < MEMFS_TOTAL_SIZE);
 
-	/* Map filesystem blocks to virtual memory */
-	return l4_map_helper((void *)rootfs_img->phys_start, __pfn(rootfs_size));
+	/*
+	 * Filesystem blocks are used from where physical memory is mapped,
+	 * so that they have page structs, and files can be cached in them.
+	 */
+	BUG_ON(!is_page_aligned(rootfs_img->phys_start));
+	BUG_ON(rootfs_img->phys_start < membank[0].start ||
+	       rootfs_img->phys_end > membank[0].end);
+
+	return phys_to_virt((void *)rootfs_img->phys_start);
 }
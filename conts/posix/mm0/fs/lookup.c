@@ -12,8 +12,9 @@
 
 /*
  * Given a dentry that has been populated by readdir with children dentries
- * and their vnodes, this itself checks all those children on that level for
- * a match, but it also calls lookup, which recursively checks lower levels.
+ * and their vnodes, this finds the child matching the next path component
+ * by its name hash, and calls its lookup, which recursively checks lower
+ * levels.
  */
 struct vnode *lookup_dentry_children(struct dentry *parentdir,
 				     struct pathdata *pdata)
@@ -22,19 +23,14 @@ struct vnode *lookup_dentry_children(struct dentry *parentdir,
 	struct vnode *v;
 	const char *component = pathdata_next_component(pdata);
 
-	list_foreach_struct(childdir, &parentdir->children, child)
-		if (IS_ERR(v = childdir->vnode->ops.lookup(childdir->vnode,
-							   pdata, component)))
-			/* Means not found, continue search */
-			if ((int)v == -ENOENT)
-				continue;
-			else	/* A real error */
-				return v;
-		else	/* No error, so found it */
-			return v;
+	if (!(childdir = vfs_dentry_lookup(parentdir, component)))
+		return PTR_ERR(-ENOENT);
 
-	/* Out of all children dentries, neither was a match */
-	return PTR_ERR(-ENOENT);
+	/* The child's vnode may have been evicted from the cache */
+	if (IS_ERR(v = vfs_dentry_vnode(childdir)))
+		return v;
+
+	return v->ops.lookup(v, pdata, component);
 }
 
 /* Lookup, recursive, assuming single-mountpoint */
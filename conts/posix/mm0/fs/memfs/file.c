@@ -43,6 +43,36 @@ int memfs_write_block(struct vnode *v, int blknum, void *buf)
 }
 #endif
 
+/*
+ * Returns the file's block at pfn, allocating it if there's none.
+ * Blocks come zeroed, so holes in the file read as zeroes.
+ */
+void *memfs_file_block(struct vnode *v, unsigned long pfn)
+{
+	struct memfs_inode *i;
+	struct memfs_superblock *memfs_sb;
+	void *block;
+
+	/* Low-level fs refs must be valid */
+	BUG_ON(!(i = v->inode));
+	BUG_ON(!(memfs_sb = v->sb->fs_super));
+
+	/* Check filesystem per-file size limit */
+	if (pfn >= memfs_sb->fmaxblocks) {
+		printf("%s: fslimit: Trying to access block %lx outside "
+		       "maximum file range\n", __FUNCTION__, pfn);
+		return PTR_ERR(-EINVAL);
+	}
+
+	if (!i->block[pfn]) {
+		if (IS_ERR(block = memfs_alloc_block(memfs_sb)))
+			return block;
+		i->block[pfn] = block;
+	}
+
+	return i->block[pfn];
+}
+
 /*
  * Handles both read and writes since most details are common.
  *
@@ -59,6 +89,7 @@ int memfs_file_read_write(struct vnode *v, unsigned int pfn,
 	struct memfs_superblock *memfs_sb;
 	unsigned int start, end, count;
 	u32 blocksize;
+	void *block;
 
 	/* Don't support different block and page sizes for now */
 	BUG_ON(v->sb->blocksize != PAGE_SIZE);
@@ -86,40 +117,23 @@ int memfs_file_read_write(struct vnode *v, unsigned int pfn,
 		      ? pfn + npages : __pfn(page_align_up(v->size));
 		count = end - start;
 
-		/* Copy the data from inode blocks into page buffer */
+		/* Copy the data from inode blocks into page buffer, holes are zero */
 		for (int x = start, bufpage = 0; x < end; x++, bufpage++)
-			memcpy(((void *)buf) + (bufpage * blocksize),
-			       i->block[x], blocksize);
+			if (i->block[x])
+				memcpy(((void *)buf) + (bufpage * blocksize),
+				       i->block[x], blocksize);
+			else
+				memset(((void *)buf) + (bufpage * blocksize),
+				       0, blocksize);
 		return (int)(count * blocksize);
 	} else { /* Write-specific operations */
-		/* Is the write beyond current file size? */
-		if (v->size < ((pfn + npages) * (blocksize))) {
-			unsigned long pagediff = pfn + npages - __pfn(v->size);
-			unsigned long holes;
-
-			/*
-			 * If write is not consecutively after the currently
-			 * last file block, the gap must be filled in by holes.
-			 */
-			if (pfn > __pfn(v->size))
-				holes = pfn - __pfn(v->size);
-			else
-				holes = 0;
-
-			/* Allocate new blocks */
-			for (int x = 0; x < pagediff; x++)
-				if (!(i->block[__pfn(v->size) + x] =
-				      memfs_alloc_block(v->sb->fs_super)))
-					return -ENOSPC;
-
-			/* Zero out the holes. FIXME: How do we zero out non-page-aligned bytes?` */
-			for (int x = 0; x < holes; x++)
-				memset(i->block[__pfn(v->size) + x], 0, blocksize);
+		/* Copy the data from page buffer into inode blocks, new or not */
+		for (int x = pfn, bufpage = 0; x < pfn + npages; x++, bufpage++) {
+			if (IS_ERR(block = memfs_file_block(v, x)))
+				return -ENOSPC;
+			memcpy(block, ((void *)buf) + (bufpage * blocksize),
+			       blocksize);
 		}
-
-		/* Copy the data from page buffer into inode blocks */
-		for (int x = pfn, bufpage = 0; x < pfn + npages; x++, bufpage++)
-			memcpy(i->block[x], ((void *)buf) + (bufpage * blocksize), blocksize);
 	}
 
 	return (int)(npages * blocksize);
@@ -138,5 +152,6 @@ int memfs_file_read(struct vnode *v, unsigned long pfn, unsigned long npages, vo
 struct file_ops memfs_file_operations = {
 	.read = memfs_file_read,
 	.write = memfs_file_write,
+	.block = memfs_file_block,
 };
 
@@ -153,9 +153,9 @@ int memfs_init_rootdir(struct superblock *sb)
 	/* Associate dentry with its vnode */
 	list_insert(&d->vref, &d->vnode->dentries);
 
-	/* Add both vnode and dentry to their flat caches */
-	list_insert(&d->cache_list, &dentry_cache);
-	list_insert(&v->cache_list, &vnode_cache);
+	/* Add both vnode and dentry to their caches */
+	vfs_dentry_cache_add(d);
+	vfs_vnode_cache_add(v);
 
 	return 0;
 }
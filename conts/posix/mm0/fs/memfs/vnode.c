@@ -156,10 +156,11 @@ int memfs_free_vnode(struct superblock *sb, struct vnode *v)
 struct memfs_inode *memfs_read_inode(struct superblock *sb, struct vnode *v)
 {
 	struct memfs_superblock *fssb = sb->fs_super;
+	unsigned long inum = v->vnum & ~VFS_FSIDX_MASK;
 
-	BUG_ON(!fssb->inode[v->vnum]);
+	BUG_ON(!fssb->inode[inum]);
 
-	return fssb->inode[v->vnum];
+	return fssb->inode[inum];
 }
 
 /*
@@ -173,6 +174,12 @@ int memfs_read_vnode(struct superblock *sb, struct vnode *v)
 	if (!i)
 		return -EEXIST;
 
+	/* Associate memfs-specific fields with vnode */
+	v->inode = i;
+	v->ops = memfs_vnode_operations;
+	v->fops = memfs_file_operations;
+	v->sb = sb;
+
 	/* Simply copy common fields */
 	v->vnum = i->inum | sb->fsidx;
 	v->size = i->size;
@@ -213,8 +220,8 @@ int memfs_write_vnode(struct superblock *sb, struct vnode *v)
 struct vnode *memfs_vnode_mknod(struct vnode *v, const char *dirname,
 				unsigned int mode)
 {
-	struct dentry *d, *parent = link_to_struct(v->dentries.next,
-					       struct dentry, vref);
+	struct dentry *parent = link_to_struct(v->dentries.next,
+					    struct dentry, vref);
 	struct memfs_dentry *memfsd;
 	struct dentry *newd;
 	struct vnode *newv;
@@ -234,11 +241,8 @@ struct vnode *memfs_vnode_mknod(struct vnode *v, const char *dirname,
 		return PTR_ERR(err);
 
 	/* Check there's no existing child with same name */
-	list_foreach_struct(d, &parent->children, child) {
-		/* Does the name exist as a child? */
-		if(d->ops.compare(d, dirname))
-			return PTR_ERR(-EEXIST);
-	}
+	if (vfs_dentry_lookup(parent, dirname))
+		return PTR_ERR(-EEXIST);
 
 	/* Allocate a new vnode for the new directory */
 	if (IS_ERR(newv = v->sb->ops->alloc_vnode(v->sb)))
@@ -283,9 +287,9 @@ struct vnode *memfs_vnode_mknod(struct vnode *v, const char *dirname,
 	/* Associate dentry with its parent */
 	list_insert(&newd->child, &parent->children);
 
-	/* Add both vnode and dentry to their flat caches */
-	list_insert(&newd->cache_list, &dentry_cache);
-	list_insert(&newv->cache_list, &vnode_cache);
+	/* Add both vnode and dentry to their caches */
+	vfs_dentry_cache_add(newd);
+	vfs_vnode_cache_add(newv);
 
 	return newv;
 }
@@ -359,7 +363,7 @@ int memfs_vnode_readdir(struct vnode *v)
 		 * allocates and reads it for us as well.
 		 */
 		newv = newd->vnode = vfs_vnode_lookup_byvnum(v->sb, memfsd[i].inum);
-		if (!newv) {
+		if (IS_ERR(newv)) {
 			printf("Filesystem seems to be broken. Directory has"
 			       "inode number: %d, but no such inode found.\n",
 				memfsd[i].inum);
@@ -375,9 +379,11 @@ int memfs_vnode_readdir(struct vnode *v)
 		/* Copy fields into generic dentry */
 		memcpy(newd->name, memfsd[i].name, MEMFS_DNAME_MAX);
 
-		/* Add both vnode and dentry to their caches */
-		list_insert(&newd->cache_list, &dentry_cache);
-		list_insert(&newv->cache_list, &vnode_cache);
+		/*
+		 * Add dentry to its cache. The vnode lookup above
+		 * has already added the vnode to its own.
+		 */
+		vfs_dentry_cache_add(newd);
 	}
 
 	return 0;
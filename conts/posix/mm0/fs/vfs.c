@@ -7,6 +7,8 @@
 #include <vfs.h>
 #include <task.h>
 #include <path.h>
+#include <string.h>
+#include <globals.h>
 
 LINK_DECLARE(vnode_cache);
 LINK_DECLARE(dentry_cache);
@@ -14,6 +16,158 @@ LINK_DECLARE(dentry_cache);
 struct vfs_mountpoint vfs_root;
 struct id_pool *vfs_fsidx_pool;
 
+/* Protects vnode and dentry caches and filesystems, see globals.h */
+DECLARE_SPINLOCK(vfs_lock);
+
+/* Hash chains, set up on first use */
+static struct link vnode_hash[VFS_VNODE_HASH_SIZE];
+static struct link dentry_hash[VFS_DENTRY_HASH_SIZE];
+static int vfs_hash_ready;
+static int vnode_cache_count;
+
+static void vfs_hash_init(void)
+{
+	for (int i = 0; i < VFS_VNODE_HASH_SIZE; i++)
+		link_init(&vnode_hash[i]);
+	for (int i = 0; i < VFS_DENTRY_HASH_SIZE; i++)
+		link_init(&dentry_hash[i]);
+	vfs_hash_ready = 1;
+}
+
+static inline struct link *vnode_hash_chain(unsigned long vnum)
+{
+	if (!vfs_hash_ready)
+		vfs_hash_init();
+
+	return &vnode_hash[(vnum ^ (vnum >> VFS_FSIDX_SHIFT))
+			   & (VFS_VNODE_HASH_SIZE - 1)];
+}
+
+static inline struct link *dentry_hash_chain(struct dentry *parent,
+					     const char *name)
+{
+	unsigned long hash = (unsigned long)parent >> 4;
+
+	if (!vfs_hash_ready)
+		vfs_hash_init();
+
+	while (*name)
+		hash = hash * 31 + *name++;
+
+	return &dentry_hash[(hash ^ (hash >> VFS_DENTRY_HASH_BITS))
+			    & (VFS_DENTRY_HASH_SIZE - 1)];
+}
+
+/*
+ * Only file vnodes with no references are evicted. Directories
+ * stay, since their dirbuf holds the only copy of their children
+ * dentries, and tasks keep directory vnode pointers as curdir.
+ */
+static inline int vnode_evictable(struct vnode *v)
+{
+	return !v->refcnt && !vfs_isdir(v);
+}
+
+/*
+ * Evicts a vnode from the cache. Its dentries remain, and
+ * remember the vnum so that it can be read back when needed.
+ */
+static void vnode_evict(struct vnode *v)
+{
+	struct dentry *d, *n;
+
+	/* Flush any changes back to the fs inode */
+	v->sb->ops->write_vnode(v->sb, v);
+
+	list_foreach_removable_struct(d, n, &v->dentries, vref) {
+		d->vnode = 0;
+		d->vnum = v->vnum;
+		list_remove_init(&d->vref);
+	}
+	vfs_vnode_cache_remove(v);
+	kfree(v);
+}
+
+/* Evicts least recently used vnodes until there's room for one more */
+static void vnode_cache_shrink(void)
+{
+	struct vnode *v;
+	struct link *l, *prev;
+
+	for (l = vnode_cache.prev; l != &vnode_cache &&
+	     vnode_cache_count >= VFS_VNODE_CACHE_MAX; l = prev) {
+		prev = l->prev;
+		v = link_to_struct(l, struct vnode, cache_list);
+		if (vnode_evictable(v))
+			vnode_evict(v);
+	}
+}
+
+/* Marks a vnode as the most recently used */
+static inline void vnode_cache_touch(struct vnode *v)
+{
+	list_remove(&v->cache_list);
+	list_insert(&v->cache_list, &vnode_cache);
+}
+
+void vfs_vnode_cache_add(struct vnode *v)
+{
+	list_insert(&v->cache_list, &vnode_cache);
+	list_insert(&v->hash, vnode_hash_chain(v->vnum));
+	vnode_cache_count++;
+}
+
+void vfs_vnode_cache_remove(struct vnode *v)
+{
+	if (list_empty(&v->hash))
+		return;
+
+	list_remove_init(&v->cache_list);
+	list_remove_init(&v->hash);
+	vnode_cache_count--;
+}
+
+/* Root dentries are their own parent and have no name, so aren't hashed */
+void vfs_dentry_cache_add(struct dentry *d)
+{
+	list_insert(&d->cache_list, &dentry_cache);
+	if (d->parent != d)
+		list_insert(&d->hash, dentry_hash_chain(d->parent, d->name));
+}
+
+/* Finds the child dentry of parent with given name */
+struct dentry *vfs_dentry_lookup(struct dentry *parent, const char *name)
+{
+	struct dentry *d;
+
+	list_foreach_struct(d, dentry_hash_chain(parent, name), hash)
+		if (d->parent == parent && !strcmp(d->name, name))
+			return d;
+
+	return 0;
+}
+
+/* Returns the vnode of a dentry, reading it back if it was evicted */
+struct vnode *vfs_dentry_vnode(struct dentry *d)
+{
+	struct vnode *v;
+
+	if ((v = d->vnode)) {
+		vnode_cache_touch(v);
+		return v;
+	}
+
+	if (IS_ERR(v = vfs_vnode_lookup_byvnum(d->parent->vnode->sb,
+					       d->vnum)))
+		return v;
+
+	d->vnode = v;
+	list_insert(&d->vref, &v->dentries);
+	v->links++;
+
+	return v;
+}
+
 /*
  * Vnodes in the vnode cache have 2 keys. One is their dentry names, the other
  * is their vnum. This one checks the vnode cache by the given vnum first.
@@ -25,13 +179,22 @@ struct vnode *vfs_vnode_lookup_byvnum(struct superblock *sb, unsigned long vnum)
 	struct vnode *v;
 	int err;
 
-	/* Check the vnode flat list by vnum */
-	list_foreach_struct(v, &vnode_cache, cache_list)
-		if (v->vnum == vnum)
+	/* Directory entries may carry the vnum without the fs index */
+	vnum = sb->fsidx | (vnum & ~VFS_FSIDX_MASK);
+
+	/* Check the vnode hash by vnum, and mark as most recently used */
+	list_foreach_struct(v, vnode_hash_chain(vnum), hash)
+		if (v->vnum == vnum) {
+			vnode_cache_touch(v);
 			return v;
+		}
+
+	/* Make room for it, if the cache is full */
+	vnode_cache_shrink();
 
 	/* Check the actual filesystem for the vnode */
-	v = vfs_alloc_vnode();
+	if (!(v = vfs_alloc_vnode()))
+		return PTR_ERR(-ENOMEM);
 	v->vnum = vnum;
 
 	/* Note this only checks given superblock */
@@ -40,8 +203,8 @@ struct vnode *vfs_vnode_lookup_byvnum(struct superblock *sb, unsigned long vnum)
 		return PTR_ERR(err);
 	}
 
-	/* Add the vnode back to vnode flat list */
-	list_insert(&v->cache_list, &vnode_cache);
+	/* Add the vnode back to vnode cache */
+	vfs_vnode_cache_add(v);
 
 	return v;
 }
@@ -10,6 +10,7 @@ int vfs_read(struct vnode *v, unsigned long f_offset,
 	     unsigned long npages, void *pagebuf);
 int vfs_write(struct vnode *v, unsigned long f_offset,
 	      unsigned long npages, void *pagebuf);
+void *vfs_block(struct vnode *v, unsigned long f_offset);
 int sys_read(struct tcb *sender, int fd, void *buf, int count);
 int sys_write(struct tcb *sender, int fd, void *buf, int count);
 int sys_lseek(struct tcb *sender, int fd, off_t offset, int whence);
@@ -24,6 +25,10 @@ int flush_file_pages(struct vm_file *f);
 int read_file_pages(struct vm_file *vmfile, unsigned long pfn_start,
 		    unsigned long pfn_end);
 
+/* File pages lent to buffers, see file.c */
+int file_page_unlend(struct page *page);
+int file_settle_loans(struct tcb *task);
+
 struct vm_file *vfs_file_create(void);
 
 
@@ -35,6 +35,13 @@ struct file_ops {
 	/* Write a vnode's contents by page range */
 	int (*write)(struct vnode *v, unsigned long pfn,
 		    unsigned long npages, void *buf);
+
+	/*
+	 * Returns the block at pfn, allocating it if there's none, for
+	 * filesystems whose blocks are pages of mm0's memory. The page
+	 * cache keeps those pages in place of copies, see block_pager.
+	 */
+	void *(*block)(struct vnode *v, unsigned long pfn);
 	file_op_t open;
 	file_op_t close;
 	file_op_t mmap;
@@ -89,7 +96,9 @@ struct dentry {
 	struct link children;	/* List of children dentries */
 	struct link vref;		/* For vnode's dirent reference list */
 	struct link cache_list;	/* Dentry cache reference */
+	struct link hash;		/* Dentry hash, by parent and name */
 	struct vnode *vnode;		/* The vnode associated with dentry */
+	unsigned long vnum;		/* Vnode number, when vnode evicted */
 	struct dentry_ops ops;
 };
 
@@ -122,7 +131,8 @@ struct vnode {
 	struct vnode_ops ops;		/* Operations on this vnode */
 	struct file_ops fops;		/* File-related operations on this vnode */
 	struct link dentries;	/* Dirents that refer to this vnode */
-	struct link cache_list;	/* For adding the vnode to vnode cache */
+	struct link cache_list;	/* Vnode cache lru list */
+	struct link hash;		/* Vnode cache hash, by vnum */
 	struct dirbuf dirbuf;		/* Only directory buffers are kept */
 	u32 mode;			/* Permissions and vnode type */
 	u32 owner;			/* Owner */
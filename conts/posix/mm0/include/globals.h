@@ -1,6 +1,8 @@
 #ifndef __GLOBALS_H__
 #define __GLOBALS_H__
 
+#include <lib/spinlock.h>
+
 struct global_list {
 	int total;
 	struct link list;
@@ -10,4 +12,28 @@ extern struct global_list global_vm_files;
 extern struct global_list global_vm_objects;
 extern struct global_list global_tasks;
 
+/*
+ * Locks shared by mm0's worker threads. They are taken in this
+ * order, each after the vma list lock of the task being served:
+ *
+ * vm_object io_lock:	reads and write-backs of the object's pages.
+ * vm_lock:		vm objects and files, their page caches and
+ *			shadow chains, page refcounts and shm segments.
+ * vfs_lock:		vnode and dentry caches, and filesystems.
+ * task_list_lock:	global_tasks.
+ *
+ * Requests that work on vm objects are served with vm_lock held,
+ * page faults take it themselves. It is dropped around vfs calls,
+ * with the io lock of the object held instead where pages are read
+ * or written back, so that faults and requests on other objects go
+ * on while the vfs works. Objects stay in place meanwhile, as the
+ * task being served refers to them and its vma list lock is held.
+ *
+ * The page allocator, heap and address pools lock on their own,
+ * and take no other lock.
+ */
+extern struct spinlock vm_lock;
+extern struct spinlock vfs_lock;
+extern struct spinlock task_list_lock;
+
 #endif /* __GLOBALS_H__ */
@@ -7,9 +7,11 @@
 #define __ADDR_H__
 
 #include <lib/idpool.h>
+#include <lib/spinlock.h>
 
 /* Address pool to allocate from a range of addresses */
 struct address_pool {
+	struct spinlock lock;
 	struct id_pool *idpool;
 	unsigned long start;
 	unsigned long end;
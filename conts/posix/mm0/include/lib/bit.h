@@ -12,6 +12,12 @@ int check_and_clear_contig_bits(u32 *word, int first, int nbits);
 
 int check_and_set_bit(u32 *word, int bit);
 
+/* Index of the lowest set bit, word must be non-zero */
+static inline unsigned int __ffs(unsigned int word)
+{
+	return 31 - __clz(word & -word);
+}
+
 /* Set */
 static inline void setbit(unsigned int *w, unsigned int flags)
 {
@@ -6,16 +6,31 @@
 #include <string.h>
 #include INC_GLUE(memory.h)
 
+/*
+ * The bitmap is followed by a summary bitmap with a bit set for
+ * each full bitmap word, so that allocation skips 32 full words
+ * at a time. Allocation starts from the word of the last one.
+ * Bits of the last word past bitlimit are kept set.
+ */
 struct id_pool {
 	int nwords;
 	int bitlimit;
+	int hint;
 	u32 bitmap[];
 };
 
+/* Number of summary words for a bitmap of nwords */
+#define ID_POOL_SUMMARY_WORDS(nwords)	BITWISE_GETWORD((nwords) + WORD_BITS - 1)
+
+static inline u32 *id_pool_summary(struct id_pool *pool)
+{
+	return &pool->bitmap[pool->nwords];
+}
+
 /* Copy one id pool to another by calculating its size */
 static inline void id_pool_copy(struct id_pool *to, struct id_pool *from, int totalbits)
 {
-	int nwords = BITWISE_GETWORD(totalbits);
+	int nwords = from->nwords + ID_POOL_SUMMARY_WORDS(from->nwords);
 
 	memcpy(to, from, nwords * SZ_WORD + sizeof(struct id_pool));
 }
@@ -25,6 +40,7 @@ int id_new(struct id_pool *pool);
 int id_del(struct id_pool *pool, int id);
 int id_get(struct id_pool *pool, int id);
 int id_is_empty(struct id_pool *pool);
+int id_new_range(struct id_pool *pool, int numids);
 int ids_new_contiguous(struct id_pool *pool, int numids);
 int ids_del_contiguous(struct id_pool *pool, int first, int numids);
 
@@ -0,0 +1,44 @@
+/*
+ * Radix tree of items indexed by an unsigned long key
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __MM0_RADIX_H__
+#define __MM0_RADIX_H__
+
+#define RADIX_TREE_MAP_SHIFT	6
+#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE - 1)
+#define RADIX_TREE_INDEX_BITS	(sizeof(unsigned long) * 8)
+#define RADIX_TREE_MAX_HEIGHT	((RADIX_TREE_INDEX_BITS + \
+				  RADIX_TREE_MAP_SHIFT - 1) / \
+				 RADIX_TREE_MAP_SHIFT)
+
+struct radix_tree_node {
+	int count;		/* Number of used slots */
+	void *slot[RADIX_TREE_MAP_SIZE];
+};
+
+/*
+ * Height is the number of node levels, each resolving
+ * RADIX_TREE_MAP_SHIFT bits of the index. An empty tree
+ * has no root and zero height.
+ */
+struct radix_tree {
+	int height;
+	struct radix_tree_node *root;
+};
+
+static inline void radix_tree_init(struct radix_tree *tree)
+{
+	tree->height = 0;
+	tree->root = 0;
+}
+
+int radix_tree_insert(struct radix_tree *tree, unsigned long index,
+		      void *item);
+void *radix_tree_lookup(struct radix_tree *tree, unsigned long index);
+void *radix_tree_delete(struct radix_tree *tree, unsigned long index);
+void *radix_tree_next(struct radix_tree *tree, unsigned long *index);
+
+#endif /* __MM0_RADIX_H__ */
@@ -0,0 +1,61 @@
+/*
+ * Red-black tree with optional per-node augmented data
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __MM0_RBTREE_H__
+#define __MM0_RBTREE_H__
+
+#include <l4/macros.h>
+
+#define RB_RED		0
+#define RB_BLACK	1
+
+struct rb_node {
+	struct rb_node *parent;
+	struct rb_node *left;
+	struct rb_node *right;
+	int color;
+};
+
+struct rb_root {
+	struct rb_node *node;
+};
+
+#define rb_entry(ptr, type, member)	container_of(ptr, type, member)
+
+/*
+ * Recomputes any augmented data of a node from its own
+ * data and its children's. Called for every node whose
+ * subtree changes shape. May be null for plain trees.
+ */
+typedef void (*rb_augment_t)(struct rb_node *node);
+
+static inline void rb_root_init(struct rb_root *root)
+{
+	root->node = 0;
+}
+
+/* Links a new node as a leaf, to be followed by rb_insert_color() */
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+				struct rb_node **link)
+{
+	node->parent = parent;
+	node->left = 0;
+	node->right = 0;
+	node->color = RB_RED;
+	*link = node;
+}
+
+void rb_insert_color(struct rb_root *root, struct rb_node *node,
+		     rb_augment_t augment);
+void rb_erase(struct rb_root *root, struct rb_node *node,
+	      rb_augment_t augment);
+void rb_augment_path(struct rb_node *node, rb_augment_t augment);
+
+struct rb_node *rb_first(struct rb_root *root);
+struct rb_node *rb_last(struct rb_root *root);
+struct rb_node *rb_next(struct rb_node *node);
+struct rb_node *rb_prev(struct rb_node *node);
+
+#endif /* __MM0_RBTREE_H__ */
@@ -1,15 +1,39 @@
 /*
- * Fake spinlock for future multi-threaded mm0
+ * Locks of mm0's worker threads.
+ *
+ * These are userspace mutexes. An uncontended lock or unlock is an
+ * atomic operation, a contended one sleeps in the kernel until the
+ * holder lets go, so holders may block, e.g. in an ipc.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
  */
 #ifndef __MM0_SPINLOCK_H__
 #define __MM0_SPINLOCK_H__
 
+#include <l4lib/mutex.h>
+
 struct spinlock {
-	int lock;
+	struct l4_mutex mutex;
 };
 
-static inline void spin_lock_init(struct spinlock *s) { }
-static inline void spin_lock(struct spinlock *s) { }
-static inline void spin_unlock(struct spinlock *s) { }
+#define DECLARE_SPINLOCK(name)					\
+	struct spinlock name = {				\
+		.mutex = { L4_MUTEX_UNLOCKED },			\
+	}
+
+static inline void spin_lock_init(struct spinlock *s)
+{
+	l4_mutex_init(&s->mutex);
+}
+
+static inline void spin_lock(struct spinlock *s)
+{
+	l4_mutex_lock(&s->mutex);
+}
+
+static inline void spin_unlock(struct spinlock *s)
+{
+	l4_mutex_unlock(&s->mutex);
+}
 
 #endif /* __MM0_SPINLOCK_H__ */
@@ -14,6 +14,8 @@
 #include L4LIB_INC_ARCH(syscalls.h)
 #include <l4lib/utcb.h>
 #include <lib/addr.h>
+#include <lib/rbtree.h>
+#include <lib/spinlock.h>
 #include <l4/api/kip.h>
 #include <exec.h>
 
@@ -52,6 +54,8 @@ struct task_fd_head {
 
 struct task_vma_head {
 	struct link list;
+	struct rb_root tree;
+	struct spinlock lock;	/* Serialises requests of the space */
 	int tcb_refs;
 };
 
@@ -147,6 +151,7 @@ struct tcb_head {
 };
 
 struct tcb *find_task(int tid);
+struct tcb *find_task_by_vmas(struct task_vma_head *vma_head);
 void global_add_task(struct tcb *task);
 void global_remove_task(struct tcb *task);
 int task_mmap_segments(struct tcb *task, struct vm_file *file, struct exec_file_desc *efd,
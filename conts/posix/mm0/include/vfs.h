@@ -15,6 +15,18 @@
 #define VFS_FSIDX_SHIFT		28
 #define VFS_FSIDX_SIZE		16
 
+/*
+ * Vnodes are hashed by vnum, and dentries by their parent and name.
+ * Up to VFS_VNODE_CACHE_MAX vnodes are cached, after which the least
+ * recently used unreferenced file vnodes are evicted. Their dentries
+ * stay, and the vnode is read back by vnum when needed again.
+ */
+#define VFS_VNODE_HASH_BITS	7
+#define VFS_VNODE_HASH_SIZE	(1 << VFS_VNODE_HASH_BITS)
+#define VFS_DENTRY_HASH_BITS	8
+#define VFS_DENTRY_HASH_SIZE	(1 << VFS_DENTRY_HASH_BITS)
+#define VFS_VNODE_CACHE_MAX	512
+
 extern struct link vnode_cache;
 extern struct link dentry_cache;
 extern struct id_pool *vfs_fsidx_pool;
@@ -46,6 +58,7 @@ static inline struct dentry *vfs_alloc_dentry(void)
 	link_init(&d->children);
 	link_init(&d->vref);
 	link_init(&d->cache_list);
+	link_init(&d->hash);
 
 	return d;
 }
@@ -61,14 +74,32 @@ static inline struct vnode *vfs_alloc_vnode(void)
 
 	link_init(&v->dentries);
 	link_init(&v->cache_list);
+	link_init(&v->hash);
 
 	return v;
 }
 
+void vfs_vnode_cache_add(struct vnode *v);
+void vfs_vnode_cache_remove(struct vnode *v);
+void vfs_dentry_cache_add(struct dentry *d);
+struct dentry *vfs_dentry_lookup(struct dentry *parent, const char *name);
+struct vnode *vfs_dentry_vnode(struct dentry *d);
+
+/* Takes and drops a reference that keeps a vnode in the cache */
+static inline void vfs_vnode_get(struct vnode *v)
+{
+	v->refcnt++;
+}
+
+static inline void vfs_vnode_put(struct vnode *v)
+{
+	BUG_ON(--v->refcnt < 0);
+}
+
 static inline void vfs_free_vnode(struct vnode *v)
 {
 	BUG(); /* Are the dentries freed ??? */
-	list_remove(&v->cache_list);
+	vfs_vnode_cache_remove(v);
 	kfree(v);
 }
 
@@ -12,6 +12,8 @@
 #include <l4/types.h>
 #include <task.h>
 #include <lib/spinlock.h>
+#include <lib/radix.h>
+#include <lib/rbtree.h>
 #include <physmem.h>
 #include <linker.h>
 #include __INC_ARCH(mm.h)
@@ -52,6 +54,11 @@
 /* Set when the page is dirty in cache but not written to disk */
 #define VM_DIRTY			(1 << 9)
 
+/* Set on file pages that are lent to read or write buffers, see file.c */
+#define VM_LENT				(1 << 12)
+/* Set on file pages that shared mappings may write, these aren't lent */
+#define VM_WRITE_MAPPED			(1 << 13)
+
 /* Defines the type of file. A device file? Regular file? One used at boot? */
 enum VM_FILE_TYPE {
 	VM_FILE_DEVZERO = 1,
@@ -104,6 +111,12 @@ struct vm_pager_ops {
 	int (*page_out)(struct vm_object *vm_obj,
 			unsigned long pfn_offset);
 	int (*release_pages)(struct vm_object *vm_obj);
+	int (*readahead)(struct vm_object *vm_obj,
+			 unsigned long pfn_start,
+			 unsigned long pfn_end);
+	int (*new_pages)(struct vm_object *vm_obj,
+			 unsigned long pfn_start,
+			 unsigned long pfn_end);
 };
 
 /* Describes the pager task that handles a vm_area. */
@@ -111,6 +124,18 @@ struct vm_pager {
 	struct vm_pager_ops ops;	/* The ops the pager does on area */
 };
 
+/*
+ * File pages a shadow lends to a task's buffer, mapped there without
+ * being copied. The shadow gets a copy of each page before the file
+ * writes it, see file_page_unlend().
+ */
+struct vm_loan {
+	struct task_vma_head *vma_head;	/* Vmas of the borrower */
+	unsigned long vaddr;		/* Where the first page is mapped */
+	unsigned long pfn_start;	/* Range lent, in file pages */
+	unsigned long pfn_end;
+};
+
 /*
  * Describes the in-memory representation of a resource. This could
  * point at a file or another resource, e.g. a device area, swapper space,
@@ -130,6 +155,19 @@ struct vm_object {
 	struct link list;	    /* List of all vm objects in memory */
 	struct vm_pager *pager;	    /* The pager for this object */
 	struct link page_cache;/* List of in-memory pages */
+	struct radix_tree page_tree; /* In-memory pages by offset */
+	struct spinlock io_lock;    /* Held while the vfs reads or writes pages */
+	struct vm_loan *loan;	    /* Pages lent by the original, if any */
+};
+
+/* Pages a file miss reads in, growing as long as accesses are sequential */
+#define FILE_READAHEAD_MIN		4
+#define FILE_READAHEAD_MAX		32
+
+/* Sequential access state of a file, see file_readahead() */
+struct file_readahead {
+	unsigned long next;	/* Page after the last one accessed */
+	unsigned int window;	/* Pages to read on the next miss */
 };
 
 /* In memory representation of either a vfs file, a device. */
@@ -141,6 +179,7 @@ struct vm_file {
 	struct vm_object vm_obj;
 	void (*destroy_priv_data)(struct vm_file *f);
 	struct vnode *vnode;
+	struct file_readahead readahead;
 	void *private_file_data;	/* FIXME: To be removed and placed into vnode!!! */
 };
 
@@ -184,6 +223,9 @@ static inline struct vm_object *vm_unlink_object(struct vm_obj_link *link)
  */
 struct vm_area {
 	struct link list;		/* Per-task vma list */
+	struct rb_node rb;		/* Per-task vma tree */
+	unsigned long gap;		/* Free pfns before this vma */
+	unsigned long max_gap;		/* Largest gap in tree below */
 	struct link vm_obj_list;	/* Head for vm_object list. */
 	unsigned long pfn_start;	/* Region start virtual pfn */
 	unsigned long pfn_end;		/* Region end virtual pfn, exclusive */
@@ -191,31 +233,29 @@ struct vm_area {
 	unsigned long file_offset;	/* File offset in pfns */
 };
 
-/*
- * Finds the vma that has the given address.
- * TODO: In the future a lot of use cases may need to traverse each vma
- * rather than searching the address. E.g. munmap/msync
- */
-static inline struct vm_area *find_vma(unsigned long addr,
-				       struct link *vm_area_list)
-{
-	struct vm_area *vma;
-	unsigned long pfn = __pfn(addr);
-
-	list_foreach_struct(vma, vm_area_list, list)
-		if ((pfn >= vma->pfn_start) && (pfn < vma->pfn_end))
-			return vma;
-	return 0;
-}
+/* Per-task vma tree and list */
+int task_insert_vma(struct vm_area *vma, struct task_vma_head *vma_head);
+void task_remove_vma(struct vm_area *vma, struct task_vma_head *vma_head);
+void task_update_vma(struct vm_area *vma, struct task_vma_head *vma_head);
+struct vm_area *find_vma(unsigned long addr, struct task_vma_head *vma_head);
+struct vm_area *find_vma_range(unsigned long pfn_start, unsigned long pfn_end,
+			       struct task_vma_head *vma_head);
+unsigned long find_vma_gap(unsigned long npages, unsigned long align,
+			   unsigned long pfn_low, unsigned long pfn_high,
+			   struct task_vma_head *vma_head);
 
 /* Adds a page to its vm_objects's page cache in order of offset. */
 int insert_page_olist(struct page *this, struct vm_object *vm_obj);
+void remove_page_olist(struct page *this, struct vm_object *vm_obj);
+int move_page_olist(struct page *this, struct vm_object *to,
+		    unsigned long offset);
 
 /* Find a page in page cache via page offset */
 struct page *find_page(struct vm_object *obj, unsigned long pfn);
 
 /* Pagers */
 extern struct vm_pager file_pager;
+extern struct vm_pager block_pager;
 extern struct vm_pager devzero_pager;
 extern struct vm_pager swap_pager;
 
@@ -226,6 +266,8 @@ extern struct link vm_object_list;
 struct vm_obj_link *vm_objlink_create(void);
 struct vm_obj_link *vma_next_link(struct link *link,
 				  struct link *head);
+struct vm_obj_link *vma_create_shadow(void);
+struct page *copy_to_new_page(struct page *orig);
 
 /* vm file and object initialisation */
 struct vm_object *vm_object_create(void);
@@ -234,6 +276,10 @@ int vm_file_delete(struct vm_file *f);
 int vm_object_delete(struct vm_object *vmo);
 void vm_file_put(struct vm_file *f);
 
+/* Paging i/o on an object, see globals.h */
+void vm_object_io_lock(struct vm_object *vmo);
+void vm_object_io_unlock(struct vm_object *vmo);
+
 /* Printing objects, files */
 void vm_object_print(struct vm_object *vmo);
 void vm_print_objects(struct link *vmo_list);
@@ -254,7 +300,6 @@ void pager_unmap_page(void *vaddr);
 int vm_freeze_shadows(struct tcb *task);
 
 int vm_compare_prot_flags(unsigned int current, unsigned int needed);
-int task_insert_vma(struct vm_area *vma, struct link *vma_list);
 
 /* Main page fault entry point */
 struct page *page_fault_handler(struct tcb *faulty_task, fault_kdata_t *fkdata);
@@ -0,0 +1,42 @@
+/*
+ * Worker threads that serve mm0 requests.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __MM0_WORKER_H__
+#define __MM0_WORKER_H__
+
+#include <l4/lib/list.h>
+#include <l4lib/types.h>
+#include L4LIB_INC_ARCH(utcb.h)
+#include <task.h>
+
+/* Threads that serve requests, besides the one that receives them */
+#if !defined(MM0_WORKERS)
+#define MM0_WORKERS			CONFIG_NCPU
+#endif
+
+/* Requests that may wait for a worker at once */
+#define MM0_REQUESTS			32
+
+#define MM0_WORKER_STACK_SIZE		(PAGE_SIZE * 4)
+
+/* A request, as copied out of the receiver's utcb */
+struct mm0_request {
+	struct link list;
+	u32 tag;
+	l4id_t senderid;
+	struct tcb *sender;
+	u32 mr[MR_UNUSED_TOTAL];
+	char buf[L4_UTCB_FULL_BUFFER_SIZE];	/* Pathnames */
+};
+
+void worker_pool_init(void);
+struct mm0_request *worker_request_new(void);
+void worker_request_queue(struct mm0_request *req);
+void worker_pool_drain(void);
+
+/* Serves a request and replies to its sender, see main.c */
+void handle_request(struct mm0_request *req);
+
+#endif /* __MM0_WORKER_H__ */
@@ -19,6 +19,7 @@ int address_pool_init_with_idpool(struct address_pool *pool,
 				  struct id_pool *idpool,
 				  unsigned long start, unsigned long end)
 {
+	spin_lock_init(&pool->lock);
 	pool->idpool = idpool;
 	pool->start = start;
 	pool->end = end;
@@ -30,6 +31,7 @@ int address_pool_init(struct address_pool *pool, unsigned long start, unsigned l
 {
 	if ((pool->idpool = id_pool_new_init(__pfn(end - start))) < 0)
 		return (int)pool->idpool;
+	spin_lock_init(&pool->lock);
 	pool->start = start;
 	pool->end = end;
 	return 0;
@@ -39,7 +41,11 @@ void *address_new(struct address_pool *pool, int npages)
 {
 	unsigned int pfn;
 
-	if ((int)(pfn = ids_new_contiguous(pool->idpool, npages)) < 0)
+	spin_lock(&pool->lock);
+	pfn = ids_new_contiguous(pool->idpool, npages);
+	spin_unlock(&pool->lock);
+
+	if ((int)pfn < 0)
 		return 0;
 
 	return (void *)__pfn_to_addr(pfn) + pool->start;
@@ -48,8 +54,13 @@ void *address_new(struct address_pool *pool, int npages)
 int address_del(struct address_pool *pool, void *addr, int npages)
 {
 	unsigned long pfn = __pfn(page_align(addr) - pool->start);
+	int err;
+
+	spin_lock(&pool->lock);
+	err = ids_del_contiguous(pool->idpool, pfn, npages);
+	spin_unlock(&pool->lock);
 
-	if (ids_del_contiguous(pool->idpool, pfn, npages) < 0) {
+	if (err < 0) {
 		printf("%s: Invalid address range returned to "
 		       "virtual address pool.\n", __FUNCTION__);
 		return -1;
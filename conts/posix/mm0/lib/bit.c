@@ -9,15 +9,12 @@
 #include <stdio.h>
 #include INC_GLUE(memory.h)
 
-/* Emulation of ARM's CLZ (count leading zeroes) instruction */
+/* Count leading zeroes, a single CLZ instruction on ARMv5 and later */
 unsigned int __clz(unsigned int bitvector)
 {
-	unsigned int x = 0;
-	while((!(bitvector & ((unsigned)1 << 31))) && (x < 32)) {
-		bitvector <<= 1;
-		x++;
-	}
-	return x;
+	if (!bitvector)
+		return 32;
+	return __builtin_clz(bitvector);
 }
 
 int find_and_set_first_free_bit(u32 *word, unsigned int limit)
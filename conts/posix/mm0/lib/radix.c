@@ -0,0 +1,162 @@
+/*
+ * Radix tree used for indexing pages of vm objects
+ * by their offset.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <lib/radix.h>
+#include <mem/malloc.h>
+#include <l4/macros.h>
+#include <l4/api/errno.h>
+
+/* Largest index a tree of given height can hold */
+static inline unsigned long radix_tree_maxindex(int height)
+{
+	if (height * RADIX_TREE_MAP_SHIFT >= RADIX_TREE_INDEX_BITS)
+		return ~0UL;
+
+	return (1UL << (height * RADIX_TREE_MAP_SHIFT)) - 1;
+}
+
+static inline int radix_tree_slot(unsigned long index, int height)
+{
+	return (index >> ((height - 1) * RADIX_TREE_MAP_SHIFT))
+	       & RADIX_TREE_MAP_MASK;
+}
+
+int radix_tree_insert(struct radix_tree *tree, unsigned long index,
+		      void *item)
+{
+	struct radix_tree_node *node, *child;
+	int slot;
+
+	/* Grow the tree from the top until index fits */
+	while (!tree->root || index > radix_tree_maxindex(tree->height)) {
+		if (!(node = kzalloc(sizeof(*node))))
+			return -ENOMEM;
+
+		/* Old root becomes the first child */
+		if (tree->root) {
+			node->slot[0] = tree->root;
+			node->count = 1;
+		}
+		tree->root = node;
+		tree->height++;
+	}
+
+	/* Walk down, creating any missing nodes */
+	node = tree->root;
+	for (int height = tree->height; height > 1; height--) {
+		slot = radix_tree_slot(index, height);
+		if (!(child = node->slot[slot])) {
+			if (!(child = kzalloc(sizeof(*child))))
+				return -ENOMEM;
+			node->slot[slot] = child;
+			node->count++;
+		}
+		node = child;
+	}
+
+	slot = index & RADIX_TREE_MAP_MASK;
+	if (node->slot[slot])
+		return -EEXIST;
+
+	node->slot[slot] = item;
+	node->count++;
+
+	return 0;
+}
+
+void *radix_tree_lookup(struct radix_tree *tree, unsigned long index)
+{
+	struct radix_tree_node *node = tree->root;
+
+	if (!node || index > radix_tree_maxindex(tree->height))
+		return 0;
+
+	for (int height = tree->height; height > 1; height--)
+		if (!(node = node->slot[radix_tree_slot(index, height)]))
+			return 0;
+
+	return node->slot[index & RADIX_TREE_MAP_MASK];
+}
+
+/*
+ * Removes the item at index, freeing any nodes that
+ * end up empty. Returns the removed item, if any.
+ */
+void *radix_tree_delete(struct radix_tree *tree, unsigned long index)
+{
+	struct radix_tree_node *path[RADIX_TREE_MAX_HEIGHT + 1];
+	struct radix_tree_node *node = tree->root;
+	void *item;
+	int height;
+
+	if (!node || index > radix_tree_maxindex(tree->height))
+		return 0;
+
+	/* Record the node at each level on the way down */
+	for (height = tree->height; height > 1; height--) {
+		path[height] = node;
+		if (!(node = node->slot[radix_tree_slot(index, height)]))
+			return 0;
+	}
+
+	if (!(item = node->slot[index & RADIX_TREE_MAP_MASK]))
+		return 0;
+	node->slot[index & RADIX_TREE_MAP_MASK] = 0;
+
+	/* Free empty nodes bottom up */
+	for (height = 1; !--node->count; height++) {
+		kfree(node);
+		if (height == tree->height) {
+			radix_tree_init(tree);
+			break;
+		}
+		node = path[height + 1];
+		node->slot[radix_tree_slot(index, height + 1)] = 0;
+	}
+
+	return item;
+}
+
+/*
+ * Finds the first item at or after index under node,
+ * and sets found to its index.
+ */
+static void *radix_tree_node_next(struct radix_tree_node *node, int height,
+				  unsigned long index, unsigned long *found)
+{
+	int shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+	void *item;
+
+	for (int slot = radix_tree_slot(index, height);
+	     slot < RADIX_TREE_MAP_SIZE; slot++) {
+		if ((item = node->slot[slot])) {
+			if (height == 1) {
+				*found = index;
+				return item;
+			}
+			if ((item = radix_tree_node_next(item, height - 1,
+							 index, found)))
+				return item;
+		}
+		/* Move on to the first index of next slot */
+		index = ((index >> shift) + 1) << shift;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the first item with an index equal or larger
+ * than *index, and updates *index to its index.
+ */
+void *radix_tree_next(struct radix_tree *tree, unsigned long *index)
+{
+	if (!tree->root || *index > radix_tree_maxindex(tree->height))
+		return 0;
+
+	return radix_tree_node_next(tree->root, tree->height,
+				    *index, index);
+}
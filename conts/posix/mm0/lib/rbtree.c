@@ -0,0 +1,291 @@
+/*
+ * Red-black tree with optional per-node augmented data
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <lib/rbtree.h>
+
+static inline int rb_is_black(struct rb_node *node)
+{
+	return !node || node->color == RB_BLACK;
+}
+
+/* Replaces the subtree at old with the one at new in old's parent */
+static inline void rb_transplant(struct rb_root *root, struct rb_node *old,
+				 struct rb_node *new)
+{
+	if (!old->parent)
+		root->node = new;
+	else if (old == old->parent->left)
+		old->parent->left = new;
+	else
+		old->parent->right = new;
+
+	if (new)
+		new->parent = old->parent;
+}
+
+/* Lower node is augmented first, as upper one depends on it */
+static void rb_rotate_left(struct rb_root *root, struct rb_node *node,
+			   rb_augment_t augment)
+{
+	struct rb_node *right = node->right;
+
+	node->right = right->left;
+	if (right->left)
+		right->left->parent = node;
+	rb_transplant(root, node, right);
+	right->left = node;
+	node->parent = right;
+
+	if (augment) {
+		augment(node);
+		augment(right);
+	}
+}
+
+static void rb_rotate_right(struct rb_root *root, struct rb_node *node,
+			    rb_augment_t augment)
+{
+	struct rb_node *left = node->left;
+
+	node->left = left->right;
+	if (left->right)
+		left->right->parent = node;
+	rb_transplant(root, node, left);
+	left->right = node;
+	node->parent = left;
+
+	if (augment) {
+		augment(node);
+		augment(left);
+	}
+}
+
+/* Recomputes augmented data from node up to root */
+void rb_augment_path(struct rb_node *node, rb_augment_t augment)
+{
+	if (!augment)
+		return;
+
+	for (; node; node = node->parent)
+		augment(node);
+}
+
+void rb_insert_color(struct rb_root *root, struct rb_node *node,
+		     rb_augment_t augment)
+{
+	struct rb_node *parent, *gparent, *uncle;
+
+	rb_augment_path(node, augment);
+
+	while ((parent = node->parent) && parent->color == RB_RED) {
+		/* Parent is red so it is not the root */
+		gparent = parent->parent;
+
+		if (parent == gparent->left) {
+			uncle = gparent->right;
+			if (!rb_is_black(uncle)) {
+				parent->color = RB_BLACK;
+				uncle->color = RB_BLACK;
+				gparent->color = RB_RED;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->right) {
+				rb_rotate_left(root, parent, augment);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->color = RB_BLACK;
+			gparent->color = RB_RED;
+			rb_rotate_right(root, gparent, augment);
+		} else {
+			uncle = gparent->left;
+			if (!rb_is_black(uncle)) {
+				parent->color = RB_BLACK;
+				uncle->color = RB_BLACK;
+				gparent->color = RB_RED;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->left) {
+				rb_rotate_right(root, parent, augment);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->color = RB_BLACK;
+			gparent->color = RB_RED;
+			rb_rotate_left(root, gparent, augment);
+		}
+	}
+	root->node->color = RB_BLACK;
+}
+
+/*
+ * Restores colors after a black node was removed from under
+ * parent, on the side where node (possibly null) now stands.
+ */
+static void rb_erase_color(struct rb_root *root, struct rb_node *node,
+			   struct rb_node *parent, rb_augment_t augment)
+{
+	struct rb_node *sibling;
+
+	while (node != root->node && rb_is_black(node)) {
+		if (node == parent->left) {
+			sibling = parent->right;
+			if (sibling->color == RB_RED) {
+				sibling->color = RB_BLACK;
+				parent->color = RB_RED;
+				rb_rotate_left(root, parent, augment);
+				sibling = parent->right;
+			}
+			if (rb_is_black(sibling->left) &&
+			    rb_is_black(sibling->right)) {
+				sibling->color = RB_RED;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+			if (rb_is_black(sibling->right)) {
+				sibling->left->color = RB_BLACK;
+				sibling->color = RB_RED;
+				rb_rotate_right(root, sibling, augment);
+				sibling = parent->right;
+			}
+			sibling->color = parent->color;
+			parent->color = RB_BLACK;
+			sibling->right->color = RB_BLACK;
+			rb_rotate_left(root, parent, augment);
+		} else {
+			sibling = parent->left;
+			if (sibling->color == RB_RED) {
+				sibling->color = RB_BLACK;
+				parent->color = RB_RED;
+				rb_rotate_right(root, parent, augment);
+				sibling = parent->left;
+			}
+			if (rb_is_black(sibling->left) &&
+			    rb_is_black(sibling->right)) {
+				sibling->color = RB_RED;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+			if (rb_is_black(sibling->left)) {
+				sibling->right->color = RB_BLACK;
+				sibling->color = RB_RED;
+				rb_rotate_left(root, sibling, augment);
+				sibling = parent->left;
+			}
+			sibling->color = parent->color;
+			parent->color = RB_BLACK;
+			sibling->left->color = RB_BLACK;
+			rb_rotate_right(root, parent, augment);
+		}
+		node = root->node;
+	}
+
+	if (node)
+		node->color = RB_BLACK;
+}
+
+void rb_erase(struct rb_root *root, struct rb_node *node,
+	      rb_augment_t augment)
+{
+	struct rb_node *child, *parent, *next;
+	int color = node->color;
+
+	if (!node->left) {
+		child = node->right;
+		parent = node->parent;
+		rb_transplant(root, node, child);
+	} else if (!node->right) {
+		child = node->left;
+		parent = node->parent;
+		rb_transplant(root, node, child);
+	} else {
+		/* Successor takes the place of node */
+		next = node->right;
+		while (next->left)
+			next = next->left;
+
+		color = next->color;
+		child = next->right;
+
+		if (next->parent == node) {
+			parent = next;
+		} else {
+			parent = next->parent;
+			rb_transplant(root, next, child);
+			next->right = node->right;
+			next->right->parent = next;
+		}
+		rb_transplant(root, node, next);
+		next->left = node->left;
+		next->left->parent = next;
+		next->color = node->color;
+	}
+
+	/* Everything above where the change happened needs updating */
+	rb_augment_path(parent, augment);
+
+	if (color == RB_BLACK)
+		rb_erase_color(root, child, parent, augment);
+}
+
+struct rb_node *rb_first(struct rb_root *root)
+{
+	struct rb_node *node = root->node;
+
+	if (!node)
+		return 0;
+	while (node->left)
+		node = node->left;
+	return node;
+}
+
+struct rb_node *rb_last(struct rb_root *root)
+{
+	struct rb_node *node = root->node;
+
+	if (!node)
+		return 0;
+	while (node->right)
+		node = node->right;
+	return node;
+}
+
+struct rb_node *rb_next(struct rb_node *node)
+{
+	struct rb_node *parent;
+
+	if (node->right) {
+		node = node->right;
+		while (node->left)
+			node = node->left;
+		return node;
+	}
+
+	while ((parent = node->parent) && node == parent->right)
+		node = parent;
+
+	return parent;
+}
+
+struct rb_node *rb_prev(struct rb_node *node)
+{
+	struct rb_node *parent;
+
+	if (node->left) {
+		node = node->left;
+		while (node->right)
+			node = node->right;
+		return node;
+	}
+
+	while ((parent = node->parent) && node == parent->left)
+		node = parent;
+
+	return parent;
+}
@@ -24,6 +24,8 @@
 #include <test.h>
 #include <capability.h>
 #include <globals.h>
+#include <worker.h>
+#include <string.h>
 
 /* Receives all registers and origies back */
 int ipc_test_full_sync(l4id_t senderid)
@@ -40,39 +42,76 @@ int ipc_test_full_sync(l4id_t senderid)
 	return 0;
 }
 
-void handle_requests(void)
+/*
+ * Requests that create, destroy or inspect tasks as a whole. They
+ * are served by the main thread alone, see worker.c
+ */
+static inline int request_is_exclusive(u32 tag)
 {
-	/* Generic ipc data */
-	u32 mr[MR_UNUSED_TOTAL];
-	l4id_t senderid;
-	struct tcb *sender;
-	u32 tag;
-	int ret;
+	switch (tag) {
+	case L4_IPC_TAG_SYNC:
+	case L4_IPC_TAG_FORK:
+	case L4_IPC_TAG_CLONE:
+	case L4_IPC_TAG_EXIT:
+	case L4_IPC_TAG_EXECVE:
+		return 1;
+	}
+	return 0;
+}
 
-	// printf("%s: Initiating ipc.\n", __TASKNAME__);
-	if ((ret = l4_receive(L4_ANYTHREAD)) < 0) {
-		printf("%s: %s: IPC Error: %d. Quitting...\n", __TASKNAME__,
-		       __FUNCTION__, ret);
-		BUG();
+/*
+ * Page faults take vm_lock for as long as they need it, and calls
+ * that only look at the fs or the sender need none. The rest are
+ * served with it held, and drop it around the vfs calls they make,
+ * e.g. those of a read or write, see globals.h
+ */
+static inline int request_needs_vm_lock(u32 tag)
+{
+	switch (tag) {
+	case L4_IPC_TAG_UNDEF_FAULT:
+	case L4_IPC_TAG_PFAULT:
+	case L4_IPC_TAG_MKDIR:
+	case L4_IPC_TAG_CHDIR:
+	case L4_IPC_TAG_READDIR:
+		return 0;
 	}
+	return 1;
+}
 
-	/* Syslib conventional ipc data which uses first few mrs. */
-	tag = l4_get_tag();
-	senderid = l4_get_sender();
+/* Takes the locks a request needs, see globals.h */
+static inline void request_lock(struct mm0_request *req)
+{
+	spin_lock(&req->sender->vm_area_head->lock);
+	if (request_needs_vm_lock(req->tag))
+		spin_lock(&vm_lock);
+}
 
-	if (!(sender = find_task(senderid))) {
-		l4_ipc_return(-ESRCH);
-		return;
-	}
+static inline void request_unlock(struct mm0_request *req)
+{
+	if (request_needs_vm_lock(req->tag))
+		spin_unlock(&vm_lock);
+	spin_unlock(&req->sender->vm_area_head->lock);
+}
 
-	/* Read mrs not used by syslib */
-	for (int i = 0; i < MR_UNUSED_TOTAL; i++)
-		mr[i] = read_mr(MR_UNUSED_START + i);
+/*
+ * Serves a request on a worker, or on the main thread for exclusive
+ * requests, and replies to its sender.
+ */
+void handle_request(struct mm0_request *req)
+{
+	char dirbuf[L4_IPC_EXTENDED_MAX_SIZE];
+	struct tcb *sender = req->sender;
+	u32 *mr = req->mr;
+	int extended = 0;
+	int ret;
 
-	switch(tag) {
-	case L4_IPC_TAG_SYNC_FULL:
-		ret = ipc_test_full_sync(senderid);
-		return;
+	/* Replies go to the sender from whichever thread serves it */
+	l4_set_sender(req->senderid);
+
+	if (!request_is_exclusive(req->tag))
+		request_lock(req);
+
+	switch(req->tag) {
 	case L4_IPC_TAG_SYNC:
 		mm0_test_global_vm_integrity();
 		// printf("%s: Synced with waiting thread.\n", __TASKNAME__);
@@ -179,36 +218,117 @@ void handle_requests(void)
 
 	/* FS0 System calls */
 	case L4_IPC_TAG_OPEN:
-		ret = sys_open(sender, utcb_full_buffer(), (int)mr[0], (unsigned int)mr[1]);
+		ret = sys_open(sender, req->buf, (int)mr[0], (unsigned int)mr[1]);
 		break;
 	case L4_IPC_TAG_MKDIR:
-		ret = sys_mkdir(sender, utcb_full_buffer(), (unsigned int)mr[0]);
+		ret = sys_mkdir(sender, req->buf, (unsigned int)mr[0]);
 		break;
 	case L4_IPC_TAG_CHDIR:
-		ret = sys_chdir(sender, utcb_full_buffer());
+		ret = sys_chdir(sender, req->buf);
 		break;
-	case L4_IPC_TAG_READDIR: {
-		char dirbuf[L4_IPC_EXTENDED_MAX_SIZE];
+	case L4_IPC_TAG_READDIR:
 		ret = sys_readdir(sender, (int)mr[0], (int)mr[1], dirbuf);
-		l4_return_extended(ret, L4_IPC_EXTENDED_MAX_SIZE, dirbuf, ret < 0);
-		return;
-	}
+		extended = 1;
+		break;
 	default:
 		printf("%s: Unrecognised ipc tag (%d) "
-		       "received from (%d). Full mr reading: "
-		       "%u, %u, %u, %u, %u, %u. Ignoring.\n",
-		       __TASKNAME__, tag, senderid, read_mr(0),
-		       read_mr(1), read_mr(2), read_mr(3), read_mr(4),
-		       read_mr(5));
+		       "received from (%d). Unused mr reading: "
+		       "%u, %u, %u, %u. Ignoring.\n",
+		       __TASKNAME__, req->tag, req->senderid, mr[0],
+		       mr[1], mr[2], mr[3]);
+		ret = 0;
 	}
 
+	if (!request_is_exclusive(req->tag))
+		request_unlock(req);
+
 	/* Reply */
+	if (extended) {
+		l4_return_extended(ret, L4_IPC_EXTENDED_MAX_SIZE,
+				   dirbuf, ret < 0);
+		return;
+	}
+
 	if ((ret = l4_ipc_return(ret)) < 0) {
 		printf("%s: L4 IPC Error: %d.\n", __FUNCTION__, ret);
 		BUG();
 	}
 }
 
+/* Requests that pass a pathname in the utcb */
+static inline int request_has_path(u32 tag)
+{
+	return tag == L4_IPC_TAG_OPEN || tag == L4_IPC_TAG_MKDIR ||
+	       tag == L4_IPC_TAG_CHDIR;
+}
+
+/*
+ * Receives a request and hands it over to a worker. Requests are
+ * served here if they are exclusive, or if all slots are in use.
+ */
+void handle_requests(void)
+{
+	struct mm0_request *req, inline_req;
+	l4id_t senderid;
+	struct tcb *sender;
+	u32 tag;
+	int ret;
+
+	// printf("%s: Initiating ipc.\n", __TASKNAME__);
+	if ((ret = l4_receive(L4_ANYTHREAD)) < 0) {
+		printf("%s: %s: IPC Error: %d. Quitting...\n", __TASKNAME__,
+		       __FUNCTION__, ret);
+		BUG();
+	}
+
+	/* Syslib conventional ipc data which uses first few mrs. */
+	tag = l4_get_tag();
+	senderid = l4_get_sender();
+
+	if (!(sender = find_task(senderid))) {
+		l4_ipc_return(-ESRCH);
+		return;
+	}
+
+	/* This one echoes all of our own registers back */
+	if (tag == L4_IPC_TAG_SYNC_FULL) {
+		ipc_test_full_sync(senderid);
+		return;
+	}
+
+	if (request_is_exclusive(tag) || !(req = worker_request_new()))
+		req = &inline_req;
+
+	req->tag = tag;
+	req->senderid = senderid;
+	req->sender = sender;
+
+	/* Read mrs not used by syslib */
+	for (int i = 0; i < MR_UNUSED_TOTAL; i++)
+		req->mr[i] = read_mr(MR_UNUSED_START + i);
+
+	if (request_has_path(tag))
+		memcpy(req->buf, utcb_full_buffer(), L4_UTCB_FULL_BUFFER_SIZE);
+
+	if (req != &inline_req) {
+		worker_request_queue(req);
+		return;
+	}
+
+	/* Exclusive ones wait until workers are done with other tasks */
+	if (request_is_exclusive(tag)) {
+		worker_pool_drain();
+
+		/* Pagers they call drop and take it back, as on workers */
+		spin_lock(&vm_lock);
+		handle_request(req);
+		spin_unlock(&vm_lock);
+		return;
+	}
+
+	handle_request(req);
+}
+
 void main(void)
 {
 
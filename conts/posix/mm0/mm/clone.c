@@ -13,6 +13,7 @@
 #include <task.h>
 #include <mmap.h>
 #include <shm.h>
+#include <file.h>
 #include <test.h>
 #include <clone.h>
 
@@ -23,16 +24,21 @@ int sys_fork(struct tcb *parent)
 	struct exregs_data exregs;
 	struct task_ids ids;
 
+	/* The child can't share pages lent to the parent's buffers */
+	if ((err = file_settle_loans(parent)) < 0)
+		return err;
+
 	/* Make all shadows in this task read-only */
 	vm_freeze_shadows(parent);
 
 	/*
 	 * Create a new L4 thread with parent's page tables
-	 * kernel stack and kernel-side tcb copied
+	 * kernel stack and kernel-side tcb copied. All writable
+	 * pages of both go read-only, for copy-on-write.
 	 */
 	if (IS_ERR(child = task_create(parent, &ids,
 			    	       TCB_NO_SHARING,
-				       TC_COPY_SPACE)))
+				       TC_COPY_SPACE | TC_WRITE_PROTECT)))
 		return (int)child;
 
 	/* Set child's fork return value to 0 */
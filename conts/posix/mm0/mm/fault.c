@@ -14,6 +14,8 @@
 #include <shm.h>
 #include <file.h>
 #include <test.h>
+#include <init.h>
+#include <globals.h>
 
 #include L4LIB_INC_ARCH(syscalls.h)
 #include L4LIB_INC_ARCH(syslib.h)
@@ -115,11 +117,12 @@ int vm_object_is_subset(struct vm_object *shadow,
 	return 1;
 }
 
+/* Shadows holding file pages on loan stay, to take those pages back */
 static inline int vm_object_is_droppable(struct vm_object *shadow,
 					 struct vm_object *original)
 {
 	if (shadow->npages == original->npages &&
-	    (original->flags & VM_OBJ_SHADOW))
+	    (original->flags & VM_OBJ_SHADOW) && !original->loan)
 		return 1;
 	else
 		return 0;
@@ -155,6 +158,7 @@ int vma_merge_object(struct vm_object *redundant)
 	struct vm_object *front; /* Shadow in front of redundant */
 	struct vm_obj_link *last_link;
 	struct page *p1, *p2, *n;
+	int err;
 
 	/* Check link and shadow count is really 1 */
 	BUG_ON(redundant->nlinks != 1);
@@ -164,17 +168,16 @@ int vma_merge_object(struct vm_object *redundant)
 	front = link_to_struct(redundant->shdw_list.next,
 			   struct vm_object, shref);
 
-	/* Move all non-intersecting pages to front shadow. */
+	/*
+	 * Move all non-intersecting pages to front shadow. If one can't
+	 * be moved the merge is left off, those moved so far are as good
+	 * in front as they were behind it.
+	 */
 	list_foreach_removable_struct(p1, n, &redundant->page_cache, list) {
 		/* Page doesn't exist in front, move it there */
-		if (!(p2 = find_page(front, p1->offset))) {
-			list_remove_init(&p1->list);
-			spin_lock(&p1->lock);
-			p1->owner = front;
-			spin_unlock(&p1->lock);
-			insert_page_olist(p1, front);
-			front->npages++;
-		}
+		if (!(p2 = find_page(front, p1->offset)))
+			if ((err = move_page_olist(p1, front, p1->offset)) < 0)
+				return err;
 	}
 
 	/* Sort out shadow relationships after the merge: */
@@ -419,10 +422,11 @@ int vma_drop_merge_delete(struct vm_area *vma, struct vm_obj_link *link)
 		dprintf("Deleting object:\n");
 		// vm_object_print(obj);
 		vm_object_delete(obj);
-	} else if ((obj->flags & VM_OBJ_SHADOW) &&
+	} else if ((obj->flags & VM_OBJ_SHADOW) && !obj->loan &&
 		   obj->nlinks == 1 && obj->shadows == 1) {
 		dprintf("Merging object:\n");
 		// vm_object_print(obj);
+		/* If it fails the chain is left as it was, only longer */
 		vma_merge_object(obj);
 	}
 
@@ -489,6 +493,7 @@ struct page *copy_on_write(struct fault_data *fault)
 	struct page *page, *new_page;
 	struct vm_area *vma = fault->vma;
 	unsigned long file_offset = fault_to_file_offset(fault);
+	int err;
 
 	/* Get the first object, either original file or a shadow */
 	if (!(vmo_link = vma_next_link(&vma->vm_obj_list, &vma->vm_obj_list))) {
@@ -590,10 +595,14 @@ struct page *copy_on_write(struct fault_data *fault)
 	new_page->owner = shadow_link->obj;
 	new_page->offset = file_offset;
 	new_page->virtual = 0;
-	spin_unlock(&page->lock);
+	spin_unlock(&new_page->lock);
 
 	/* Add the page to owner's list of in-memory pages */
-	insert_page_olist(new_page, new_page->owner);
+	if ((err = insert_page_olist(new_page, new_page->owner)) < 0) {
+		page_init(new_page);
+		free_page((void *)page_to_phys(new_page));
+		return PTR_ERR(err);
+	}
 	new_page->owner->npages++;
 
 	mm0_test_global_vm_integrity();
@@ -679,10 +688,12 @@ struct page *page_write_fault(struct fault_data *fault)
 	struct vm_obj_link *vmo_link;
 	unsigned long file_offset;
 	struct page *page = 0;
+	int err;
 
 	/* Copy-on-write. All private vmas are always COW */
 	if (vma_flags & VMA_PRIVATE) {
-		BUG_ON(IS_ERR(page = copy_on_write(fault)));
+		if (IS_ERR(page = copy_on_write(fault)))
+			return page;
 
 	/*
 	 * This handles shared pages that are both anon and non-anon.
@@ -704,8 +715,7 @@ struct page *page_write_fault(struct fault_data *fault)
 			 * page, so its a bug.
 			 */
 			if (vma_flags & VMA_ANONYMOUS) {
-				BUG_ON(IS_ERR(page = copy_on_write(fault)));
-				return page;
+				return copy_on_write(fault);
 			} else {
 				printf("%s: Could not obtain faulty "
 				       "page from regular file.\n",
@@ -714,6 +724,15 @@ struct page *page_write_fault(struct fault_data *fault)
 			}
 		}
 
+		/*
+		 * The task may write the page behind our back once it is
+		 * mapped, so it is taken back from buffers it is lent to,
+		 * and isn't lent again, see file.c
+		 */
+		if ((err = file_page_unlend(page)) < 0)
+			return PTR_ERR(err);
+		page->flags |= VM_WRITE_MAPPED;
+
 		/*
 		 * Page and object are now dirty. Currently it's
 		 * only relevant for file-backed shared objects.
@@ -726,25 +745,265 @@ struct page *page_write_fault(struct fault_data *fault)
 	return page;
 }
 
+/*
+ * Returns the top object of an anonymous vma if the large page aligned
+ * block at pfn may be filled in at once, or 0. Called with vm_lock held.
+ */
+static struct vm_obj_link *anon_large_fault_link(struct vm_area *vma,
+						 unsigned long pfn)
+{
+	unsigned long file_offset = vma->file_offset + pfn - vma->pfn_start;
+	struct vm_obj_link *vmo_link, *next;
+
+	if (!(vma->flags & VMA_ANONYMOUS) || pfn < vma->pfn_start ||
+	    pfn + LARGE_PAGE_PTES > vma->pfn_end)
+		return 0;
+
+	if (!(vmo_link = vma_next_link(&vma->vm_obj_list, &vma->vm_obj_list)) ||
+	    !(vmo_link->obj->flags & VM_WRITE) ||
+	    !(next = vma_next_link(&vmo_link->list, &vma->vm_obj_list)) ||
+	    next->obj != &get_devzero()->vm_obj)
+		return 0;
+
+	for (int i = 0; i < LARGE_PAGE_PTES; i++)
+		if (find_page(vmo_link->obj, file_offset + i))
+			return 0;
+
+	return vmo_link;
+}
+
+/*
+ * On a first write to an anonymous area, pages in the whole large page
+ * aligned block around the fault as zeroed pages and maps them at once,
+ * so that the kernel may map them as a large page. Only done where the
+ * top object is writable with devzero right behind it, i.e. a shm file
+ * or the shadow of a private area, and none of the block is paged in.
+ *
+ * Called with vm_lock held, which is dropped while the block is zeroed
+ * and checked again after. Returns with it released and the block
+ * mapped, with the faulty page, or released with an error if the block
+ * could not be cached or mapped, or held and 0 if the fault needs the
+ * usual handling.
+ */
+static struct page *anon_large_fault(struct fault_data *fault,
+				     unsigned int map_flags)
+{
+	struct vm_area *vma = fault->vma;
+	unsigned long pfn = __pfn(fault->address) & ~(LARGE_PAGE_PTES - 1);
+	unsigned long file_offset = vma->file_offset + pfn - vma->pfn_start;
+	struct vm_obj_link *vmo_link;
+	struct page *page, *faulty = 0;
+	void *paddr;
+	int i, err;
+
+	if (!anon_large_fault_link(vma, pfn))
+		return 0;
+
+	spin_unlock(&vm_lock);
+
+	/* No aligned block left, go a page at a time */
+	if (!(paddr = alloc_page_aligned(LARGE_PAGE_PTES, LARGE_PAGE_PTES))) {
+		spin_lock(&vm_lock);
+		return 0;
+	}
+	memset(phys_to_virt(paddr), 0, LARGE_PAGE_SIZE);
+
+	/* Another task sharing the object may have paged some in meanwhile */
+	spin_lock(&vm_lock);
+	if (!(vmo_link = anon_large_fault_link(vma, pfn))) {
+		for (i = 0; i < LARGE_PAGE_PTES; i++)
+			free_page(paddr + __pfn_to_addr(i));
+		return 0;
+	}
+
+	for (i = 0; i < LARGE_PAGE_PTES; i++) {
+		page = phys_to_page(paddr + i * PAGE_SIZE);
+
+		spin_lock(&page->lock);
+		BUG_ON(!list_empty(&page->list));
+		page->refcnt = 0;
+		page->owner = vmo_link->obj;
+		page->offset = file_offset + i;
+		page->virtual = 0;
+		spin_unlock(&page->lock);
+
+		if ((err = insert_page_olist(page, page->owner)) < 0)
+			goto out_err;
+		page->owner->npages++;
+
+		if (__pfn_to_addr(pfn + i) == page_align(fault->address))
+			faulty = page;
+	}
+
+	/*
+	 * Mapped before the lock goes, so that no other fault can find
+	 * the pages if it fails. The block is within one pmd, so either
+	 * all of it is mapped or none.
+	 */
+	if ((err = l4_map(paddr, (void *)__pfn_to_addr(pfn), LARGE_PAGE_PTES,
+			  map_flags, fault->task->tid)) < 0)
+		goto out_err;
+
+	mm0_test_global_vm_integrity();
+	spin_unlock(&vm_lock);
+
+	return faulty;
+
+out_err:
+	/* Take back the pages added so far, and free the whole block */
+	while (i--) {
+		page = phys_to_page(paddr + i * PAGE_SIZE);
+		remove_page_olist(page, page->owner);
+		page->owner->npages--;
+	}
+	for (i = 0; i < LARGE_PAGE_PTES; i++) {
+		page_init(phys_to_page(paddr + i * PAGE_SIZE));
+		free_page(paddr + __pfn_to_addr(i));
+	}
+	spin_unlock(&vm_lock);
+
+	return PTR_ERR(err);
+}
+
+/* Pages around a read fault that are mapped along with it, if resident */
+#define FAULT_AROUND_PAGES		16
+
+struct fault_around {
+	unsigned long pfn;		/* First virtual pfn of the block */
+	int npages;
+	unsigned long phys[FAULT_AROUND_PAGES];	/* Zero if not to map */
+};
+
+/*
+ * Returns the resident page at file_offset in the vma, as a read fault
+ * would find it, or 0. Pages of writable objects are left alone, as the
+ * task may have them mapped writable already.
+ */
+static struct page *fault_around_page(struct vm_area *vma,
+				      unsigned long file_offset)
+{
+	struct vm_obj_link *vmo_link;
+	struct page *page;
+
+	for (vmo_link = vma_next_link(&vma->vm_obj_list, &vma->vm_obj_list);
+	     vmo_link; vmo_link = vma_next_link(&vmo_link->list,
+						&vma->vm_obj_list)) {
+		if (!(page = find_page(vmo_link->obj, file_offset)))
+			continue;
+		if (vmo_link->obj->flags & VM_WRITE)
+			return 0;
+		return page;
+	}
+
+	return 0;
+}
+
+/*
+ * Finds the pages of the aligned block around a read fault that can
+ * be mapped with the faulty page, without paging anything in. Pages
+ * read ahead by the file pager are usually there. Shared writable vmas
+ * are left out, their pages may be mapped writable. Called with
+ * vm_lock held.
+ */
+static void fault_around_find(struct fault_data *fault, struct page *page,
+			      struct fault_around *fa)
+{
+	struct vm_area *vma = fault->vma;
+	unsigned long fault_pfn = __pfn(fault->address);
+	unsigned long start = fault_pfn & ~(FAULT_AROUND_PAGES - 1);
+	unsigned long end = start + FAULT_AROUND_PAGES;
+	unsigned long pfn;
+	struct page *p;
+	int around;
+
+	if (start < vma->pfn_start)
+		start = vma->pfn_start;
+	if (end > vma->pfn_end)
+		end = vma->pfn_end;
+
+	around = !((vma->flags & VMA_SHARED) && (vma->flags & VM_WRITE));
+
+	fa->pfn = start;
+	fa->npages = end - start;
+	for (int i = 0; i < fa->npages; i++) {
+		pfn = start + i;
+		fa->phys[i] = 0;
+		if (pfn == fault_pfn)
+			fa->phys[i] = page_to_phys(page);
+		else if (around && (p = fault_around_page(vma, vma->file_offset +
+							  pfn - vma->pfn_start)))
+			fa->phys[i] = page_to_phys(p);
+	}
+}
+
+/* Maps the pages found, a run of contiguous ones with each call */
+static void fault_around_map(struct fault_around *fa, unsigned int map_flags,
+			     l4id_t tid)
+{
+	int n;
+
+	for (int i = 0; i < fa->npages; i += n) {
+		n = 1;
+		if (!fa->phys[i])
+			continue;
+		while (i + n < fa->npages &&
+		       fa->phys[i + n] == fa->phys[i] + __pfn_to_addr(n))
+			n++;
+		l4_map((void *)fa->phys[i], (void *)__pfn_to_addr(fa->pfn + i),
+		       n, map_flags, tid);
+	}
+}
+
+/* Returns whether the vma may map file pages on loan, see file.c */
+static int vma_has_loan(struct vm_area *vma)
+{
+	struct vm_obj_link *vmo_link;
+
+	list_foreach_struct(vmo_link, &vma->vm_obj_list, list)
+		if (vmo_link->obj->loan)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * The page is found under vm_lock, and mapped after it is released,
+ * so that faults of other tasks go on while the kernel maps it. File
+ * pagers release it too while the vfs reads pages in. The task's own
+ * vma list lock keeps its vmas, and the objects they link, in place
+ * meanwhile.
+ *
+ * Vmas with pages on loan are mapped before the lock goes, or a write
+ * to the file could take a page back before it is mapped, and the
+ * task would then map the written page.
+ */
 struct page *__do_page_fault(struct fault_data *fault)
 {
 	unsigned int reason = fault->reason;
 	unsigned int pte_flags = fault->pte_flags;
 	unsigned int map_flags = 0;
+	struct fault_around fa;
 	struct page *page = 0;
+	int around = 0, locked;
+
+	spin_lock(&vm_lock);
 
 	if ((reason & VM_READ) && (pte_flags & VM_NONE)) {
 		page = page_read_fault(fault);
 		map_flags = MAP_USR_RO;
+		around = 1;
 
 	} else if ((reason & VM_WRITE) && (pte_flags & VM_NONE)) {
-		page = page_read_fault(fault);
-		page = page_write_fault(fault);
 		map_flags = MAP_USR_RW;
+		if ((page = anon_large_fault(fault, map_flags)))
+			return page;
+		if (!IS_ERR(page = page_read_fault(fault)))
+			page = page_write_fault(fault);
 
 	} else if ((reason & VM_EXEC) && (pte_flags & VM_NONE)) {
 		page = page_read_fault(fault);
 		map_flags = MAP_USR_RX;
+		around = 1;
 
 	} else if ((reason & VM_EXEC) && (pte_flags & VM_READ)) {
 		/* Retrieve already paged in file */
@@ -767,13 +1026,27 @@ struct page *__do_page_fault(struct fault_data *fault)
 	}
 
 	BUG_ON(!page);
-
-	/* Map the new page to faulty task */
-	l4_map((void *)page_to_phys(page),
-	       (void *)page_align(fault->address), 1,
-	       map_flags, fault->task->tid);
+	if (IS_ERR(page)) {
+		spin_unlock(&vm_lock);
+		return page;
+	}
+	if (around)
+		fault_around_find(fault, page, &fa);
+	if (!(locked = vma_has_loan(fault->vma)))
+		spin_unlock(&vm_lock);
+
+	/* Map the new page to faulty task, with its neighbours on a read */
+	if (around)
+		fault_around_map(&fa, map_flags, fault->task->tid);
+	else
+		l4_map((void *)page_to_phys(page),
+		       (void *)page_align(fault->address), 1,
+		       map_flags, fault->task->tid);
 	// vm_object_print(page->owner);
 
+	if (locked)
+		spin_unlock(&vm_lock);
+
 	return page;
 }
 
@@ -781,14 +1054,16 @@ struct page *__do_page_fault(struct fault_data *fault)
  * Sets all r/w shadow objects as read-only for the process
  * so that as expected after a fork() operation, writes to those
  * objects cause copy-on-write events.
+ *
+ * Only the objects are changed here. Their pages are made read-only
+ * by the kernel as it copies the space with TC_WRITE_PROTECT, in a
+ * single pass over the page tables rather than a map call per page.
  */
 int vm_freeze_shadows(struct tcb *task)
 {
-	unsigned long virtual;
 	struct vm_area *vma;
 	struct vm_obj_link *vmo_link;
 	struct vm_object *vmo;
-	struct page *p;
 
 	list_foreach_struct(vma, &task->vm_area_head->list, list) {
 
@@ -816,21 +1091,6 @@ int vm_freeze_shadows(struct tcb *task)
 		/* Make the object read only */
 		vmo->flags &= ~VM_WRITE;
 		vmo->flags |= VM_READ;
-
-		/*
-		 * Make all pages on it read-only
-		 * in the page tables.
-		 */
-		list_foreach_struct(p, &vmo->page_cache, list) {
-
-			/* Find virtual address of each page */
-			virtual = vma_page_to_virtual(vma, p);
-
-			/* Map the page as read-only */
-			l4_map((void *)page_to_phys(p),
-			       (void *)virtual, 1,
-			       MAP_USR_RO, task->tid);
-		}
 	}
 
 	return 0;
@@ -910,7 +1170,7 @@ struct page *page_fault_handler(struct tcb *sender, fault_kdata_t *fkdata)
 
 	/* Get vma info */
 	if (!(fault.vma = find_vma(fault.address,
-				   &fault.task->vm_area_head->list)))
+				   fault.task->vm_area_head)))
 		printf("Hmm. No vma for faulty region. "
 		       "Bad things will happen.\n");
 
@@ -982,7 +1242,7 @@ struct page *task_prefault_smart(struct tcb *task, unsigned long address,
 
 	/* Find the vma */
 	if (!(fault.vma = find_vma(fault.address,
-				   &fault.task->vm_area_head->list))) {
+				   fault.task->vm_area_head))) {
 		dprintf("%s: Invalid: No vma for given address. %d\n",
 			__FUNCTION__, -EINVAL);
 		return PTR_ERR(-EINVAL);
@@ -1088,7 +1348,7 @@ struct page *task_prefault_page(struct tcb *task, unsigned long address,
 
 	/* Find the vma */
 	if (!(fault.vma = find_vma(fault.address,
-				   &fault.task->vm_area_head->list))) {
+				   fault.task->vm_area_head))) {
 		dprintf("%s: Invalid: No vma for given address. %d\n",
 			__FUNCTION__, -EINVAL);
 		return PTR_ERR(-EINVAL);
@@ -29,6 +29,7 @@
 #include <alloca.h>
 #include <path.h>
 #include <syscalls.h>
+#include <mmap.h>
 
 #include INC_GLUE(message.h)
 
@@ -61,11 +62,17 @@ int page_copy(struct page *dst, struct page *src,
 int vfs_read(struct vnode *v, unsigned long file_offset,
 	     unsigned long npages, void *pagebuf)
 {
+	int ret;
+
 	/* Ensure vnode is not a directory */
 	if (vfs_isdir(v))
 		return -EISDIR;
 
-	return v->fops.read(v, file_offset, npages, pagebuf);
+	spin_lock(&vfs_lock);
+	ret = v->fops.read(v, file_offset, npages, pagebuf);
+	spin_unlock(&vfs_lock);
+
+	return ret;
 }
 
 /* Directories only for now */
@@ -125,8 +132,10 @@ int sys_mkdir(struct tcb *task, const char *pathname, unsigned int mode)
 	mode |= S_IFDIR;
 
 	/* Create the directory or fail */
+	spin_lock(&vfs_lock);
 	if (IS_ERR(v = vfs_vnode_create(task, pdata, mode)))
 		ret = (int)v;
+	spin_unlock(&vfs_lock);
 
 	/* Destroy extracted path data */
 	pathdata_destroy(pdata);
@@ -146,6 +155,7 @@ int sys_chdir(struct tcb *task, const char *pathname)
 		return (int)pdata;
 
 	/* Get the vnode */
+	spin_lock(&vfs_lock);
 	if (IS_ERR(v = vfs_vnode_lookup_bypath(pdata))) {
 		ret = (int)v;
 		goto out;
@@ -161,6 +171,7 @@ int sys_chdir(struct tcb *task, const char *pathname)
 	task->fs_data->curdir = v;
 
 out:
+	spin_unlock(&vfs_lock);
 	/* Destroy extracted path data */
 	pathdata_destroy(pdata);
 	return ret;
@@ -188,7 +199,9 @@ int sys_fstat(struct tcb *task, int fd, void *statbuf)
 		return -EBADF;
 
 	/* Fill in the c0-style stat structure */
+	spin_lock(&vfs_lock);
 	fill_kstat(task->files->fd[fd].vmfile->vnode, statbuf);
+	spin_unlock(&vfs_lock);
 
 	return 0;
 }
@@ -211,6 +224,7 @@ int sys_stat(struct tcb *task, const char *pathname, void *statbuf)
 		return (int)pdata;
 
 	/* Get the vnode */
+	spin_lock(&vfs_lock);
 	if (IS_ERR(v = vfs_vnode_lookup_bypath(pdata))) {
 		ret = (int)v;
 		goto out;
@@ -220,6 +234,7 @@ int sys_stat(struct tcb *task, const char *pathname, void *statbuf)
 	fill_kstat(v, statbuf);
 
 out:
+	spin_unlock(&vfs_lock);
 	/* Destroy extracted path data */
 	pathdata_destroy(pdata);
 	return ret;
@@ -227,56 +242,87 @@ out:
 
 
 /*
- * Inserts the page to vmfile's list in order of page frame offset.
- * We use an ordered list instead of a better data structure for now.
+ * Inserts the page to vm object's page tree by its offset, and
+ * to its page list in order of offset. The tree gives us the next
+ * page in order, so the list is kept ordered without a search.
  */
 int insert_page_olist(struct page *this, struct vm_object *vmo)
 {
-	struct page *before, *after;
+	unsigned long next = this->offset + 1;
+	struct page *after;
+	int err;
 
-	/* Add if list is empty */
-	if (list_empty(&vmo->page_cache)) {
-		list_insert_tail(&this->list, &vmo->page_cache);
-		return 0;
+	if ((err = radix_tree_insert(&vmo->page_tree,
+				     this->offset, this)) < 0) {
+		BUG_ON(err == -EEXIST);
+		return err;
 	}
 
-	/* Else find the right interval */
-	list_foreach_struct(before, &vmo->page_cache, list) {
-		after = link_to_struct(before->list.next, struct page, list);
-
-		/* If there's only one in list */
-		if (before->list.next == &vmo->page_cache) {
-			/* Add as next if greater */
-			if (this->offset > before->offset)
-				list_insert(&this->list, &before->list);
-			/* Add  as previous if smaller */
-			else if (this->offset < before->offset)
-				list_insert_tail(&this->list, &before->list);
-			else
-				BUG();
-			return 0;
-		}
+	/* Add before the next page in order, or to the end */
+	if (next > this->offset &&
+	    (after = radix_tree_next(&vmo->page_tree, &next)))
+		list_insert_tail(&this->list, &after->list);
+	else
+		list_insert_tail(&this->list, &vmo->page_cache);
 
-		/* If this page is in-between two other, insert it there */
-		if (before->offset < this->offset &&
-		    after->offset > this->offset) {
-			list_insert(&this->list, &before->list);
-			return 0;
-		}
-		BUG_ON(this->offset == before->offset);
-		BUG_ON(this->offset == after->offset);
+	return 0;
+}
+
+/* Removes the page from vm object's page tree and list */
+void remove_page_olist(struct page *this, struct vm_object *vmo)
+{
+	BUG_ON(radix_tree_delete(&vmo->page_tree, this->offset) != this);
+	list_remove_init(&this->list);
+}
+
+/*
+ * Moves the page to another vm object's cache, at offset. It goes into
+ * the new tree before it leaves the old one, as only that may fail, so
+ * that it stays where it was if it does.
+ */
+int move_page_olist(struct page *this, struct vm_object *to,
+		    unsigned long offset)
+{
+	struct vm_object *from = this->owner;
+	unsigned long old_offset = this->offset;
+	struct link *next = this->list.next;
+	int err;
+
+	list_remove_init(&this->list);
+	this->offset = offset;
+	if ((err = insert_page_olist(this, to)) < 0) {
+		this->offset = old_offset;
+		list_insert_tail(&this->list, next);
+		return err;
 	}
-	BUG();
+	BUG_ON(radix_tree_delete(&from->page_tree, old_offset) != this);
+
+	spin_lock(&this->lock);
+	this->owner = to;
+	spin_unlock(&this->lock);
+
+	BUG_ON(--from->npages < 0);
+	to->npages++;
+
+	return 0;
 }
 
 /*
  * This reads-in a range of pages from a file and populates the page cache
- * just like a page fault, but its not in the page fault path.
+ * just like a page fault, but its not in the page fault path. Pagers that
+ * can read ahead bring in the range with as few vfs calls as they can.
  */
 int read_file_pages(struct vm_file *vmfile, unsigned long pfn_start,
 		    unsigned long pfn_end)
 {
+	struct vm_pager *pager = vmfile->vm_obj.pager;
 	struct page *page;
+	int err;
+
+	if (pager->ops.readahead && pfn_start < pfn_end &&
+	    (err = pager->ops.readahead(&vmfile->vm_obj,
+					pfn_start, pfn_end)) < 0)
+		return err;
 
 	for (int f_offset = pfn_start; f_offset < pfn_end; f_offset++) {
 		page = vmfile->vm_obj.pager->ops.page_in(&vmfile->vm_obj,
@@ -310,8 +356,9 @@ int vfs_write(struct vnode *v, unsigned long file_offset,
 	//printf("%s/%s: Writing to vnode %lu, at pgoff 0x%x, %d pages, buf at 0x%x\n",
 	//	__TASKNAME__, __FUNCTION__, vnum, f_offset, npages, pagebuf);
 
+	spin_lock(&vfs_lock);
 	if ((ret = v->fops.write(v, file_offset, npages, pagebuf)) < 0)
-		return ret;
+		goto out;
 
 	/*
 	 * If the file is extended, write silently extends it.
@@ -324,24 +371,51 @@ int vfs_write(struct vnode *v, unsigned long file_offset,
 		v->sb->ops->write_vnode(v->sb, v);
 	}
 
+out:
+	spin_unlock(&vfs_lock);
 	return ret;
 }
 
-/* Writes updated file stats back to vfs. (e.g. new file size) */
+/* Returns the vnode's block at file_offset, for block_pager files */
+void *vfs_block(struct vnode *v, unsigned long file_offset)
+{
+	void *block;
+
+	spin_lock(&vfs_lock);
+	block = v->fops.block(v, file_offset);
+	spin_unlock(&vfs_lock);
+
+	return block;
+}
+
+/*
+ * Writes updated file stats back to vfs. (e.g. new file size)
+ * Called with vm_lock held, which is dropped while the vfs writes.
+ */
 int vfs_update_file_stats(struct vm_file *f)
 {
 	struct vnode *v = f->vnode;
+	unsigned long length = f->length;
 
-	v->size = f->length;
+	spin_unlock(&vm_lock);
+	spin_lock(&vfs_lock);
+	v->size = length;
 	v->sb->ops->write_vnode(v->sb, v);
+	spin_unlock(&vfs_lock);
+	spin_lock(&vm_lock);
 
 	return 0;
 }
 
-/* Writes pages in cache back to their file */
+/*
+ * Writes pages in cache back to their file. Called with the object's
+ * io lock held, pages stay in the cache while the pager drops vm_lock
+ * to write each of them.
+ */
 int write_file_pages(struct vm_file *f, unsigned long pfn_start,
 		     unsigned long pfn_end)
 {
+	struct page *p;
 	int err;
 
 	/* We have only thought of vfs files for this */
@@ -352,12 +426,18 @@ int write_file_pages(struct vm_file *f, unsigned long pfn_start,
 		return 0;
 
 	BUG_ON(pfn_end != __pfn(page_align_up(f->length)));
-	for (int f_offset = pfn_start; f_offset < pfn_end; f_offset++) {
-		err = f->vm_obj.pager->ops.page_out(&f->vm_obj, f_offset);
+
+	/* Only resident pages can be dirty, go through them in order */
+	list_foreach_struct(p, &f->vm_obj.page_cache, list) {
+		if (p->offset < pfn_start)
+			continue;
+		if (p->offset >= pfn_end)
+			break;
+		err = f->vm_obj.pager->ops.page_out(&f->vm_obj, p->offset);
 		if (err < 0) {
-			printf("%s: %s:Could not write page %d "
+			printf("%s: %s:Could not write page %lu "
 			       "to file with vnum: 0x%lu\n", __TASKNAME__,
-			       __FUNCTION__, f_offset, f->vnode->vnum);
+			       __FUNCTION__, p->offset, f->vnode->vnum);
 			return err;
 		}
 	}
@@ -365,18 +445,26 @@ int write_file_pages(struct vm_file *f, unsigned long pfn_start,
 	return 0;
 }
 
-/* Flush all dirty file pages and update file stats */
+/*
+ * Flush all dirty file pages and update file stats. Flushes of the
+ * file are done one at a time, so that none returns before pages that
+ * another one has taken to write are written.
+ */
 int flush_file_pages(struct vm_file *f)
 {
 	int err;
 
-	if ((err = write_file_pages(f, 0, __pfn(page_align_up(f->length)))) < 0)
-		return err;
+	vm_object_io_lock(&f->vm_obj);
 
-	if ((err = vfs_update_file_stats(f)) < 0)
-		return err;
+	if ((err = write_file_pages(f, 0,
+				    __pfn(page_align_up(f->length)))) < 0)
+		goto out;
 
-	return 0;
+	err = vfs_update_file_stats(f);
+
+out:
+	vm_object_io_unlock(&f->vm_obj);
+	return err;
 }
 
 /* Given a task and fd, syncs all IO on it */
@@ -417,10 +505,6 @@ void vm_file_put(struct vm_file *file)
 		if (!file->vm_obj.nlinks)
 			/* No links or openers, delete the file */
 			vm_file_delete(file);
-
-	/* FIXME:
-	 * Shall we delete the cached vnode here as well???
-	 */
 }
 
 /*
@@ -472,13 +556,14 @@ int sys_fsync(struct tcb *task, int fd)
 	return fsync_common(task, fd);
 }
 
-/* FIXME: Add error handling to this */
-/* Extends a file's size by adding it new pages */
-int new_file_pages(struct vm_file *f, unsigned long start, unsigned long end)
+/* Adds a run of new pages, none of which are in the cache */
+static int new_file_page_run(struct vm_file *f, unsigned long start,
+			     unsigned long end)
 {
 	unsigned long npages = end - start;
 	struct page *page;
 	void *paddr;
+	int err;
 
 	/* Allocate the memory for new pages */
 	if (!(paddr = alloc_page(npages)))
@@ -495,7 +580,18 @@ int new_file_pages(struct vm_file *f, unsigned long start, unsigned long end)
 
 		/* Add the page to file's vm object */
 		BUG_ON(!list_empty(&page->list));
-		insert_page_olist(page, &f->vm_obj);
+		if ((err = insert_page_olist(page, &f->vm_obj)) < 0) {
+			/* Take back those added so far, and free them all */
+			for (unsigned long j = 0; j < i; j++)
+				remove_page_olist(phys_to_page(paddr +
+							       PAGE_SIZE * j),
+						  &f->vm_obj);
+			for (unsigned long j = 0; j < npages; j++) {
+				page_init(phys_to_page(paddr + PAGE_SIZE * j));
+				free_page(paddr + PAGE_SIZE * j);
+			}
+			return err;
+		}
 	}
 
 	/* Update vm object */
@@ -504,6 +600,34 @@ int new_file_pages(struct vm_file *f, unsigned long start, unsigned long end)
 	return 0;
 }
 
+/* FIXME: Add error handling to this */
+/*
+ * Extends a file's size by adding it new pages. Another write may have
+ * added some of them while vm_lock was dropped, those are left as they
+ * are.
+ */
+int new_file_pages(struct vm_file *f, unsigned long start, unsigned long end)
+{
+	unsigned long n;
+	int err;
+
+	/* The pager may have somewhere to put them already */
+	if (f->vm_obj.pager->ops.new_pages)
+		return f->vm_obj.pager->ops.new_pages(&f->vm_obj, start, end);
+
+	for (; start < end; start += n) {
+		n = 1;
+		if (find_page(&f->vm_obj, start))
+			continue;
+		while (start + n < end && !find_page(&f->vm_obj, start + n))
+			n++;
+		if ((err = new_file_page_run(f, start, start + n)) < 0)
+			return err;
+	}
+
+	return 0;
+}
+
 #define page_offset(x)	((unsigned long)(x) & PAGE_MASK)
 
 
@@ -523,21 +647,26 @@ int copy_cache_pages(struct vm_file *vmfile, struct tcb *task, void *buf,
 		     unsigned long pfn_start, unsigned long pfn_end,
 		     unsigned long cursor_offset, int count, int read)
 {
-	struct page *file_page;
+	struct page *file_page, *upage;
 	unsigned long task_offset; /* Current copy offset on the task buffer */
 	unsigned long file_offset; /* Current copy offset on the file */
 	int copysize, left;
-	int empty;
+	int empty, err;
 
 	task_offset = (unsigned long)buf;
 	file_offset = cursor_offset;
 	left = count;
 
-	/* Find the head of consecutive pages */
-	list_foreach_struct(file_page, &vmfile->vm_obj.page_cache, list) {
-		if (file_page->offset < pfn_start)
-			continue;
-		else if (file_page->offset == pfn_end || left == 0)
+	if (!left)
+		return 0;
+
+	/* Look up the head of consecutive pages */
+	BUG_ON(!(file_page = find_page(&vmfile->vm_obj, pfn_start)));
+
+	for (; &file_page->list != &vmfile->vm_obj.page_cache;
+	     file_page = link_to_struct(file_page->list.next,
+					struct page, list)) {
+		if (file_page->offset == pfn_end || left == 0)
 			break;
 
 		empty = PAGE_SIZE - page_offset(file_offset);
@@ -554,30 +683,344 @@ int copy_cache_pages(struct vm_file *vmfile, struct tcb *task, void *buf,
 					  page_offset(task_offset),
 					  page_offset(file_offset),
 					  copysize);
-			else
-				page_copy(file_page,
-					  task_prefault_smart(task, task_offset,
-							      VM_READ),
+			else {
+				/*
+				 * The buffer is faulted in first, which may
+				 * drop vm_lock, so that the page isn't lent
+				 * again between being taken back and written.
+				 */
+				upage = task_prefault_smart(task, task_offset,
+							    VM_READ);
+				if ((err = file_page_unlend(file_page)) < 0)
+					return err;
+				page_copy(file_page, upage,
 					  page_offset(file_offset),
 					  page_offset(task_offset),
 					  copysize);
+			}
 
 			empty -= copysize;
 			left -= copysize;
 			task_offset += copysize;
 			file_offset += copysize;
 		}
+
+		/* Written pages are flushed to the file on sync or close */
+		if (!read) {
+			file_page->flags |= VM_DIRTY;
+			vmfile->vm_obj.flags |= VM_DIRTY;
+		}
 	}
 	BUG_ON(left != 0);
 
 	return count - left;
 }
 
+/* Transfers of this many whole pages or more map the cache, not copy it */
+#define FILE_ZEROCOPY_MIN_PAGES		8
+
+/*
+ * Gives a loan shadow a copy of the file page as it is now, for the
+ * borrower to fault in instead of the page.
+ */
+static int loan_copy_page(struct vm_object *shadow, struct page *page)
+{
+	struct page *copy = copy_to_new_page(page);
+	int err;
+
+	spin_lock(&copy->lock);
+	BUG_ON(!list_empty(&copy->list));
+	copy->refcnt = 0;
+	copy->owner = shadow;
+	copy->offset = page->offset;
+	copy->virtual = 0;
+	spin_unlock(&copy->lock);
+
+	if ((err = insert_page_olist(copy, shadow)) < 0) {
+		page_init(copy);
+		free_page((void *)page_to_phys(copy));
+		return err;
+	}
+	shadow->npages++;
+
+	return 0;
+}
+
+/*
+ * Takes a cached file page back from the buffers it is lent to, before
+ * it is written. Each loan keeps a copy of the page as it was, and the
+ * borrower is unmapped from the page, to fault in the copy on its next
+ * access. Called with vm_lock held, which the caller keeps until the
+ * page is written.
+ */
+int file_page_unlend(struct page *page)
+{
+	struct vm_object *shadow;
+	struct vm_loan *loan;
+	struct tcb *task;
+	int err;
+
+	if (!(page->flags & VM_LENT))
+		return 0;
+
+	list_foreach_struct(shadow, &page->owner->shdw_list, shref) {
+		if (!(loan = shadow->loan) || page->offset < loan->pfn_start ||
+		    page->offset >= loan->pfn_end ||
+		    find_page(shadow, page->offset))
+			continue;
+
+		if ((err = loan_copy_page(shadow, page)) < 0)
+			return err;
+
+		if ((task = find_task_by_vmas(loan->vma_head)))
+			l4_unmap((void *)(loan->vaddr +
+					  __pfn_to_addr(page->offset -
+							loan->pfn_start)),
+				 1, task->tid);
+	}
+	page->flags &= ~VM_LENT;
+
+	return 0;
+}
+
+/*
+ * Ends the loans of a task that is about to fork. The child would map
+ * the pages as well, and a loan can only take them back from one task,
+ * so each loan is given copies of the pages it has left instead, and
+ * the task is unmapped from them. Called with vm_lock held.
+ */
+int file_settle_loans(struct tcb *task)
+{
+	struct vm_obj_link *vmo_link;
+	struct vm_object *shadow;
+	struct vm_area *vma;
+	struct vm_loan *loan;
+	struct page *page;
+	int err;
+
+	list_foreach_struct(vma, &task->vm_area_head->list, list) {
+		list_foreach_struct(vmo_link, &vma->vm_obj_list, list) {
+			shadow = vmo_link->obj;
+			if (!(loan = shadow->loan))
+				continue;
+
+			for (unsigned long pfn = loan->pfn_start;
+			     pfn < loan->pfn_end; pfn++) {
+				if (find_page(shadow, pfn) ||
+				    !(page = find_page(shadow->orig_obj, pfn)))
+					continue;
+				if ((err = loan_copy_page(shadow, page)) < 0)
+					return err;
+			}
+
+			l4_unmap((void *)loan->vaddr,
+				 loan->pfn_end - loan->pfn_start, task->tid);
+			shadow->loan = 0;
+			kfree(loan);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the vma of a buffer, if a transfer of count bytes at cursor
+ * between it and the file may map the page cache instead of copying
+ * it, or 0. File offset and buffer must be page aligned, and a single
+ * private vma must cover the buffer, as it is mapped over.
+ */
+static struct vm_area *file_zerocopy_vma(struct tcb *task, struct vm_file *f,
+					 unsigned long cursor, void *buf,
+					 int count)
+{
+	struct vm_area *vma;
+
+	if (f->type != VM_FILE_VFS || !is_page_aligned(cursor) ||
+	    !is_page_aligned(buf) || __pfn(count) < FILE_ZEROCOPY_MIN_PAGES)
+		return 0;
+
+	if (!mmap_address_validate(task, (unsigned long)buf, VMA_PRIVATE))
+		return 0;
+
+	if (!(vma = find_vma((unsigned long)buf, task->vm_area_head)) ||
+	    !(vma->flags & VMA_PRIVATE) || !(vma->flags & VM_WRITE) ||
+	    (vma->flags & VMA_GROWSDOWN) ||
+	    vma->pfn_end < __pfn(buf) + __pfn(count))
+		return 0;
+
+	return vma;
+}
+
+/*
+ * Lends npages of the file from pfn on to the buffer. The buffer is
+ * mapped over as a private mapping of the file, with the protection of
+ * its vma, and a loan shadow in front of the file. The pages are mapped
+ * in read-only, and must all be in the cache. Writes of the task to the
+ * buffer copy the pages as with any private mapping, and writes to the
+ * file take them back, so the buffer keeps the data as it was read.
+ * Pages that shared mappings may write are copied to the shadow.
+ */
+static int file_lend_pages(struct tcb *task, struct vm_file *f,
+			   struct vm_area *vma, void *buf,
+			   unsigned long pfn, int npages)
+{
+	unsigned int flags = VMA_PRIVATE | VMA_FIXED |
+			     (vma->flags & VM_PROT_MASK);
+	struct vm_obj_link *shadow_link;
+	struct vm_object *shadow;
+	struct page *p, *next;
+	struct vm_loan *loan;
+	void *mapped;
+	int n, err;
+
+	if (!(loan = kzalloc(sizeof(*loan))))
+		return -ENOMEM;
+	if (!(shadow_link = vma_create_shadow())) {
+		kfree(loan);
+		return -ENOMEM;
+	}
+	shadow = shadow_link->obj;
+
+	/* Replaces the buffer's vma over the range */
+	if (IS_ERR(mapped = do_mmap(f, __pfn_to_addr(pfn), task,
+				    (unsigned long)buf, flags, npages))) {
+		vm_unlink_object(shadow_link);
+		kfree(shadow_link);
+		kfree(shadow);
+		kfree(loan);
+		return (int)mapped;
+	}
+	BUG_ON(!(vma = find_vma((unsigned long)buf, task->vm_area_head)));
+
+	/* Add the loan in front of the file, as copy_on_write() would */
+	loan->vma_head = task->vm_area_head;
+	loan->vaddr = (unsigned long)buf;
+	loan->pfn_start = pfn;
+	loan->pfn_end = pfn + npages;
+	shadow->loan = loan;
+	shadow->orig_obj = &f->vm_obj;
+	shadow->flags = VM_OBJ_SHADOW | VM_READ;
+	shadow->pager = &swap_pager;
+	f->vm_obj.shadows++;
+	list_insert(&shadow_link->list, &vma->vm_obj_list);
+	list_insert(&shadow->shref, &f->vm_obj.shdw_list);
+	global_add_vm_object(shadow);
+
+	for (int i = 0; i < npages; i++) {
+		BUG_ON(!(p = find_page(&f->vm_obj, pfn + i)));
+		if (!(p->flags & VM_WRITE_MAPPED))
+			p->flags |= VM_LENT;
+		else if ((err = loan_copy_page(shadow, p)) < 0)
+			return err;
+	}
+
+	/* Physically contiguous pages are mapped with one call */
+	for (int i = 0; i < npages; i += n) {
+		if (!(p = find_page(shadow, pfn + i)))
+			p = find_page(&f->vm_obj, pfn + i);
+		for (n = 1; i + n < npages; n++) {
+			if (!(next = find_page(shadow, pfn + i + n)))
+				next = find_page(&f->vm_obj, pfn + i + n);
+			if (page_to_phys(next) !=
+			    page_to_phys(p) + __pfn_to_addr(n))
+				break;
+		}
+		l4_map((void *)page_to_phys(p), buf + __pfn_to_addr(i), n,
+		       MAP_USR_RO, task->tid);
+	}
+
+	mm0_test_global_vm_integrity();
+
+	return 0;
+}
+
+/*
+ * Returns the page of a buffer at vaddr if it may be given to the page
+ * cache as it is, or 0. Only pages of a writable shadow that no other
+ * vma or object refers to belong to the buffer alone.
+ */
+static struct page *file_zerocopy_page(struct vm_area *vma,
+				       unsigned long vaddr)
+{
+	struct vm_obj_link *vmo_link;
+	struct vm_object *top;
+
+	BUG_ON(!(vmo_link = vma_next_link(&vma->vm_obj_list,
+					  &vma->vm_obj_list)));
+	top = vmo_link->obj;
+
+	if (!(top->flags & VM_OBJ_SHADOW) || !(top->flags & VM_WRITE) ||
+	    top->nlinks != 1 || top->shadows)
+		return 0;
+
+	return find_page(top, vma->file_offset + __pfn(vaddr) -
+			 vma->pfn_start);
+}
+
+/*
+ * Writes npages whole pages of the buffer to the file from pfn on.
+ * Buffer pages that are the task's own take the place of file pages
+ * not in the cache, the rest are copied. The buffer is then lent the
+ * pages as on a read. Returns bytes written.
+ */
+static int file_write_zerocopy(struct tcb *task, struct vm_file *f,
+			       struct vm_area *vma, void *buf,
+			       unsigned long pfn, int npages)
+{
+	unsigned long file_pages;
+	unsigned long vaddr;
+	struct page *fpage, *upage;
+	int err;
+
+	for (int i = 0; i < npages; i++) {
+		vaddr = (unsigned long)buf + __pfn_to_addr(i);
+
+		if (!(fpage = find_page(&f->vm_obj, pfn + i)) &&
+		    (upage = file_zerocopy_page(vma, vaddr))) {
+			if ((err = move_page_olist(upage, &f->vm_obj,
+						   pfn + i)) < 0)
+				return err;
+			upage->flags |= VM_DIRTY;
+			f->vm_obj.flags |= VM_DIRTY;
+			continue;
+		}
+
+		/* Others may write to the file while vm_lock is dropped */
+		file_pages = __pfn(page_align_up(f->length));
+		if (!fpage) {
+			if (pfn + i < file_pages)
+				err = read_file_pages(f, pfn + i, pfn + i + 1);
+			else
+				err = new_file_pages(f, pfn + i, pfn + i + 1);
+			if (err < 0)
+				return err;
+			BUG_ON(!(fpage = find_page(&f->vm_obj, pfn + i)));
+		}
+
+		upage = task_prefault_smart(task, vaddr, VM_READ);
+		if ((err = file_page_unlend(fpage)) < 0)
+			return err;
+		page_copy(fpage, upage, 0, 0, PAGE_SIZE);
+		fpage->flags |= VM_DIRTY;
+		f->vm_obj.flags |= VM_DIRTY;
+	}
+
+	if (__pfn_to_addr(pfn + npages) > f->length)
+		f->length = __pfn_to_addr(pfn + npages);
+
+	if ((err = file_lend_pages(task, f, vma, buf, pfn, npages)) < 0)
+		return err;
+
+	return __pfn_to_addr(npages);
+}
+
 int sys_read(struct tcb *task, int fd, void *buf, int count)
 {
 	unsigned long pfn_start, pfn_end;
 	unsigned long cursor;
 	struct vm_file *vmfile;
+	struct vm_area *vma;
+	int lent = 0;
 	int ret = 0;
 
 	/* Check that fd is valid */
@@ -621,10 +1064,21 @@ int sys_read(struct tcb *task, int fd, void *buf, int count)
 	if ((ret = read_file_pages(vmfile, pfn_start, pfn_end)) < 0)
 		return ret;
 
-	/* Read it into the user buffer from the cache */
-	if ((count = copy_cache_pages(vmfile, task, buf, pfn_start, pfn_end,
-				      cursor, count, 1)) < 0)
+	/* Large page aligned reads are lent whole pages of the cache */
+	if ((vma = file_zerocopy_vma(task, vmfile, cursor, buf, count))) {
+		if ((ret = file_lend_pages(task, vmfile, vma, buf, pfn_start,
+					   __pfn(count))) < 0)
+			return ret;
+		lent = page_align(count);
+		pfn_start += __pfn(count);
+	}
+
+	/* Read the rest into the user buffer from the cache */
+	if ((count = copy_cache_pages(vmfile, task, buf + lent, pfn_start,
+				      pfn_end, cursor + lent,
+				      count - lent, 1)) < 0)
 		return count;
+	count += lent;
 
 	/* Update cursor on success */
 	task->files->fd[fd].cursor += count;
@@ -645,6 +1099,8 @@ int sys_write(struct tcb *task, int fd, void *buf, int count)
 	unsigned long pfn_nstart, pfn_nend;	/* New pages start/end */
 	unsigned long cursor;
 	struct vm_file *vmfile;
+	struct vm_area *vma;
+	int written = 0;
 	int ret = 0;
 
 	/* Check that fd is valid */
@@ -667,6 +1123,23 @@ int sys_write(struct tcb *task, int fd, void *buf, int count)
 	vmfile = task->files->fd[fd].vmfile;
 	cursor = task->files->fd[fd].cursor;
 
+	/*
+	 * Large page aligned writes hand whole pages to the cache. Files
+	 * cached in their filesystem's blocks are copied to, as ever.
+	 */
+	if (vmfile->vm_obj.pager == &file_pager &&
+	    (vma = file_zerocopy_vma(task, vmfile, cursor, buf, count))) {
+		if ((written = file_write_zerocopy(task, vmfile, vma, buf,
+						   __pfn(cursor),
+						   __pfn(count))) < 0)
+			return written;
+		task->files->fd[fd].cursor += written;
+		if ((count -= written) == 0)
+			return written;
+		cursor += written;
+		buf += written;
+	}
+
 	//printf("Thread %d writing to fd: %d, vnum: 0x%lx, vnode: %p\n",
 	//task->tid, fd, vmfile->vnode->vnum, vmfile->vnode);
 
@@ -740,7 +1213,7 @@ int sys_write(struct tcb *task, int fd, void *buf, int count)
 
 	task->files->fd[fd].cursor += count;
 
-	return count;
+	return written + count;
 }
 
 /* FIXME: Check for invalid cursor values. Check for total, sometimes negative. */
@@ -819,36 +1292,14 @@ int fill_dirent(void *buf, unsigned long vnum, int offset, char *name)
 }
 
 
-/*
- * Reads @count bytes of posix struct dirents into @buf. This implements
- * the raw dirent read syscall upon which readdir() etc. posix calls
- * can be built in userspace.
- *
- * FIXME: Ensure buf is in shared utcb, and count does not exceed it.
- */
-int sys_readdir(struct tcb *t, int fd, int count, char *dirbuf)
+/* Fills in dirents of a directory vnode, called with vfs_lock held */
+static int vfs_readdir(struct vnode *v, int count, char *dirbuf)
 {
 	int dirent_size = sizeof(struct dirent);
 	int total = 0, nbytes = 0;
-	struct vnode *v;
 	struct dentry *d;
 	char *buf = dirbuf;
 
-	// printf("%s/%s\n", __TASKNAME__, __FUNCTION__);
-
-	/*
-	 * FIXME:
-	 * Add dirbuf overflow checking
-	 */
-
-	/* Check address is in task's utcb */
-
-	if (fd < 0 || fd > TASK_FILES_MAX ||
-	    !t->files->fd[fd].vmfile->vnode)
-		return -EBADF;
-
-	v = t->files->fd[fd].vmfile->vnode;
-
 	d = link_to_struct(v->dentries.next, struct dentry, vref);
 
 	/* Ensure vnode is a directory */
@@ -879,6 +1330,37 @@ int sys_readdir(struct tcb *t, int fd, int count, char *dirbuf)
 	return nbytes + total;
 }
 
+/*
+ * Reads @count bytes of posix struct dirents into @buf. This implements
+ * the raw dirent read syscall upon which readdir() etc. posix calls
+ * can be built in userspace.
+ *
+ * FIXME: Ensure buf is in shared utcb, and count does not exceed it.
+ */
+int sys_readdir(struct tcb *t, int fd, int count, char *dirbuf)
+{
+	int ret;
+
+	// printf("%s/%s\n", __TASKNAME__, __FUNCTION__);
+
+	/*
+	 * FIXME:
+	 * Add dirbuf overflow checking
+	 */
+
+	/* Check address is in task's utcb */
+
+	if (fd < 0 || fd > TASK_FILES_MAX ||
+	    !t->files->fd[fd].vmfile->vnode)
+		return -EBADF;
+
+	spin_lock(&vfs_lock);
+	ret = vfs_readdir(t->files->fd[fd].vmfile->vnode, count, dirbuf);
+	spin_unlock(&vfs_lock);
+
+	return ret;
+}
+
 /* FIXME:
  * - Is it already open?
  * - Check flags and mode.
@@ -899,22 +1381,32 @@ int sys_open(struct tcb *task, const char *pathname,
 					  task)))
 		return (int)pdata;
 
+	/* The vfs looks up the path without vm_lock, see globals.h */
+	spin_unlock(&vm_lock);
+	spin_lock(&vfs_lock);
+
 	/* Creating new file */
 	if (flags & O_CREAT) {
 		/* Make sure mode identifies a file */
 		mode |= S_IFREG;
 
 		/* Create new vnode */
-		if (IS_ERR(v = vfs_vnode_create(task, pdata, mode))) {
-			retval = (int)v;
-			goto out;
-		}
+		v = vfs_vnode_create(task, pdata, mode);
 	} else {
 		/* Not creating. Get the existing vnode */
-		if (IS_ERR(v = vfs_vnode_lookup_bypath(pdata))) {
-			retval = (int)v;
-			goto out;
-		}
+		v = vfs_vnode_lookup_bypath(pdata);
+	}
+
+	/* Keep it in cache until its vm_file is found or made */
+	if (!IS_ERR(v))
+		vfs_vnode_get(v);
+
+	spin_unlock(&vfs_lock);
+	spin_lock(&vm_lock);
+
+	if (IS_ERR(v)) {
+		retval = (int)v;
+		goto out;
 	}
 
 	/* Get a new fd */
@@ -930,28 +1422,40 @@ int sys_open(struct tcb *task, const char *pathname,
 			task->files->fd[fd].vmfile = vmfile;
 
 			vmfile->openers++;
-			goto out;
+			goto out_put;
 		}
 	}
 
 	/* Create a new vm_file for this vnode */
 	if (IS_ERR(vmfile = vfs_file_create())) {
 		retval = (int)vmfile;
-		goto out;
+		goto out_put;
 	}
 
-	/* Assign file information */
+	/* Assign file information, the file keeps the vnode in cache */
+	spin_lock(&vfs_lock);
 	vmfile->vnode = v;
 	vmfile->length = vmfile->vnode->size;
+	spin_unlock(&vfs_lock);
+
+	/* Filesystems with blocks in memory have them cached in place */
+	if (v->fops.block)
+		vmfile->vm_obj.pager = &block_pager;
+	else
+		vmfile->vm_obj.pager = &file_pager;
 
 	/* Add a reference to it from the task */
-	vmfile->vm_obj.pager = &file_pager;
 	task->files->fd[fd].vmfile = vmfile;
 	vmfile->openers++;
 
 	/* Add to file list */
 	global_add_vm_file(vmfile);
+	goto out;
 
+out_put:
+	spin_lock(&vfs_lock);
+	vfs_vnode_put(v);
+	spin_unlock(&vfs_lock);
 out:
 	pathdata_destroy(pdata);
 	return retval;
@@ -26,10 +26,12 @@
 #include <utcb.h>
 #include <bootm.h>
 #include <vfs.h>
+#include <globals.h>
 #include <init.h>
 #include <memory.h>
 #include <capability.h>
 #include <linker.h>
+#include <worker.h>
 #include <mmap.h>
 #include <file.h>
 #include <syscalls.h>
@@ -280,6 +282,7 @@ void init_physmem_secondary(struct membank *membank)
 	/* Initialise the page array */
 	for (int i = 0; i < npages; i++) {
 		link_init(&membank[0].page_array[i].list);
+		spin_lock_init(&membank[0].page_array[i].lock);
 
 		/*
 		 * Set use counts for pages the
@@ -496,12 +499,19 @@ void init(void)
 
 	vfs_init();
 
+	/* Pagers are called with vm_lock held, as on requests */
+	spin_lock(&vm_lock);
+
 	pager_setup_task();
 
 	start_init_process();
 
 	release_initdata();
 
+	spin_unlock(&vm_lock);
+
 	mm0_test_global_vm_integrity();
+
+	worker_pool_init();
 }
 
@@ -36,7 +36,9 @@ unsigned long free_virtual_address_start;
 static struct pager_virtual_address_id_pool {
 	int nwords;
 	int bitlimit;
+	int hint;
 	u32 bitmap[ADDRESS_POOL_256MB];
+	u32 summary[ID_POOL_SUMMARY_WORDS(ADDRESS_POOL_256MB)];
 } pager_virtual_address_id_pool = {
 	.nwords = ADDRESS_POOL_256MB,
 	.bitlimit = ADDRESS_POOL_256MB * 32,
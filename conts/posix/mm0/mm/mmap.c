@@ -18,6 +18,7 @@
 #include <syscalls.h>
 #include <user.h>
 #include <shm.h>
+#include INC_SUBARCH(mm.h)
 
 struct vm_area *vma_new(unsigned long pfn_start, unsigned long npages,
 			unsigned int flags, unsigned long file_offset)
@@ -39,110 +40,52 @@ struct vm_area *vma_new(unsigned long pfn_start, unsigned long npages,
 	return vma;
 }
 
-/*
- * Inserts a new vma to the ordered vm area list.
- *
- * The new vma is assumed to have been correctly set up not to intersect
- * with any other existing vma.
- */
-int task_insert_vma(struct vm_area *this, struct link *vma_list)
-{
-	struct vm_area *before, *after;
-
-	/* Add if list is empty */
-	if (list_empty(vma_list)) {
-		list_insert_tail(&this->list, vma_list);
-		return 0;
-	}
-
-	/* Else find the right interval */
-	list_foreach_struct(before, vma_list, list) {
-		after = link_to_struct(before->list.next, struct vm_area, list);
-
-		/* If there's only one in list */
-		if (before->list.next == vma_list) {
-
-			/* Eliminate the possibility of intersection */
-			BUG_ON(set_intersection(this->pfn_start, this->pfn_end,
-						before->pfn_start,
-						before->pfn_end));
-
-			/* Add as next if greater */
-			if (this->pfn_start > before->pfn_start)
-				list_insert(&this->list, &before->list);
-			/* Add as previous if smaller */
-			else if (this->pfn_start < before->pfn_start)
-				list_insert_tail(&this->list, &before->list);
-			else
-				BUG();
-
-			return 0;
-		}
-
-		/* If this page is in-between two other, insert it there */
-		if (before->pfn_start < this->pfn_start &&
-		    after->pfn_start > this->pfn_start) {
-
-			/* Eliminate possibility of intersection */
-			BUG_ON(set_intersection(this->pfn_start, this->pfn_end,
-						before->pfn_start,
-						before->pfn_end));
-			BUG_ON(set_intersection(this->pfn_start, this->pfn_end,
-						after->pfn_start,
-						after->pfn_end));
-			list_insert(&this->list, &before->list);
-
-			return 0;
-		}
-	}
-	BUG();
-}
-
 int vma_intersection(struct tcb *task,
 		     unsigned long pfn_start, unsigned long pfn_end)
 {
-	struct vm_area *vma;
+	return find_vma_range(pfn_start, pfn_end, task->vm_area_head) != 0;
+}
 
-	list_foreach_struct(vma, &task->vm_area_head->list, list) {
-		if (set_intersection(pfn_start, pfn_end,
-				     vma->pfn_start, vma->pfn_end))
-			return 1;
-	}
-	return 0;
+/*
+ * Alignment in pages for a new area of npages, so that large
+ * areas may be mapped by the kernel with sections or large pages.
+ */
+static inline unsigned long mmap_area_align(unsigned long npages)
+{
+	if (npages >= SECTION_PAGES)
+		return SECTION_PAGES;
+	if (npages >= LARGE_PAGE_PTES)
+		return LARGE_PAGE_PTES;
+	return 1;
 }
 
 /*
- * Take first vma, place region after it. Traverse all vmas, if hit
- * an intersection, take the next vma and retry until all are traversed
+ * Finds the lowest free region of npages within the task's map
+ * boundaries, skipping over any vma subtree with no gap large enough.
+ * Large regions are aligned if there is room, and placed anywhere
+ * otherwise.
  */
 unsigned long find_unmapped_area(unsigned long npages, struct tcb *task)
 {
-	unsigned long pfn_start = __pfn(task->map_start);
-	unsigned long pfn_end = pfn_start + npages;
-	struct vm_area *vma;
+	unsigned long pfn_start, align = mmap_area_align(npages);
 
 	if (npages > __pfn(task->map_end - task->map_start))
 		return 0;
 
-	/* If no vmas, first map slot is available. */
-	if (list_empty(&task->vm_area_head->list))
-		return task->map_start;
-
-	list_foreach_struct(vma, &task->vm_area_head->list, list) {
-		/* Update region to after this vma */
-		pfn_start = vma->pfn_end;
-		pfn_end = pfn_start + npages;
+	if (!(pfn_start = find_vma_gap(npages, align,
+				       __pfn(task->map_start),
+				       __pfn(task->map_end),
+				       task->vm_area_head)) &&
+	    (align == 1 ||
+	     !(pfn_start = find_vma_gap(npages, 1,
+					__pfn(task->map_start),
+					__pfn(task->map_end),
+					task->vm_area_head))))
+		return 0;
 
-		/* If it doesn't intersect with any other vmas
-		 * and is within boundaries, return it */
-		if (pfn_end <= __pfn(task->map_end) &&
-		    !vma_intersection(task, pfn_start, pfn_end))
-			return __pfn_to_addr(pfn_start);
-	}
-	return 0;
+	return __pfn_to_addr(pfn_start);
 }
 
-
 #if 0
 /*
  * Search an empty space in the task's mmapable address region.
@@ -361,7 +304,7 @@ void *do_mmap(struct vm_file *mapfile, unsigned long file_offset,
 	/* Finished initialising the vma, add it to task */
 	dprintf("%s: Mapping 0x%lx - 0x%lx\n", __FUNCTION__,
 		map_address, map_address + __pfn_to_addr(npages));
-	task_insert_vma(new, &task->vm_area_head->list);
+	task_insert_vma(new, task->vm_area_head);
 
 	/*
 	 * If area is going to be used going downwards, (i.e. as a stack)
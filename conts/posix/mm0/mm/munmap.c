@@ -44,11 +44,11 @@ int vma_split(struct vm_area *vma, struct tcb *task,
 	vma_copy_links(new, vma);
 
 	/* Add new one next to original vma */
-	list_insert_tail(&new->list, &vma->list);
+	task_insert_vma(new, task->vm_area_head);
 
-	/* Unmap the removed portion */
+	/* Unmap the removed portion, parts never faulted in are unmapped */
 	BUG_ON((err = l4_unmap((void *)__pfn_to_addr(unmap_start),
-	       unmap_end - unmap_start, task->tid)) < 0);
+	       unmap_end - unmap_start, task->tid)) < 0 && err != -ENOMAP);
 
 	return 0;
 }
@@ -78,9 +78,12 @@ int vma_shrink(struct vm_area *vma, struct tcb *task,
 	} else
 		BUG();
 
-	/* Unmap the shrinked portion */
+	/* Gaps around the vma have grown */
+	task_update_vma(vma, task->vm_area_head);
+
+	/* Unmap the shrinked portion, parts never faulted in are unmapped */
 	BUG_ON((err = l4_unmap((void *)__pfn_to_addr(unmap_start),
-	       unmap_end - unmap_start, task->tid)) < 0);
+	       unmap_end - unmap_start, task->tid)) < 0 && err != -ENOMAP);
 
 	return 0;
 }
@@ -103,7 +106,7 @@ int vma_destroy_single(struct tcb *task, struct vm_area *vma)
 		 vma->pfn_end - vma->pfn_start, task->tid);
 
 	/* Unlink and delete vma */
-	list_remove(&vma->list);
+	task_remove_vma(vma, task->vm_area_head);
 	kfree(vma);
 
 	return 0;
@@ -188,22 +191,27 @@ int do_munmap(struct tcb *task, unsigned long vaddr, unsigned long npages)
 	struct vm_area *vma, *n;
 	int err;
 
-	list_foreach_removable_struct(vma, n, &task->vm_area_head->list, list) {
-		/* Check for intersection */
-		if (set_intersection(munmap_start, munmap_end,
-				     vma->pfn_start, vma->pfn_end)) {
-			/*
-			 * Flush pages if vma is writable,
-			 * dirty and file-backed.
-			 */
-			if ((err = vma_flush_pages(vma)) < 0)
-				return err;
-
-			/* Unmap the vma accordingly. This may delete the vma */
-			if ((err = vma_unmap(vma, task, munmap_start,
-					     munmap_end)) < 0)
-				return err;
-		}
+	/* Start from the lowest vma in range, none before it intersect */
+	if (!(vma = find_vma_range(munmap_start, munmap_end,
+				   task->vm_area_head)))
+		return 0;
+
+	for (; &vma->list != &task->vm_area_head->list &&
+	       vma->pfn_start < munmap_end; vma = n) {
+		/* This vma may be deleted below */
+		n = link_to_struct(vma->list.next, struct vm_area, list);
+
+		/*
+		 * Flush pages if vma is writable,
+		 * dirty and file-backed.
+		 */
+		if ((err = vma_flush_pages(vma)) < 0)
+			return err;
+
+		/* Unmap the vma accordingly. This may delete the vma */
+		if ((err = vma_unmap(vma, task, munmap_start,
+				     munmap_end)) < 0)
+			return err;
 	}
 
 	return 0;
@@ -230,7 +238,7 @@ int do_msync(struct tcb *task, void *vaddr, unsigned long npages, int flags)
 	int err;
 
 	/* Find a vma that overlaps with this address range */
-	while ((vma = find_vma(addr, &task->vm_area_head->list))) {
+	while ((vma = find_vma(addr, task->vm_area_head))) {
 
 		/* Flush pages if vma is writable, dirty and file-backed. */
 		if ((err = vma_flush_pages(vma)) < 0)
@@ -3,6 +3,7 @@
  */
 #include <l4/macros.h>
 #include <l4/lib/list.h>
+#include <l4/lib/math.h>
 #include L4LIB_INC_ARCH(syscalls.h)
 #include L4LIB_INC_ARCH(syslib.h)
 #include <mem/malloc.h>
@@ -28,13 +29,7 @@ struct page *page_init(struct page *page)
 
 struct page *find_page(struct vm_object *obj, unsigned long pfn)
 {
-	struct page *p;
-
-	list_foreach_struct(p, &obj->page_cache, list)
-		if (p->offset == pfn)
-			return p;
-
-	return 0;
+	return radix_tree_lookup(&obj->page_tree, pfn);
 }
 
 /*
@@ -47,7 +42,7 @@ int default_release_pages(struct vm_object *vm_obj)
 	struct page *p, *n;
 
 	list_foreach_removable_struct(p, n, &vm_obj->page_cache, list) {
-		list_remove_init(&p->list);
+		remove_page_olist(p, vm_obj);
 		BUG_ON(p->refcnt);
 
 		/* Reinitialise the page */
@@ -62,6 +57,7 @@ int default_release_pages(struct vm_object *vm_obj)
 	return 0;
 }
 
+/* Called with the object's io lock held, see flush_file_pages() */
 int file_page_out(struct vm_object *vm_obj, unsigned long page_offset)
 {
 	struct vm_file *f = vm_object_to_file(vm_obj);
@@ -90,65 +86,172 @@ int file_page_out(struct vm_object *vm_obj, unsigned long page_offset)
 	//printf("%s/%s: Writing to vnode %lu, at pgoff 0x%lu, %d pages, buf at %p\n",
 	//	__TASKNAME__, __FUNCTION__, f->vnode->vnum, page_offset, 1, vaddr);
 
-	/* Syscall to vfs to write page back to file. */
-	if ((err = vfs_write(f->vnode, page_offset, 1,
-			     phys_to_virt(paddr))) < 0)
-		return err;
-
-	/* Clear dirty flag */
+	/* Cleared first, so that writes to it meanwhile dirty it again */
 	page->flags &= ~VM_DIRTY;
 
+	/* Syscall to vfs to write page back to file, without vm_lock. */
+	spin_unlock(&vm_lock);
+	err = vfs_write(f->vnode, page_offset, 1, phys_to_virt(paddr));
+	spin_lock(&vm_lock);
+
+	if (err < 0) {
+		page->flags |= VM_DIRTY;
+		return err;
+	}
+
 	return 0;
 }
 
-struct page *file_page_in(struct vm_object *vm_obj, unsigned long page_offset)
+/*
+ * Reads up to npages of the file from pfn on into a block of new pages,
+ * with a single vfs call. Stops short at the end of file, or where a
+ * page is already in the cache. Returns the number of pages read in.
+ *
+ * Called with the object's io lock held, vm_lock is dropped while the
+ * vfs reads.
+ */
+static int file_read_pages(struct vm_object *vm_obj, unsigned long pfn,
+			   int npages)
 {
 	struct vm_file *f = vm_object_to_file(vm_obj);
+	unsigned long file_pages = __pfn(page_align_up(f->length));
 	struct page *page;
 	void *paddr;
 	int err;
 
-	/* Check first if the file has such a page at all */
-	if (__pfn(page_align_up(f->length) <= page_offset)) {
-		printf("%s: %s: Trying to look up page %lu, but file length "
-		       "is %lu bytes.\n", __TASKNAME__, __FUNCTION__,
-		       page_offset, f->length);
-		BUG();
-	}
+	npages = min(npages, FILE_READAHEAD_MAX);
+	if (pfn + npages > file_pages)
+		npages = file_pages - pfn;
+	for (int i = 1; i < npages; i++)
+		if (find_page(vm_obj, pfn + i)) {
+			npages = i;
+			break;
+		}
 
-	/* Call vfs only if the page is not resident in page cache. */
-	if (!(page = find_page(vm_obj, page_offset))) {
-		/* Allocate a new page */
-		paddr = alloc_page(1);
-		page = phys_to_page(paddr);
+	/* Pages of the block are freed one by one like any other */
+	while (!(paddr = alloc_page_aligned(npages, 1)))
+		if (!(npages >>= 1))
+			return -ENOMEM;
 
-		/* Call to vfs to read into the page. */
-		if ((err = vfs_read(f->vnode, page_offset,
-				    1, phys_to_virt(paddr))) < 0) {
+	/* Call to vfs to read into the pages. */
+	spin_unlock(&vm_lock);
+	err = vfs_read(f->vnode, pfn, npages, phys_to_virt(paddr));
+	spin_lock(&vm_lock);
 
-			free_page(paddr);
-			return PTR_ERR(err);
-		}
+	if (err < 0) {
+		for (int i = 0; i < npages; i++)
+			free_page(paddr + __pfn_to_addr(i));
+		return err;
+	}
 
-	//	printf("%s/%s: Reading into vnode %lu, at pgoff 0x%lu, %d pages, buf at %p\n",
-	//	       __TASKNAME__, __FUNCTION__, f->vnode->vnum, page_offset, 1, vaddr);
+	for (int i = 0; i < npages; i++) {
+		/* Ones cached meanwhile other than by a read are kept */
+		if (find_page(vm_obj, pfn + i)) {
+			free_page(paddr + __pfn_to_addr(i));
+			continue;
+		}
 
-		/* Update vm object details */
-		vm_obj->npages++;
+		page = phys_to_page(paddr + __pfn_to_addr(i));
 
 		/* Update page details */
 		page_init(page);
 		page->refcnt++;
 		page->owner = vm_obj;
-		page->offset = page_offset;
+		page->offset = pfn + i;
 		page->virtual = 0;
 
 		/* Add the page to owner's list of in-memory pages */
 		BUG_ON(!list_empty(&page->list));
-		insert_page_olist(page, vm_obj);
+		if ((err = insert_page_olist(page, vm_obj)) < 0) {
+			/* Those in already are kept, the rest are freed */
+			for (int j = i; j < npages; j++) {
+				page_init(phys_to_page(paddr +
+						       __pfn_to_addr(j)));
+				free_page(paddr + __pfn_to_addr(j));
+			}
+			return i ? i : err;
+		}
+
+		/* Update vm object details */
+		vm_obj->npages++;
 	}
 
-	return page;
+	return npages;
+}
+
+/*
+ * Makes the file pages from pfn_start to pfn_end resident, and reads
+ * ahead of them on a miss. An access that follows on from the last one
+ * doubles the readahead window, up to FILE_READAHEAD_MAX pages, any
+ * other access resets it, so that random accesses read little ahead.
+ *
+ * Called with vm_lock held, as the rest of the pager ops. Misses take
+ * the object's io lock, so a read of the same pages under way finishes
+ * first and they are found in the cache after it.
+ */
+static int file_readahead(struct vm_object *vm_obj, unsigned long pfn_start,
+			  unsigned long pfn_end)
+{
+	struct vm_file *f = vm_object_to_file(vm_obj);
+	struct file_readahead *ra = &f->readahead;
+	unsigned long file_pages, pfn, end;
+	int ret = 0;
+
+	/* First page that is not resident */
+	for (pfn = pfn_start; pfn < pfn_end; pfn++)
+		if (!find_page(vm_obj, pfn))
+			break;
+
+	if (pfn < pfn_end) {
+		vm_object_io_lock(vm_obj);
+
+		if (pfn_start == ra->next && ra->window)
+			ra->window = min(ra->window * 2, FILE_READAHEAD_MAX);
+		else
+			ra->window = FILE_READAHEAD_MIN;
+
+		file_pages = __pfn(page_align_up(f->length));
+		end = max(pfn_end, pfn + ra->window);
+		if (end > file_pages)
+			end = file_pages;
+
+		while (pfn < end) {
+			if (find_page(vm_obj, pfn)) {
+				pfn++;
+				continue;
+			}
+			if ((ret = file_read_pages(vm_obj, pfn, end - pfn)) < 0)
+				break;
+			pfn += ret;
+		}
+
+		vm_object_io_unlock(vm_obj);
+		if (ret < 0)
+			return ret;
+	}
+
+	ra->next = pfn_end;
+	return 0;
+}
+
+struct page *file_page_in(struct vm_object *vm_obj, unsigned long page_offset)
+{
+	struct vm_file *f = vm_object_to_file(vm_obj);
+	int err;
+
+	/* Check first if the file has such a page at all */
+	if (__pfn(page_align_up(f->length) <= page_offset)) {
+		printf("%s: %s: Trying to look up page %lu, but file length "
+		       "is %lu bytes.\n", __TASKNAME__, __FUNCTION__,
+		       page_offset, f->length);
+		BUG();
+	}
+
+	/* Call vfs only if the page is not resident in page cache. */
+	if ((err = file_readahead(vm_obj, page_offset, page_offset + 1)) < 0)
+		return PTR_ERR(err);
+
+	return find_page(vm_obj, page_offset);
 }
 
 /*
@@ -160,10 +263,10 @@ struct vm_pager file_pager = {
 		.page_in = file_page_in,
 		.page_out = file_page_out,
 		.release_pages = default_release_pages,
+		.readahead = file_readahead,
 	},
 };
 
-
 /* A proposal for shadow vma container, could be part of vm_file->priv_data */
 struct vm_swap_node {
 	struct vm_file *swap_file;
@@ -203,7 +306,7 @@ int bootfile_release_pages(struct vm_object *vm_obj)
 	struct page *p, *n;
 
 	list_foreach_removable_struct(p, n, &vm_obj->page_cache, list) {
-		list_remove(&p->list);
+		remove_page_olist(p, vm_obj);
 		BUG_ON(p->refcnt);
 
 		/* Reinitialise the page */
@@ -222,6 +325,119 @@ int bootfile_release_pages(struct vm_object *vm_obj)
 	return 0;
 }
 
+/*
+ * Files of filesystems whose blocks are pages of our memory, e.g.
+ * memfs, have those very pages in their page cache rather than copies
+ * of them. Writes to the cache are writes to the file, and private
+ * mappings copy on write from the blocks as from any file page.
+ */
+static struct page *block_cache_page(struct vm_object *vm_obj,
+				     unsigned long pfn)
+{
+	struct vm_file *f = vm_object_to_file(vm_obj);
+	struct page *page;
+	void *block;
+	int err;
+
+	if ((page = find_page(vm_obj, pfn)))
+		return page;
+
+	/* Blocks of holes and new pages are allocated here */
+	if (IS_ERR(block = vfs_block(f->vnode, pfn)))
+		return block;
+
+	page = virt_to_page(block);
+
+	/* Update page details */
+	page_init(page);
+	page->refcnt++;
+	page->owner = vm_obj;
+	page->offset = pfn;
+	page->virtual = 0;
+
+	/* Add the page to owner's list of in-memory pages, the block stays */
+	BUG_ON(!list_empty(&page->list));
+	if ((err = insert_page_olist(page, vm_obj)) < 0) {
+		page_init(page);
+		return PTR_ERR(err);
+	}
+
+	/* Update vm object details */
+	vm_obj->npages++;
+
+	return page;
+}
+
+/* Blocks are written in place, there's nothing to write back */
+int block_page_out(struct vm_object *vm_obj, unsigned long page_offset)
+{
+	struct page *page;
+
+	if ((page = find_page(vm_obj, page_offset)))
+		page->flags &= ~VM_DIRTY;
+
+	return 0;
+}
+
+/* New pages past the end of file are new blocks of it */
+static int block_new_pages(struct vm_object *vm_obj, unsigned long pfn_start,
+			   unsigned long pfn_end)
+{
+	struct page *page;
+
+	for (unsigned long pfn = pfn_start; pfn < pfn_end; pfn++)
+		if (IS_ERR(page = block_cache_page(vm_obj, pfn)))
+			return (int)page;
+
+	return 0;
+}
+
+/* Takes in the range at once, as there's no reading to be done */
+static int block_readahead(struct vm_object *vm_obj, unsigned long pfn_start,
+			   unsigned long pfn_end)
+{
+	struct vm_file *f = vm_object_to_file(vm_obj);
+	unsigned long file_pages = __pfn(page_align_up(f->length));
+
+	if (pfn_end > file_pages)
+		pfn_end = file_pages;
+
+	return block_new_pages(vm_obj, pfn_start, pfn_end);
+}
+
+struct page *block_page_in(struct vm_object *vm_obj,
+			   unsigned long page_offset)
+{
+	struct vm_file *f = vm_object_to_file(vm_obj);
+	int err;
+
+	/* Check first if the file has such a page at all */
+	if (__pfn(page_align_up(f->length) <= page_offset)) {
+		printf("%s: %s: Trying to look up page %lu, but file length "
+		       "is %lu bytes.\n", __TASKNAME__, __FUNCTION__,
+		       page_offset, f->length);
+		BUG();
+	}
+
+	/* Neighbours come in with it, for fault around to map them too */
+	if ((err = block_readahead(vm_obj, page_offset,
+				   page_offset + FILE_READAHEAD_MIN)) < 0)
+		return PTR_ERR(err);
+
+	return find_page(vm_obj, page_offset);
+}
+
+/* Pages go back to the filesystem, not the allocator, as do boot files */
+struct vm_pager block_pager = {
+	.ops = {
+		.page_in = block_page_in,
+		.page_out = block_page_out,
+		.release_pages = bootfile_release_pages,
+		.readahead = block_readahead,
+		.new_pages = block_new_pages,
+	},
+};
+
 #if 0
 /* Returns the page with given offset in this vm_object */
 struct page *bootfile_page_in(struct vm_object *vm_obj,
@@ -230,6 +446,7 @@ struct page *bootfile_page_in(struct vm_object *vm_obj,
 	struct vm_file *boot_file = vm_object_to_file(vm_obj);
 	struct svc_image *img = boot_file->priv_data;
 	struct page *page;
+	int err;
 
 	/* Check first if the file has such a page at all */
 	if (__pfn(page_align_up(boot_file->length) <= offset)) {
@@ -249,12 +466,15 @@ struct page *bootfile_page_in(struct vm_object *vm_obj,
 		page->owner = vm_obj;
 		page->offset = offset;
 
-		/* Update object */
-		vm_obj->npages++;
-
 		/* Add the page to owner's list of in-memory pages */
 		BUG_ON(!list_empty(&page->list));
-		insert_page_olist(page, vm_obj);
+		if ((err = insert_page_olist(page, vm_obj)) < 0) {
+			page_init(page);
+			return PTR_ERR(err);
+		}
+
+		/* Update object */
+		vm_obj->npages++;
 	}
 
 	return page;
@@ -41,6 +41,8 @@ struct global_list global_tasks = {
 	.total = 0,
 };
 
+DECLARE_SPINLOCK(task_list_lock);
+
 void print_tasks(void)
 {
 	struct tcb *task;
@@ -53,24 +55,47 @@ void print_tasks(void)
 void global_add_task(struct tcb *task)
 {
 	BUG_ON(!list_empty(&task->list));
+	spin_lock(&task_list_lock);
 	list_insert_tail(&task->list, &global_tasks.list);
 	global_tasks.total++;
+	spin_unlock(&task_list_lock);
 }
 
 void global_remove_task(struct tcb *task)
 {
 	BUG_ON(list_empty(&task->list));
+	spin_lock(&task_list_lock);
 	list_remove_init(&task->list);
 	BUG_ON(--global_tasks.total < 0);
+	spin_unlock(&task_list_lock);
 }
 
 struct tcb *find_task(int tid)
 {
 	struct tcb *t;
 
+	spin_lock(&task_list_lock);
 	list_foreach_struct(t, &global_tasks.list, list)
-		if (t->tid == tid)
+		if (t->tid == tid) {
+			spin_unlock(&task_list_lock);
 			return t;
+		}
+	spin_unlock(&task_list_lock);
+	return 0;
+}
+
+/* Returns a task with the given vmas, threads of a space share them */
+struct tcb *find_task_by_vmas(struct task_vma_head *vma_head)
+{
+	struct tcb *t;
+
+	spin_lock(&task_list_lock);
+	list_foreach_struct(t, &global_tasks.list, list)
+		if (t->vm_area_head == vma_head) {
+			spin_unlock(&task_list_lock);
+			return t;
+		}
+	spin_unlock(&task_list_lock);
 	return 0;
 }
 
@@ -91,6 +116,8 @@ struct tcb *tcb_alloc_init(unsigned int flags)
 		}
 		task->vm_area_head->tcb_refs = 1;
 		link_init(&task->vm_area_head->list);
+		rb_root_init(&task->vm_area_head->tree);
+		spin_lock_init(&task->vm_area_head->lock);
 
 		/* Also allocate a utcb head for new address space */
 		if (!(task->utcb_head =
@@ -251,7 +278,7 @@ int task_copy_vmas(struct tcb *to, struct tcb *from)
 		vma_copy_links(new_vma, vma);
 
 		/* All link copying is finished, now add the new vma to task */
-		task_insert_vma(new_vma, &to->vm_area_head->list);
+		task_insert_vma(new_vma, to->vm_area_head);
 	}
 
 	return 0;
@@ -269,8 +296,8 @@ int task_release_vmas(struct task_vma_head *vma_head)
 		/* Release all links */
 		vma_drop_merge_delete_all(vma);
 
-		/* Delete the vma from task's vma list */
-		list_remove(&vma->list);
+		/* Delete the vma from task's vma tree and list */
+		task_remove_vma(vma, vma_head);
 
 		/* Free the vma */
 		kfree(vma);
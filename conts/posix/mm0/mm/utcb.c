@@ -140,7 +140,7 @@ int task_setup_utcb(struct tcb *task)
 out:
 
 	/* Check if utcb is already mapped (in case of multiple threads) */
-	if (!find_vma(slot, &task->vm_area_head->list)) {
+	if (!find_vma(slot, task->vm_area_head)) {
 		/* Map this region as private to current task */
 		if (IS_ERR(err = do_mmap(0, 0, task, slot,
 					 VMA_ANONYMOUS | VMA_PRIVATE |
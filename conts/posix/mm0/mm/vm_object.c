@@ -9,6 +9,7 @@
 #include <l4/api/errno.h>
 #include <mem/malloc.h>
 #include <globals.h>
+#include <vfs.h>
 
 /* Global list of all in-memory files on the system */
 struct global_list global_vm_files = {
@@ -22,6 +23,9 @@ struct global_list global_vm_objects = {
 	.total = 0,
 };
 
+/* Protects all of the vm object graph, see globals.h */
+DECLARE_SPINLOCK(vm_lock);
+
 
 void global_add_vm_object(struct vm_object *obj)
 {
@@ -117,11 +121,30 @@ struct vm_object *vm_object_init(struct vm_object *obj)
 	link_init(&obj->shref);
 	link_init(&obj->shdw_list);
 	link_init(&obj->page_cache);
+	radix_tree_init(&obj->page_tree);
 	link_init(&obj->link_list);
+	spin_lock_init(&obj->io_lock);
 
 	return obj;
 }
 
+/*
+ * Takes the object's io lock, which vm_lock comes after, so it is
+ * dropped while waiting. Pages may have come in or gone out of the
+ * cache meanwhile. Called and returns with vm_lock held.
+ */
+void vm_object_io_lock(struct vm_object *vmo)
+{
+	spin_unlock(&vm_lock);
+	spin_lock(&vmo->io_lock);
+	spin_lock(&vm_lock);
+}
+
+void vm_object_io_unlock(struct vm_object *vmo)
+{
+	spin_unlock(&vmo->io_lock);
+}
+
 /* Allocate and initialise a vmfile, and return it */
 struct vm_object *vm_object_create(void)
 {
@@ -192,6 +215,14 @@ int vm_object_delete(struct vm_object *vmo)
 	if (vmo->flags & VM_OBJ_FILE) {
 		f = vm_object_to_file(vmo);
 		BUG_ON(!list_empty(&f->list));
+
+		/* Vnode may now be evicted from the vfs cache */
+		if (f->type == VM_FILE_VFS) {
+			spin_lock(&vfs_lock);
+			vfs_vnode_put(f->vnode);
+			spin_unlock(&vfs_lock);
+		}
+
 		if (f->private_file_data) {
 			if (f->destroy_priv_data)
 				f->destroy_priv_data(f);
@@ -199,9 +230,11 @@ int vm_object_delete(struct vm_object *vmo)
 				kfree(f->private_file_data);
 		}
 		kfree(f);
-	} else if (vmo->flags & VM_OBJ_SHADOW)
+	} else if (vmo->flags & VM_OBJ_SHADOW) {
+		if (vmo->loan)
+			kfree(vmo->loan);
 		kfree(vmo);
-	else BUG();
+	} else BUG();
 
 	return 0;
 }
@@ -0,0 +1,262 @@
+/*
+ * Per-task vma index.
+ *
+ * Vmas of a task are kept both on an address ordered list for
+ * walking them in order, and on a red-black tree for lookups.
+ * Each vma records the free gap between itself and the vma
+ * before it, and each tree node the largest such gap in its
+ * subtree, so that free areas can be found without visiting
+ * every vma.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <vm_area.h>
+#include <task.h>
+#include <lib/rbtree.h>
+#include <l4/lib/math.h>
+
+#define rb_to_vma(node)		rb_entry(node, struct vm_area, rb)
+
+static inline unsigned long vma_rb_max_gap(struct rb_node *node)
+{
+	return node ? rb_to_vma(node)->max_gap : 0;
+}
+
+static void vma_augment(struct rb_node *node)
+{
+	struct vm_area *vma = rb_to_vma(node);
+	unsigned long left = vma_rb_max_gap(node->left);
+	unsigned long right = vma_rb_max_gap(node->right);
+
+	vma->max_gap = vma->gap;
+	if (left > vma->max_gap)
+		vma->max_gap = left;
+	if (right > vma->max_gap)
+		vma->max_gap = right;
+}
+
+static inline struct vm_area *vma_prev(struct vm_area *vma,
+				       struct task_vma_head *vma_head)
+{
+	if (vma->list.prev == &vma_head->list)
+		return 0;
+	return link_to_struct(vma->list.prev, struct vm_area, list);
+}
+
+static inline struct vm_area *vma_next(struct vm_area *vma,
+				       struct task_vma_head *vma_head)
+{
+	if (vma->list.next == &vma_head->list)
+		return 0;
+	return link_to_struct(vma->list.next, struct vm_area, list);
+}
+
+/* Recalculates the gap in front of a vma and updates the tree */
+static void vma_update_gap(struct vm_area *vma,
+			   struct task_vma_head *vma_head)
+{
+	struct vm_area *prev = vma_prev(vma, vma_head);
+
+	vma->gap = vma->pfn_start - (prev ? prev->pfn_end : 0);
+	rb_augment_path(&vma->rb, vma_augment);
+}
+
+/*
+ * Inserts a new vma to the task's vma tree and ordered list.
+ *
+ * The new vma is assumed to have been correctly set up not to intersect
+ * with any other existing vma.
+ */
+int task_insert_vma(struct vm_area *this, struct task_vma_head *vma_head)
+{
+	struct rb_node **link = &vma_head->tree.node;
+	struct rb_node *parent = 0, *prev;
+	struct vm_area *vma, *next;
+
+	while (*link) {
+		parent = *link;
+		vma = rb_to_vma(parent);
+
+		/*
+		 * Eliminate the possibility of intersection. Vmas
+		 * on either side of the new one are on this path.
+		 */
+		BUG_ON(set_intersection(this->pfn_start, this->pfn_end,
+					vma->pfn_start, vma->pfn_end));
+
+		if (this->pfn_start < vma->pfn_start)
+			link = &parent->left;
+		else
+			link = &parent->right;
+	}
+	rb_link_node(&this->rb, parent, link);
+
+	/* Add to the list right after the vma before it */
+	if ((prev = rb_prev(&this->rb)))
+		list_insert(&this->list, &rb_to_vma(prev)->list);
+	else
+		list_insert(&this->list, &vma_head->list);
+
+	/* Gap must be known before rebalancing */
+	vma = vma_prev(this, vma_head);
+	this->gap = this->pfn_start - (vma ? vma->pfn_end : 0);
+	rb_insert_color(&vma_head->tree, &this->rb, vma_augment);
+
+	/* The next vma now has a smaller gap in front of it */
+	if ((next = vma_next(this, vma_head)))
+		vma_update_gap(next, vma_head);
+
+	return 0;
+}
+
+/* Unlinks a vma from the task's vma tree and list */
+void task_remove_vma(struct vm_area *vma, struct task_vma_head *vma_head)
+{
+	struct vm_area *next = vma_next(vma, vma_head);
+
+	rb_erase(&vma_head->tree, &vma->rb, vma_augment);
+	list_remove(&vma->list);
+
+	/* The next vma now has a larger gap in front of it */
+	if (next)
+		vma_update_gap(next, vma_head);
+}
+
+/*
+ * Must be called after the range of a vma on the tree changes
+ * without changing its order, e.g. after it is shrunk.
+ */
+void task_update_vma(struct vm_area *vma, struct task_vma_head *vma_head)
+{
+	struct vm_area *next = vma_next(vma, vma_head);
+
+	vma_update_gap(vma, vma_head);
+	if (next)
+		vma_update_gap(next, vma_head);
+}
+
+/* Finds the vma that has the given address. */
+struct vm_area *find_vma(unsigned long addr, struct task_vma_head *vma_head)
+{
+	struct rb_node *node = vma_head->tree.node;
+	unsigned long pfn = __pfn(addr);
+	struct vm_area *vma;
+
+	while (node) {
+		vma = rb_to_vma(node);
+		if (pfn < vma->pfn_start)
+			node = node->left;
+		else if (pfn >= vma->pfn_end)
+			node = node->right;
+		else
+			return vma;
+	}
+	return 0;
+}
+
+/* Finds the lowest vma that intersects with given pfn range */
+struct vm_area *find_vma_range(unsigned long pfn_start, unsigned long pfn_end,
+			       struct task_vma_head *vma_head)
+{
+	struct rb_node *node = vma_head->tree.node;
+	struct vm_area *vma, *found = 0;
+
+	while (node) {
+		vma = rb_to_vma(node);
+		if (vma->pfn_end <= pfn_start) {
+			node = node->right;
+		} else {
+			/* Any lower one would intersect as well */
+			if (vma->pfn_start < pfn_end)
+				found = vma;
+			node = node->left;
+		}
+	}
+	return found;
+}
+
+/* Lowest pfn at or above both gap_start and pfn_low that is aligned */
+static inline unsigned long gap_fit_start(unsigned long gap_start,
+					  unsigned long pfn_low,
+					  unsigned long align)
+{
+	unsigned long start = gap_start < pfn_low ? pfn_low : gap_start;
+
+	return (start + align - 1) & ~(align - 1);
+}
+
+/*
+ * Finds the lowest free range of npages within pfn_low and pfn_high
+ * that no vma intersects with, starting at a multiple of align pages,
+ * which must be a power of two. Subtrees whose largest gap is too
+ * small are never visited. Returns the start pfn, or 0 if there's no
+ * space.
+ */
+unsigned long find_vma_gap(unsigned long npages, unsigned long align,
+			   unsigned long pfn_low, unsigned long pfn_high,
+			   struct task_vma_head *vma_head)
+{
+	unsigned long gap_start, gap_end, low_limit, high_limit, start;
+	struct rb_node *node, *prev;
+	struct vm_area *vma;
+
+	if (!npages || pfn_high < pfn_low || npages > pfn_high - pfn_low)
+		return 0;
+
+	/* Lowest possible end, and highest possible start */
+	low_limit = pfn_low + npages;
+	high_limit = pfn_high - npages;
+
+	node = vma_head->tree.node;
+	if (!node || vma_rb_max_gap(node) < npages)
+		goto check_highest;
+
+	vma = rb_to_vma(node);
+	for (;;) {
+		/* Lower gaps come first, if any of them may fit */
+		gap_end = vma->pfn_start;
+		if (gap_end >= low_limit &&
+		    vma_rb_max_gap(vma->rb.left) >= npages) {
+			vma = rb_to_vma(vma->rb.left);
+			continue;
+		}
+		gap_start = gap_end - vma->gap;
+
+check_current:
+		/* All gaps from here on are higher */
+		if (gap_start > high_limit)
+			return 0;
+		start = gap_fit_start(gap_start, pfn_low, align);
+		if (start <= high_limit && start + npages <= gap_end)
+			return start;
+
+		/* Then higher gaps, if any of them may fit */
+		if (vma_rb_max_gap(vma->rb.right) >= npages) {
+			vma = rb_to_vma(vma->rb.right);
+			continue;
+		}
+
+		/* Go up until we come up from a left subtree */
+		for (;;) {
+			prev = &vma->rb;
+			if (!(node = prev->parent))
+				goto check_highest;
+			vma = rb_to_vma(node);
+			if (prev == node->left) {
+				gap_end = vma->pfn_start;
+				gap_start = gap_end - vma->gap;
+				goto check_current;
+			}
+		}
+	}
+
+check_highest:
+	/* Space after the last vma */
+	node = rb_last(&vma_head->tree);
+	gap_start = node ? rb_to_vma(node)->pfn_end : 0;
+	start = gap_fit_start(gap_start, pfn_low, align);
+	if (gap_start > high_limit || start > high_limit)
+		return 0;
+
+	return start;
+}
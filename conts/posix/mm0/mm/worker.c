@@ -0,0 +1,232 @@
+/*
+ * A pool of worker threads that serve mm0 requests.
+ *
+ * The main thread receives all requests, and queues them for the
+ * workers, which reply to their senders themselves. A sender waits
+ * for its reply from the main thread, and the kernel takes it from
+ * any thread in its thread group, which the workers are created in.
+ *
+ * Requests that create or destroy tasks are served by the main
+ * thread after the workers have gone idle, as the kernel lets only
+ * the creator of a thread manage it, and they change the structures
+ * of several tasks at once. Others are served in parallel, under
+ * the locks in globals.h.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/macros.h>
+#include <l4/api/thread.h>
+#include <l4/api/ipc.h>
+#include <l4/api/errno.h>
+#include <l4lib/types.h>
+#include <l4lib/exregs.h>
+#include <l4lib/mutex.h>
+#include <l4lib/lib/thread.h>
+#include L4LIB_INC_ARCH(syscalls.h)
+#include L4LIB_INC_ARCH(syslib.h)
+#include <mem/lock.h>
+#include <stdio.h>
+#include <string.h>
+#include <worker.h>
+
+/* Notification bit that wakes a worker, or the main thread on drain */
+#define WORKER_NOTIFY_WAKEUP		1
+
+struct mm0_worker {
+	struct link list;	/* Entry on the idle list */
+	struct task_ids ids;
+};
+
+static struct worker_pool {
+	struct l4_mutex lock;
+	struct link pending;	/* Requests waiting for a worker */
+	struct link free;	/* Unused request slots */
+	struct link idle;	/* Workers waiting for a request */
+	int busy;		/* Workers serving a request */
+	int draining;		/* Main thread waits for all to finish */
+	int nworkers;
+	l4id_t main_tid;
+	struct mm0_worker worker[MM0_WORKERS];
+	struct mm0_request request[MM0_REQUESTS];
+} pool;
+
+/* Worker stacks and utcbs are in the bss, which is mapped from start */
+static unsigned long worker_stack[MM0_WORKERS]
+				 [MM0_WORKER_STACK_SIZE / sizeof(unsigned long)]
+				 ALIGN(8);
+static char worker_utcb[MM0_WORKERS][UTCB_SIZE] ALIGN(UTCB_SIZE);
+
+/* The page allocator and heap are shared by all workers */
+static L4_MUTEX(mem_mutex);
+
+static void mem_mutex_lock(void)
+{
+	l4_mutex_lock(&mem_mutex);
+}
+
+static void mem_mutex_unlock(void)
+{
+	l4_mutex_unlock(&mem_mutex);
+}
+
+static struct mem_lock_ops mm0_mem_lock_ops = {
+	.lock = mem_mutex_lock,
+	.unlock = mem_mutex_unlock,
+};
+
+static int worker_thread(void *arg)
+{
+	struct mm0_worker *w = arg;
+	struct mm0_request *req;
+
+	while (1) {
+		l4_mutex_lock(&pool.lock);
+		while (list_empty(&pool.pending)) {
+			/* May have been woken up for a request already taken */
+			if (list_empty(&w->list))
+				list_insert(&w->list, &pool.idle);
+			l4_mutex_unlock(&pool.lock);
+
+			/* Bits are kept if they are sent before we sleep */
+			l4_receive_notify(pool.main_tid, L4_TIMEOUT_NEVER);
+
+			l4_mutex_lock(&pool.lock);
+		}
+		req = link_to_struct(pool.pending.next,
+				     struct mm0_request, list);
+		list_remove_init(&req->list);
+		pool.busy++;
+		l4_mutex_unlock(&pool.lock);
+
+		handle_request(req);
+
+		l4_mutex_lock(&pool.lock);
+		list_insert(&req->list, &pool.free);
+		pool.busy--;
+		if (pool.draining && !pool.busy && list_empty(&pool.pending))
+			l4_notify(pool.main_tid, WORKER_NOTIFY_WAKEUP);
+		l4_mutex_unlock(&pool.lock);
+	}
+
+	return 0;
+}
+
+static int worker_create(struct mm0_worker *w, int i)
+{
+	unsigned long *stack = (void *)worker_stack[i] + MM0_WORKER_STACK_SIZE;
+	struct exregs_data exregs;
+	int err;
+
+	link_init(&w->list);
+
+	/* Same space, and same thread group so that it may reply for us */
+	l4_getid(&w->ids);
+	if ((err = l4_thread_control(THREAD_CREATE | TC_SHARE_SPACE |
+				     TC_SHARE_GROUP, &w->ids)) < 0)
+		return err;
+
+	/* See setup_new_thread */
+	stack[-1] = (unsigned long)w;
+	stack[-2] = (unsigned long)worker_thread;
+
+	memset(&exregs, 0, sizeof(exregs));
+	exregs_set_stack(&exregs, (unsigned long)stack);
+	exregs_set_utcb(&exregs, (unsigned long)worker_utcb[i]);
+	exregs_set_pc(&exregs, (unsigned long)setup_new_thread);
+	if ((err = l4_exchange_registers(&exregs, w->ids.tid)) < 0)
+		return err;
+
+	return l4_thread_control(THREAD_RUN, &w->ids);
+}
+
+void worker_pool_init(void)
+{
+	struct task_ids ids;
+	int err;
+
+	l4_mutex_init(&pool.lock);
+	link_init(&pool.pending);
+	link_init(&pool.free);
+	link_init(&pool.idle);
+
+	l4_getid(&ids);
+	pool.main_tid = ids.tid;
+
+	for (int i = 0; i < MM0_REQUESTS; i++) {
+		link_init(&pool.request[i].list);
+		list_insert(&pool.request[i].list, &pool.free);
+	}
+
+	/* Allocation must be locked before there's a second thread */
+	mem_lock_register(&mm0_mem_lock_ops);
+
+	for (int i = 0; i < MM0_WORKERS; i++) {
+		if ((err = worker_create(&pool.worker[i], i)) < 0) {
+			printf("%s: Could not create worker %d, err=%d. "
+			       "Continuing with %d.\n", __TASKNAME__, i,
+			       err, pool.nworkers);
+			break;
+		}
+		pool.nworkers++;
+	}
+}
+
+/* Returns a request slot, or 0 if the request is to be served inline */
+struct mm0_request *worker_request_new(void)
+{
+	struct mm0_request *req = 0;
+
+	if (!pool.nworkers)
+		return 0;
+
+	l4_mutex_lock(&pool.lock);
+	if (!list_empty(&pool.free)) {
+		req = link_to_struct(pool.free.next,
+				     struct mm0_request, list);
+		list_remove_init(&req->list);
+	}
+	l4_mutex_unlock(&pool.lock);
+
+	return req;
+}
+
+/* Queues a request and wakes up a worker for it, if one is idle */
+void worker_request_queue(struct mm0_request *req)
+{
+	struct mm0_worker *w = 0;
+
+	l4_mutex_lock(&pool.lock);
+	list_insert_tail(&req->list, &pool.pending);
+	if (!list_empty(&pool.idle)) {
+		w = link_to_struct(pool.idle.next, struct mm0_worker, list);
+		list_remove_init(&w->list);
+	}
+	l4_mutex_unlock(&pool.lock);
+
+	if (w)
+		l4_notify(w->ids.tid, WORKER_NOTIFY_WAKEUP);
+}
+
+/*
+ * Waits until all queued requests are served and workers are
+ * idle. Only the main thread queues requests, so none come in
+ * until it returns.
+ */
+void worker_pool_drain(void)
+{
+	if (!pool.nworkers)
+		return;
+
+	l4_mutex_lock(&pool.lock);
+	pool.draining = 1;
+	while (pool.busy || !list_empty(&pool.pending)) {
+		l4_mutex_unlock(&pool.lock);
+
+		/* Workers never send us ipcs, only notifications */
+		l4_receive_notify(pool.worker[0].ids.tid, L4_TIMEOUT_NEVER);
+
+		l4_mutex_lock(&pool.lock);
+	}
+	pool.draining = 0;
+	l4_mutex_unlock(&pool.lock);
+}
@@ -6,15 +6,12 @@
 #include "bit.h"
 #include <stdio.h>
 
-/* Emulation of ARM's CLZ (count leading zeroes) instruction */
+/* Count leading zeroes, a single CLZ instruction on ARMv5 and later */
 unsigned int __clz(unsigned int bitvector)
 {
-	unsigned int x = 0;
-	while((!(bitvector & ((unsigned)1 << 31))) && (x < 32)) {
-		bitvector <<= 1;
-		x++;
-	}
-	return x;
+	if (!bitvector)
+		return 32;
+	return __builtin_clz(bitvector);
 }
 
 int find_and_set_first_free_bit(u32 *word, unsigned int limit)
@@ -31,7 +28,6 @@ int find_and_set_first_free_bit(u32 *word, unsigned int limit)
 			break;
 		}
 	}
-
 	/* Return bit just set */
 	if (success)
 		return i;
@@ -39,7 +35,7 @@ int find_and_set_first_free_bit(u32 *word, unsigned int limit)
 		return -1;
 }
 
-int find_and_set_first_free_contig_bits(u32 *word, unsigned int limit,
+int find_and_set_first_free_contig_bits(u32 *word,  unsigned int limit,
 					int nbits)
 {
 	int i = 0, first = 0, last = 0, found = 0;
@@ -49,7 +45,7 @@ int find_and_set_first_free_contig_bits(u32 *word, unsigned int limit,
 		return -1;
 
 	/* This is a state machine that checks n contiguous free bits. */
-	while (i < limit) {
+	while (i + nbits <= limit) {
 		first = i;
 		last  = i;
 		while (!(word[BITWISE_GETWORD(last)] & BITWISE_GETBIT(last))) {
@@ -59,8 +55,6 @@ int find_and_set_first_free_contig_bits(u32 *word, unsigned int limit,
 				found = 1;
 				break;
 			}
-			if (i == limit)
-				break;
 		}
 		if (found)
 			break;
@@ -88,6 +82,18 @@ int check_and_clear_bit(u32 *word, int bit)
 	}
 }
 
+int check_and_set_bit(u32 *word, int bit)
+{
+	/* Check that bit was clear */
+	if (!(word[BITWISE_GETWORD(bit)] & BITWISE_GETBIT(bit))) {
+		word[BITWISE_GETWORD(bit)] |= BITWISE_GETBIT(bit);
+		return 0;
+	} else {
+		//printf("Trying to set already set bit\n");
+		return -1;
+	}
+}
+
 int check_and_clear_contig_bits(u32 *word, int first, int nbits)
 {
 	for (int i = first; i < first + nbits; i++)
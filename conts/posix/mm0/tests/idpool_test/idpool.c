@@ -7,31 +7,150 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/* Marks a bitmap word as full or not in the summary, after it changes */
+static inline void id_pool_summarize(struct id_pool *pool, int word)
+{
+	u32 *summary = id_pool_summary(pool);
+
+	if (pool->bitmap[word] == ~0U)
+		summary[BITWISE_GETWORD(word)] |= BITWISE_GETBIT(word);
+	else
+		summary[BITWISE_GETWORD(word)] &= ~BITWISE_GETBIT(word);
+}
+
+static inline void id_pool_summarize_range(struct id_pool *pool,
+					   int first, int numids)
+{
+	for (int w = BITWISE_GETWORD(first);
+	     w <= BITWISE_GETWORD(first + numids - 1); w++)
+		id_pool_summarize(pool, w);
+}
+
+/* Finds the first non-full bitmap word in [start, end), or -1 */
+static int id_pool_find_word(struct id_pool *pool, int start, int end)
+{
+	u32 *summary = id_pool_summary(pool);
+	u32 free;
+	int word;
+
+	for (int s = BITWISE_GETWORD(start); s * WORD_BITS < end; s++) {
+		free = ~summary[s];
+		if (s == BITWISE_GETWORD(start))
+			free &= ~0U << (start % WORD_BITS);
+		if (free) {
+			word = s * WORD_BITS + __ffs(free);
+			return word < end ? word : -1;
+		}
+	}
+	return -1;
+}
+
 struct id_pool *id_pool_new_init(int totalbits)
 {
-	int nwords = BITWISE_GETWORD(totalbits);
-	struct id_pool *new = calloc(1, (nwords * SZ_WORD)
-				      + sizeof(struct id_pool));
+	int nwords = BITWISE_GETWORD(totalbits) + 1;
+	struct id_pool *new = calloc(1, (nwords + ID_POOL_SUMMARY_WORDS(nwords))
+				     * SZ_WORD + sizeof(struct id_pool));
+	if (!new)
+		return 0;
+
 	new->nwords = nwords;
+	new->bitlimit = totalbits;
+
+	/* Ids past the limit are never given out */
+	new->bitmap[nwords - 1] = ~0U << (totalbits % WORD_BITS);
+	id_pool_summarize(new, nwords - 1);
+
 	return new;
 }
 
+/*
+ * Search for a free slot starting from the word of the last
+ * allocation, skipping over full words via the summary.
+ */
 int id_new(struct id_pool *pool)
 {
-	int id = find_and_set_first_free_bit(pool->bitmap,
-					     pool->nwords * WORD_BITS);
-	if (id < 0)
-		printf("%s: Warning! New id alloc failed\n", __FUNCTION__);
+	int word, id;
+
+	if ((word = id_pool_find_word(pool, pool->hint, pool->nwords)) < 0 &&
+	    (word = id_pool_find_word(pool, 0, pool->hint)) < 0)
+		return -1;
+
+	id = word * WORD_BITS + __ffs(~pool->bitmap[word]);
+	pool->bitmap[word] |= BITWISE_GETBIT(id);
+	id_pool_summarize(pool, word);
+	pool->hint = word;
+
 	return id;
 }
 
+/* Finds numids free ids within a word that is not full, or -1 */
+static inline int id_word_find_run(u32 word, int numids)
+{
+	u32 free = ~word;
+
+	/* A bit stays set if it starts a free run of numids */
+	for (int i = 1; i < numids && free; i++)
+		free &= free >> 1;
+
+	return free ? __ffs(free) : -1;
+}
+
+/*
+ * Finds numids contiguous free ids, allocates them and returns
+ * the first one. Goes a word at a time, carrying over the free
+ * run at the top of each word, and skipping full words.
+ */
+int id_new_range(struct id_pool *pool, int numids)
+{
+	int word = 0, run = 0, first = -1, bit;
+	u32 bits;
+
+	if (numids <= 0)
+		return -1;
+
+	while (word < pool->nwords) {
+		bits = pool->bitmap[word];
+
+		if (bits == ~0U) {
+			run = 0;
+			if ((word = id_pool_find_word(pool, word,
+						      pool->nwords)) < 0)
+				return -1;
+			continue;
+		}
+
+		/* Free run from the last word, extended by lowest bits */
+		if (run + (bits ? __ffs(bits) : WORD_BITS) >= numids) {
+			first = word * WORD_BITS - run;
+			break;
+		}
+
+		/* A run within this word */
+		if (numids <= WORD_BITS &&
+		    (bit = id_word_find_run(bits, numids)) >= 0) {
+			first = word * WORD_BITS + bit;
+			break;
+		}
+
+		/* Free run at the top carries over to next word */
+		run = bits ? __clz(bits) : run + WORD_BITS;
+		word++;
+	}
+	if (first < 0)
+		return -1;
+
+	for (int id = first; id < first + numids; id++)
+		pool->bitmap[BITWISE_GETWORD(id)] |= BITWISE_GETBIT(id);
+	id_pool_summarize_range(pool, first, numids);
+
+	return first;
+}
+
 /* This finds n contiguous free ids, allocates and returns the first one */
 int ids_new_contiguous(struct id_pool *pool, int numids)
 {
-	printf("%s: Enter\n", __FUNCTION__);
-	int id = find_and_set_first_free_contig_bits(pool->bitmap,
-						     pool->nwords *WORD_BITS,
-						     numids);
+	int id = id_new_range(pool, numids);
+
 	if (id < 0)
 		printf("%s: Warning! New id alloc failed\n", __FUNCTION__);
 	return id;
@@ -41,11 +160,13 @@ int ids_new_contiguous(struct id_pool *pool, int numids)
 int ids_del_contiguous(struct id_pool *pool, int first, int numids)
 {
 	int ret;
-	printf("bits: %d, first +nids: %d\n", pool->nwords *WORD_BITS, first+numids);
-	if (pool->nwords * WORD_BITS < first + numids)
+
+	if (pool->bitlimit < first + numids)
 		return -1;
-	if ((ret = check_and_clear_contig_bits(pool->bitmap, first, numids)))
-		printf("Warning!!!\n");
+	ret = check_and_clear_contig_bits(pool->bitmap, first, numids);
+	id_pool_summarize_range(pool, first, numids);
+	if (ret)
+		printf("%s: Error: Invalid argument range.\n", __FUNCTION__);
 	return ret;
 }
 
@@ -53,11 +174,43 @@ int id_del(struct id_pool *pool, int id)
 {
 	int ret;
 
-	if (pool->nwords * WORD_BITS < id)
+	if (pool->bitlimit <= id)
 		return -1;
 
 	if ((ret = check_and_clear_bit(pool->bitmap, id) < 0))
-		printf("Warning!!!\n");
+		printf("%s: Error: Could not delete id.\n", __FUNCTION__);
+	id_pool_summarize(pool, BITWISE_GETWORD(id));
 	return ret;
 }
 
+/* Return a specific id, if available */
+int id_get(struct id_pool *pool, int id)
+{
+	int ret;
+
+	if (pool->bitlimit <= id)
+		return -1;
+
+	ret = check_and_set_bit(pool->bitmap, id);
+	id_pool_summarize(pool, BITWISE_GETWORD(id));
+
+	if (ret < 0)
+		return ret;
+	else
+		return id;
+}
+
+int id_is_empty(struct id_pool *pool)
+{
+	int last = pool->nwords - 1;
+
+	for (int i = 0; i < last; i++)
+		if (pool->bitmap[i])
+			return 0;
+
+	/* Only the ids past the limit may be set in the last word */
+	if (pool->bitlimit < pool->nwords * WORD_BITS)
+		return pool->bitmap[last] ==
+		       ~0U << (pool->bitlimit % WORD_BITS);
+	return !pool->bitmap[last];
+}
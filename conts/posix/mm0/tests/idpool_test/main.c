@@ -4,55 +4,169 @@
 #include "bit.h"
 #include "idpool.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define CTOTAL	3
 
-int main(int argc, char *argv[])
+/* Same size as the kernel's thread and space id pools */
+#define BENCH_IDS	(1023 * 32)
+#define BENCH_ROUNDS	100000
+
+static double now(void)
 {
-	struct id_pool *pool = id_pool_new_init(64);
-	int id_array[64];
-	int first;
+	struct timespec ts;
 
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
 
-	if ((first = ids_new_contiguous(pool, 64)) < 0)
-		printf("%d contig ids not allocated.\n", 64);
-	else
-		printf("%d contig ids allocated starting from %d\n", 64, first);
+/* Checks allocations, ranges and frees against a byte per id */
+static int test_against_model(int total)
+{
+	struct id_pool *pool = id_pool_new_init(total);
+	char *used = calloc(1, total);
+	int id, n, first;
 
-	if (ids_del_contiguous(pool, 5, 60) == 0)
-		printf("%d contig ids freed with success.\n", 64);
-	else
-		printf("%d-%d contig ids could not be freed\n", 1, 65);
+	for (int i = 0; i < 20 * total; i++) {
+		switch (rand() % 4) {
+		case 0:
+		case 1:
+			if ((id = id_new(pool)) < 0) {
+				for (int j = 0; j < total; j++)
+					if (!used[j])
+						return -1;
+				break;
+			}
+			if (id >= total || used[id])
+				return -1;
+			used[id] = 1;
+			break;
+		case 2:
+			n = 1 + rand() % 70;
+			if ((first = id_new_range(pool, n)) < 0)
+				break;
+			if (first + n > total)
+				return -1;
+			for (int j = first; j < first + n; j++) {
+				if (used[j])
+					return -1;
+				used[j] = 1;
+			}
+			break;
+		case 3:
+			id = rand() % total;
+			if (used[id]) {
+				if (id_del(pool, id) < 0)
+					return -1;
+				used[id] = 0;
+			}
+			break;
+		}
+	}
+
+	for (int j = 0; j < total; j++)
+		if (used[j])
+			id_del(pool, j);
+	if (!id_is_empty(pool))
+		return -1;
+
+	free(used);
+	free(pool);
 	return 0;
 }
+
 /*
+ * Allocates and frees ids in a pool already filled to a given
+ * percentage, against a first-fit scan over a plain bitmap.
+ */
+static void bench_throughput(int percent)
+{
+	struct id_pool *pool = id_pool_new_init(BENCH_IDS);
+	u32 *flat = calloc(BITWISE_GETWORD(BENCH_IDS) + 1, SZ_WORD);
+	int *held = malloc(BENCH_IDS * sizeof(int));
+	int *flat_held = malloc(BENCH_IDS * sizeof(int));
+	int nheld = 0, slot;
+	double t, tflat, tpool;
+
+	/* Fill both, then free random ones down to the percentage */
+	for (int i = 0; i < BENCH_IDS; i++) {
+		held[nheld] = id_new(pool);
+		flat_held[nheld++] = find_and_set_first_free_bit(flat,
+								 BENCH_IDS);
+	}
+	while (nheld > BENCH_IDS / 100 * percent) {
+		slot = rand() % nheld--;
+		id_del(pool, held[slot]);
+		check_and_clear_bit(flat, flat_held[slot]);
+		held[slot] = held[nheld];
+		flat_held[slot] = flat_held[nheld];
+	}
+
+	/* Allocate one, then free a random held one */
+	srand(1);
+	t = now();
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		flat_held[nheld] = find_and_set_first_free_bit(flat,
+							       BENCH_IDS);
+		slot = rand() % (nheld + 1);
+		check_and_clear_bit(flat, flat_held[slot]);
+		flat_held[slot] = flat_held[nheld];
+	}
+	tflat = (now() - t) / BENCH_ROUNDS;
+
+	srand(1);
+	t = now();
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		held[nheld] = id_new(pool);
+		slot = rand() % (nheld + 1);
+		id_del(pool, held[slot]);
+		held[slot] = held[nheld];
+	}
+	tpool = (now() - t) / BENCH_ROUNDS;
+
+	printf("%3d%% used: id_new+id_del %4.0fns, flat first-fit %6.0fns, ",
+	       percent, tpool, tflat);
+
+	t = now();
+	for (int i = 0; i < BENCH_ROUNDS / 100; i++) {
+		if ((slot = id_new_range(pool, 8)) >= 0)
+			ids_del_contiguous(pool, slot, 8);
+	}
+	printf("id_new_range(8) %6.0fns\n",
+	       (now() - t) / (BENCH_ROUNDS / 100));
+
+	free(flat_held);
+	free(held);
+	free(flat);
+	free(pool);
+}
+
 int main(int argc, char *argv[])
 {
 	struct id_pool *pool = id_pool_new_init(64);
-	int id_array[64];
 	int first;
 
 
-	for (int i = 0; i < 64; i++) {
-		id_array[i] = id_new(pool);
-		printf("Allocated id: %d\n", id_array[i]);
-	}
-	if ((first = ids_new_contiguous(pool, CTOTAL)) < 0)
-		printf("%d contig ids not allocated as expected.\n", CTOTAL);
-
-	printf("Now freeing id_array[30 - 32]\n");
-	ids_del_contiguous(pool, id_array[30], 3);
-	ids_del_contiguous(pool, id_array[35], 9);
-	if ((first = ids_new_contiguous(pool, CTOTAL + 3)) < 0)
-		printf("%d contig ids not allocated.\n", CTOTAL + 3);
+	if ((first = ids_new_contiguous(pool, 64)) < 0)
+		printf("%d contig ids not allocated.\n", 64);
 	else
-		printf("%d contig ids allocated starting from %d\n", CTOTAL + 3, first);
+		printf("%d contig ids allocated starting from %d\n", 64, first);
 
-	if ((first = ids_new_contiguous(pool, CTOTAL)) < 0)
-		printf("Error: %d contig ids not allocated.\n", CTOTAL);
+	if (ids_del_contiguous(pool, 5, 59) == 0)
+		printf("%d contig ids freed with success.\n", 59);
 	else
-		printf("%d contig ids allocated as expected starting from %d\n", CTOTAL, first);
+		printf("%d-%d contig ids could not be freed\n", 5, 63);
+
+	for (int total = 1; total < 2000; total = total * 3 + 1)
+		if (test_against_model(total) < 0)
+			printf("Id pool of %d ids does not match model.\n",
+			       total);
+
+	for (int percent = 0; percent <= 90; percent += 30)
+		bench_throughput(percent);
+	bench_throughput(99);
 
 	return 0;
 }
-*/
@@ -0,0 +1 @@
+/* Build configuration is not needed on the host */
@@ -0,0 +1,191 @@
+/*
+ * Host test and benchmark for the pager's vma tree.
+ *
+ * Builds address spaces of 10 to 10000 vmas with random gaps,
+ * checks lookups, free area searches and removals against a
+ * linear walk of the vma list, and times them.
+ *
+ * gcc -std=gnu99 -O2 -fno-builtin -I. -I../../include \
+ *     -I../../../../../include main.c ../../mm/vma.c ../../lib/rbtree.c
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include "vm_area.h"
+#include <time.h>
+
+#define SPACE_PFNS	(1UL << 20)
+#define ROUNDS		100000
+
+static unsigned long seed = 1;
+
+static unsigned long rnd(void)
+{
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return seed >> 33;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* What find_vma() did before the tree */
+static struct vm_area *list_find_vma(unsigned long pfn,
+				     struct task_vma_head *head)
+{
+	struct vm_area *vma;
+
+	list_foreach_struct(vma, &head->list, list)
+		if (pfn >= vma->pfn_start && pfn < vma->pfn_end)
+			return vma;
+	return 0;
+}
+
+static unsigned long list_find_gap(unsigned long npages, unsigned long align,
+				   unsigned long low, unsigned long high,
+				   struct task_vma_head *head)
+{
+	unsigned long start = (low + align - 1) & ~(align - 1);
+	struct vm_area *vma;
+
+	list_foreach_struct(vma, &head->list, list) {
+		if (vma->pfn_end <= start)
+			continue;
+		if (vma->pfn_start >= start + npages)
+			break;
+		start = (vma->pfn_end + align - 1) & ~(align - 1);
+	}
+	return start + npages <= high ? start : 0;
+}
+
+/* Checks list order and gap bookkeeping of every vma */
+static void check_tree(struct task_vma_head *head)
+{
+	struct vm_area *vma, *prev = 0;
+	struct rb_node *node = rb_first(&head->tree);
+
+	list_foreach_struct(vma, &head->list, list) {
+		BUG_ON(&vma->rb != node);
+		BUG_ON(prev && prev->pfn_end > vma->pfn_start);
+		BUG_ON(vma->gap != vma->pfn_start -
+		       (prev ? prev->pfn_end : 0));
+		BUG_ON(vma->max_gap < vma->gap);
+		prev = vma;
+		node = rb_next(node);
+	}
+	BUG_ON(node);
+}
+
+static struct vm_area *vma_alloc(unsigned long start, unsigned long npages)
+{
+	struct vm_area *vma = calloc(1, sizeof(*vma));
+
+	link_init(&vma->list);
+	vma->pfn_start = start;
+	vma->pfn_end = start + npages;
+	return vma;
+}
+
+static void test_vmas(int nvmas)
+{
+	struct task_vma_head head;
+	struct vm_area **vmas = calloc(nvmas, sizeof(*vmas));
+	unsigned long stride = SPACE_PFNS / nvmas;
+	unsigned long pfn, npages, align, found;
+	double t, tlist, ttree;
+	int i, j;
+
+	link_init(&head.list);
+	rb_root_init(&head.tree);
+
+	/* Each vma somewhere in its own stride, inserted shuffled */
+	for (i = 0; i < nvmas; i++)
+		vmas[i] = vma_alloc(i * stride + rnd() % (stride / 2),
+				    1 + rnd() % (stride / 2));
+	for (i = nvmas - 1; i > 0; i--) {
+		struct vm_area *tmp = vmas[i];
+
+		j = rnd() % (i + 1);
+		vmas[i] = vmas[j];
+		vmas[j] = tmp;
+	}
+
+	t = now();
+	for (i = 0; i < nvmas; i++)
+		task_insert_vma(vmas[i], &head);
+	t = (now() - t) / nvmas;
+	check_tree(&head);
+
+	/* Lookups */
+	for (i = 0; i < ROUNDS / 10; i++) {
+		pfn = rnd() % SPACE_PFNS;
+		BUG_ON(find_vma(__pfn_to_addr(pfn), &head) !=
+		       list_find_vma(pfn, &head));
+	}
+	tlist = now();
+	for (i = 0, found = 0; i < ROUNDS; i++)
+		found += (unsigned long)list_find_vma(rnd() % SPACE_PFNS,
+						      &head);
+	tlist = (now() - tlist) / ROUNDS;
+	ttree = now();
+	for (i = 0; i < ROUNDS; i++)
+		found += (unsigned long)find_vma(__pfn_to_addr(rnd() %
+							       SPACE_PFNS),
+						 &head);
+	ttree = (now() - ttree) / ROUNDS;
+	printf("%6d vmas: insert %6.0fns, find_vma %8.0fns list, "
+	       "%4.0fns tree", nvmas, t, tlist, ttree);
+
+	/* Free area searches, also aligned as for large pages */
+	for (i = 0; i < ROUNDS / 10; i++) {
+		npages = 1 + rnd() % stride;
+		align = 1 << (rnd() % 9);
+		pfn = rnd() % (SPACE_PFNS / 2);
+		BUG_ON(find_vma_gap(npages, 1, pfn, SPACE_PFNS, &head) !=
+		       list_find_gap(npages, 1, pfn, SPACE_PFNS, &head));
+		BUG_ON(find_vma_gap(npages, align, pfn, SPACE_PFNS, &head) !=
+		       list_find_gap(npages, align, pfn, SPACE_PFNS, &head));
+	}
+	/* Larger than any gap between vmas, so only the top one fits */
+	npages = 2 * stride;
+	BUG_ON(find_vma_gap(npages, 1, 1, 2 * SPACE_PFNS, &head) !=
+	       list_find_gap(npages, 1, 1, 2 * SPACE_PFNS, &head));
+	tlist = now();
+	for (i = 0; i < ROUNDS / 10; i++)
+		found += list_find_gap(npages, 1, 1, 2 * SPACE_PFNS, &head);
+	tlist = (now() - tlist) / (ROUNDS / 10);
+	ttree = now();
+	for (i = 0; i < ROUNDS / 10; i++)
+		found += find_vma_gap(npages, 1, 1, 2 * SPACE_PFNS, &head);
+	ttree = (now() - ttree) / (ROUNDS / 10);
+	printf(", free area %8.0fns list, %4.0fns tree\n", tlist, ttree);
+
+	/* Shrink half of them, then remove all */
+	for (i = 0; i < nvmas; i += 2) {
+		if (vmas[i]->pfn_end - vmas[i]->pfn_start > 1) {
+			vmas[i]->pfn_end--;
+			task_update_vma(vmas[i], &head);
+		}
+	}
+	check_tree(&head);
+	for (i = 0; i < nvmas; i++) {
+		task_remove_vma(vmas[i], &head);
+		if (i % 64 == 0)
+			check_tree(&head);
+		free(vmas[i]);
+	}
+	BUG_ON(head.tree.node || !list_empty(&head.list));
+	free(vmas);
+	(void)found;
+}
+
+int main(int argc, char *argv[])
+{
+	for (int nvmas = 10; nvmas <= 10000; nvmas *= 10)
+		test_vmas(nvmas);
+
+	return 0;
+}
@@ -0,0 +1,2 @@
+/* Everything mm/vma.c needs from task.h is in vm_area.h */
+#include "vm_area.h"
@@ -0,0 +1,48 @@
+/*
+ * Minimal host definitions for building mm/vma.c
+ * in this test, in place of the pager's own headers.
+ */
+#ifndef __VMA_TEST_VM_AREA_H__
+#define __VMA_TEST_VM_AREA_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <l4/lib/list.h>
+#include <lib/rbtree.h>
+
+#define PAGE_BITS		12
+#define __pfn(x)		((unsigned long)(x) >> PAGE_BITS)
+#define __pfn_to_addr(x)	((unsigned long)(x) << PAGE_BITS)
+
+#undef BUG
+#undef BUG_ON
+#define BUG()			do { printf("BUG: %s:%d\n", __FILE__, \
+					    __LINE__); abort(); } while (0)
+#define BUG_ON(x)		do { if (x) BUG(); } while (0)
+
+struct task_vma_head {
+	struct link list;
+	struct rb_root tree;
+	int tcb_refs;
+};
+
+struct vm_area {
+	struct link list;
+	struct rb_node rb;
+	unsigned long gap;
+	unsigned long max_gap;
+	unsigned long pfn_start;
+	unsigned long pfn_end;
+};
+
+int task_insert_vma(struct vm_area *vma, struct task_vma_head *vma_head);
+void task_remove_vma(struct vm_area *vma, struct task_vma_head *vma_head);
+void task_update_vma(struct vm_area *vma, struct task_vma_head *vma_head);
+struct vm_area *find_vma(unsigned long addr, struct task_vma_head *vma_head);
+struct vm_area *find_vma_range(unsigned long pfn_start, unsigned long pfn_end,
+			       struct task_vma_head *vma_head);
+unsigned long find_vma_gap(unsigned long npages, unsigned long align,
+			   unsigned long pfn_low, unsigned long pfn_high,
+			   struct task_vma_head *vma_head);
+
+#endif /* __VMA_TEST_VM_AREA_H__ */
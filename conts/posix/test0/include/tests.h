@@ -28,5 +28,7 @@ int exectest(pid_t);
 int user_mutex_test(void);
 int small_io_test(void);
 int undeftest(void);
+int faultstorm(void);
+int zerocopy(void);
 
 #endif /* __TEST0_TESTS_H__ */
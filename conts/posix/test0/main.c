@@ -52,6 +52,10 @@ int main(int argc, char *argv[])
 
 	fileio();
 
+	zerocopy();
+
+	faultstorm();
+
 	forktest();
 
 	clonetest();
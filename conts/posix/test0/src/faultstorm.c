@@ -0,0 +1,100 @@
+/*
+ * Page fault storm from several processes at once.
+ *
+ * Forked clients each map a fresh anonymous area and fault in all
+ * of its pages, at the same time. The pager serves faults of
+ * different processes in parallel, so on smp the fault rate should
+ * go up with the clients, up to the cpus in the system. Each round
+ * prints a FAULT STORM line with the rate, to compare runs by.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4lib/ipcdefs.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <tests.h>
+
+#define FAULTSTORM_PAGES		256
+#define FAULTSTORM_CLIENTS_MAX		8
+
+/* Maps its area, waits for the start, faults it in and tells parent */
+static void faultstorm_client(pid_t parent)
+{
+	volatile char *area;
+	char sum = 0;
+
+	if (IS_ERR(area = mmap(0, FAULTSTORM_PAGES * PAGE_SIZE, PROT_READ,
+			       MAP_PRIVATE | MAP_ANONYMOUS, 0, 0)))
+		_exit(1);
+
+	if (l4_receive(parent) < 0)
+		_exit(1);
+
+	/* A read fault for each page */
+	for (int i = 0; i < FAULTSTORM_PAGES; i++)
+		sum += area[i * PAGE_SIZE];
+
+	/* They must all have read as zero */
+	l4_send(parent, sum ? 0 : L4_IPC_TAG_SYNC);
+	_exit(0);
+}
+
+/* Runs a round with nclients, and returns its time in microseconds */
+static int faultstorm_round(int nclients)
+{
+	pid_t parent = getpid(), child[FAULTSTORM_CLIENTS_MAX];
+	struct timeval start, end;
+	int err = 0;
+
+	for (int i = 0; i < nclients; i++) {
+		if ((child[i] = fork()) < 0)
+			return -1;
+		if (!child[i])
+			faultstorm_client(parent);
+	}
+
+	gettimeofday(&start, 0);
+
+	for (int i = 0; i < nclients; i++)
+		if (l4_send(child[i], L4_IPC_TAG_SYNC) < 0)
+			return -1;
+
+	for (int i = 0; i < nclients; i++)
+		if (l4_receive(child[i]) < 0 ||
+		    l4_get_tag() != L4_IPC_TAG_SYNC)
+			err = -1;
+
+	gettimeofday(&end, 0);
+
+	if (err < 0)
+		return err;
+
+	return (end.tv_sec - start.tv_sec) * 1000000 +
+	       end.tv_usec - start.tv_usec;
+}
+
+int faultstorm(void)
+{
+	int usec, faults;
+
+	for (int n = 1; n <= FAULTSTORM_CLIENTS_MAX; n *= 2) {
+		if ((usec = faultstorm_round(n)) < 0)
+			goto out_err;
+
+		faults = n * FAULTSTORM_PAGES;
+		printf("FAULT STORM clients=%d faults=%d usec=%d "
+		       "faults_per_msec=%d\n", n, faults, usec,
+		       usec ? faults * 1000 / usec : 0);
+	}
+
+	printf("FAULT STORM TEST    -- PASSED --\n");
+	return 0;
+
+out_err:
+	printf("FAULT STORM TEST    -- FAILED --\n");
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Page aligned read()/write() that map the page cache, against
+ * those that copy it.
+ *
+ * Whole pages of large page aligned transfers are mapped between the
+ * buffer and the page cache, others are copied. Each size is run with
+ * an aligned buffer, and with the same buffer a few bytes off page
+ * alignment to take the copy path. Reads go over a file that is in
+ * the cache, writes append to new files so that the buffer's pages
+ * can be handed over. Memfs keeps files in its own blocks, so writes
+ * to it are copied on both paths. Each prints a ZEROCOPY line with the
+ * times of both paths, to compare runs by.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <tests.h>
+#include <l4/macros.h>
+#include INC_GLUE(memory.h)
+
+/* The largest a memfs file may be is a little under 512KB */
+#define ZEROCOPY_FILE_SIZE	(PAGE_SIZE * 64)
+#define ZEROCOPY_TOTAL		SZ_4MB
+#define ZEROCOPY_MISALIGN	64
+
+static int zerocopy_sizes[] = {
+	PAGE_SIZE, PAGE_SIZE * 4, PAGE_SIZE * 16, PAGE_SIZE * 64
+};
+
+static int usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000 +
+	       end.tv_usec - start->tv_usec;
+}
+
+/* Each word of a file holds its own offset, plus a seed */
+static void zerocopy_fill(void *buf, int offset, int size, int seed)
+{
+	for (int i = 0; i < size; i += sizeof(int))
+		*(int *)(buf + i) = offset + i + seed;
+}
+
+static int zerocopy_check(void *buf, int offset, int size, int seed)
+{
+	for (int i = 0; i < size; i += sizeof(int))
+		if (*(int *)(buf + i) != offset + i + seed)
+			return -1;
+	return 0;
+}
+
+/* Reads the file in transfers of size, for ZEROCOPY_TOTAL bytes */
+static int zerocopy_read(int fd, void *buf, int size)
+{
+	struct timeval start;
+	int usec = 0;
+
+	for (int done = 0; done < ZEROCOPY_TOTAL; done += size) {
+		if (lseek(fd, done % ZEROCOPY_FILE_SIZE, SEEK_SET) < 0)
+			return -1;
+		gettimeofday(&start, 0);
+		if (read(fd, buf, size) != size)
+			return -1;
+		usec += usec_since(&start);
+		if (zerocopy_check(buf, done % ZEROCOPY_FILE_SIZE, size, 0))
+			return -1;
+	}
+
+	return usec;
+}
+
+/*
+ * Writes a new file in transfers of size, and reads it back. The
+ * buffer is filled before each write, as a producer would, which is
+ * not timed.
+ */
+static int zerocopy_write(char *path, void *buf, void *check, int size)
+{
+	struct timeval start;
+	int fd, usec = 0;
+
+	if ((fd = open(path, O_CREAT | O_TRUNC | O_RDWR, S_IRWXU)) < 0)
+		return -1;
+
+	for (int done = 0; done < ZEROCOPY_FILE_SIZE; done += size) {
+		zerocopy_fill(buf, done, size, 1);
+		gettimeofday(&start, 0);
+		if (write(fd, buf, size) != size)
+			goto out_err;
+		usec += usec_since(&start);
+	}
+
+	/* Read back by copy, the buffer is reused meanwhile */
+	zerocopy_fill(buf, 0, size, 2);
+	if (lseek(fd, 0, SEEK_SET) < 0 ||
+	    read(fd, check, ZEROCOPY_FILE_SIZE) != ZEROCOPY_FILE_SIZE ||
+	    zerocopy_check(check, 0, ZEROCOPY_FILE_SIZE, 1))
+		goto out_err;
+
+	close(fd);
+	return usec;
+
+out_err:
+	close(fd);
+	return -1;
+}
+
+/*
+ * A buffer that was read into keeps the data as it was read when the
+ * file is written after, and writing the buffer leaves the file.
+ */
+static int zerocopy_private(int fd, void *buf, void *check)
+{
+	int size = ZEROCOPY_FILE_SIZE;
+
+	if (lseek(fd, 0, SEEK_SET) < 0 || read(fd, buf, size) != size ||
+	    zerocopy_check(buf, 0, size, 0))
+		return -1;
+
+	zerocopy_fill(check, 0, size, 3);
+	if (lseek(fd, 0, SEEK_SET) < 0 || write(fd, check, size) != size ||
+	    zerocopy_check(buf, 0, size, 0))
+		return -1;
+
+	zerocopy_fill(buf, 0, size, 4);
+	if (lseek(fd, 0, SEEK_SET) < 0 || read(fd, check, size) != size ||
+	    zerocopy_check(check, 0, size, 3))
+		return -1;
+
+	return zerocopy_check(buf, 0, size, 4);
+}
+
+int zerocopy(void)
+{
+	int fd, size, copy_usec, map_usec;
+	void *buf, *check;
+	char path[32];
+
+	/* Buffers for aligned and misaligned transfers of a whole file */
+	if (IS_ERR(buf = mmap(0, ZEROCOPY_FILE_SIZE + PAGE_SIZE,
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, 0, 0)))
+		goto out_err;
+	if (IS_ERR(check = mmap(0, ZEROCOPY_FILE_SIZE + PAGE_SIZE,
+				PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, 0, 0)))
+		goto out_err;
+	check += ZEROCOPY_MISALIGN;
+
+	if ((fd = open("/zerocopy.dat", O_CREAT | O_TRUNC | O_RDWR,
+		       S_IRWXU)) < 0)
+		goto out_err;
+	zerocopy_fill(check, 0, ZEROCOPY_FILE_SIZE, 0);
+	if (write(fd, check, ZEROCOPY_FILE_SIZE) != ZEROCOPY_FILE_SIZE)
+		goto out_err;
+
+	for (int i = 0; i < sizeof(zerocopy_sizes) / sizeof(int); i++) {
+		size = zerocopy_sizes[i];
+		if ((copy_usec = zerocopy_read(fd, buf + ZEROCOPY_MISALIGN,
+					       size)) < 0 ||
+		    (map_usec = zerocopy_read(fd, buf, size)) < 0)
+			goto out_err;
+		printf("ZEROCOPY op=read size=%d total=%d copy_usec=%d "
+		       "zerocopy_usec=%d\n", size, ZEROCOPY_TOTAL,
+		       copy_usec, map_usec);
+	}
+
+	if (zerocopy_private(fd, buf, check) < 0)
+		goto out_err;
+	close(fd);
+
+	for (int i = 0; i < sizeof(zerocopy_sizes) / sizeof(int); i++) {
+		size = zerocopy_sizes[i];
+		sprintf(path, "/zerocopy%d.copy", i);
+		if ((copy_usec = zerocopy_write(path, buf + ZEROCOPY_MISALIGN,
+						check, size)) < 0)
+			goto out_err;
+		sprintf(path, "/zerocopy%d.map", i);
+		if ((map_usec = zerocopy_write(path, buf, check, size)) < 0)
+			goto out_err;
+		printf("ZEROCOPY op=write size=%d total=%d copy_usec=%d "
+		       "zerocopy_usec=%d\n", size, ZEROCOPY_FILE_SIZE,
+		       copy_usec, map_usec);
+	}
+
+	munmap(buf, ZEROCOPY_FILE_SIZE + PAGE_SIZE);
+	munmap(check - ZEROCOPY_MISALIGN, ZEROCOPY_FILE_SIZE + PAGE_SIZE);
+
+	printf("ZERO COPY IO TEST   -- PASSED --\n");
+	return 0;
+
+out_err:
+	printf("ZERO COPY IO TEST   -- FAILED --\n");
+	return 0;
+}
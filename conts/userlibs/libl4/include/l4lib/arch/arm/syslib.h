@@ -300,6 +300,47 @@ static inline int l4_receive(l4id_t from)
 	return l4_ipc(L4_NILTHREAD, from, 0);
 }
 
+/* As above, but give up with -ETIMEDOUT, see l4/api/timeout.h */
+static inline int l4_send_timeout(l4id_t to, unsigned int tag,
+				  unsigned int timeout)
+{
+	l4_set_tag(tag);
+
+	return l4_ipc(to, L4_NILTHREAD, L4_IPC_FLAGS_TIMEOUT(timeout));
+}
+
+static inline int l4_receive_timeout(l4id_t from, unsigned int timeout)
+{
+	return l4_ipc(L4_NILTHREAD, from, L4_IPC_FLAGS_TIMEOUT(timeout));
+}
+
+/*
+ * Sets notification bits on a thread, without waiting for it
+ * to receive them. See L4_IPC_FLAGS_NOTIFY.
+ */
+static inline int l4_notify(l4id_t to, unsigned int bits)
+{
+	write_mr(MR_NOTIFY, bits);
+
+	return l4_ipc(to, L4_NILTHREAD, L4_IPC_FLAGS_NOTIFY);
+}
+
+/*
+ * Receives either an ipc or notification bits, whichever comes
+ * first. Notifications have the L4_IPC_TAG_NOTIFY tag.
+ */
+static inline int l4_receive_notify(l4id_t from, unsigned int timeout)
+{
+	return l4_ipc(L4_NILTHREAD, from, L4_IPC_FLAGS_NOTIFY |
+		      L4_IPC_FLAGS_TIMEOUT(timeout));
+}
+
+/* Bits of an L4_IPC_TAG_NOTIFY receive */
+static inline unsigned int l4_get_notify(void)
+{
+	return read_mr(MR_NOTIFY);
+}
+
 static inline void l4_print_mrs()
 {
 	printf("Message registers: 0x%x, 0x%x, 0x%x, 0x%x, 0x%x, 0x%x\n",
@@ -0,0 +1,23 @@
+#ifndef __ARM_V6_UTCB_H__
+#define __ARM_V6_UTCB_H__
+
+static inline struct utcb *l4_get_utcb()
+{
+	struct utcb *utcb;
+
+	/*
+	 * Threads of a space may run on different cpus at
+	 * once, so the KIP's single utcb reference can't be
+	 * used. The kernel keeps the utcb of the thread that
+	 * runs on this cpu in the user read-only thread id
+	 * register during context switch.
+	 */
+	__asm__ __volatile__ (
+		"mrc	p15, 0, %0, c13, c0, 3\n"
+		: "=r" (utcb)
+	);
+
+	return utcb;
+}
+
+#endif /* __ARM_V6_UTCB_H__ */
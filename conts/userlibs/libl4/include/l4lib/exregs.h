@@ -8,6 +8,7 @@ void exregs_set_mr(struct exregs_data *s, int offset, unsigned long val);
 void exregs_set_pc(struct exregs_data *s, unsigned long pc);
 void exregs_set_pager(struct exregs_data *s, l4id_t pagerid);
 void exregs_set_utcb(struct exregs_data *s, unsigned long virt);
+void exregs_set_affinity(struct exregs_data *s, int cpu);
 void exregs_set_read(struct exregs_data *exregs);
 
 unsigned long exregs_get_utcb(struct exregs_data *s);
@@ -17,6 +17,7 @@
 /*
  * Tag 0 for L4_IPC_TAG_PFAULT
  * Tag 1 for L4_IPC_TAG_UNDEF_FAULT
+ * Tag 2 for L4_IPC_TAG_NOTIFY
  */
 
 /* For ping ponging */
@@ -72,6 +73,5 @@ extern l4id_t pagerid;
 /* For ipc to timer service (TODO: Shared mapping buffers???) */
 #define L4_IPC_TAG_TIMER_GETTIME				55
 #define L4_IPC_TAG_TIMER_SLEEP				56
-#define L4_IPC_TAG_TIMER_WAKE_THREADS		57
 
 #endif /* __IPCDEFS_H__ */
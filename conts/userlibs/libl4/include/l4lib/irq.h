@@ -3,5 +3,7 @@
 
 
 int l4_irq_wait(int slot, int irqnum);
+int l4_irq_wait_timeout(int slot, int irqnum, unsigned int timeout);
+int l4_irq_read(int slot);
 
 #endif /* __L4LIB_IRQ_H__ */
@@ -1,6 +1,8 @@
 #ifndef __IPC_H__
 #define __IPC_H__
 
+#include <l4/api/timeout.h>
+
 #define L4_NILTHREAD		0xFFFFFFFF
 #define L4_ANYTHREAD		0xFFFFFFFE
 
@@ -10,17 +12,33 @@
 #define L4_IPC_TAG_PFAULT		0
 #define L4_IPC_TAG_UNDEF_FAULT		1
 
-#define L4_IPC_FLAGS_TYPE_MASK		0x0000000F
+/* Notification bits were received, they are in MR_NOTIFY */
+#define L4_IPC_TAG_NOTIFY		2
+
+#define L4_IPC_FLAGS_TYPE_MASK		0x00000007
 #define L4_IPC_FLAGS_SHORT		0x00000000	/* Short IPC involves just primary message registers */
 #define L4_IPC_FLAGS_FULL		0x00000001	/* Full IPC involves full UTCB copy */
 #define L4_IPC_FLAGS_EXTENDED		0x00000002	/* Extended IPC can page-fault and copy up to 2KB */
 
+/*
+ * On send, ORs the bits in MR_NOTIFY into the receiver's notification
+ * word and returns without blocking. On receive, also wakes up with
+ * any notification bits that are set. Not for extended ipc.
+ */
+#define L4_IPC_FLAGS_NOTIFY		0x00000008
+
 /* Extended IPC extra fields */
 #define L4_IPC_FLAGS_MSG_INDEX_MASK	0x00000FF0	/* Index of message register with buffer pointer */
 #define L4_IPC_FLAGS_SIZE_MASK		0x0FFF0000
 #define L4_IPC_FLAGS_SIZE_SHIFT		16
 #define L4_IPC_FLAGS_MSG_INDEX_SHIFT	4
 
+/* Timeout of blocking send and receive, as in api/timeout.h */
+#define L4_IPC_FLAGS_TIMEOUT_MASK	0x0000F000
+#define L4_IPC_FLAGS_TIMEOUT_SHIFT	12
+#define L4_IPC_FLAGS_TIMEOUT(t)		\
+	(((t) & L4_TIMEOUT_MASK) << L4_IPC_FLAGS_TIMEOUT_SHIFT)
+
 
 #define L4_IPC_EXTENDED_MAX_SIZE	(SZ_1K*2)
 
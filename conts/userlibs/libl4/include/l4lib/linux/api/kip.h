@@ -71,6 +71,8 @@ struct kip {
 	u32 utcb;
 
 	struct kernel_descriptor kdesc;
+
+	u32 trace;	/* Address of kernel trace rings, 0 if none */
 } __attribute__((__packed__));
 
 
@@ -19,6 +19,7 @@
 #define TC_SHARE_SPACE		0x01000000 /* New thread, use given space */
 #define TC_COPY_SPACE		0x02000000 /* New thread, copy given space */
 #define TC_NEW_SPACE		0x04000000 /* New thread, new space */
+#define TC_WRITE_PROTECT	0x08000000 /* Copied space and original go read-only */
 
 /* #define THREAD_USER_MASK	0x000F0000 Reserved for userspace */
 #define THREAD_EXIT_MASK	0x0000FFFF /* Thread exit code */
@@ -0,0 +1,16 @@
+#ifndef __API_TIMEOUT_H__
+#define __API_TIMEOUT_H__
+
+/*
+ * Timeouts of blocking system calls, encoded in 4 bits so that
+ * they fit in the flags of each call. Other than never timing out
+ * or failing at once instead of blocking, a call may wait for a
+ * power of two milliseconds, from 1 up to 8192.
+ */
+#define L4_TIMEOUT_MASK			0xF
+#define L4_TIMEOUT_NEVER		0
+#define L4_TIMEOUT_POLL			1
+#define L4_TIMEOUT_MSEC_LOG2(x)		((x) + 2)
+#define L4_TIMEOUT_MSEC_LOG2_MAX	13
+
+#endif /* __API_TIMEOUT_H__ */
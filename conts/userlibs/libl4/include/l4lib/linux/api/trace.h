@@ -0,0 +1,62 @@
+#ifndef __API_TRACE_H__
+#define __API_TRACE_H__
+
+#include <l4lib/types.h>
+
+/*
+ * Kernel event trace, as laid out in the area that the kip's trace
+ * field points at. Each cpu writes its own ring of records without
+ * any locking, overwriting the oldest ones once it is full.
+ *
+ * A record's seq is its index since boot, or TRACE_SEQ_BUSY while
+ * it is being written. A reader copies a record out, and keeps it
+ * only if seq was the expected one both before and after the copy.
+ */
+#define TRACE_MAGIC		0x54524345	/* "TRCE" */
+#define TRACE_RING_ENTRIES	512		/* Must be a power of two */
+#define TRACE_SEQ_BUSY		0xFFFFFFFF
+
+/* Events, and what goes in their arguments */
+#define TRACE_SYSCALL_ENTRY	1	/* call offset, r0, r1, r2 */
+#define TRACE_SYSCALL_EXIT	2	/* call offset, return value */
+#define TRACE_IPC		3	/* sender, receiver, ipc flags, error */
+#define TRACE_SWITCH		4	/* next tid, next space id */
+#define TRACE_FAULT_ENTRY	5	/* fault address, fault status, pc */
+#define TRACE_FAULT_EXIT	6	/* fault address */
+#define TRACE_IRQ_ENTRY		7	/* irq number */
+#define TRACE_IRQ_EXIT		8	/* irq number */
+
+struct trace_entry {
+	u32 seq;
+	u32 stamp;	/* Clock source counts, or jiffies if there is none */
+	u16 event;
+	u16 cpu;
+	u32 tid;	/* Thread the kernel was entered from */
+	u32 arg[4];
+};
+
+struct trace_ring {
+	u32 head;	/* Seq of the next record to be written */
+	u32 reserved[7];
+	struct trace_entry entry[TRACE_RING_ENTRIES];
+};
+
+struct trace_info {
+	u32 magic;
+	u32 ncpu;		/* Rings that follow */
+	u32 entries;		/* Records in each ring */
+	u32 counts_per_usec;	/* Of stamps, 0 if they are jiffies */
+	u32 ticks_per_sec;
+	u32 reserved[3];
+};
+
+/* A ring for each cpu follows the info */
+struct trace_area {
+	struct trace_info info;
+	struct trace_ring ring[];
+};
+
+#define TRACE_AREA_SIZE(ncpu)	(sizeof(struct trace_info) +		\
+				 (ncpu) * sizeof(struct trace_ring))
+
+#endif /* __API_TRACE_H__ */
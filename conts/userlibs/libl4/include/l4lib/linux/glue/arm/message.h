@@ -69,6 +69,9 @@
 #define MR_UNUSED_TOTAL		(MR_TOTAL - MR_UNUSED_START)
 #define MR_USABLE_TOTAL		MR_UNUSED_TOTAL
 
+/* Notification bits, on notify sends and L4_IPC_TAG_NOTIFY receives */
+#define MR_NOTIFY		MR_UNUSED_START
+
 /* These are defined so that we don't hard-code register names */
 #define MR0_REGISTER		r3
 #define MR_RETURN_REGISTER	r3
@@ -20,6 +20,7 @@ struct l4_mutex {
 
 void l4_mutex_init(struct l4_mutex *m);
 int l4_mutex_lock(struct l4_mutex *m);
+int l4_mutex_lock_timeout(struct l4_mutex *m, unsigned int timeout);
 int l4_mutex_unlock(struct l4_mutex *m);
 
 #endif
@@ -0,0 +1,15 @@
+/*
+ * Reading the kernel's event trace.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __L4LIB_TRACE_H__
+#define __L4LIB_TRACE_H__
+
+#include <l4lib/types.h>
+#include <l4/api/trace.h>
+
+struct trace_area *l4_trace_area(void);
+int l4_trace_read(int cpu, u32 *seq, struct trace_entry *buf, int max);
+
+#endif /* __L4LIB_TRACE_H__ */
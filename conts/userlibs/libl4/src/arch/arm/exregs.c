@@ -85,6 +85,13 @@ void exregs_set_utcb(struct exregs_data *s, unsigned long virt)
 	s->flags |= EXREGS_SET_UTCB;
 }
 
+/* Pins thread to cpu, or unpins it if cpu is negative */
+void exregs_set_affinity(struct exregs_data *s, int cpu)
+{
+	s->affinity = cpu;
+	s->flags |= EXREGS_SET_AFFINITY;
+}
+
 void exregs_set_stack(struct exregs_data *s, unsigned long sp)
 {
 	s->context.sp = sp;
@@ -3,21 +3,38 @@
  *
  * Copyright (C) 2009 B Labs Ltd.
  */
+#include <l4lib/irq.h>
 #include L4LIB_INC_ARCH(irq.h)
 #include L4LIB_INC_ARCH(syscalls.h)
 #include <l4/api/irq.h>
+#include <l4/api/timeout.h>
 
 /*
  * Reads the irq notification slot. Destructive atomic read ensures that
  * an irq may write to the slot in sync.
  */
 int l4_irq_wait(int slot, int irqnum)
+{
+	return l4_irq_wait_timeout(slot, irqnum, L4_TIMEOUT_NEVER);
+}
+
+/* Same as above, but gives up with -ETIMEDOUT. See l4/api/timeout.h */
+int l4_irq_wait_timeout(int slot, int irqnum, unsigned int timeout)
 {
 	int irqval = l4_atomic_dest_readb(&(l4_get_utcb()->notify[slot]));
 
 	if (!irqval)
-		return l4_irq_control(IRQ_CONTROL_WAIT, 0, irqnum);
+		return l4_irq_control(IRQ_CONTROL_WAIT, timeout, irqnum);
 	else
 		return irqval;
 }
 
+
+/*
+ * Takes the irq count of a slot without waiting, for threads
+ * that get irqs as notification bits, i.e. bit (1 << slot).
+ */
+int l4_irq_read(int slot)
+{
+	return l4_atomic_dest_readb(&(l4_get_utcb()->notify[slot]));
+}
@@ -224,7 +224,10 @@ int thread_wait(struct l4_thread *thread)
 }
 
 /*
- * Create a new thread in the same address space as caller
+ * Create a new thread in the same address space as caller, or in a
+ * copy of it. A copied space maps the same pages as the caller at
+ * the time of the copy, so the stack and utcb allocated here are
+ * valid in it as well.
  */
 int thread_create(int (*func)(void *), void *args, unsigned int flags,
 		  struct l4_thread **tptr)
@@ -233,10 +236,10 @@ int thread_create(int (*func)(void *), void *args, unsigned int flags,
 	struct l4_thread *thread;
 	int err;
 
-	/* Shared space only */
-	if (!(TC_SHARE_SPACE & flags)) {
+	/* Shared or copied space only */
+	if (!(flags & (TC_SHARE_SPACE | TC_COPY_SPACE))) {
 		printf("%s: Warning - This function allows only "
-		       "shared space thread creation.\n",
+		       "shared or copied space thread creation.\n",
 		       __FUNCTION__);
 		return -EINVAL;
 	}
@@ -245,7 +248,7 @@ int thread_create(int (*func)(void *), void *args, unsigned int flags,
 	if (IS_ERR(thread = l4_thread_alloc_init()))
 		return (int)thread;
 
-	/* Assign own space id since TC_SHARE_SPACE requires it */
+	/* Assign own ids, to share or copy the space from */
 	l4_getid(&thread->ids);
 
 	/* Create thread in kernel */
@@ -7,6 +7,7 @@
 #include <l4lib/types.h>
 #include L4LIB_INC_ARCH(syscalls.h)
 #include L4LIB_INC_ARCH(syslib.h)
+#include <l4/api/errno.h>
 
 /*
  * NOTES:
@@ -59,19 +60,30 @@ void l4_mutex_init(struct l4_mutex *m)
 	m->lock = L4_MUTEX_UNLOCKED;
 }
 
-int l4_mutex_lock(struct l4_mutex *m)
+/*
+ * Gives up with -ETIMEDOUT if the lock is not granted within the
+ * timeout of a contended attempt. See l4/api/timeout.h
+ */
+int l4_mutex_lock_timeout(struct l4_mutex *m, unsigned int timeout)
 {
 	int err;
 
 	while(__l4_mutex_lock(&m->lock) != L4_MUTEX_SUCCESS) {
-		if ((err = l4_mutex_control(&m->lock, L4_MUTEX_LOCK)) < 0) {
-			printf("%s: Error: %d\n", __FUNCTION__, err);
+		if ((err = l4_mutex_control(&m->lock, L4_MUTEX_LOCK |
+					    L4_MUTEX_TIMEOUT(timeout))) < 0) {
+			if (err != -ETIMEDOUT)
+				printf("%s: Error: %d\n", __FUNCTION__, err);
 			return err;
 		}
 	}
 	return 0;
 }
 
+int l4_mutex_lock(struct l4_mutex *m)
+{
+	return l4_mutex_lock_timeout(m, L4_TIMEOUT_NEVER);
+}
+
 int l4_mutex_unlock(struct l4_mutex *m)
 {
 	int err, contended;
@@ -0,0 +1,67 @@
+/*
+ * Reading the kernel's event trace, see l4/api/trace.h.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4lib/trace.h>
+#include <l4lib/kip.h>
+#include L4LIB_INC_ARCH(utcb.h)
+#include <l4/api/errno.h>
+
+/* Trace rings as mapped by the kernel, 0 if it does not trace */
+struct trace_area *l4_trace_area(void)
+{
+	struct trace_area *trace = (struct trace_area *)kip->trace;
+
+	if (!trace || trace->info.magic != TRACE_MAGIC)
+		return 0;
+	return trace;
+}
+
+/*
+ * Copies up to max records of a cpu into buf, starting from the
+ * one with the given seq, and advances seq past them. Records that
+ * were overwritten before they could be read are skipped, so seq
+ * may move further than the records returned.
+ */
+int l4_trace_read(int cpu, u32 *seq, struct trace_entry *buf, int max)
+{
+	struct trace_area *trace = l4_trace_area();
+	volatile struct trace_entry *entry;
+	struct trace_ring *ring;
+	u32 head;
+	int n = 0;
+
+	if (!trace)
+		return -ENODEV;
+	if (cpu < 0 || cpu >= trace->info.ncpu)
+		return -EINVAL;
+
+	ring = &trace->ring[cpu];
+	head = *(volatile u32 *)&ring->head;
+
+	/* Those older than a ring full are gone */
+	if (head - *seq > TRACE_RING_ENTRIES)
+		*seq = head - TRACE_RING_ENTRIES;
+
+	for (; *seq != head && n < max; (*seq)++) {
+		entry = &ring->entry[*seq & (TRACE_RING_ENTRIES - 1)];
+		if (entry->seq != *seq)
+			continue;
+
+		buf[n].seq = entry->seq;
+		buf[n].stamp = entry->stamp;
+		buf[n].event = entry->event;
+		buf[n].cpu = entry->cpu;
+		buf[n].tid = entry->tid;
+		for (int i = 0; i < 4; i++)
+			buf[n].arg[i] = entry->arg[i];
+
+		/* Overwritten while it was copied */
+		if (entry->seq != *seq)
+			continue;
+		n++;
+	}
+
+	return n;
+}
@@ -25,6 +25,7 @@ void init_page_allocator(unsigned long start, unsigned long end);
 
 /* Page allocation functions */
 void *alloc_page(int quantity);
+void *alloc_page_aligned(int quantity, int align);
 int free_page(void *paddr);
 
 #endif /* __ALLOC_PAGE_H__ */
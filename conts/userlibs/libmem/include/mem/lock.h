@@ -0,0 +1,36 @@
+/*
+ * Locking of the page allocator and the heap, for users that
+ * allocate from more than one thread.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __MEM_LOCK_H__
+#define __MEM_LOCK_H__
+
+struct mem_lock_ops {
+	void (*lock)(void);
+	void (*unlock)(void);
+};
+
+/* Unset, allocation is not locked at all */
+extern struct mem_lock_ops *mem_lock_ops;
+
+/* Must be done before a second thread starts allocating */
+static inline void mem_lock_register(struct mem_lock_ops *ops)
+{
+	mem_lock_ops = ops;
+}
+
+static inline void mem_lock(void)
+{
+	if (mem_lock_ops)
+		mem_lock_ops->lock();
+}
+
+static inline void mem_unlock(void)
+{
+	if (mem_lock_ops)
+		mem_lock_ops->unlock();
+}
+
+#endif /* __MEM_LOCK_H__ */
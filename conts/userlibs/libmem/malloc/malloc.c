@@ -19,6 +19,7 @@ Messages that indicate a software error will contain three asterisks (***).
 #include <string.h> /* memcpy(), memset() */
 #include <stdio.h> /* printf() */
 #include <l4/macros.h>
+#include <mem/lock.h>
 #define	_32BIT	1
 
 /* use small (32K) heap for 16-bit compilers,
@@ -128,7 +129,7 @@ static void *kbrk(int *delta)
 /*****************************************************************************
 kmalloc() and kfree() use g_heap_bot, but not g_kbrk nor g_heap_top
 *****************************************************************************/
-void *kmalloc(size_t size)
+static void *__kmalloc(size_t size)
 {
 	unsigned total_size;
 	malloc_t *m, *n;
@@ -205,9 +206,20 @@ create a new, free block */
 	return (char *)n + sizeof(malloc_t);
 }
 
+/* BB: Addition: heap may be shared by threads, see mem/lock.h */
+void *kmalloc(size_t size)
+{
+	void *blk;
+
+	mem_lock();
+	blk = __kmalloc(size);
+	mem_unlock();
+
+	return blk;
+}
 /*****************************************************************************
 *****************************************************************************/
-void kfree(void *blk)
+static void __kfree(void *blk)
 {
 	malloc_t *m, *n;
 
@@ -262,6 +274,12 @@ Hard to spell, hard to do */
 		}
 	}
 }
+void kfree(void *blk)
+{
+	mem_lock();
+	__kfree(blk);
+	mem_unlock();
+}
 /*****************************************************************************
 *****************************************************************************/
 void *krealloc(void *blk, size_t size)
@@ -10,6 +10,7 @@
 #include <l4/types.h>
 #include <l4/lib/list.h>
 #include <mem/alloc_page.h>
+#include <mem/lock.h>
 #include INC_GLUE(memory.h)
 #include INC_SUBARCH(mm.h)
 #include INC_GLUE(memlayout.h)
@@ -19,6 +20,11 @@
 
 struct page_allocator allocator;
 
+/* Shared with the heap, see mem/lock.h */
+struct mem_lock_ops *mem_lock_ops;
+
+static int find_and_free_page_area(void *addr, struct page_allocator *p);
+
 /*
  * Allocate a new page area from the page area cache
  */
@@ -71,6 +77,70 @@ get_free_page_area(int quantity, struct page_allocator *p)
 	return 0;
 }
 
+/*
+ * Finds a free region with a block of @quantity pages aligned to
+ * @align pages, and divides it so that each page of the block has
+ * its own area. The pages can then be freed one by one.
+ */
+static struct page_area *
+get_free_page_area_aligned(int quantity, int align, struct page_allocator *p)
+{
+	struct page_area *new, *area;
+	unsigned int pfn, end;
+
+	if (quantity <= 0 || align <= 0 || (align & (align - 1)))
+		return 0;
+
+	list_foreach_struct(area, &p->page_area_list, list) {
+		if (area->used || area->numpages < quantity)
+			continue;
+
+		/* Highest aligned block, as areas are divided from the top */
+		end = area->pfn + area->numpages;
+		pfn = (end - quantity) & ~(align - 1);
+		if (pfn < area->pfn)
+			continue;
+
+		/* Free remainder above the block */
+		if (end > pfn + quantity) {
+			new = new_page_area(p);
+			new->pfn = pfn + quantity;
+			new->numpages = end - new->pfn;
+			new->used = 0;
+			link_init(&new->list);
+			list_insert(&new->list, &area->list);
+		}
+
+		/* Pages of the block but the first, inserted top down */
+		for (int i = quantity - 1; i > 0; i--) {
+			new = new_page_area(p);
+			new->pfn = pfn + i;
+			new->numpages = 1;
+			new->used = 1;
+			link_init(&new->list);
+			list_insert(&new->list, &area->list);
+		}
+
+		/* First page takes over the area if there's nothing below */
+		if (pfn == area->pfn) {
+			area->numpages = 1;
+			area->used = 1;
+			return area;
+		}
+
+		new = new_page_area(p);
+		new->pfn = pfn;
+		new->numpages = 1;
+		new->used = 1;
+		link_init(&new->list);
+		list_insert(&new->list, &area->list);
+		area->numpages = pfn - area->pfn;
+		return new;
+	}
+
+	/* No more pages */
+	return 0;
+}
 
 /*
  * All physical memory is tracked by a simple linked list implementation. A
@@ -128,24 +198,22 @@ void init_page_allocator(unsigned long start, unsigned long end)
 }
 
 /*
- * Check if we're about to run out of free page area structures.
- * If so, allocate a new cache of page areas.
+ * Makes sure there are at least @count free page area structures,
+ * allocating new caches of page areas as needed. At least one must
+ * be free on entry, for dividing an area for the new cache.
  */
-int check_page_areas(struct page_allocator *p)
+static int reserve_page_areas(struct page_allocator *p, int count)
 {
 	struct page_area *new;
 	struct mem_cache *newcache;
 
-	/* If only one free area left */
-	if (p->pga_free == 1) {
+	while (p->pga_free < count) {
+		BUG_ON(p->pga_free < 1);
 
-		/* Use that area to allocate a new page */
+		/* Use a free area to allocate a new page */
 		if (!(new = get_free_page_area(1, p)))
 			return -1;	/* Out of memory */
 
-		/* Free page areas must now be reduced to 0 */
-		BUG_ON(p->pga_free != 0);
-
 		/* Initialise it as a new source of page area structures */
 		newcache = mem_cache_init(phys_to_virt((void *)__pfn_to_addr(new->pfn)),
 					  PAGE_SIZE, sizeof(struct page_area), 0);
@@ -166,16 +234,29 @@ int check_page_areas(struct page_allocator *p)
 	return 0;
 }
 
+/*
+ * Check if we're about to run out of free page area structures.
+ * If so, allocate a new cache of page areas.
+ */
+int check_page_areas(struct page_allocator *p)
+{
+	return reserve_page_areas(p, 2);
+}
+
 void *alloc_page(int quantity)
 {
 	struct page_area *new;
 
+	mem_lock();
+
 	/*
 	 * First make sure we have enough page
 	 * area structures in the cache
 	 */
-	if (check_page_areas(&allocator) < 0)
+	if (check_page_areas(&allocator) < 0) {
+		mem_unlock();
 		return 0; /* Out of memory */
+	}
 
 	/*
 	 * Now allocate the actual pages, using the available
@@ -183,10 +264,37 @@ void *alloc_page(int quantity)
 	 */
 	new = get_free_page_area(quantity, &allocator);
 
+	mem_unlock();
+
+	if (!new)
+		return 0;
+
 	/* Return physical address */
 	return (void *)__pfn_to_addr(new->pfn);
 }
 
+/*
+ * Allocates @quantity pages starting at a multiple of @align pages,
+ * e.g. to be mapped as a large page. Each page is freed on its own.
+ */
+void *alloc_page_aligned(int quantity, int align)
+{
+	struct page_area *new = 0;
+
+	mem_lock();
+
+	/* A page area for each page, and up to two for the remainders */
+	if (reserve_page_areas(&allocator, quantity + 2) == 0)
+		new = get_free_page_area_aligned(quantity, align, &allocator);
+
+	mem_unlock();
+
+	if (!new)
+		return 0;
+
+	return (void *)__pfn_to_addr(new->pfn);
+}
+
 
 /* Merges two page areas, frees area cache if empty, returns the merged area. */
 struct page_area *merge_free_areas(struct page_area *before,
@@ -206,7 +314,7 @@ struct page_area *merge_free_areas(struct page_area *before,
 	/* Recursively free the cache page */
 	if (mem_cache_is_empty(c)) {
 		list_remove(&c->list);
-		if (free_page(virt_to_phys(c)) < 0) {
+		if (find_and_free_page_area(virt_to_phys(c), &allocator) < 0) {
 			printf("Page ptr: 0x%lx, virt_to_phys = 0x%lx\n"
 			       "Page not found in cache.\n",
 			       (unsigned long)c, (unsigned long)virt_to_phys(c));
@@ -246,6 +354,12 @@ found:
 
 int free_page(void *paddr)
 {
-	return find_and_free_page_area(paddr, &allocator);
+	int ret;
+
+	mem_lock();
+	ret = find_and_free_page_area(paddr, &allocator);
+	mem_unlock();
+
+	return ret;
 }
 
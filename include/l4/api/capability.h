@@ -50,6 +50,7 @@
  */
 struct capability {
 	struct link list;
+	struct link index;	/* Kernel lookup index, see cap_list */
 
 	/* Capability identifiers */
 	l4id_t capid;		/* Unique capability ID */
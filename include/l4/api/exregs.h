@@ -14,6 +14,7 @@
 #define EXREGS_SET_PAGER		1
 #define	EXREGS_SET_UTCB			2
 #define EXREGS_READ			4
+#define EXREGS_SET_AFFINITY		8
 
 #define EXREGS_VALID_REGULAR_REGS 			\
 	(FIELD_TO_BIT(exregs_context_t, r0) |		\
@@ -44,6 +45,7 @@ struct exregs_data {
 	u32 flags;
 	l4id_t pagerid;
 	unsigned long utcb_address;
+	int affinity;		/* Cpu to pin to, or negative to unpin */
 };
 
 
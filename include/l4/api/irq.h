@@ -4,7 +4,7 @@
 
 #define IRQ_CONTROL_REGISTER		0
 #define IRQ_CONTROL_RELEASE		1
-#define IRQ_CONTROL_WAIT		2
+#define IRQ_CONTROL_WAIT		2	/* Flags give the timeout */
 
 
 #endif /* __API_IRQ_H__ */
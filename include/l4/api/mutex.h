@@ -1,6 +1,8 @@
 #ifndef __MUTEX_CONTROL_H__
 #define __MUTEX_CONTROL_H__
 
+#include <l4/api/timeout.h>
+
 /* Request ids for mutex_control syscall */
 
 #if defined (__KERNEL__)
@@ -11,6 +13,8 @@
 
 #define mutex_operation(x)	((x) & MUTEX_CONTROL_OPMASK)
 #define mutex_contenders(x)	((x) & ~MUTEX_CONTROL_OPMASK)
+#define mutex_timeout(x)	\
+	(((x) & L4_MUTEX_TIMEOUT_MASK) >> L4_MUTEX_TIMEOUT_SHIFT)
 
 #include <l4/lib/wait.h>
 #include <l4/lib/list.h>
@@ -30,9 +34,12 @@ struct mutex_queue {
 };
 
 /*
- * Mutex queue head keeps the list of all userspace mutexes.
+ * Mutex queue head keeps all userspace mutexes, hashed by
+ * their physical address into buckets. Mutexes in different
+ * buckets never contend with each other in the kernel.
  *
- * Here, mutex_control_mutex is a single lock for:
+ * Here, each bucket's mutex_control_mutex is a single lock
+ * for the mutex queues in that bucket, for:
  * (1) Mutex_queue create/deletion
  * (2) List add/removal.
  * (3) Wait synchronization:
@@ -40,12 +47,19 @@ struct mutex_queue {
  *       rendezvous inspection to occur atomically. Currently
  *       it's not done since we rely on this mutex for that.
  */
-struct mutex_queue_head {
+#define MUTEX_HASH_BITS		5
+#define MUTEX_HASH_BUCKETS	(1 << MUTEX_HASH_BITS)
+
+struct mutex_queue_bucket {
 	struct link list;
 	struct mutex mutex_control_mutex;
 	int count;
 };
 
+struct mutex_queue_head {
+	struct mutex_queue_bucket bucket[MUTEX_HASH_BUCKETS];
+};
+
 void init_mutex_queue_head(struct mutex_queue_head *mqhead);
 
 #endif
@@ -54,4 +68,10 @@ void init_mutex_queue_head(struct mutex_queue_head *mqhead);
 #define L4_MUTEX_LOCK		0x10000000
 #define L4_MUTEX_UNLOCK		0x20000000
 
+/* Timeout of a contended lock, as in api/timeout.h */
+#define L4_MUTEX_TIMEOUT_MASK	0x0F000000
+#define L4_MUTEX_TIMEOUT_SHIFT	24
+#define L4_MUTEX_TIMEOUT(t)	\
+	(((t) & L4_TIMEOUT_MASK) << L4_MUTEX_TIMEOUT_SHIFT)
+
 #endif /* __MUTEX_CONTROL_H__*/
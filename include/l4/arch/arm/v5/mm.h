@@ -35,6 +35,12 @@
 #define PTE_TYPE_SMALL				2
 #define PTE_TYPE_TINY				3
 
+/* Large pages take up this many replicated ptes in a pmd */
+#define LARGE_PAGE_SIZE				SZ_64K
+#define LARGE_PAGE_MASK				(LARGE_PAGE_SIZE - 1)
+#define LARGE_PAGE_PTES				(LARGE_PAGE_SIZE / ARM_PAGE_SIZE)
+#define SECTION_PAGES				(SECTION_SIZE / ARM_PAGE_SIZE)
+
 /* Permission field offsets */
 #define SECTION_AP0				10
 
@@ -106,6 +112,9 @@ typedef struct pmd_table {
 #define __MAP_USR_IO	(uncacheable | unbufferable | (SVC_RW_USR_RW << PAGE_AP0)	\
 			| (SVC_RW_USR_RW << PAGE_AP1) | (SVC_RW_USR_RW << PAGE_AP2)	\
 			| (SVC_RW_USR_RW << PAGE_AP3))
+#define __MAP_USR_RO_IO	(uncacheable | unbufferable | (SVC_RW_USR_RO << PAGE_AP0)	\
+			| (SVC_RW_USR_RO << PAGE_AP1) | (SVC_RW_USR_RO << PAGE_AP2)	\
+			| (SVC_RW_USR_RO << PAGE_AP3))
 
 /* There is no execute bit in ARMv5, so we ignore it */
 #define __MAP_USR_RWX	__MAP_USR_RW
@@ -40,4 +40,14 @@ static inline void cpu_startup(void)
 
 }
 
+/* Sleeps the cpu until an irq is pending, even if irqs are masked */
+static inline void cpu_idle_wait(void)
+{
+	__asm__ __volatile__ (
+		"mcr  p15, 0, %0, c7, c0, 4\n"
+		:
+		: "r" (0)
+	);
+}
+
 #endif /* __V6_CPU_H__ */
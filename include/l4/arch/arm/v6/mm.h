@@ -1,10 +1,10 @@
 /*
- * ARM v5-specific virtual memory details
+ * ARM v6-specific virtual memory details
  *
  * Copyright (C) 2007 Bahadir Balban
  */
-#ifndef __V5_MM_H__
-#define __V5_MM_H__
+#ifndef __V6_MM_H__
+#define __V6_MM_H__
 
 /* ARM specific definitions */
 #define VIRT_MEM_START			0
@@ -35,8 +35,15 @@
 #define PTE_TYPE_SMALL				2
 #define PTE_TYPE_TINY				3
 
+/* Large pages take up this many replicated ptes in a pmd */
+#define LARGE_PAGE_SIZE				SZ_64K
+#define LARGE_PAGE_MASK				(LARGE_PAGE_SIZE - 1)
+#define LARGE_PAGE_PTES				(LARGE_PAGE_SIZE / ARM_PAGE_SIZE)
+#define SECTION_PAGES				(SECTION_SIZE / ARM_PAGE_SIZE)
+
 /* Permission field offsets */
 #define SECTION_AP0				10
+#define SECTION_NG				(1 << 17)
 
 /*
  * These are indices into arrays with pgd_t or pmd_t sized elements,
@@ -70,18 +77,24 @@ typedef struct pmd_table {
 	pte_t entry[PMD_ENTRY_TOTAL];
 } pmd_table_t;
 
-/* Applies for both small and large pages */
+/*
+ * ARMv6 extended small page format, in use with the XP bit set.
+ * Subpage permissions are gone, there's a single AP field plus
+ * APX, and nG marks a mapping as private to the ASID that was
+ * current when it was loaded into the tlb. Kernel mappings leave
+ * nG clear, so they are global and survive ASID changes.
+ */
 #define PAGE_AP0				4
-#define PAGE_AP1				6
-#define	PAGE_AP2				8
-#define PAGE_AP3				10
+#define PAGE_APX				9
+#define PAGE_NG					11
+#define PTE_NG					(1 << PAGE_NG)
 
 /* Permission values with rom and sys bits ignored */
 #define SVC_RW_USR_NONE				1
 #define SVC_RW_USR_RO				2
 #define SVC_RW_USR_RW				3
 
-#define PTE_PROT_MASK				(0xFF << 4)
+#define PTE_PROT_MASK				(0x3 << PAGE_AP0)
 
 #define CACHEABILITY				3
 #define BUFFERABILITY				2
@@ -91,29 +104,31 @@ typedef struct pmd_table {
 #define unbufferable				0
 
 /* Helper macros for common cases */
-#define __MAP_USR_RW	(cacheable | bufferable | (SVC_RW_USR_RW << PAGE_AP0)		\
-			| (SVC_RW_USR_RW << PAGE_AP1) | (SVC_RW_USR_RW << PAGE_AP2)	\
-			| (SVC_RW_USR_RW << PAGE_AP3))
-#define __MAP_USR_RO	(cacheable | bufferable | (SVC_RW_USR_RO << PAGE_AP0)		\
-			| (SVC_RW_USR_RO << PAGE_AP1) | (SVC_RW_USR_RO << PAGE_AP2)	\
-			| (SVC_RW_USR_RO << PAGE_AP3))
-#define __MAP_KERN_RW	(cacheable | bufferable | (SVC_RW_USR_NONE << PAGE_AP0) 	\
-			| (SVC_RW_USR_NONE << PAGE_AP1) | (SVC_RW_USR_NONE << PAGE_AP2)	\
-			| (SVC_RW_USR_NONE << PAGE_AP3))
-#define __MAP_KERN_IO	(uncacheable | unbufferable | (SVC_RW_USR_NONE << PAGE_AP0)	\
-			| (SVC_RW_USR_NONE << PAGE_AP1) | (SVC_RW_USR_NONE << PAGE_AP2)	\
-			| (SVC_RW_USR_NONE << PAGE_AP3))
-#define __MAP_USR_IO	(uncacheable | unbufferable | (SVC_RW_USR_RW << PAGE_AP0)	\
-			| (SVC_RW_USR_RW << PAGE_AP1) | (SVC_RW_USR_RW << PAGE_AP2)	\
-			| (SVC_RW_USR_RW << PAGE_AP3))
-
-/* There is no execute bit in ARMv5, so we ignore it */
+#define __MAP_USR_RW	(cacheable | bufferable | PTE_NG		\
+			| (SVC_RW_USR_RW << PAGE_AP0))
+#define __MAP_USR_RO	(cacheable | bufferable | PTE_NG		\
+			| (SVC_RW_USR_RO << PAGE_AP0))
+#define __MAP_KERN_RW	(cacheable | bufferable				\
+			| (SVC_RW_USR_NONE << PAGE_AP0))
+#define __MAP_KERN_IO	(uncacheable | unbufferable			\
+			| (SVC_RW_USR_NONE << PAGE_AP0))
+#define __MAP_USR_IO	(uncacheable | unbufferable | PTE_NG		\
+			| (SVC_RW_USR_RW << PAGE_AP0))
+#define __MAP_USR_RO_IO	(uncacheable | unbufferable | PTE_NG		\
+			| (SVC_RW_USR_RO << PAGE_AP0))
+
+/* Execute never is not used yet, so we ignore it */
 #define __MAP_USR_RWX	__MAP_USR_RW
 #define __MAP_USR_RX	__MAP_USR_RO
 #define __MAP_KERN_RWX	__MAP_KERN_RW
 #define __MAP_KERN_RX	__MAP_KERN_RW	/* We always have kernel RW */
 #define __MAP_FAULT	0
 
+/* Hardware ASIDs, tagging tlb entries of non-global mappings */
+#define ASID_BITS				8
+#define ASID_TOTAL				(1 << ASID_BITS)
+#define ASID_MASK				(ASID_TOTAL - 1)
+
 void add_section_mapping_init(unsigned int paddr, unsigned int vaddr,
 			      unsigned int size, unsigned int flags);
 
@@ -122,4 +137,4 @@ void remove_section_mapping(unsigned long vaddr);
 extern pgd_table_t init_pgd;
 
 #endif /* __ASSEMBLY__ */
-#endif /* __V5_MM_H__ */
+#endif /* __V6_MM_H__ */
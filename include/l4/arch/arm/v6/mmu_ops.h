@@ -7,9 +7,13 @@
  *
  */
 void arm_set_ttb(unsigned int);
+void arm_set_ttb_asid(unsigned int ttb, unsigned int asid);
+void arm_set_utcb_ref(unsigned int utcb);
+unsigned int arm_get_cache_type(void);
 void arm_set_domain(unsigned int);
 unsigned int arm_get_domain(void);
 void arm_enable_mmu(void);
+void arm_enable_extended_pagetables(void);
 void arm_enable_icache(void);
 void arm_enable_dcache(void);
 void arm_enable_wbuffer(void);
@@ -20,11 +24,20 @@ void arm_invalidate_dcache(void);
 void arm_clean_dcache(void);
 void arm_clean_invalidate_dcache(void);
 void arm_clean_invalidate_cache(void);
+void arm_clean_dcache_range(unsigned long start, unsigned long end);
+void arm_clean_invalidate_dcache_range(unsigned long start, unsigned long end);
+void arm_invalidate_dcache_range(unsigned long start, unsigned long end);
+void arm_invalidate_icache_range(unsigned long start, unsigned long end);
 void arm_drain_writebuffer(void);
 void arm_invalidate_tlb(void);
+void arm_invalidate_tlb_asid(unsigned int asid);
+void arm_invalidate_tlb_mva(unsigned int mva_asid);
 void arm_invalidate_itlb(void);
 void arm_invalidate_dtlb(void);
 
+/* Cache type register bit for a data cache with virtual aliases */
+#define CACHE_TYPE_DCACHE_ALIASING		(1 << 23)
+
 static inline void arm_enable_caches(void)
 {
 	arm_enable_icache();
@@ -21,23 +21,48 @@
 #define CAP_RESID_NONE		-1
 
 
+/*
+ * Besides the plain list, each capability list keeps an index
+ * hashed on capability type and resource id, so that syscall
+ * checks only look at the few caps that could possibly match
+ * their target. Each chain is kept sorted by resource start, so
+ * memory range lookups can stop as soon as they are past the
+ * range they are looking for.
+ */
+#define CAP_HASH_BITS		4
+#define CAP_HASH_BUCKETS	(1 << CAP_HASH_BITS)
+
 struct cap_list {
 	int ncaps;
 	struct link caps;
+	struct link hash[CAP_HASH_BUCKETS];
 };
 
 void capability_init(struct capability *cap);
 
+static inline struct link *cap_hash_bucket(struct cap_list *clist,
+					   unsigned int type, l4id_t resid)
+{
+	unsigned int key = (unsigned int)resid * 0x9E3779B1 + type;
+
+	return &clist->hash[(key * 0x9E3779B1) >> (32 - CAP_HASH_BITS)];
+}
+
+void cap_index_insert(struct capability *cap, struct cap_list *clist);
+
 static inline void cap_list_init(struct cap_list *clist)
 {
 	clist->ncaps = 0;
 	link_init(&clist->caps);
+	for (int i = 0; i < CAP_HASH_BUCKETS; i++)
+		link_init(&clist->hash[i]);
 }
 
 static inline void cap_list_insert(struct capability *cap,
 				   struct cap_list *clist)
 {
 	list_insert(&cap->list, &clist->caps);
+	cap_index_insert(cap, clist);
 	clist->ncaps++;
 }
 
@@ -45,43 +70,31 @@ static inline void cap_list_remove(struct capability *cap,
 				   struct cap_list *clist)
 {
 	list_remove(&cap->list);
+	list_remove_init(&cap->index);
 	clist->ncaps--;
 }
 
-/* Detach a whole list of capabilities from list head */
-static inline struct capability *
-cap_list_detach(struct cap_list *clist)
-{
-	struct link *list;
-
-	if (!clist->ncaps)
-		return 0;
-
-	list = list_detach(&clist->caps);
-	clist->ncaps = 0;
-	return link_to_struct(list, struct capability, list);
-}
-
-/* Attach a whole list of capabilities to list head */
-static inline void cap_list_attach(struct capability *cap,
-				   struct cap_list *clist)
+/*
+ * Must be called whenever the type, resid or start
+ * of a capability changes while it is on a list.
+ */
+static inline void cap_list_reindex(struct capability *cap,
+				    struct cap_list *clist)
 {
-	/* Attach as if cap is the list and clist is the element */
-	list_insert(&clist->caps, &cap->list);
-
-	/* Count the number of caps attached */
-	list_foreach_struct(cap, &clist->caps, list)
-		clist->ncaps++;
+	list_remove_init(&cap->index);
+	cap_index_insert(cap, clist);
 }
 
+/* Moves all capabilities on one list to another */
 static inline void cap_list_move(struct cap_list *to,
 				 struct cap_list *from)
 {
-	if (!from->ncaps)
-		return;
+	struct capability *cap, *n;
 
-	struct capability *cap_head = cap_list_detach(from);
-	cap_list_attach(cap_head, to);
+	list_foreach_removable_struct(cap, n, &from->caps, list) {
+		cap_list_remove(cap, from);
+		cap_list_insert(cap, to);
+	}
 }
 
 /* Have to have these as tcb.h includes this file */
@@ -23,6 +23,19 @@
 #define CONFIG_MAX_CONT_CAPS			5
 #define CONFIG_MAX_PAGERS_USED			1
 
+/*
+ * Thread id hash. Threads are hashed by the id pool slot of their
+ * thread id. Slots are handed out next-fit after the last one, so
+ * threads created together land in consecutive buckets, but a long
+ * running container may still have several threads per bucket.
+ */
+#define CONFIG_KTCB_HASH_BUCKETS		256
+#define KTCB_HASH_MASK				(CONFIG_KTCB_HASH_BUCKETS - 1)
+
+struct ktcb_hash {
+	struct ktcb *bucket[CONFIG_KTCB_HASH_BUCKETS];
+};
+
 /* Container macro. No locks needed! */
 
 struct pager {
@@ -48,6 +61,7 @@ struct container {
 	struct address_space_list space_list;	/* List of address spaces */
 	char name[CONFIG_CONTAINER_NAMESIZE];	/* Name of container */
 	struct ktcb_list ktcb_list;		/* List of threads */
+	struct ktcb_hash ktcb_hash;		/* Thread lookup by id */
 	struct link pager_list;			/* List of pagers */
 
 	struct id_pool *thread_id_pool;		/* Id pools for thread/spaces */
@@ -126,6 +140,7 @@ struct container *container_alloc_init(void);
 int init_containers(struct kernel_resources *kres);
 struct container *container_find(struct kernel_resources *kres, l4id_t cid);
 struct ktcb *container_find_tcb(struct container *c, l4id_t tid);
+struct ktcb *container_find_lock_tcb(struct container *c, l4id_t tid);
 
 #endif /* __CONTAINER_H__ */
 
@@ -44,11 +44,19 @@ static inline struct ktcb *current_task(void)
 
 #define SCHED_RQ_TOTAL			4
 
-/* A basic runqueue */
+/* One task list per priority level, 0 to TASK_PRIO_MAX */
+#define SCHED_PRIO_LEVELS		(TASK_PRIO_MAX + 1)
+
+/*
+ * A runqueue with a task list per priority level. A bit is set
+ * in prio_map for each non-empty level, so that the highest
+ * priority runnable task is found in constant time.
+ */
 struct runqueue {
 	struct scheduler *sched;
 	struct spinlock lock;		/* Lock */
-	struct link task_list;		/* List of tasks in rq */
+	unsigned int prio_map;		/* Bitmap of non-empty levels */
+	struct link task_list[SCHED_PRIO_LEVELS]; /* Tasks by priority */
 	unsigned int total;		/* Total tasks */
 };
 
@@ -74,6 +82,12 @@ struct scheduler {
 
 	/* Total priority of all tasks in container */
 	int prio_total;
+
+	/* Load balancing */
+	int load;			/* Runnable tasks, but idle */
+	unsigned int balance_request;	/* Cpus to push tasks over to */
+	int balance_ticks;		/* Ticks to next periodic balance */
+	u32 balance_jiffies;		/* Last time idle asked for tasks */
 };
 
 DECLARE_PERCPU(extern struct scheduler, scheduler);
@@ -88,7 +102,15 @@ void sched_resume_async(struct ktcb *task);
 void sched_enqueue_task(struct ktcb *first_time_runner, int sync);
 void scheduler_start(void);
 void schedule(void);
+void sched_switch_to(struct ktcb *next);
 void sched_init(void);
 void idle_task(void);
+void sched_idle_wait(void);
+
+#if defined(CONFIG_SMP_)
+void sched_balance_tick(void);
+#else
+static inline void sched_balance_tick(void) { }
+#endif
 
 #endif /* __SCHEDULER_H__ */
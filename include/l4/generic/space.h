@@ -20,6 +20,7 @@
 #define MAP_USR_RX			8
 #define MAP_KERN_RX			9
 #define MAP_UNMAP			10	/* For unmap syscall */
+#define MAP_USR_RO_IO			11	/* Kernel use only */
 #define MAP_INVALID_FLAGS 		(1 << 31)
 
 /* Some default aliases */
@@ -46,6 +47,10 @@ struct address_space {
 	/* Capabilities shared by threads in same space */
 	struct cap_list cap_list;
 	int ktcb_refs;
+
+	/* Hardware space tag and cpus with stale tlb entries for it */
+	u32 asid;
+	u32 tlb_stale;
 };
 
 struct address_space_list {
@@ -54,7 +59,8 @@ struct address_space_list {
 	int count;
 };
 
-struct address_space *address_space_create(struct address_space *orig);
+struct address_space *address_space_create(struct address_space *orig,
+					    int write_protect);
 void address_space_delete(struct address_space *space, struct cap_list *clist);
 void address_space_attach(struct ktcb *tcb, struct address_space *space);
 struct address_space *address_space_find(l4id_t spid);
@@ -29,8 +29,15 @@
 #define TASK_SUSPENDING			(1 << 1)
 #define TASK_RESUMING			(1 << 2)
 #define TASK_PENDING_SIGNAL		(TASK_SUSPENDING)
+#define TASK_TIMEDOUT			(1 << 4)
 #define TASK_REALTIME			(1 << 5)
 
+/* Task stays on its cpu, load balancing does not move it */
+#define TASK_PINNED			(1 << 6)
+
+/* Task is out of its container's lists, lookups must not return it */
+#define TASK_REMOVED			(1 << 7)
+
 /*
  * This is to indicate a task (either current or one of
  * its children) exit has occured and cleanup needs to be
@@ -113,6 +120,7 @@ struct ktcb {
 	enum task_state state;
 
 	struct link task_list; /* Global task list. */
+	struct ktcb *tid_hash_next; /* Container thread id hash chain */
 
 	/* UTCB related, see utcb.txt in docs */
 	unsigned long utcb_address;	/* Virtual ref to task's utcb area */
@@ -146,6 +154,9 @@ struct ktcb {
 	struct waitqueue_head wqh_send;
 	l4id_t expected_sender;
 
+	/* Pending notification bits, protected by wqh_recv lock */
+	u32 notify_bits;
+
 	/* Waitqueue for notifiactions */
 	struct waitqueue_head wqh_notify;
 
@@ -191,6 +202,7 @@ void tcb_remove(struct ktcb *tcb);
 
 void tcb_init(struct ktcb *tcb);
 struct ktcb *tcb_alloc_init(l4id_t cid);
+struct ktcb *tcb_alloc_init_id(l4id_t cid, int id);
 void tcb_delete(struct ktcb *tcb);
 void tcb_delete_zombies(void);
 
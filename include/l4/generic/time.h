@@ -13,8 +13,40 @@ struct timeval {
 	int tv_usec;
 };
 
+/*
+ * A free running counter that system time is read from. It
+ * must count up, and at a whole multiple of 1MHz.
+ */
+struct clock_source {
+	char *name;
+	u32 counts_per_usec;
+	u32 (*read)(void);
+};
+
+/*
+ * A timer that raises the tick irq once, at a given number
+ * of microseconds from now. Only the boot cpu has one.
+ */
+struct clock_event {
+	char *name;
+	void (*set_next_event)(u32 usec);
+};
+
+/* Tick length, and the longest an idle cpu sleeps without a tick */
+#define TICK_USEC		(1000000 / CONFIG_SCHED_TICKS)
+#define TICK_IDLE_MAX_USEC	1000000
+
 extern volatile u32 jiffies;
 
+void clock_source_register(struct clock_source *cs);
+void clock_event_register(struct clock_event *ce);
+void time_read(struct timeval *tv);
+u32 time_stamp(void);
+u32 time_stamp_rate(void);
+void tick_stop_idle(void);
+void tick_restart_idle(void);
+int tick_is_stopped(int cpu);
+
 int do_timer_irq(void);
 int secondary_timer_irq(void);
 
@@ -0,0 +1,64 @@
+/*
+ * Kernel timers, kept on a per-cpu timer wheel.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __GENERIC_TIMER_H__
+#define __GENERIC_TIMER_H__
+
+#include <l4/lib/list.h>
+#include <l4/lib/spinlock.h>
+#include <l4/api/timeout.h>
+
+/*
+ * The wheel has a slot for each of the next 256 ticks, then
+ * coarser slots further out in time that are cascaded down into
+ * finer ones as time reaches them. Adding, removing and expiring
+ * a timer are all constant time.
+ */
+#define TIMER_WHEEL_ROOT_BITS	8
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_LEVELS	2	/* Levels above the root */
+
+#define TIMER_WHEEL_ROOT_SIZE	(1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_SIZE	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_ROOT_MASK	(TIMER_WHEEL_ROOT_SIZE - 1)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SIZE - 1)
+
+/* Furthest a timer may expire, timers beyond are brought in to it */
+#define TIMER_WHEEL_MAX_TICKS						\
+	((1 << (TIMER_WHEEL_ROOT_BITS +					\
+		TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1)
+
+struct ktimer;
+typedef void (*ktimer_fn_t)(struct ktimer *timer);
+
+struct ktimer {
+	struct link list;
+	u32 expires;			/* Jiffies it expires at */
+	ktimer_fn_t func;		/* Called in irq context */
+	void *data;
+	struct timer_wheel *wheel;	/* Wheel it was added to */
+};
+
+struct timer_wheel {
+	struct spinlock lock;
+	u32 jiffies;			/* Next tick to be run */
+	int pending;			/* Timers on the wheel */
+	struct ktimer *volatile running; /* Timer whose func is running */
+	struct link root[TIMER_WHEEL_ROOT_SIZE];
+	struct link level[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+};
+
+void init_timer_wheel(void);
+void timer_add(struct ktimer *timer, u32 ticks);
+void timer_del(struct ktimer *timer);
+int timer_wheel_pending(void);
+void timer_wheel_tick(void);
+
+/* Sleeping with a timeout */
+u32 timeout_to_ticks(unsigned int timeout);
+void timeout_start(struct ktimer *timer, unsigned int timeout);
+void timeout_stop(struct ktimer *timer);
+
+#endif /* __GENERIC_TIMER_H__ */
@@ -0,0 +1,25 @@
+/*
+ * Kernel event tracing.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __GENERIC_TRACE_H__
+#define __GENERIC_TRACE_H__
+
+#include <l4/types.h>
+#include <l4/api/trace.h>
+
+#if defined(CONFIG_DEBUG_TRACE)
+
+void trace_init(void);
+void trace_event(unsigned int event, u32 arg0, u32 arg1, u32 arg2, u32 arg3);
+
+#else /* End of CONFIG_DEBUG_TRACE */
+
+static inline void trace_init(void) { }
+static inline void trace_event(unsigned int event, u32 arg0, u32 arg1,
+			       u32 arg2, u32 arg3) { }
+
+#endif /* End of !CONFIG_DEBUG_TRACE */
+
+#endif /* __GENERIC_TRACE_H__ */
@@ -16,6 +16,12 @@ static inline int extended_ipc_msg_size(unsigned int flags)
 	       >> IPC_FLAGS_SIZE_SHIFT;
 }
 
+static inline unsigned int ipc_flags_get_timeout(unsigned int flags)
+{
+	return (flags & IPC_FLAGS_TIMEOUT_MASK)
+	       >> IPC_FLAGS_TIMEOUT_SHIFT;
+}
+
 static inline void tcb_set_ipc_flags(struct ktcb *task,
 				     unsigned int flags)
 {
@@ -16,6 +16,7 @@
 #define TASK_PGD(x)		(x)->space->pgd
 
 unsigned int space_flags_to_ptflags(unsigned int flags);
+int space_flags_exec(unsigned int flags);
 
 struct address_space;
 struct cap_list;
@@ -36,6 +37,8 @@ void add_boot_mapping(unsigned long paddr, unsigned long vaddr,
 
 int remove_mapping(unsigned long vaddr);
 int remove_mapping_space(struct address_space *space, unsigned long vaddr);
+int remove_mapping_range(struct address_space *space, unsigned long vaddr,
+			 unsigned long npages, struct cap_list *clist);
 void remove_mapping_pgd_all_user(struct address_space *space,
 				 struct cap_list *clist);
 
@@ -49,7 +52,8 @@ void copy_pgd_kern_all(pgd_table_t *);
 
 struct address_space;
 int delete_page_tables(struct address_space *space, struct cap_list *clist);
-int copy_user_tables(struct address_space *new, struct address_space *orig);
+int copy_user_tables(struct address_space *new, struct address_space *orig,
+		     int write_protect);
 void remap_as_pages(void *vstart, void *vend);
 
 void copy_pgds_by_vrange(pgd_table_t *to, pgd_table_t *from,
@@ -75,9 +79,43 @@ void arch_write_pte(pte_t *ptep, pte_t pte, u32 vaddr, u32 asid);
 void arch_prepare_write_pte(struct address_space *space, u32 paddr, u32 vaddr,
 			    unsigned int flags, pte_t *ptep);
 
+/*
+ * Pte writes to a range of a space, with cache and tlb
+ * maintenance done once for the whole range on commit,
+ * rather than once per pte.
+ */
+struct pte_batch {
+	struct address_space *space;
+	unsigned long start;	/* Virtual range written */
+	unsigned long end;
+	int exec;		/* New mappings are executable */
+	int stale;		/* Valid entries were overwritten */
+	int global;		/* Some of them were global */
+	pte_t *ptep_start;	/* Run of ptes written last */
+	pte_t *ptep_end;
+};
+
+void arch_pte_batch_begin(struct pte_batch *batch,
+			  struct address_space *space,
+			  unsigned long start, unsigned long end, int exec);
+void arch_pte_batch_write(struct pte_batch *batch, pte_t *ptep,
+			  pte_t pte, u32 vaddr);
+void arch_pte_batch_write_pmd(struct pte_batch *batch, pmd_t *pmdp,
+			      pmd_t pmd, u32 vaddr);
+void arch_pte_batch_commit(struct pte_batch *batch);
+
+/* Conversions between sections and the small ptes they are made of */
+pmd_t arch_pte_to_section(pte_t pte);
+pte_t arch_section_to_pte(pmd_t section, unsigned long vaddr);
+
+/* Same mappings without user write access */
+pte_t arch_pte_write_protect(pte_t pte);
+pmd_t arch_section_write_protect(pmd_t section);
+
 pmd_t *arch_pick_pmd(pgd_table_t *pgd, unsigned long vaddr);
 
 void arch_write_pmd(pmd_t *pmd_entry, u32 pmd_phys, u32 vaddr, u32 asid);
+void arch_clear_pmd(pmd_t *pmd_entry, u32 vaddr, u32 asid);
 
 int arch_check_pte_access_perms(pte_t pte, unsigned int flags);
 
@@ -89,6 +127,7 @@ int is_global_pgdi(int i);
 
 struct ktcb;
 void arch_space_switch(struct ktcb *task);
+void arch_space_release(struct address_space *space);
 
 int pgd_count_boot_pmds();
 
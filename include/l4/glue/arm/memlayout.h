@@ -24,6 +24,9 @@
 
 #define USER_KIP_PAGE		0xFF000000
 
+/* Kernel trace rings, in the same section as the kip */
+#define USER_TRACE_AREA		(USER_KIP_PAGE + PAGE_SIZE)
+
 /* ARM-specific offset in KIP that tells the address of UTCB page */
 #define UTCB_KIP_OFFSET		0x50
 
@@ -6,6 +6,11 @@ int find_and_set_first_free_bit(u32 *word, unsigned int lastbit);
 int check_and_clear_bit(u32 *word, int bit);
 int check_and_set_bit(u32 *word, int bit);
 
+/* Index of the lowest set bit, word must be non-zero */
+static inline unsigned int __ffs(unsigned int word)
+{
+	return 31 - __clz(word & -word);
+}
 
 /* Set */
 static inline void setbit(unsigned int *w, unsigned int flags)
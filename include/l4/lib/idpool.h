@@ -8,15 +8,27 @@
 #define CONFIG_MAX_SYSTEM_IDS			(1023*32)
 #define SYSTEM_IDS_MAX				(CONFIG_MAX_SYSTEM_IDS >> 5)
 
+/* A bit for each bitmap word */
+#define SYSTEM_IDS_SUMMARY_MAX			((SYSTEM_IDS_MAX + 31) >> 5)
+
+/*
+ * The summary has a bit set for each full bitmap word, so that
+ * allocation skips 32 full words at a time. Allocation starts
+ * from the word of the last one, given by hint.
+ */
 struct id_pool {
 	struct spinlock lock;
 	int nwords;
+	int hint;
+	u32 summary[SYSTEM_IDS_SUMMARY_MAX];
 	u32 bitmap[SYSTEM_IDS_MAX];
 };
 
 struct id_pool_variable {
 	struct spinlock lock;
 	int nwords;
+	int hint;
+	u32 summary[SYSTEM_IDS_SUMMARY_MAX];
 	u32 bitmap[];
 };
 
@@ -24,5 +36,6 @@ struct id_pool *id_pool_new_init(int mapsize, void *buffer);
 int id_new(struct id_pool *pool);
 int id_del(struct id_pool *pool, int id);
 int id_get(struct id_pool *pool, int id);
+int id_new_range(struct id_pool *pool, int nids);
 
 #endif /* __IDPOOL_H__ */
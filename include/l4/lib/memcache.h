@@ -12,12 +12,30 @@
 #include <l4/types.h>
 #include <l4/lib/list.h>
 #include <l4/lib/mutex.h>
+#include <l4/lib/spinlock.h>
+
+/*
+ * Free objects each cpu keeps in front of the bitmap, and
+ * the number moved between the two at a time.
+ */
+#define MEM_CACHE_MAG_SIZE	16
+#define MEM_CACHE_MAG_BATCH	(MEM_CACHE_MAG_SIZE / 2)
+
+struct mem_cache_magazine {
+	struct spinlock lock;
+	int count;
+	void *obj[MEM_CACHE_MAG_SIZE];
+};
 
 /*
  * Very basic cache structure. All it does is, keep an internal bitmap of
  * items of struct_size. (Note bitmap is fairly efficient and simple for a
  * fixed-size memory cache) Keeps track of free/occupied items within its
  * start/end boundaries. Does not grow/shrink but you can link-list it.
+ *
+ * Each cpu allocates from and frees to its own magazine of objects,
+ * and only takes the cache mutex to move a batch of them from or to
+ * the bitmap. The free count is that of the bitmap.
  */
 struct mem_cache {
 	struct link list;
@@ -28,6 +46,7 @@ struct mem_cache {
 	unsigned int end;
 	unsigned int struct_size;
 	unsigned int *bitmap;
+	DECLARE_PERCPU(struct mem_cache_magazine, mag);
 };
 
 int mem_cache_bufsize(void *start, int struct_size, int nstructs, int aligned);
@@ -0,0 +1,54 @@
+/*
+ * Sequence counters, for data that is read often and written
+ * rarely, by a single writer that must not wait for readers.
+ *
+ * The writer makes the count odd while it updates the data. A
+ * reader retries if the count was odd or changed during its read.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __LIB_SEQCOUNT_H__
+#define __LIB_SEQCOUNT_H__
+
+#include INC_SUBARCH(mmu_ops.h)
+
+struct seqcount {
+	volatile unsigned int sequence;
+};
+
+static inline void seqcount_init(struct seqcount *s)
+{
+	s->sequence = 0;
+}
+
+static inline unsigned int read_seqcount_begin(struct seqcount *s)
+{
+	unsigned int seq;
+
+	/* Wait out a write in progress */
+	while ((seq = s->sequence) & 1)
+		;
+	dmb();
+	return seq;
+}
+
+/* Non-zero if a write happened since read_seqcount_begin() */
+static inline int read_seqcount_retry(struct seqcount *s, unsigned int seq)
+{
+	dmb();
+	return s->sequence != seq;
+}
+
+static inline void write_seqcount_begin(struct seqcount *s)
+{
+	s->sequence++;
+	dmb();
+}
+
+static inline void write_seqcount_end(struct seqcount *s)
+{
+	dmb();
+	s->sequence++;
+}
+
+#endif /* __LIB_SEQCOUNT_H__ */
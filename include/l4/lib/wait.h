@@ -3,6 +3,7 @@
 
 #include <l4/lib/list.h>
 #include <l4/lib/spinlock.h>
+#include <l4/generic/timer.h>
 
 struct ktcb;
 struct waitqueue {
@@ -15,6 +16,7 @@ struct waitqueue {
 enum wakeup_flags {
 	WAKEUP_INTERRUPT = (1 << 0),	/* Set interrupt flag for task */
 	WAKEUP_SYNC	 = (1 << 1),	/* Wake it up synchronously */
+	WAKEUP_TIMEOUT	 = (1 << 2),	/* Set timeout flag for task */
 };
 
 #define CREATE_WAITQUEUE_ON_STACK(wq, tsk)		\
@@ -74,6 +76,51 @@ do {								\
 	}							\
 } while(0);
 
+/*
+ * Same as above, but gives up with -ETIMEDOUT if the condition
+ * isn't met within the timeout of each sleep, or at once if the
+ * timeout is L4_TIMEOUT_POLL.
+ */
+#define WAIT_EVENT_TIMEOUT(wqh, condition, ret, timeout)	\
+do {								\
+	ret = 0;						\
+	for (;;) {						\
+		unsigned long irqsave;				\
+		struct ktimer timer;				\
+		spin_lock_irq(&(wqh)->slock, &irqsave);		\
+		if (condition) {				\
+			spin_unlock_irq(&(wqh)->slock, irqsave);\
+			break;					\
+		}						\
+		if ((timeout) == L4_TIMEOUT_POLL) {		\
+			spin_unlock_irq(&(wqh)->slock, irqsave);\
+			ret = -ETIMEDOUT;			\
+			break;					\
+		}						\
+		CREATE_WAITQUEUE_ON_STACK(wq, current);		\
+		task_set_wqh(current, wqh, &wq);		\
+		(wqh)->sleepers++;				\
+		list_insert_tail(&wq.task_list, 		\
+				 &(wqh)->task_list);		\
+		sched_prepare_sleep();				\
+		spin_unlock_irq(&(wqh)->slock, irqsave);	\
+		timeout_start(&timer, timeout);			\
+		schedule();					\
+		timeout_stop(&timer);				\
+		/* Did we wake up normally, or why not */	\
+		if (current->flags & TASK_INTERRUPTED) {	\
+			current->flags &= ~TASK_INTERRUPTED;	\
+			ret = -EINTR;				\
+			break;					\
+		}						\
+		if (current->flags & TASK_TIMEDOUT) {		\
+			current->flags &= ~TASK_TIMEDOUT;	\
+			ret = -ETIMEDOUT;			\
+			break;					\
+		}						\
+	}							\
+} while(0);
+
 
 void wake_up(struct waitqueue_head *wqh, unsigned int flags);
 int wake_up_task(struct ktcb *task, unsigned int flags);
@@ -82,5 +129,6 @@ void wake_up_all(struct waitqueue_head *wqh, unsigned int flags);
 int wait_on(struct waitqueue_head *wqh);
 int wait_on_prepare(struct waitqueue_head *wqh, struct waitqueue *wq);
 int wait_on_prepared_wait(void);
+int wait_on_prepared_wait_timeout(unsigned int timeout);
 #endif /* __LIB_WAIT_H__ */
 
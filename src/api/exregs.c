@@ -72,6 +72,16 @@ flags:
 		if (task == current)
 			task_update_utcb(task);
 	}
+
+	/* Pin thread to a cpu, or let it be balanced again */
+	if (exregs->flags & EXREGS_SET_AFFINITY) {
+		if (exregs->affinity < 0) {
+			task->flags &= ~TASK_PINNED;
+		} else {
+			task->affinity = exregs->affinity;
+			task->flags |= TASK_PINNED;
+		}
+	}
 }
 
 void exregs_read_registers(struct ktcb *task, struct exregs_data *exregs)
@@ -123,6 +133,10 @@ flags:
 	/* Read thread's utcb if utcb flag supplied */
 	if (exregs->flags & EXREGS_SET_UTCB)
 		exregs->utcb_address = task->utcb_address;
+
+	/* Read thread's cpu if affinity flag supplied */
+	if (exregs->flags & EXREGS_SET_AFFINITY)
+		exregs->affinity = task->affinity;
 }
 
 /*
@@ -184,6 +198,24 @@ int sys_exchange_registers(struct exregs_data *exregs, l4id_t tid)
 		goto out;
 	}
 
+	/*
+	 * A thread is placed on a cpu only before it first
+	 * runs, as it may otherwise still be switching out
+	 * on its last cpu, while being picked up on the new.
+	 */
+	if ((exregs->flags & EXREGS_SET_AFFINITY) &&
+	    !(exregs->flags & EXREGS_READ) && exregs->affinity >= 0) {
+		if (exregs->affinity >= CONFIG_NCPU) {
+			err = -EINVAL;
+			goto out;
+		}
+		if (task->state != TASK_INACTIVE ||
+		    !(task->flags & TASK_RESUMING)) {
+			err = -EACTIVE;
+			goto out;
+		}
+	}
+
 	if ((err = cap_exregs_check(task, exregs)) < 0)
 		return -ENOCAP;
 
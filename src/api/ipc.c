@@ -4,6 +4,8 @@
  * Copyright (C) 2007-2009 Bahadir Bilgehan Balban
  */
 #include <l4/generic/tcb.h>
+#include <l4/generic/timer.h>
+#include <l4/generic/trace.h>
 #include <l4/lib/mutex.h>
 #include <l4/api/ipc.h>
 #include <l4/api/thread.h>
@@ -136,6 +138,9 @@ int ipc_msg_copy(struct ktcb *to, struct ktcb *from)
 		mr0_dst[MR_SENDER] = from->tid;
 	}
 
+	trace_event(TRACE_IPC, from->tid, to->tid, from->ipc_flags,
+		    ret);
+
 	return ret;
 }
 
@@ -177,6 +182,12 @@ int ipc_handle_errors(void)
 		return -EINTR;
 	}
 
+	/* Or did it time out */
+	if (current->flags & TASK_TIMEDOUT) {
+		current->flags &= ~TASK_TIMEDOUT;
+		return -ETIMEDOUT;
+	}
+
 	/* Did ipc fail with a fault error? */
 	if (current->ipc_flags & IPC_EFAULT) {
 		current->ipc_flags &= ~IPC_EFAULT;
@@ -192,6 +203,20 @@ int ipc_handle_errors(void)
 	return 0;
 }
 
+/*
+ * Does a receiver take an ipc from this sender? A receiver waiting
+ * on a thread also takes from the threads in that thread's group,
+ * so that a server may reply to its callers from any of its threads.
+ * Group ids are the tid of the group's first thread.
+ */
+static inline int ipc_sender_expected(struct ktcb *receiver,
+				      struct ktcb *sender)
+{
+	return receiver->expected_sender == L4_ANYTHREAD ||
+	       receiver->expected_sender == sender->tid ||
+	       receiver->expected_sender == sender->tgid;
+}
+
 /*
  * NOTE:
  * Why can we safely copy registers and resume task
@@ -204,8 +229,11 @@ int ipc_handle_errors(void)
 /* Interruptible ipc */
 int ipc_send(l4id_t recv_tid, unsigned int flags)
 {
+	unsigned int timeout = ipc_flags_get_timeout(flags);
 	struct ktcb *receiver;
 	struct waitqueue_head *wqhs, *wqhr;
+	unsigned long irqflags[2];
+	struct ktimer timer;
 	int ret = 0;
 
 	if (!(receiver = tcb_find_lock(recv_tid)))
@@ -214,14 +242,14 @@ int ipc_send(l4id_t recv_tid, unsigned int flags)
 	wqhs = &receiver->wqh_send;
 	wqhr = &receiver->wqh_recv;
 
-	spin_lock(&wqhs->slock);
-	spin_lock(&wqhr->slock);
+	/* Timeouts wake up sleepers on these from irq context */
+	spin_lock_irq(&wqhs->slock, &irqflags[0]);
+	spin_lock_irq(&wqhr->slock, &irqflags[1]);
 
 	/* Ready to receive and expecting us? */
 	if (receiver->state == TASK_SLEEPING &&
 	    receiver->waiting_on == wqhr &&
-	    (receiver->expected_sender == current->tid ||
-	     receiver->expected_sender == L4_ANYTHREAD)) {
+	    ipc_sender_expected(receiver, current)) {
 		struct waitqueue *wq = receiver->wq;
 
 		/* Remove from waitqueue */
@@ -230,8 +258,8 @@ int ipc_send(l4id_t recv_tid, unsigned int flags)
 		task_unset_wqh(receiver);
 
 		/* Release locks */
-		spin_unlock(&wqhr->slock);
-		spin_unlock(&wqhs->slock);
+		spin_unlock_irq(&wqhr->slock, irqflags[1]);
+		spin_unlock_irq(&wqhs->slock, irqflags[0]);
 
 		/* Copy message registers */
 		if ((ret = ipc_msg_copy(receiver, current)) < 0)
@@ -249,24 +277,101 @@ int ipc_send(l4id_t recv_tid, unsigned int flags)
 	}
 
 	/* The receiver is not ready and/or not expecting us */
+	if (timeout == L4_TIMEOUT_POLL) {
+		spin_unlock_irq(&wqhr->slock, irqflags[1]);
+		spin_unlock_irq(&wqhs->slock, irqflags[0]);
+		spin_unlock(&receiver->thread_lock);
+		return -ETIMEDOUT;
+	}
+
 	CREATE_WAITQUEUE_ON_STACK(wq, current);
 	wqhs->sleepers++;
 	list_insert_tail(&wq.task_list, &wqhs->task_list);
 	task_set_wqh(current, wqhs, &wq);
 	sched_prepare_sleep();
-	spin_unlock(&wqhr->slock);
-	spin_unlock(&wqhs->slock);
+	timeout_start(&timer, timeout);
+	spin_unlock_irq(&wqhr->slock, irqflags[1]);
+	spin_unlock_irq(&wqhs->slock, irqflags[0]);
 	spin_unlock(&receiver->thread_lock);
 	// printk("%s: (%d) waiting for (%d)\n", __FUNCTION__,
 	//       current->tid, recv_tid);
-	schedule();
+
+	/* Let the receiver run on our time until it gets to receive */
+	sched_switch_to(receiver);
+	timeout_stop(&timer);
 
 	return ipc_handle_errors();
 }
 
+/*
+ * Hands the pending notification bits over to a receiver, in its
+ * message registers. Receiver's wqh_recv lock must be held.
+ */
+static inline void ipc_notify_deliver(struct ktcb *receiver)
+{
+	unsigned int *mr0 = KTCB_REF_MR0(receiver);
+
+	mr0[MR_TAG] = L4_IPC_TAG_NOTIFY;
+	mr0[MR_SENDER] = L4_NILTHREAD;
+	mr0[MR_NOTIFY] = receiver->notify_bits;
+	receiver->notify_bits = 0;
+
+	trace_event(TRACE_IPC, L4_NILTHREAD, receiver->tid,
+		    IPC_FLAGS_NOTIFY, 0);
+}
+
+/*
+ * ORs bits into a thread's notification word. If it is in a receive
+ * that takes notifications, it wakes up with them. Never blocks, so
+ * it may also be called from irq context.
+ */
+void ipc_notify(struct ktcb *receiver, unsigned int bits)
+{
+	struct waitqueue_head *wqhr = &receiver->wqh_recv;
+	unsigned long irqflags;
+
+	spin_lock_irq(&wqhr->slock, &irqflags);
+
+	receiver->notify_bits |= bits;
+
+	if (receiver->state == TASK_SLEEPING &&
+	    receiver->waiting_on == wqhr &&
+	    (tcb_get_ipc_flags(receiver) & IPC_FLAGS_NOTIFY)) {
+		list_remove_init(&receiver->wq->task_list);
+		wqhr->sleepers--;
+		task_unset_wqh(receiver);
+		ipc_notify_deliver(receiver);
+		spin_unlock_irq(&wqhr->slock, irqflags);
+
+		sched_resume_async(receiver);
+		return;
+	}
+
+	spin_unlock_irq(&wqhr->slock, irqflags);
+}
+
+/* Sends the notification bits in current's MR_NOTIFY */
+int ipc_notify_send(l4id_t recv_tid)
+{
+	struct ktcb *receiver;
+	unsigned int bits = KTCB_REF_MR0(current)[MR_NOTIFY];
+
+	if (!(receiver = tcb_find_lock(recv_tid)))
+		return -ESRCH;
+
+	ipc_notify(receiver, bits);
+
+	spin_unlock(&receiver->thread_lock);
+	return 0;
+}
+
 int ipc_recv(l4id_t senderid, unsigned int flags)
 {
+	unsigned int timeout = ipc_flags_get_timeout(flags);
 	struct waitqueue_head *wqhs, *wqhr;
+	unsigned long irqflags[2];
+	struct ktcb *partner;
+	struct ktimer timer;
 	int ret = 0;
 
 	wqhs = &current->wqh_send;
@@ -278,8 +383,16 @@ int ipc_recv(l4id_t senderid, unsigned int flags)
 	 */
 	current->expected_sender = senderid;
 
-	spin_lock(&wqhs->slock);
-	spin_lock(&wqhr->slock);
+	spin_lock_irq(&wqhs->slock, &irqflags[0]);
+	spin_lock_irq(&wqhr->slock, &irqflags[1]);
+
+	/* Notifications that came meanwhile are taken first */
+	if ((flags & IPC_FLAGS_NOTIFY) && current->notify_bits) {
+		ipc_notify_deliver(current);
+		spin_unlock_irq(&wqhr->slock, irqflags[1]);
+		spin_unlock_irq(&wqhs->slock, irqflags[0]);
+		return 0;
+	}
 
 	/* Are there senders? */
 	if (wqhs->sleepers > 0) {
@@ -293,13 +406,12 @@ int ipc_recv(l4id_t senderid, unsigned int flags)
 			sleeper = wq->task;
 
 			/* Found a sender that we wanted to receive from */
-			if ((sleeper->tid == current->expected_sender) ||
-			    (current->expected_sender == L4_ANYTHREAD)) {
+			if (ipc_sender_expected(current, sleeper)) {
 				list_remove_init(&wq->task_list);
 				wqhs->sleepers--;
 				task_unset_wqh(sleeper);
-				spin_unlock(&wqhr->slock);
-				spin_unlock(&wqhs->slock);
+				spin_unlock_irq(&wqhr->slock, irqflags[1]);
+				spin_unlock_irq(&wqhs->slock, irqflags[0]);
 
 				/* Copy message registers */
 				if ((ret = ipc_msg_copy(current, sleeper)) < 0)
@@ -308,23 +420,40 @@ int ipc_recv(l4id_t senderid, unsigned int flags)
 				// printk("%s: (%d) Waking up (%d)\n",
 				// __FUNCTION__,
 				//       current->tid, sleeper->tid);
-				sched_resume_sync(sleeper);
+				sched_resume_async(sleeper);
+				sched_switch_to(sleeper);
 				return ret;
 			}
 		}
 	}
 
 	/* The sender is not ready */
+	if (timeout == L4_TIMEOUT_POLL) {
+		spin_unlock_irq(&wqhr->slock, irqflags[1]);
+		spin_unlock_irq(&wqhs->slock, irqflags[0]);
+		return -ETIMEDOUT;
+	}
+
 	CREATE_WAITQUEUE_ON_STACK(wq, current);
 	wqhr->sleepers++;
 	list_insert_tail(&wq.task_list, &wqhr->task_list);
 	task_set_wqh(current, wqhr, &wq);
 	sched_prepare_sleep();
+	timeout_start(&timer, timeout);
 	// printk("%s: (%d) waiting for (%d)\n", __FUNCTION__,
 	//       current->tid, current->expected_sender);
-	spin_unlock(&wqhr->slock);
-	spin_unlock(&wqhs->slock);
-	schedule();
+	spin_unlock_irq(&wqhr->slock, irqflags[1]);
+	spin_unlock_irq(&wqhs->slock, irqflags[0]);
+
+	/*
+	 * Waiting on a particular sender is the reply phase of
+	 * a call, and that sender is who we need to run next.
+	 */
+	if (senderid != L4_ANYTHREAD && (partner = tcb_find(senderid)))
+		sched_switch_to(partner);
+	else
+		schedule();
+	timeout_stop(&timer);
 
 	return ipc_handle_errors();
 }
@@ -480,6 +609,10 @@ static inline int __sys_ipc(l4id_t to, l4id_t from,
 	int ret;
 
 	if (ipc_flags_get_type(flags) == IPC_FLAGS_EXTENDED) {
+		/* Notification bits don't go in extended buffers */
+		if (flags & IPC_FLAGS_NOTIFY)
+			return -EINVAL;
+
 		switch (ipc_dir) {
 		case IPC_SEND:
 			ret = ipc_send_extended(to, flags);
@@ -498,7 +631,10 @@ static inline int __sys_ipc(l4id_t to, l4id_t from,
 	} else {
 		switch (ipc_dir) {
 		case IPC_SEND:
-			ret = ipc_send(to, flags);
+			if (flags & IPC_FLAGS_NOTIFY)
+				ret = ipc_notify_send(to);
+			else
+				ret = ipc_send(to, flags);
 			break;
 		case IPC_RECV:
 			ret = ipc_recv(from, flags);
@@ -532,7 +668,7 @@ void printk_sysregs(syscall_context_t *regs)
 /*
  * sys_ipc has multiple functions. In a nutshell:
  * - Copies message registers from one thread to another.
- * - Sends notification bits from one thread to another. - Not there yet.
+ * - Sends notification bits from one thread to another, without blocking.
  * - Synchronises the threads involved in ipc. (i.e. a blocking rendez-vous)
  * - Can propagate messages from third party threads.
  * - A thread can both send and receive on the same call.
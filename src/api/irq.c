@@ -4,6 +4,7 @@
  * Copyright (C) 2009 Bahadir Balban
  */
 #include <l4/api/irq.h>
+#include <l4/api/ipc.h>
 #include <l4/api/errno.h>
 #include <l4/generic/scheduler.h>
 #include <l4/generic/thread.h>
@@ -64,6 +65,9 @@ int irq_thread_notify(struct irq_desc *desc)
 	/* Async wake up any waiter irq threads */
 	wake_up(&desc->wqh_irq, WAKEUP_ASYNC);
 
+	/* Or the task if it receives with notifications */
+	ipc_notify(desc->task, 1 << desc->task_notify_slot);
+
 	BUG_ON(!irqs_enabled());
 	return 0;
 }
@@ -98,9 +102,10 @@ int irq_control_register(struct ktcb *task, int slot, l4id_t irqnum)
 }
 
 /*
- * Makes current task wait on the given irq
+ * Makes current task wait on the given irq, for
+ * up to the given timeout
  */
-int irq_wait(l4id_t irq_index)
+int irq_wait(l4id_t irq_index, unsigned int timeout)
 {
 	struct irq_desc *desc = irq_desc_array + irq_index;
 	struct utcb *utcb = (struct utcb *)current->utcb_address;
@@ -115,9 +120,9 @@ int irq_wait(l4id_t irq_index)
 		return ret;
 
 	/* Wait until the irq changes slot value */
-	WAIT_EVENT(&desc->wqh_irq,
-		   utcb->notify[desc->task_notify_slot] != 0,
-		   ret);
+	WAIT_EVENT_TIMEOUT(&desc->wqh_irq,
+			   utcb->notify[desc->task_notify_slot] != 0,
+			   ret, timeout);
 
 	if (ret < 0)
 		return ret;
@@ -143,7 +148,7 @@ int sys_irq_control(unsigned int req, unsigned int flags, l4id_t irqnum)
 	case IRQ_CONTROL_REGISTER:
 		return irq_control_register(task, flags, irqnum);
 	case IRQ_CONTROL_WAIT:
-		return irq_wait(irqnum);
+		return irq_wait(irqnum, flags & L4_TIMEOUT_MASK);
 	default:
 		return -EINVAL;
 	}
@@ -4,6 +4,8 @@
  * Copyright (C) 2007 Bahadir Balban
  */
 #include <l4/generic/tcb.h>
+#include <l4/generic/capability.h>
+#include <l4/generic/cap-types.h>
 #include INC_API(syscall.h)
 #include INC_SUBARCH(mm.h)
 #include <l4/api/errno.h>
@@ -59,8 +61,9 @@ int sys_map(unsigned long phys, unsigned long virt,
  */
 int sys_unmap(unsigned long virtual, unsigned long npages, unsigned int tid)
 {
+	struct cap_list *clist = 0;
 	struct ktcb *target;
-	int ret = 0, retval = 0;
+	int ret = 0;
 
 	if (!(target = tcb_find(tid)))
 		return -ESRCH;
@@ -71,13 +74,16 @@ int sys_unmap(unsigned long virtual, unsigned long npages, unsigned int tid)
 	if ((ret = cap_unmap_check(target, virtual, npages)) < 0)
 		return ret;
 
-	for (int i = 0; i < npages; i++) {
-		ret = remove_mapping_space(target->space,
-					   virtual + i * PAGE_SIZE);
-		if (ret)
-			retval = ret;
-	}
+	/*
+	 * Emptied pmds go back to the list space deletion returns
+	 * them to, that of the target's pager, which is the one that
+	 * maps the target's pages and gets charged for its pmds. The
+	 * caller may be some other task that has no share in them.
+	 */
+	if (cap_list_find_by_rtype(&target->pager->space->cap_list,
+				   CAP_RTYPE_MAPPOOL))
+		clist = &target->pager->space->cap_list;
 
-	return retval;
+	return remove_mapping_range(target->space, virtual, npages, clist);
 }
 
@@ -20,21 +20,34 @@
 void init_mutex_queue_head(struct mutex_queue_head *mqhead)
 {
 	memset(mqhead, 0, sizeof(*mqhead));
-	link_init(&mqhead->list);
-	mutex_init(&mqhead->mutex_control_mutex);
+	for (int i = 0; i < MUTEX_HASH_BUCKETS; i++) {
+		link_init(&mqhead->bucket[i].list);
+		mutex_init(&mqhead->bucket[i].mutex_control_mutex);
+	}
 }
 
-void mutex_queue_head_lock(struct mutex_queue_head *mqhead)
+/*
+ * Hashes a mutex physical address to its bucket. Mutexes
+ * are word aligned, so low bits carry no information.
+ */
+static inline struct mutex_queue_bucket *
+mutex_queue_bucket(struct mutex_queue_head *mqhead, unsigned long physical)
 {
-	mutex_lock(&mqhead->mutex_control_mutex);
+	unsigned int key = (physical >> 2) * 0x9E3779B1;
+
+	return &mqhead->bucket[key >> (32 - MUTEX_HASH_BITS)];
 }
 
-void mutex_queue_head_unlock(struct mutex_queue_head *mqhead)
+void mutex_queue_bucket_lock(struct mutex_queue_bucket *mqb)
 {
-	/* Async unlock because in some cases preemption may be disabled here */
-	mutex_unlock_async(&mqhead->mutex_control_mutex);
+	mutex_lock(&mqb->mutex_control_mutex);
 }
 
+void mutex_queue_bucket_unlock(struct mutex_queue_bucket *mqb)
+{
+	/* Async unlock because in some cases preemption may be disabled here */
+	mutex_unlock_async(&mqb->mutex_control_mutex);
+}
 
 void mutex_queue_init(struct mutex_queue *mq, unsigned long physical)
 {
@@ -46,28 +59,28 @@ void mutex_queue_init(struct mutex_queue *mq, unsigned long physical)
 	waitqueue_head_init(&mq->wqh_contenders);
 }
 
-void mutex_control_add(struct mutex_queue_head *mqhead, struct mutex_queue *mq)
+void mutex_control_add(struct mutex_queue_bucket *mqb, struct mutex_queue *mq)
 {
 	BUG_ON(!list_empty(&mq->list));
 
-	list_insert(&mq->list, &mqhead->list);
-	mqhead->count++;
+	list_insert(&mq->list, &mqb->list);
+	mqb->count++;
 }
 
-void mutex_control_remove(struct mutex_queue_head *mqhead, struct mutex_queue *mq)
+void mutex_control_remove(struct mutex_queue_bucket *mqb, struct mutex_queue *mq)
 {
 	list_remove_init(&mq->list);
-	mqhead->count--;
+	mqb->count--;
 }
 
 /* Note, this has ptr/negative error returns instead of ptr/zero. */
-struct mutex_queue *mutex_control_find(struct mutex_queue_head *mqhead,
+struct mutex_queue *mutex_control_find(struct mutex_queue_bucket *mqb,
 				       unsigned long mutex_physical)
 {
 	struct mutex_queue *mutex_queue;
 
 	/* Find the mutex queue with this key */
-	list_foreach_struct(mutex_queue, &mqhead->list, list)
+	list_foreach_struct(mutex_queue, &mqb->list, list)
 		if (mutex_queue->physical == mutex_physical)
 			return mutex_queue;
 
@@ -152,22 +165,65 @@ void mutex_control_delete(struct mutex_queue *mq)
  * wake ups must occur as the number of contended waits.
  */
 
+/*
+ * A contender that gave up waiting has been counted by the lock
+ * holder in userspace all the same, so it leaves behind its arrival
+ * for the holder to consume. If the holder already waits for it, it
+ * is the last one that the holder was waiting for.
+ */
+static void mutex_control_lock_cancel(struct mutex_queue_head *mqhead,
+				      unsigned long mutex_address)
+{
+	struct mutex_queue *mutex_queue;
+	struct mutex_queue_bucket *mqb =
+		mutex_queue_bucket(mqhead, mutex_address);
+
+	mutex_queue_bucket_lock(mqb);
+
+	/* Holder may have deleted it as we were waking up */
+	if (!(mutex_queue = mutex_control_find(mqb, mutex_address))) {
+		if (!(mutex_queue = mutex_control_create(mutex_address))) {
+			mutex_queue_bucket_unlock(mqb);
+			return;
+		}
+		mutex_control_add(mqb, mutex_queue);
+	}
+
+	mutex_queue->contenders--;
+
+	if (mutex_queue->contenders == 0) {
+		if (mutex_queue->wqh_holders.sleepers)
+			wake_up(&mutex_queue->wqh_holders, WAKEUP_ASYNC);
+
+		if (!mutex_queue->wqh_holders.sleepers &&
+		    !mutex_queue->wqh_contenders.sleepers) {
+			mutex_control_remove(mqb, mutex_queue);
+			mutex_control_delete(mutex_queue);
+		}
+	}
+
+	mutex_queue_bucket_unlock(mqb);
+}
+
 int mutex_control_lock(struct mutex_queue_head *mqhead,
-		       unsigned long mutex_address)
+		       unsigned long mutex_address, unsigned int timeout)
 {
+	int ret;
 	struct mutex_queue *mutex_queue;
+	struct mutex_queue_bucket *mqb =
+		mutex_queue_bucket(mqhead, mutex_address);
 
-	mutex_queue_head_lock(mqhead);
+	mutex_queue_bucket_lock(mqb);
 
 	/* Search for the mutex queue */
-	if (!(mutex_queue = mutex_control_find(mqhead, mutex_address))) {
+	if (!(mutex_queue = mutex_control_find(mqb, mutex_address))) {
 		/* Create a new one */
 		if (!(mutex_queue = mutex_control_create(mutex_address))) {
-			mutex_queue_head_unlock(mqhead);
+			mutex_queue_bucket_unlock(mqb);
 			return -ENOMEM;
 		}
 		/* Add the queue to mutex queue list */
-		mutex_control_add(mqhead, mutex_queue);
+		mutex_control_add(mqb, mutex_queue);
 
 	} else if (mutex_queue->wqh_holders.sleepers) {
 		/*
@@ -182,40 +238,52 @@ int mutex_control_lock(struct mutex_queue_head *mqhead,
 			wake_up(&mutex_queue->wqh_holders, WAKEUP_ASYNC);
 
 			/* There must not be any contenders, delete the mutex */
-			mutex_control_remove(mqhead, mutex_queue);
+			mutex_control_remove(mqb, mutex_queue);
 			mutex_control_delete(mutex_queue);
 		}
 
 		/* Release lock and return */
-		mutex_queue_head_unlock(mqhead);
+		mutex_queue_bucket_unlock(mqb);
 		return 0;
 	}
 
+	/* Not to wait at all */
+	if (timeout == L4_TIMEOUT_POLL) {
+		mutex_queue_bucket_unlock(mqb);
+		mutex_control_lock_cancel(mqhead, mutex_address);
+		return -ETIMEDOUT;
+	}
+
 	/* Prepare to wait on the contenders queue */
 	CREATE_WAITQUEUE_ON_STACK(wq, current);
 
 	wait_on_prepare(&mutex_queue->wqh_contenders, &wq);
 
 	/* Release lock */
-	mutex_queue_head_unlock(mqhead);
+	mutex_queue_bucket_unlock(mqb);
 
 	/* Initiate prepared wait */
-	return wait_on_prepared_wait();
+	if ((ret = wait_on_prepared_wait_timeout(timeout)) == -ETIMEDOUT)
+		mutex_control_lock_cancel(mqhead, mutex_address);
+
+	return ret;
 }
 
 int mutex_control_unlock(struct mutex_queue_head *mqhead,
 			 unsigned long mutex_address, int contenders)
 {
 	struct mutex_queue *mutex_queue;
+	struct mutex_queue_bucket *mqb =
+		mutex_queue_bucket(mqhead, mutex_address);
 
-	mutex_queue_head_lock(mqhead);
+	mutex_queue_bucket_lock(mqb);
 
 	/* Search for the mutex queue */
-	if (!(mutex_queue = mutex_control_find(mqhead, mutex_address))) {
+	if (!(mutex_queue = mutex_control_find(mqb, mutex_address))) {
 
 		/* No such mutex, create one and sleep on it */
 		if (!(mutex_queue = mutex_control_create(mutex_address))) {
-			mutex_queue_head_unlock(mqhead);
+			mutex_queue_bucket_unlock(mqb);
 			return -ENOMEM;
 		}
 
@@ -223,7 +291,7 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		mutex_queue->contenders = contenders;
 
 		/* Add the queue to mutex queue list */
-		mutex_control_add(mqhead, mutex_queue);
+		mutex_control_add(mqb, mutex_queue);
 
 		/* Prepare to wait on the lock holders queue */
 		CREATE_WAITQUEUE_ON_STACK(wq, current);
@@ -232,7 +300,7 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		wait_on_prepare(&mutex_queue->wqh_holders, &wq);
 
 		/* Release lock first */
-		mutex_queue_head_unlock(mqhead);
+		mutex_queue_bucket_unlock(mqb);
 
 		/* Initiate prepared wait */
 		return wait_on_prepared_wait();
@@ -268,12 +336,12 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		/* Delete only if no more contenders */
 		if (mutex_queue->wqh_contenders.sleepers == 0) {
 			/* Since noone is left, delete the mutex queue */
-			mutex_control_remove(mqhead, mutex_queue);
+			mutex_control_remove(mqb, mutex_queue);
 			mutex_control_delete(mutex_queue);
 		}
 
 		/* Release lock and return */
-		mutex_queue_head_unlock(mqhead);
+		mutex_queue_bucket_unlock(mqb);
 	} else {
 		/* Prepare to wait on the lock holders queue */
 		CREATE_WAITQUEUE_ON_STACK(wq, current);
@@ -282,7 +350,7 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		wait_on_prepare(&mutex_queue->wqh_holders, &wq);
 
 		/* Release lock first */
-		mutex_queue_head_unlock(mqhead);
+		mutex_queue_bucket_unlock(mqb);
 
 		/* Initiate prepared wait */
 		return wait_on_prepared_wait();
@@ -323,7 +391,8 @@ int sys_mutex_control(unsigned long mutex_address, int mutex_flags)
 	switch (mutex_op) {
 	case MUTEX_CONTROL_LOCK:
 		ret = mutex_control_lock(&curcont->mutex_queue_head,
-					 mutex_physical);
+					 mutex_physical,
+					 mutex_timeout(mutex_flags));
 		break;
 	case MUTEX_CONTROL_UNLOCK:
 		ret = mutex_control_unlock(&curcont->mutex_queue_head,
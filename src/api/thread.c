@@ -382,7 +382,8 @@ int thread_setup_space(struct ktcb *tcb, struct task_ids *ids, unsigned int flag
 			goto out;
 		}
 		spin_lock(&space->lock);
-		if (IS_ERR(new = address_space_create(space))) {
+		if (IS_ERR(new = address_space_create(space,
+						       flags & TC_WRITE_PROTECT))) {
 			spin_unlock(&curcont->space_list.lock);
 			spin_unlock(&space->lock);
 			ret = (int)new;
@@ -395,7 +396,7 @@ int thread_setup_space(struct ktcb *tcb, struct task_ids *ids, unsigned int flag
 		spin_unlock(&curcont->space_list.lock);
 	}
 	else if (flags & TC_NEW_SPACE) {
-		if (IS_ERR(new = address_space_create(0))) {
+		if (IS_ERR(new = address_space_create(0, 0))) {
 			ret = (int)new;
 			goto out;
 		}
@@ -429,6 +430,10 @@ int thread_create(struct task_ids *ids, unsigned int flags)
 	if ((flags & THREAD_SPACE_MASK) == 0)
 		return -EINVAL;
 
+	/* Only a copied space can be write protected */
+	if ((flags & TC_WRITE_PROTECT) && !(flags & TC_COPY_SPACE))
+		return -EINVAL;
+
 	/* Can't request shared utcb or tgid without shared space */
 	if (!(flags & TC_SHARE_SPACE)) {
 		if ((flags & TC_SHARE_UTCB) ||
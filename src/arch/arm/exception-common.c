@@ -11,6 +11,7 @@
 #include <l4/generic/tcb.h>
 #include <l4/generic/platform.h>
 #include <l4/generic/debug.h>
+#include <l4/generic/trace.h>
 #include <l4/lib/printk.h>
 #include <l4/api/ipc.h>
 #include <l4/api/kip.h>
@@ -211,7 +212,9 @@ void data_abort_handler(u32 faulted_pc, u32 dfsr, u32 dfar, u32 spsr)
 		return;
 
 	/* Notify the pager */
+	trace_event(TRACE_FAULT_ENTRY, dfar, dfsr, faulted_pc, 0);
 	fault_ipc_to_pager(faulted_pc, dfsr, dfar, L4_IPC_TAG_PFAULT);
+	trace_event(TRACE_FAULT_EXIT, dfar, 0, 0, 0);
 
 	/*
 	 * FIXME:
@@ -257,7 +260,9 @@ void prefetch_abort_handler(u32 faulted_pc, u32 ifsr, u32 ifar, u32 spsr)
 		return; /* Return if handled internally */
 
 	/* Notify the pager */
+	trace_event(TRACE_FAULT_ENTRY, ifar, ifsr, faulted_pc, 0);
 	fault_ipc_to_pager(faulted_pc, ifsr, ifar, L4_IPC_TAG_PFAULT);
+	trace_event(TRACE_FAULT_EXIT, ifar, 0, 0, 0);
 
 	/*
 	 * FIXME:
@@ -38,6 +38,58 @@ pmd_table_t *pmd_exists(pgd_table_t *task_pgd, unsigned long vaddr)
 	return 0;
 }
 
+/*
+ * Large page ptes have the same flags as small ones,
+ * and are replicated over the small ptes they cover.
+ */
+static inline pte_t pte_to_large(pte_t pte)
+{
+	return (pte & ~PTE_TYPE_MASK) | PTE_TYPE_LARGE;
+}
+
+static inline pte_t large_to_pte(pte_t large, unsigned long vaddr)
+{
+	return (large & ~LARGE_PAGE_MASK) |
+	       (vaddr & LARGE_PAGE_MASK & ~PAGE_MASK) |
+	       (large & PAGE_MASK & ~PTE_TYPE_MASK) | PTE_TYPE_SMALL;
+}
+
+/*
+ * Rewrites the large page around vaddr as the small pages it is made
+ * of. The large pte is passed as it was before any of its replicas
+ * were written, as the first of them may already be cleared.
+ */
+static void split_large_pte(struct pte_batch *batch, pmd_table_t *pmd_table,
+			    unsigned long vaddr, pte_t large)
+{
+	unsigned long base = vaddr & ~LARGE_PAGE_MASK;
+
+	for (int i = 0; i < LARGE_PAGE_PTES; i++)
+		arch_pte_batch_write(batch,
+				     &pmd_table->entry[PMD_INDEX(base) + i],
+				     large_to_pte(large, base + i * PAGE_SIZE),
+				     base + i * PAGE_SIZE);
+}
+
+/* Replaces the section at pmd with a pmd table of the same mappings */
+static pmd_table_t *split_section(struct pte_batch *batch, pmd_t *pmd,
+				  unsigned long vaddr, struct cap_list *clist)
+{
+	unsigned long base = vaddr & SECTION_ALIGN_MASK;
+	pmd_table_t *pmd_table;
+
+	if (!(pmd_table = pmd_cap_alloc(clist)))
+		return 0;
+
+	for (int i = 0; i < PMD_ENTRY_TOTAL; i++)
+		pmd_table->entry[i] = arch_section_to_pte(*pmd,
+							  base + i * PAGE_SIZE);
+
+	arch_pte_batch_write_pmd(batch, pmd, (pmd_t)(virt_to_phys(pmd_table)
+						     | PMD_TYPE_PMD), vaddr);
+	return pmd_table;
+}
+
 /*
  * Convert virtual address to a pte from a task-specific pgd
  * FIXME: Remove this by using ptep version, leaving due to
@@ -46,12 +98,21 @@ pmd_table_t *pmd_exists(pgd_table_t *task_pgd, unsigned long vaddr)
 pte_t virt_to_pte_from_pgd(pgd_table_t *task_pgd,
 			   unsigned long virtual)
 {
-	pmd_table_t *pmd = pmd_exists(task_pgd, virtual);
+	pmd_t *pmdp = arch_pick_pmd(task_pgd, virtual);
+	pmd_table_t *pmd;
+	pte_t pte;
 
-	if (pmd)
-		return (pte_t)pmd->entry[PMD_INDEX(virtual)];
-	else
+	/* Sections and large pages are given as the small page here */
+	if ((*pmdp & PMD_TYPE_MASK) == PMD_TYPE_SECTION)
+		return arch_section_to_pte(*pmdp, virtual);
+
+	if (!(pmd = pmd_exists(task_pgd, virtual)))
 		return (pte_t)0;
+
+	pte = (pte_t)pmd->entry[PMD_INDEX(virtual)];
+	if ((pte & PTE_TYPE_MASK) == PTE_TYPE_LARGE)
+		return large_to_pte(pte, virtual);
+	return pte;
 }
 
 /* Convert virtual address to a pte from a task-specific pgd */
@@ -112,7 +173,7 @@ void attach_pmd(struct address_space *space,
 	pmd = arch_pick_pmd(space->pgd, vaddr);
 
 	/* Write the pmd into hardware pgd */
-	arch_write_pmd(pmd, pmd_phys, vaddr, space->spid);
+	arch_write_pmd(pmd, pmd_phys, vaddr, space->asid);
 }
 
 /*
@@ -121,6 +182,14 @@ void attach_pmd(struct address_space *space,
  *
  * This is useful for when irqs force mapping of UTCBs of
  * other tasks to the preempted tasks for handling.
+ *
+ * Where physical and virtual addresses are aligned alike, the
+ * range is mapped with sections and large pages. Sections go
+ * only where there's no pmd table, and not in global areas,
+ * as those are copied to each pgd once.
+ *
+ * All ptes of the range are written first, and the caches
+ * and tlb are synced once for the range when they are done.
  */
 int add_mapping_use_cap(unsigned long physical, unsigned long virtual,
 		     	unsigned int sz_bytes, unsigned int flags,
@@ -128,7 +197,12 @@ int add_mapping_use_cap(unsigned long physical, unsigned long virtual,
 			struct cap_list *clist)
 {
 	unsigned long npages = (sz_bytes >> PFN_SHIFT);
+	unsigned long pages;
 	pmd_table_t *pmd_table;
+	struct pte_batch batch;
+	int exec, ret = 0;
+	pmd_t *pmd;
+	pte_t pte;
 
 	if (sz_bytes < PAGE_SIZE) {
 		print_early("Error: Mapping size less than PAGE_SIZE. "
@@ -140,85 +214,85 @@ int add_mapping_use_cap(unsigned long physical, unsigned long virtual,
 		npages++;
 
 	/* Convert generic map flags to arch specific flags */
+	exec = space_flags_exec(flags);
 	BUG_ON(!(flags = space_flags_to_ptflags(flags)));
 
+	arch_pte_batch_begin(&batch, space, virtual,
+			     virtual + npages * PAGE_SIZE, exec);
+
 	/* Map all pages that cover given size */
-	for (int i = 0; i < npages; i++) {
-		/* Check if a pmd was attached previously */
-		if (!(pmd_table = pmd_exists(space->pgd, virtual))) {
+	for (; npages; npages -= pages) {
+		pmd = arch_pick_pmd(space->pgd, virtual);
+		arch_prepare_pte(physical, virtual, flags, &pte);
+
+		if ((*pmd & PMD_TYPE_MASK) != PMD_TYPE_PMD &&
+		    npages >= SECTION_PAGES &&
+		    is_aligned(physical | virtual, SECTION_SIZE) &&
+		    !is_global_pgdi(PGD_INDEX(virtual))) {
+			/* Whole section */
+			arch_pte_batch_write_pmd(&batch, pmd,
+						 arch_pte_to_section(pte),
+						 virtual);
+			pages = SECTION_PAGES;
+			goto next;
+		}
 
+		if ((*pmd & PMD_TYPE_MASK) == PMD_TYPE_SECTION) {
+			/* Part of a section is remapped */
+			if (!(pmd_table = split_section(&batch, pmd,
+							virtual, clist))) {
+				ret = -ENOMEM;
+				break;
+			}
+		} else if (!(pmd_table = pmd_exists(space->pgd, virtual))) {
 			/* First mapping in pmd, allocate it */
-			if (!(pmd_table = pmd_cap_alloc(clist)))
-				return -ENOMEM;
+			if (!(pmd_table = pmd_cap_alloc(clist))) {
+				ret = -ENOMEM;
+				break;
+			}
 
-			/* Prepare the pte but don't sync */
-			arch_prepare_pte(physical, virtual, flags,
-			&pmd_table->entry[PMD_INDEX(virtual)]);
-
-			/* Attach pmd to its pgd and sync it */
+			/* Attach the empty pmd to its pgd and sync it */
 			attach_pmd(space, pmd_table, virtual);
+		}
+
+		if (npages >= LARGE_PAGE_PTES &&
+		    is_aligned(physical | virtual, LARGE_PAGE_SIZE)) {
+			/* Large page, over whatever was there */
+			pages = LARGE_PAGE_PTES;
+			for (int i = 0; i < LARGE_PAGE_PTES; i++)
+				arch_pte_batch_write(&batch,
+						     &pmd_table->entry[PMD_INDEX(virtual) + i],
+						     pte_to_large(pte),
+						     virtual + i * PAGE_SIZE);
 		} else {
-			/* Prepare, write the pte and sync */
-			arch_prepare_write_pte(space, physical, virtual,
-					       flags,
-					       &pmd_table->entry[PMD_INDEX(virtual)]);
+			/* Small page, remapping part of a large one */
+			pages = 1;
+			if ((pmd_table->entry[PMD_INDEX(virtual)] &
+			     PTE_TYPE_MASK) == PTE_TYPE_LARGE)
+				split_large_pte(&batch, pmd_table, virtual,
+						pmd_table->entry[PMD_INDEX(virtual)]);
+			arch_pte_batch_write(&batch,
+					     &pmd_table->entry[PMD_INDEX(virtual)],
+					     pte, virtual);
 		}
 
+next:
 		/* Move on to the next page */
-		physical += PAGE_SIZE;
-		virtual += PAGE_SIZE;
+		physical += pages * PAGE_SIZE;
+		virtual += pages * PAGE_SIZE;
 	}
 
-	return 0;
+	arch_pte_batch_commit(&batch);
+
+	return ret;
 }
 
 int add_mapping_space(unsigned long physical, unsigned long virtual,
 		      unsigned int sz_bytes, unsigned int flags,
 		      struct address_space *space)
 {
-	unsigned long npages = (sz_bytes >> PFN_SHIFT);
-	pmd_table_t *pmd_table;
-
-	if (sz_bytes < PAGE_SIZE) {
-		print_early("Error: Mapping size less than PAGE_SIZE. "
-			   "Mapping size is in bytes not pages.\n");
-		BUG();
-	}
-
-	if (sz_bytes & PAGE_MASK)
-		npages++;
-
-	/* Convert generic map flags to arch specific flags */
-	BUG_ON(!(flags = space_flags_to_ptflags(flags)));
-
-	/* Map all pages that cover given size */
-	for (int i = 0; i < npages; i++) {
-		/* Check if a pmd was attached previously */
-		if (!(pmd_table = pmd_exists(space->pgd, virtual))) {
-
-			/* First mapping in pmd, allocate it */
-			if (!(pmd_table = pmd_cap_alloc(&current->space->cap_list)))
-				return -ENOMEM;
-
-			/* Prepare the pte but don't sync */
-			arch_prepare_pte(physical, virtual, flags,
-			&pmd_table->entry[PMD_INDEX(virtual)]);
-
-			/* Attach pmd to its pgd and sync it */
-			attach_pmd(space, pmd_table, virtual);
-		} else {
-			/* Prepare, write the pte and sync */
-			arch_prepare_write_pte(space, physical, virtual,
-					       flags,
-					       &pmd_table->entry[PMD_INDEX(virtual)]);
-		}
-
-		/* Move on to the next page */
-		physical += PAGE_SIZE;
-		virtual += PAGE_SIZE;
-	}
-
-	return 0;
+	return add_mapping_use_cap(physical, virtual, sz_bytes, flags,
+				   space, &current->space->cap_list);
 }
 
 void add_boot_mapping(unsigned long physical, unsigned long virtual,
@@ -306,54 +380,155 @@ int check_mapping(unsigned long vaddr, unsigned long size,
 				 TASK_PGD(current));
 }
 
+/* Tells if a pmd table has no valid entries left */
+static int pmd_table_empty(pmd_table_t *pmd_table)
+{
+	for (int i = 0; i < PMD_ENTRY_TOTAL; i++)
+		if ((pmd_table->entry[i] & PTE_TYPE_MASK) != PTE_TYPE_FAULT)
+			return 0;
+	return 1;
+}
+
 /*
- * This can be made common for v5/v7, keeping split/page table
- * and cache flush parts in arch-specific files.
+ * Clears the ptes of [start, end) within a single pmd as one
+ * batch, then detaches the pmd and returns it to clist if no
+ * mappings are left in it. Global pmds are always kept, as are
+ * all pmds if clist is null. Sections unmapped in part are
+ * split into a pmd table first.
  */
-int remove_mapping_space(struct address_space *space, unsigned long vaddr)
+static int remove_mapping_pmd(struct address_space *space,
+			      unsigned long start, unsigned long end,
+			      struct cap_list *clist)
 {
 	pmd_table_t *pmd_table;
-	int pmd_i;
-	pmd_t *pmd;
+	struct pte_batch batch;
 	unsigned int pmd_type, pte_type;
-
-	vaddr = page_align(vaddr);
-	pmd_i = PMD_INDEX(vaddr);
+	unsigned long vaddr;
+	int ret = 0;
+	pmd_t *pmd;
+	pte_t pte, *ptep;
 
 	/*
 	 * Get the right pgd's pmd according to whether
 	 * the address is global or task-specific.
 	 */
-	pmd = arch_pick_pmd(space->pgd, vaddr);
+	pmd = arch_pick_pmd(space->pgd, start);
 
 	pmd_type = *pmd & PMD_TYPE_MASK;
 
 	if (pmd_type == PMD_TYPE_FAULT)
 		return -ENOMAP;
 
-	/* Anything else must be a proper pmd */
-	BUG_ON(pmd_type != PMD_TYPE_PMD);
+	arch_prepare_pte(0, start, space_flags_to_ptflags(MAP_FAULT), &pte);
+	arch_pte_batch_begin(&batch, space, start, end, 0);
 
-	/* Get the 2nd level pmd table */
-	pmd_table = (pmd_table_t *)
-		    phys_to_virt((unsigned long)*pmd
-				 & PMD_ALIGN_MASK);
+	if (pmd_type == PMD_TYPE_SECTION) {
+		/* A whole section simply goes */
+		if (end - start == SECTION_SIZE) {
+			arch_pte_batch_write_pmd(&batch, pmd,
+						 (pmd_t)PMD_TYPE_FAULT, start);
+			arch_pte_batch_commit(&batch);
+			return 0;
+		}
 
-	/* Get the pte type already there */
-	pte_type = pmd_table->entry[pmd_i] & PTE_TYPE_MASK;
+		/* Part of it is unmapped as pages */
+		if (!(pmd_table = split_section(&batch, pmd, start,
+						clist ? clist :
+						&current->space->cap_list))) {
+			arch_pte_batch_commit(&batch);
+			return -ENOMEM;
+		}
+	} else {
+		/* Anything else must be a proper pmd */
+		BUG_ON(pmd_type != PMD_TYPE_PMD);
+
+		/* Get the 2nd level pmd table */
+		pmd_table = (pmd_table_t *)
+			    phys_to_virt((unsigned long)*pmd
+					 & PMD_ALIGN_MASK);
+	}
 
-	/* If it's a fault we're done */
-	if (pte_type == PTE_TYPE_FAULT)
-		return -ENOMAP;
-	/* It must be a small pte if not fault */
-	else if (pte_type != PTE_TYPE_SMALL)
-		BUG();
+	for (vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+		ptep = &pmd_table->entry[PMD_INDEX(vaddr)];
+		pte_type = *ptep & PTE_TYPE_MASK;
 
-	/* Write to pte, also syncing it as required by arch */
-	arch_prepare_write_pte(space, 0, vaddr,
-			       space_flags_to_ptflags(MAP_FAULT),
-			       (pte_t *)&pmd_table->entry[pmd_i]);
-	return 0;
+		/* If it's a fault there's nothing to clear */
+		if (pte_type == PTE_TYPE_FAULT) {
+			ret = -ENOMAP;
+			continue;
+		}
+
+		/* It must be a small or large pte if not fault */
+		BUG_ON(pte_type != PTE_TYPE_SMALL &&
+		       pte_type != PTE_TYPE_LARGE);
+
+		if (pte_type == PTE_TYPE_LARGE) {
+			/* Large pages wholly in range go all at once */
+			if (is_aligned(vaddr, LARGE_PAGE_SIZE) &&
+			    end - vaddr >= LARGE_PAGE_SIZE) {
+				for (int i = 0; i < LARGE_PAGE_PTES; i++)
+					arch_pte_batch_write(&batch, ptep + i,
+							     pte, vaddr +
+							     i * PAGE_SIZE);
+				vaddr += LARGE_PAGE_SIZE - PAGE_SIZE;
+				continue;
+			}
+
+			/* Those partly out of range are split first */
+			split_large_pte(&batch, pmd_table, vaddr, *ptep);
+		}
+
+		arch_pte_batch_write(&batch, ptep, pte, vaddr);
+	}
+
+	/* No tlb entries from the pmd may be left before it goes */
+	arch_pte_batch_commit(&batch);
+
+	if (clist && !is_global_pgdi(PGD_INDEX(start)) &&
+	    pmd_table_empty(pmd_table)) {
+		arch_clear_pmd(pmd, start, space->asid);
+		pmd_cap_free(pmd_table, clist);
+	}
+
+	return ret;
+}
+
+/*
+ * This can be made common for v5/v7, keeping split/page table
+ * and cache flush parts in arch-specific files.
+ */
+int remove_mapping_space(struct address_space *space, unsigned long vaddr)
+{
+	return remove_mapping_range(space, vaddr, 1, 0);
+}
+
+/*
+ * Unmaps npages from vaddr, a pmd at a time, with one cache and
+ * tlb sync for each pmd. Pmds left empty are freed to clist, if
+ * given. Returns -ENOMAP if part of the range was not mapped.
+ */
+int remove_mapping_range(struct address_space *space, unsigned long vaddr,
+			 unsigned long npages, struct cap_list *clist)
+{
+	unsigned long end, pmd_end;
+	int ret, retval = 0;
+
+	vaddr = page_align(vaddr);
+	end = vaddr + npages * PAGE_SIZE;
+
+	while (vaddr != end) {
+		/* Up to the end of this pmd, or of the range */
+		pmd_end = align(vaddr, PMD_MAP_SIZE) + PMD_MAP_SIZE;
+		if (pmd_end - vaddr > end - vaddr)
+			pmd_end = end;
+
+		if ((ret = remove_mapping_pmd(space, vaddr, pmd_end, clist)))
+			retval = ret;
+
+		vaddr = pmd_end;
+	}
+
+	return retval;
 }
 
 int remove_mapping(unsigned long vaddr)
@@ -369,16 +544,49 @@ int delete_page_tables(struct address_space *space, struct cap_list *clist)
 	return 0;
 }
 
+/* Takes away user write access from the ptes of a pmd table */
+static void pmd_table_write_protect(struct pte_batch *batch,
+				    pmd_table_t *pmd_table,
+				    unsigned long vaddr)
+{
+	unsigned int pte_type;
+	pte_t pte;
+
+	for (int i = 0; i < PMD_ENTRY_TOTAL; i++) {
+		pte_type = pmd_table->entry[i] & PTE_TYPE_MASK;
+		if (pte_type != PTE_TYPE_SMALL && pte_type != PTE_TYPE_LARGE)
+			continue;
+
+		/* Large pages change in each pte they are replicated over */
+		pte = arch_pte_write_protect(pmd_table->entry[i]);
+		if (pte != pmd_table->entry[i])
+			arch_pte_batch_write(batch, &pmd_table->entry[i], pte,
+					     vaddr + i * PAGE_SIZE);
+	}
+}
+
 /*
  * Copies userspace entries of one task to another.
  * In order to do that, it allocates new pmds and
  * copies the original values into new ones.
+ *
+ * With write_protect, user writable mappings of the original go
+ * read-only on the way, so that both end up read-only, as a fork
+ * needs for copy-on-write. This is a single pass over the tables,
+ * with the caches and tlb synced once at the end.
  */
 int copy_user_tables(struct address_space *new,
-		     struct address_space *orig_space)
+		     struct address_space *orig_space,
+		     int write_protect)
 {
 	pgd_table_t *to = new->pgd, *from = orig_space->pgd;
 	pmd_table_t *pmd, *orig;
+	struct pte_batch batch;
+	pmd_t section;
+
+	if (write_protect)
+		arch_pte_batch_begin(&batch, orig_space, 0,
+				     KERNEL_AREA_START, 0);
 
 	/* Allocate and copy all pmds that will be exclusive to new task. */
 	for (int i = 0; i < PGD_ENTRY_TOTAL; i++) {
@@ -395,15 +603,36 @@ int copy_user_tables(struct address_space *new,
 				phys_to_virt((from->entry[i] &
 				PMD_ALIGN_MASK));
 
+			if (write_protect)
+				pmd_table_write_protect(&batch, orig,
+							i * PMD_MAP_SIZE);
+
 			/* Copy original to new */
 			memcpy(pmd, orig, sizeof(pmd_table_t));
 
 			/* Replace original pmd entry in pgd with new */
 			to->entry[i] = (pmd_t)(virt_to_phys(pmd)
 					       | PMD_TYPE_PMD);
+		} else if (!is_global_pgdi(i) &&
+			   (from->entry[i] & PMD_TYPE_MASK)
+			   == PMD_TYPE_SECTION) {
+			if (write_protect) {
+				section = arch_section_write_protect(from->entry[i]);
+				if (section != from->entry[i])
+					arch_pte_batch_write_pmd(&batch,
+								 &from->entry[i],
+								 section,
+								 i * PMD_MAP_SIZE);
+			}
+
+			/* Sections have no table to copy */
+			to->entry[i] = from->entry[i];
 		}
 	}
 
+	if (write_protect)
+		arch_pte_batch_commit(&batch);
+
 	/* Just in case the new table is written to any ttbr
 	 * after here, make sure all writes on it are complete. */
 	dmb();
@@ -411,6 +640,10 @@ int copy_user_tables(struct address_space *new,
 	return 0;
 
 out_error:
+	/* What was write protected so far must not linger in the tlb */
+	if (write_protect)
+		arch_pte_batch_commit(&batch);
+
 	/* Find all non-kernel pmds we have just allocated and free them */
 	for (int i = 0; i < PGD_ENTRY_TOTAL; i++) {
 		/* Non-kernel pmd that has just been allocated. */
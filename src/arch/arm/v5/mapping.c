@@ -116,6 +116,47 @@ void arch_prepare_pte(u32 paddr, u32 vaddr, unsigned int flags,
 		*ptep = paddr | flags | PTE_TYPE_SMALL;
 }
 
+/*
+ * Section permissions are a single field, where small pages
+ * have one for each subpage. Subpages are always the same here.
+ */
+pmd_t arch_pte_to_section(pte_t pte)
+{
+	return (pte & SECTION_ALIGN_MASK) |
+	       (pte & (cacheable | bufferable)) |
+	       (((pte >> PAGE_AP0) & 0x3) << SECTION_AP0) |
+	       PMD_TYPE_SECTION;
+}
+
+pte_t arch_section_to_pte(pmd_t section, unsigned long vaddr)
+{
+	unsigned int ap = (section >> SECTION_AP0) & 0x3;
+
+	return (section & SECTION_ALIGN_MASK) |
+	       (vaddr & SECTION_MASK & ~ARM_PAGE_MASK) |
+	       (section & (cacheable | bufferable)) |
+	       (ap << PAGE_AP0) | (ap << PAGE_AP1) |
+	       (ap << PAGE_AP2) | (ap << PAGE_AP3) |
+	       PTE_TYPE_SMALL;
+}
+
+/* Takes away user write access, from each subpage that has it */
+pte_t arch_pte_write_protect(pte_t pte)
+{
+	for (int ap = PAGE_AP0; ap <= PAGE_AP3; ap += 2)
+		if (((pte >> ap) & 0x3) == SVC_RW_USR_RW)
+			pte = (pte & ~(0x3 << ap)) | (SVC_RW_USR_RO << ap);
+	return pte;
+}
+
+pmd_t arch_section_write_protect(pmd_t section)
+{
+	if (((section >> SECTION_AP0) & 0x3) == SVC_RW_USR_RW)
+		section = (section & ~(0x3 << SECTION_AP0)) |
+			  (SVC_RW_USR_RO << SECTION_AP0);
+	return section;
+}
+
 void arch_write_pte(pte_t *ptep, pte_t pte, u32 vaddr, u32 asid)
 {
 	/* FIXME:
@@ -155,7 +196,51 @@ void arch_prepare_write_pte(struct address_space *space,
 
 	arch_prepare_pte(paddr, vaddr, flags, &pte);
 
-	arch_write_pte(ptep, pte, vaddr, space->spid);
+	arch_write_pte(ptep, pte, vaddr, space->asid);
+}
+
+/*
+ * The v5 dcache is virtual, so it is cleaned before the
+ * translations of a range change. There are no asids, nor
+ * a way to clean by mva in another space, so the whole
+ * cache and tlb are synced, but only once for the range.
+ */
+void arch_pte_batch_begin(struct pte_batch *batch,
+			  struct address_space *space,
+			  unsigned long start, unsigned long end, int exec)
+{
+	batch->space = space;
+	batch->start = start;
+	batch->end = end;
+	batch->exec = exec;
+	batch->stale = 0;
+	batch->global = 0;
+	batch->ptep_start = batch->ptep_end = 0;
+
+	arm_clean_invalidate_cache();
+}
+
+void arch_pte_batch_write(struct pte_batch *batch, pte_t *ptep,
+			  pte_t pte, u32 vaddr)
+{
+	if ((*ptep & PTE_TYPE_MASK) != PTE_TYPE_FAULT)
+		batch->stale = 1;
+	*ptep = pte;
+}
+
+void arch_pte_batch_write_pmd(struct pte_batch *batch, pmd_t *pmdp,
+			      pmd_t pmd, u32 vaddr)
+{
+	if ((*pmdp & PMD_TYPE_MASK) != PMD_TYPE_FAULT)
+		batch->stale = 1;
+	*pmdp = pmd;
+}
+
+void arch_pte_batch_commit(struct pte_batch *batch)
+{
+	arm_clean_invalidate_cache();
+	if (batch->stale)
+		arm_invalidate_tlb();
 }
 
 pmd_t *
@@ -175,6 +260,13 @@ void arch_write_pmd(pmd_t *pmd_entry, u32 pmd_phys, u32 vaddr, u32 asid)
 	arm_invalidate_tlb();
 }
 
+/* Detaches a pmd whose ptes have all been cleared and synced */
+void arch_clear_pmd(pmd_t *pmd_entry, u32 vaddr, u32 asid)
+{
+	*pmd_entry = (pmd_t)PMD_TYPE_FAULT;
+	arm_drain_writebuffer();
+}
+
 
 int arch_check_pte_access_perms(pte_t pte, unsigned int flags)
 {
@@ -360,6 +452,12 @@ void arch_space_switch(struct ktcb *to)
 	arm_invalidate_tlb();
 }
 
+/* Tlbs are not tagged on v5, so spaces hold nothing to release */
+void arch_space_release(struct address_space *space)
+{
+
+}
+
 void idle_task(void)
 {
 	while(1) {
@@ -369,6 +467,9 @@ void idle_task(void)
 		/* Clear idle runnable flag */
 		per_cpu(scheduler).flags &= ~SCHED_RUN_IDLE;
 
+		/* Sleep until there is something to run */
+		sched_idle_wait();
+
 		schedule();
 	}
 }
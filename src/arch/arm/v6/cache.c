@@ -0,0 +1,38 @@
+/*
+ * Generic layer over ARMv6 specific cache calls
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/generic/tcb.h>
+#include INC_SUBARCH(mm.h)
+#include INC_SUBARCH(mmu_ops.h)
+#include INC_GLUE(memory.h)
+
+void arch_invalidate_dcache(unsigned long start, unsigned long end)
+{
+	arm_invalidate_dcache_range(start, end);
+}
+
+void arch_clean_invalidate_dcache(unsigned long start, unsigned long end)
+{
+	arm_clean_invalidate_dcache_range(start, end);
+}
+
+void arch_invalidate_icache(unsigned long start, unsigned long end)
+{
+	arm_invalidate_icache_range(start, end);
+}
+
+void arch_clean_dcache(unsigned long start, unsigned long end)
+{
+	arm_clean_dcache_range(start, end);
+}
+
+/* Entries of the current space only */
+void arch_invalidate_tlb(unsigned long start, unsigned long end)
+{
+	u32 asid = current->space->asid & ASID_MASK;
+
+	for (start = page_align(start); start < end; start += PAGE_SIZE)
+		arm_invalidate_tlb_mva(start | asid);
+}
@@ -23,9 +23,7 @@ void cpu_startup(void)
 	 * write buffers
 	 */
 
-	/* Enable V6 page tables */
-	//unsigned int val = arm_get_cp15_cr() | 1<<23;
-        //arm_set_cp15_cr(val);
+	/* V6 page tables are enabled in start_virtual_memory() */
 
 
 #if defined (CONFIG_SMP_)
@@ -38,10 +38,7 @@ void jump(struct ktcb *task)
 
 void switch_to_user(struct ktcb *task)
 {
-	arm_clean_invalidate_cache();
-	arm_invalidate_tlb();
-	arm_set_ttb(virt_to_phys(TASK_PGD(task)));
-	arm_invalidate_tlb();
+	arch_space_switch(task);
 	jump(task);
 }
 
@@ -90,6 +87,9 @@ void start_virtual_memory()
 
 	arm_enable_high_vectors();
 
+	/* Needed for non-global mappings, tagged with ASIDs */
+	arm_enable_extended_pagetables();
+
 	/*
 	 * Leave the past behind. Tlbs are invalidated, write buffer is drained.
 	 * The whole of I + D caches are invalidated unconditionally. This is
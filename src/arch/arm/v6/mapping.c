@@ -9,6 +9,9 @@
 #include <l4/generic/bootmem.h>
 #include <l4/generic/resource.h>
 #include <l4/generic/platform.h>
+#include <l4/generic/debug.h>
+#include <l4/generic/smp.h>
+#include <l4/lib/bit.h>
 #include <l4/api/errno.h>
 #include INC_SUBARCH(mm.h)
 #include INC_SUBARCH(mmu_ops.h)
@@ -112,34 +115,141 @@ void arch_prepare_pte(u32 paddr, u32 vaddr, unsigned int flags,
 		*ptep = paddr | flags | PTE_TYPE_SMALL;
 }
 
-void arch_write_pte(pte_t *ptep, pte_t pte, u32 vaddr)
+/*
+ * Sections have the same cacheability bits as small pages,
+ * but permissions and nG are elsewhere.
+ */
+pmd_t arch_pte_to_section(pte_t pte)
+{
+	pmd_t section = (pte & SECTION_ALIGN_MASK) |
+			(pte & (cacheable | bufferable)) |
+			(((pte & PTE_PROT_MASK) >> PAGE_AP0) << SECTION_AP0) |
+			PMD_TYPE_SECTION;
+
+	if (pte & PTE_NG)
+		section |= SECTION_NG;
+	return section;
+}
+
+pte_t arch_section_to_pte(pmd_t section, unsigned long vaddr)
+{
+	pte_t pte = (section & SECTION_ALIGN_MASK) |
+		    (vaddr & SECTION_MASK & ~ARM_PAGE_MASK) |
+		    (section & (cacheable | bufferable)) |
+		    (((section >> SECTION_AP0) & 0x3) << PAGE_AP0) |
+		    PTE_TYPE_SMALL;
+
+	if (section & SECTION_NG)
+		pte |= PTE_NG;
+	return pte;
+}
+
+/*
+ * Takes away user write access. Small and large ptes have their
+ * permissions in the same place, and APX is never set here.
+ */
+pte_t arch_pte_write_protect(pte_t pte)
+{
+	if (((pte >> PAGE_AP0) & 0x3) == SVC_RW_USR_RW)
+		pte = (pte & ~PTE_PROT_MASK) | (SVC_RW_USR_RO << PAGE_AP0);
+	return pte;
+}
+
+pmd_t arch_section_write_protect(pmd_t section)
+{
+	if (((section >> SECTION_AP0) & 0x3) == SVC_RW_USR_RW)
+		section = (section & ~(0x3 << SECTION_AP0)) |
+			  (SVC_RW_USR_RO << SECTION_AP0);
+	return section;
+}
+
+/*
+ * ASIDs tag the tlb entries of non-global mappings with the space
+ * they belong to, so switching spaces needs no tlb flush, and with
+ * physically tagged caches, no cache flush either.
+ *
+ * A space keeps its asid until it is deleted, or until asids run
+ * out, at which point a new generation starts: all asids are free
+ * again, spaces take new ones as they are switched to, and each cpu
+ * flushes its whole tlb once before running in the new generation.
+ * Otherwise a recycled asid is flushed on each cpu before its new
+ * owner first runs there. Asid 0 is never given out.
+ */
+static struct asid_pool {
+	struct spinlock lock;
+	u32 generation;
+	u32 bitmap[ASID_TOTAL / WORD_BITS];
+} asid_pool = {
+	.generation = ASID_TOTAL,
+	.bitmap = { 1 },
+};
+
+#define ASID_GEN_MASK		(~ASID_MASK)
+
+/* Generation of asids each cpu's tlb holds entries for */
+DECLARE_PERCPU(static u32, asid_cpu_generation);
+
+/* Gives a new asid to a space. Asid pool must be locked */
+static void asid_new(struct address_space *space)
+{
+	int asid;
+
+	if ((asid = find_and_set_first_free_bit(asid_pool.bitmap,
+						ASID_TOTAL)) < 0) {
+		asid_pool.generation += ASID_TOTAL;
+		memset(asid_pool.bitmap, 0, sizeof(asid_pool.bitmap));
+		asid_pool.bitmap[0] = 1;
+		asid = find_and_set_first_free_bit(asid_pool.bitmap,
+						   ASID_TOTAL);
+	}
+	space->asid = asid_pool.generation | asid;
+
+	/* Any cpu may have entries from the last owner of the asid */
+	space->tlb_stale = cpu_mask_all();
+}
+
+/* Makes other cpus drop their entries of the space before running it */
+static inline void asid_mark_stale(struct address_space *space)
+{
+	if (CONFIG_NCPU == 1)
+		return;
+
+	spin_lock(&asid_pool.lock);
+	space->tlb_stale |= cpu_mask_others();
+	spin_unlock(&asid_pool.lock);
+}
+
+void arch_space_release(struct address_space *space)
+{
+	spin_lock(&asid_pool.lock);
+	if ((space->asid & ASID_GEN_MASK) == asid_pool.generation)
+		check_and_clear_bit(asid_pool.bitmap, space->asid & ASID_MASK);
+	spin_unlock(&asid_pool.lock);
+}
+
+void arch_write_pte(pte_t *ptep, pte_t pte, u32 vaddr, u32 asid)
 {
 	/* FIXME:
 	 * Clean the dcache and invalidate the icache
 	 * for the old translation first?
 	 *
-	 * The dcache is virtual, therefore the data
-	 * in those entries should be cleaned first,
-	 * before the translation of that virtual
-	 * address is changed to a new physical address.
-	 *
 	 * Check that the entry was not faulty first.
 	 */
 	arm_clean_invalidate_cache();
 
 	*ptep = pte;
 
-	/* FIXME: Fix this!
-	 * - Use vaddr to clean the dcache pte by MVA.
-	 * - Use mapped area to invalidate the icache
-	 * - Invalidate the tlb for mapped area
+	/*
+	 * Only the changed entry needs to go. This also
+	 * drops a global entry at the same address.
 	 */
 	arm_clean_invalidate_cache();
-	arm_invalidate_tlb();
+	arm_invalidate_tlb_mva(page_align(vaddr) | (asid & ASID_MASK));
 }
 
 
-void arch_prepare_write_pte(u32 paddr, u32 vaddr,
+void arch_prepare_write_pte(struct address_space *space,
+			    u32 paddr, u32 vaddr,
 			    unsigned int flags, pte_t *ptep)
 {
 	pte_t pte = 0;
@@ -150,7 +260,148 @@ void arch_prepare_write_pte(u32 paddr, u32 vaddr,
 
 	arch_prepare_pte(paddr, vaddr, flags, &pte);
 
-	arch_write_pte(ptep, pte, vaddr);
+	arch_write_pte(ptep, pte, vaddr, space->asid);
+	asid_mark_stale(space);
+}
+
+/*
+ * Ranges up to this many pages have their tlb entries
+ * dropped one by one, larger ones by the whole asid.
+ */
+#define PTE_BATCH_TLB_PAGES_MAX		32
+
+static inline int dcache_aliasing(void)
+{
+	return arm_get_cache_type() & CACHE_TYPE_DCACHE_ALIASING;
+}
+
+/* Makes the last run of written ptes visible to table walks */
+static inline void pte_batch_clean_ptes(struct pte_batch *batch)
+{
+	if (batch->ptep_start != batch->ptep_end)
+		arm_clean_dcache_range((unsigned long)batch->ptep_start,
+				       (unsigned long)batch->ptep_end);
+	batch->ptep_start = batch->ptep_end = 0;
+}
+
+/*
+ * Data of the old mappings may be in an aliasing dcache under
+ * their virtual address, so it is cleaned while the old mappings
+ * are still there. Not knowing which pages are mapped, and the
+ * space not necessarily being the current one, this is a full
+ * clean. Physically tagged dcaches need nothing here.
+ */
+void arch_pte_batch_begin(struct pte_batch *batch,
+			  struct address_space *space,
+			  unsigned long start, unsigned long end, int exec)
+{
+	batch->space = space;
+	batch->start = start;
+	batch->end = end;
+	batch->exec = exec;
+	batch->stale = 0;
+	batch->global = 0;
+	batch->ptep_start = batch->ptep_end = 0;
+
+	if (dcache_aliasing())
+		arm_clean_invalidate_dcache();
+}
+
+void arch_pte_batch_write(struct pte_batch *batch, pte_t *ptep,
+			  pte_t pte, u32 vaddr)
+{
+	pte_t old = *ptep;
+
+	/* Ptes are cleaned in contiguous runs */
+	if (ptep != batch->ptep_end) {
+		pte_batch_clean_ptes(batch);
+		batch->ptep_start = ptep;
+	}
+
+	*ptep = pte;
+	batch->ptep_end = ptep + 1;
+
+	/* Fault entries are never in the tlb */
+	if ((old & PTE_TYPE_MASK) != PTE_TYPE_FAULT) {
+		batch->stale = 1;
+		if (!(old & PTE_NG))
+			batch->global = 1;
+	}
+}
+
+/*
+ * Writes a pgd entry, a section or a pmd, as part of a batch.
+ * A new pmd table must reach memory before the entry does.
+ */
+void arch_pte_batch_write_pmd(struct pte_batch *batch, pmd_t *pmdp,
+			      pmd_t pmd, u32 vaddr)
+{
+	pmd_t old = *pmdp;
+	unsigned long table;
+
+	pte_batch_clean_ptes(batch);
+
+	if ((pmd & PMD_TYPE_MASK) == PMD_TYPE_PMD) {
+		table = (unsigned long)phys_to_virt(pmd & PMD_ALIGN_MASK);
+		arm_clean_dcache_range(table, table + PMD_SIZE);
+	}
+
+	*pmdp = pmd;
+	arm_clean_dcache_range((unsigned long)pmdp,
+			       (unsigned long)(pmdp + 1));
+
+	/* Entries of an old pmd table may be global */
+	if ((old & PMD_TYPE_MASK) == PMD_TYPE_SECTION) {
+		batch->stale = 1;
+		if (!(old & SECTION_NG))
+			batch->global = 1;
+	} else if ((old & PMD_TYPE_MASK) == PMD_TYPE_PMD) {
+		batch->stale = 1;
+		batch->global = 1;
+	}
+}
+
+/*
+ * Drops the tlb entries of the overwritten mappings, by mva
+ * for small ranges or by asid for large ones. Global entries
+ * are not tagged with an asid, so if any of those changed and
+ * the range is large, the whole tlb goes.
+ *
+ * New executable mappings need their data cleaned to memory
+ * and the icache invalidated. This is by mva when the space is
+ * the current one, since the new mappings are then in effect.
+ */
+void arch_pte_batch_commit(struct pte_batch *batch)
+{
+	struct address_space *space = batch->space;
+	unsigned long npages = __pfn(batch->end - batch->start);
+	unsigned long vaddr;
+
+	pte_batch_clean_ptes(batch);
+
+	if (batch->stale) {
+		if (npages <= PTE_BATCH_TLB_PAGES_MAX)
+			for (vaddr = batch->start; vaddr < batch->end;
+			     vaddr += PAGE_SIZE)
+				arm_invalidate_tlb_mva(vaddr |
+						       (space->asid &
+							ASID_MASK));
+		else if (batch->global)
+			arm_invalidate_tlb();
+		else
+			arm_invalidate_tlb_asid(space->asid & ASID_MASK);
+		asid_mark_stale(space);
+	}
+
+	if (batch->exec) {
+		if (space == current->space) {
+			arm_clean_dcache_range(batch->start, batch->end);
+			arm_invalidate_icache_range(batch->start, batch->end);
+		} else {
+			arm_clean_dcache();
+			arm_invalidate_icache();
+		}
+	}
 }
 
 pmd_t *
@@ -160,17 +411,33 @@ arch_pick_pmd(pgd_table_t *pgd, unsigned long vaddr)
 }
 
 /*
- * v5 pmd writes
+ * v6 pmd writes. Pmds are only attached in place of fault
+ * entries, which the tlb doesn't hold, so nothing to flush.
+ * The new table and the entry itself must reach memory for
+ * table walks to see them.
  */
-void arch_write_pmd(pmd_t *pmd_entry, u32 pmd_phys, u32 vaddr)
+void arch_write_pmd(pmd_t *pmd_entry, u32 pmd_phys, u32 vaddr, u32 asid)
 {
-	/* FIXME: Clean the dcache if there was a valid entry */
+	unsigned long table = (unsigned long)phys_to_virt(pmd_phys);
+
+	arm_clean_dcache_range(table, table + PMD_SIZE);
 	*pmd_entry = (pmd_t)(pmd_phys | PMD_TYPE_PMD);
-	arm_clean_invalidate_cache(); /*FIXME: Write these properly! */
-	arm_invalidate_tlb();
+	arm_clean_dcache_range((unsigned long)pmd_entry,
+			       (unsigned long)(pmd_entry + 1));
 }
 
 
+/*
+ * Detaches a pmd. Its ptes must already be faults and out
+ * of the tlb, so only the entry is made visible to walks.
+ */
+void arch_clear_pmd(pmd_t *pmd_entry, u32 vaddr, u32 asid)
+{
+	*pmd_entry = (pmd_t)PMD_TYPE_FAULT;
+	arm_clean_dcache_range((unsigned long)pmd_entry,
+			       (unsigned long)(pmd_entry + 1));
+}
+
 int arch_check_pte_access_perms(pte_t pte, unsigned int flags)
 {
 	if ((pte & PTE_PROT_MASK) >= (flags & PTE_PROT_MASK))
@@ -201,8 +468,10 @@ int is_global_pgdi(int i)
 
 extern pmd_table_t *pmd_array;
 
-void remove_mapping_pgd_all_user(pgd_table_t *pgd)
+void remove_mapping_pgd_all_user(struct address_space *space,
+				 struct cap_list *clist)
 {
+	pgd_table_t *pgd = space->pgd;
 	pmd_table_t *pmd;
 
 	/* Traverse through all pgd entries. */
@@ -217,13 +486,22 @@ void remove_mapping_pgd_all_user(pgd_table_t *pgd)
 				      phys_to_virt((pgd->entry[i] &
 						    PMD_ALIGN_MASK));
 				/* Free it */
-				free_pmd(pmd);
+				pmd_cap_free(pmd, clist);
 			}
 
 			/* Clear the pgd entry */
 			pgd->entry[i] = PMD_TYPE_FAULT;
 		}
 	}
+
+	/*
+	 * User mappings are all tagged with the space's asid, so
+	 * dropping those is enough. Other cpus do the same before
+	 * they next run the space.
+	 */
+	arm_drain_writebuffer();
+	arm_invalidate_tlb_asid(space->asid & ASID_MASK);
+	asid_mark_stale(space);
 }
 
 
@@ -238,13 +516,12 @@ int pgd_count_boot_pmds()
 	return npmd;
 }
 
-
 /*
  * Jumps from boot pmd/pgd page tables to tables allocated from the cache.
  */
 pgd_table_t *arch_realloc_page_tables(void)
 {
-	pgd_table_t *pgd_new = alloc_pgd();
+	pgd_table_t *pgd_new = pgd_alloc();
 	pgd_table_t *pgd_old = &init_pgd;
 	pmd_table_t *orig, *pmd;
 
@@ -256,7 +533,7 @@ pgd_table_t *arch_realloc_page_tables(void)
 		/* Detect a pmd entry */
 		if ((pgd_old->entry[i] & PMD_TYPE_MASK) == PMD_TYPE_PMD) {
 			/* Allocate new pmd */
-			if (!(pmd = alloc_pmd())) {
+			if (!(pmd = pmd_cap_alloc(&current->space->cap_list))) {
 				printk("FATAL: PMD allocation "
 				       "failed during system initialization\n");
 				BUG();
@@ -346,21 +623,62 @@ void arch_copy_pgd_kernel_entries(pgd_table_t *to)
 				  USERSPACE_CONSOLE_VBASE + PAGE_SIZE);
 }
 
-/* Scheduler uses this to switch context */
+void arch_update_utcb(unsigned long utcb_address)
+{
+	/* Update the KIP pointer */
+	kip.utcb = utcb_address;
+
+	/* The KIP is shared by all cpus, this one is our own */
+	arm_set_utcb_ref(utcb_address);
+}
+
+/*
+ * Scheduler uses this to switch context. Takes a new asid if the
+ * space has none in the current generation, and flushes what this
+ * cpu's tlb may hold for it from before. The dcache only needs a
+ * clean if it can hold aliases of the same data at different
+ * virtual addresses.
+ */
 void arch_space_switch(struct ktcb *to)
 {
-	pgd_table_t *pgd = TASK_PGD(to);
+	struct address_space *space = to->space;
+	u32 self = cpu_mask_self();
+
+	system_account_space_switch();
+
+	spin_lock(&asid_pool.lock);
+	if ((space->asid & ASID_GEN_MASK) != asid_pool.generation)
+		asid_new(space);
+
+	if (per_cpu(asid_cpu_generation) != asid_pool.generation) {
+		per_cpu(asid_cpu_generation) = asid_pool.generation;
+		space->tlb_stale &= ~self;
+		arm_invalidate_tlb();
+	} else if (space->tlb_stale & self) {
+		space->tlb_stale &= ~self;
+		arm_invalidate_tlb_asid(space->asid & ASID_MASK);
+	}
+	spin_unlock(&asid_pool.lock);
 
-	arm_clean_invalidate_cache();
-	arm_invalidate_tlb();
-	arm_set_ttb(virt_to_phys(pgd));
-	arm_invalidate_tlb();
+	if (arm_get_cache_type() & CACHE_TYPE_DCACHE_ALIASING)
+		arm_clean_invalidate_cache();
+
+	arm_set_ttb_asid(virt_to_phys(space->pgd), space->asid & ASID_MASK);
 }
 
 void idle_task(void)
 {
-	printk("Idle task.\n");
+	while(1) {
+		/* Do maintenance */
+		tcb_delete_zombies();
 
-	while(1);
+		/* Clear idle runnable flag */
+		per_cpu(scheduler).flags &= ~SCHED_RUN_IDLE;
+
+		/* Sleep until there is something to run */
+		sched_idle_wait();
+
+		schedule();
+	}
 }
 
@@ -72,6 +72,23 @@ void timer_init_oneshot(unsigned long timer_base)
 	write(reg, timer_base + SP804_CTRL);
 }
 
+/* Counts down from the top forever, without irqs */
+void timer_init_freerun(unsigned long timer_base)
+{
+	/* Periodic, wraparound, 32 bit, no irqs */
+	write(SP804_PERIODIC | SP804_32BIT, timer_base + SP804_CTRL);
+	timer_load(0xFFFFFFFF, timer_base);
+}
+
+/* Raises one irq after ticks, and stops */
+void timer_oneshot_irq(unsigned long timer_base, u32 ticks)
+{
+	timer_stop(timer_base);
+	timer_load(ticks, timer_base);
+	write(SP804_ONESHOT | SP804_32BIT | SP804_IRQEN | SP804_ENABLE,
+	      timer_base + SP804_CTRL);
+}
+
 void timer_init(unsigned long timer_base, unsigned int load_value)
 {
 	timer_init_periodic(timer_base, load_value);
@@ -14,7 +14,7 @@
  * All memory allocated here is discarded after boot.
  * Increase this size if bootmem allocations fail.
  */
-#define BOOTMEM_SIZE		(SZ_4K * 4)
+#define BOOTMEM_SIZE		(SZ_4K * 6)
 SECTION(".init.bootmem") char bootmem[BOOTMEM_SIZE];
 
 static unsigned long cursor = (unsigned long)&bootmem;
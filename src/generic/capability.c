@@ -25,6 +25,25 @@ void capability_init(struct capability *cap)
 {
 	cap->capid = id_new(&kernel_resources.capability_ids);
 	link_init(&cap->list);
+	link_init(&cap->index);
+}
+
+/*
+ * Adds a capability to its index chain, keeping
+ * the chain sorted by resource start.
+ */
+void cap_index_insert(struct capability *cap, struct cap_list *clist)
+{
+	struct link *bucket = cap_hash_bucket(clist, cap_type(cap),
+					      cap->resid);
+	struct capability *c;
+
+	list_foreach_struct(c, bucket, index)
+		if (c->start > cap->start)
+			break;
+
+	/* Goes right before the first larger one, or at the end */
+	list_insert_tail(&cap->index, &c->index);
 }
 
 
@@ -119,6 +138,8 @@ typedef struct capability *(*cap_match_func_t) \
 /*
  * This is used by every system call to match each
  * operation with a capability in a syscall-specific way.
+ * It goes through all caps of given type, so prefer the
+ * indexed lookups below when there is a known target.
  */
 struct capability *cap_find(struct ktcb *task, cap_match_func_t cap_match_func,
 			    void *match_args, unsigned int cap_type)
@@ -140,6 +161,79 @@ struct capability *cap_find(struct ktcb *task, cap_match_func_t cap_match_func,
 	return 0;
 }
 
+/*
+ * Matches caps of given type that target the given resource,
+ * only looking at the index chain they would be hashed into.
+ * Chains are sorted by start, so caps starting beyond pfn can
+ * not cover it and end the search. Non-memory lookups pass
+ * CAP_PFN_ANY to look at the whole chain.
+ */
+#define CAP_PFN_ANY	(~0UL)
+
+struct capability *
+cap_list_find_resid(struct cap_list *clist, cap_match_func_t cap_match_func,
+		    void *match_args, unsigned int cap_type,
+		    unsigned int rtype, l4id_t resid, unsigned long pfn)
+{
+	struct link *bucket = cap_hash_bucket(clist, cap_type, resid);
+	struct capability *cap, *found;
+
+	list_foreach_struct(cap, bucket, index) {
+		if (cap->start > pfn)
+			break;
+		if (cap_type(cap) == cap_type &&
+		    cap_rtype(cap) == rtype &&
+		    cap->resid == resid &&
+		    ((found = cap_match_func(cap, match_args))))
+			return found;
+	}
+
+	return 0;
+}
+
+struct capability *
+cap_find_resid(struct ktcb *task, cap_match_func_t cap_match_func,
+	       void *match_args, unsigned int cap_type,
+	       unsigned int rtype, l4id_t resid, unsigned long pfn)
+{
+	struct capability *found;
+
+	if ((found = cap_list_find_resid(&task->space->cap_list,
+					 cap_match_func, match_args,
+					 cap_type, rtype, resid, pfn)))
+		return found;
+
+	return cap_list_find_resid(&task->container->cap_list,
+				   cap_match_func, match_args,
+				   cap_type, rtype, resid, pfn);
+}
+
+/*
+ * Finds a cap of task that targets the target thread,
+ * its address space or its container.
+ */
+struct capability *
+cap_find_target(struct ktcb *task, cap_match_func_t cap_match_func,
+		void *match_args, unsigned int cap_type,
+		struct ktcb *target, unsigned long pfn)
+{
+	struct capability *found;
+
+	if ((found = cap_find_resid(task, cap_match_func, match_args,
+				    cap_type, CAP_RTYPE_THREAD,
+				    target->tid, pfn)))
+		return found;
+
+	if ((found = cap_find_resid(task, cap_match_func, match_args,
+				    cap_type, CAP_RTYPE_SPACE,
+				    target->space->spid, pfn)))
+		return found;
+
+	return cap_find_resid(task, cap_match_func, match_args,
+			      cap_type, CAP_RTYPE_CONTAINER,
+			      target->container->cid, pfn);
+}
+
 struct sys_ipc_args {
 	struct ktcb *task;
 	unsigned int ipc_type;
@@ -601,12 +695,14 @@ int cap_map_check(struct ktcb *target, unsigned long phys, unsigned long virt,
 		.flags = flags,
 	};
 
-	if (!(physmem =	cap_find(current, cap_match_mem,
-				 &args, CAP_TYPE_MAP_PHYSMEM)))
+	if (!(physmem =	cap_find_target(current, cap_match_mem,
+					&args, CAP_TYPE_MAP_PHYSMEM,
+					target, __pfn(phys))))
 		return -ENOCAP;
 
-	if (!(virtmem = cap_find(current, cap_match_mem,
-				 &args, CAP_TYPE_MAP_VIRTMEM)))
+	if (!(virtmem = cap_find_target(current, cap_match_mem,
+					&args, CAP_TYPE_MAP_VIRTMEM,
+					target, __pfn(virt))))
 		return -ENOCAP;
 
 	return 0;
@@ -625,8 +721,9 @@ int cap_unmap_check(struct ktcb *target, unsigned long virt,
 		.flags = MAP_UNMAP,
 	};
 
-	if (!(virtmem = cap_find(current, cap_match_mem,
-				 &args, CAP_TYPE_MAP_VIRTMEM)))
+	if (!(virtmem = cap_find_target(current, cap_match_mem,
+					&args, CAP_TYPE_MAP_VIRTMEM,
+					target, __pfn(virt))))
 		return -ENOCAP;
 
 	return 0;
@@ -659,8 +756,9 @@ int cap_ipc_check(l4id_t to, l4id_t from,
 	args.ipc_type = ipc_type;
 	args.task = target;
 
-	if (!(cap_find(current, cap_match_ipc,
-		       &args, CAP_TYPE_IPC)))
+	if (!(cap_find_target(current, cap_match_ipc,
+			      &args, CAP_TYPE_IPC,
+			      target, CAP_PFN_ANY)))
 		return -ENOCAP;
 
 	return 0;
@@ -674,8 +772,9 @@ int cap_exregs_check(struct ktcb *task, struct exregs_data *exregs)
 	};
 
 	/* We always search for current's caps */
-	if (!(cap_find(current, cap_match_exregs,
-		       &args, CAP_TYPE_EXREGS)))
+	if (!(cap_find_target(current, cap_match_exregs,
+			      &args, CAP_TYPE_EXREGS,
+			      task, CAP_PFN_ANY)))
 		return -ENOCAP;
 
 	return 0;
@@ -691,8 +790,19 @@ int cap_thread_check(struct ktcb *task,
 		.ids = ids,
 	};
 
-	if (!(cap_find(current, cap_match_thread,
-		       &args, CAP_TYPE_TCTRL)))
+	/* Creation is only matched against current container */
+	if (!task) {
+		if (!(cap_find_resid(current, cap_match_thread,
+				     &args, CAP_TYPE_TCTRL,
+				     CAP_RTYPE_CONTAINER, curcont->cid,
+				     CAP_PFN_ANY)))
+			return -ENOCAP;
+		return 0;
+	}
+
+	if (!(cap_find_target(current, cap_match_thread,
+			      &args, CAP_TYPE_TCTRL,
+			      task, CAP_PFN_ANY)))
 		return -ENOCAP;
 
 	return 0;
@@ -710,8 +820,9 @@ int cap_irq_check(struct ktcb *task, unsigned int req,
 	};
 
 	/* Find the irq control capability of caller */
-	if (!(cap_find(current, cap_match_irqctrl,
-		       &args, CAP_TYPE_IRQCTRL)))
+	if (!(cap_find_target(current, cap_match_irqctrl,
+			      &args, CAP_TYPE_IRQCTRL,
+			      task, CAP_PFN_ANY)))
 		return -ENOCAP;
 	return 0;
 }
@@ -135,9 +135,10 @@ void map_pager_sections(struct pager *pager, struct container *cont,
  *
  * This involves setting up pager's ktcb, space, utcb,
  * all ids, registers, and mapping its (perhaps) first
- * few pages in order to make it runnable.
+ * few pages in order to make it runnable. Its thread
+ * id is taken from the id slot given.
  */
-int init_pager(struct pager *pager, struct container *cont)
+int init_pager(struct pager *pager, struct container *cont, int id)
 {
 	struct ktcb *task;
 	struct address_space *space;
@@ -153,9 +154,9 @@ int init_pager(struct pager *pager, struct container *cont)
 	current->container = cont;
 
 	/* New ktcb allocation is needed */
-	task = tcb_alloc_init(cont->cid);
+	task = tcb_alloc_init_id(cont->cid, id);
 
-	space = address_space_create(0);
+	space = address_space_create(0, 0);
 	address_space_attach(task, space);
 
 	/* Initialize ktcb */
@@ -271,6 +272,10 @@ int update_dynamic_capids(struct kernel_resources *kres)
 					/* Assign pager's thread id to cap */
 					cap->resid = tpager->tid;
 				}
+
+				/* Resource ids changed, rehash */
+				cap_list_reindex(cap,
+						 &pager->space->cap_list);
 			}
 		}
 	}
@@ -286,11 +291,19 @@ int container_init_pagers(struct kernel_resources *kres)
 {
 	struct container *cont;
 	struct pager *pager;
+	int id;
 
 	list_foreach_struct(cont, &kres->containers.list, list) {
+		if (!cont->npagers)
+			continue;
+
+		/* A container's pagers take consecutive thread ids */
+		BUG_ON((id = id_new_range(&kres->ktcb_ids,
+					  cont->npagers)) < 0);
+
 		for (int i = 0; i < cont->npagers; i++) {
 			pager = &cont->pager[i];
-			init_pager(pager, cont);
+			init_pager(pager, cont, id + i);
 		}
 	}
 
@@ -10,6 +10,7 @@
 #include <l4/generic/platform.h>
 #include <l4/generic/tcb.h>
 #include <l4/generic/irq.h>
+#include <l4/generic/trace.h>
 #include <l4/lib/mutex.h>
 #include <l4/lib/printk.h>
 #include <l4/api/errno.h>
@@ -144,6 +145,7 @@ void do_irq(void)
 	this_irq = irq_desc_array + irq_index;
 
 	system_account_irq();
+	trace_event(TRACE_IRQ_ENTRY, irq_index, 0, 0, 0);
 
 	/*
 	 * Note, this can be easily done a few instructions
@@ -165,4 +167,5 @@ void do_irq(void)
 	}
 
 	irq_enable(irq_index);
+	trace_event(TRACE_IRQ_EXIT, irq_index, 0, 0, 0);
 }
@@ -160,8 +160,10 @@ int memcap_split(struct capability *cap, struct cap_list *cap_list,
 	new->start = end;
 	cap->end = start;
 	new->access = cap->access;
+	new->type = cap->type;
+	new->resid = cap->resid;
 
-	/* Add new one next to original cap */
+	/* Add new one, it is indexed after the original cap */
 	cap_list_insert(new, cap_list);
 
 	return 0;
@@ -180,6 +182,9 @@ int memcap_shrink(struct capability *cap, struct cap_list *cap_list,
 	} else if (cap->end > end) {
 		BUG_ON(end <= cap->start);
 		cap->start = end;
+
+		/* Start moved, keep index sorted */
+		cap_list_reindex(cap, cap_list);
 	} else
 		BUG();
 
@@ -205,7 +210,7 @@ int memcap_unmap_range(struct capability *cap,
 	/* Destroy needed? */
 	else if ((cap->start >= start) && (cap->end <= end))
 		/* Simply unlink it */
-		list_remove(&cap->list);
+		cap_list_remove(cap, cap_list);
 	else
 		BUG();
 
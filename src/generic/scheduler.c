@@ -18,6 +18,8 @@
 #include <l4/generic/debug.h>
 #include <l4/generic/irq.h>
 #include <l4/generic/tcb.h>
+#include <l4/generic/time.h>
+#include <l4/generic/trace.h>
 #include <l4/api/errno.h>
 #include <l4/api/kip.h>
 #include INC_SUBARCH(mm.h)
@@ -107,7 +109,9 @@ int in_process_context(void)
 
 void sched_init_runqueue(struct scheduler *sched, struct runqueue *rq)
 {
-	link_init(&rq->task_list);
+	for (int i = 0; i < SCHED_PRIO_LEVELS; i++)
+		link_init(&rq->task_list[i]);
+	rq->prio_map = 0;
 	spin_lock_init(&rq->lock);
 	rq->sched = sched;
 }
@@ -130,7 +134,7 @@ static void sched_rq_swap_queues(void)
 {
 	struct runqueue *temp;
 
-	BUG_ON(list_empty(&per_cpu(scheduler).rq_expired->task_list));
+	BUG_ON(per_cpu(scheduler).rq_expired->total == 0);
 
 	/* Queues are swapped and expired list becomes runnable */
 	temp = per_cpu(scheduler).rq_runnable;
@@ -142,6 +146,16 @@ static void sched_rq_swap_queues(void)
 #define RQ_ADD_BEHIND		0
 #define RQ_ADD_FRONT		1
 
+/* Returns the first task of the highest priority non-empty level */
+static inline struct ktcb *sched_rq_first_task(struct runqueue *rq)
+{
+	int prio = 31 - __clz(rq->prio_map);
+
+	BUG_ON(prio < 0);
+	return link_to_struct(rq->task_list[prio].next,
+			      struct ktcb, rq_list);
+}
+
 /* Helper for adding a new task to a runqueue */
 static void sched_rq_add_task(struct ktcb *task, struct runqueue *rq, int front)
 {
@@ -150,20 +164,44 @@ static void sched_rq_add_task(struct ktcb *task, struct runqueue *rq, int front)
 		&per_cpu_byid(scheduler, task->affinity);
 
 	BUG_ON(!list_empty(&task->rq_list));
+	BUG_ON(task->priority < 0 || task->priority > TASK_PRIO_MAX);
 
 	/* Lock that particular cpu's runqueue set */
 	sched_lock_runqueues(sched, &irqflags);
 	if (front)
-		list_insert(&task->rq_list, &rq->task_list);
+		list_insert(&task->rq_list,
+			    &rq->task_list[task->priority]);
 	else
-		list_insert_tail(&task->rq_list, &rq->task_list);
+		list_insert_tail(&task->rq_list,
+				 &rq->task_list[task->priority]);
+	rq->prio_map |= (1 << task->priority);
 	rq->total++;
 	task->rq = rq;
+	if (task != sched->idle_task)
+		sched->load++;
 
 	/* Unlock that particular cpu's runqueue set */
 	sched_unlock_runqueues(sched, irqflags);
 }
 
+/* Removes a task from its runqueue, runqueues must be locked */
+static inline void __sched_rq_remove_task(struct ktcb *task,
+					  struct scheduler *sched)
+{
+	BUG_ON(list_empty(&task->rq_list));
+	list_remove_init(&task->rq_list);
+
+	/* Clear the level bit if this was its last task */
+	if (list_empty(&task->rq->task_list[task->priority]))
+		task->rq->prio_map &= ~(1 << task->priority);
+
+	task->rq->total--;
+	BUG_ON(task->rq->total < 0);
+	task->rq = 0;
+	if (task != sched->idle_task)
+		sched->load--;
+}
+
 /* Helper for removing a task from its runqueue. */
 static inline void sched_rq_remove_task(struct ktcb *task)
 {
@@ -171,19 +209,12 @@ static inline void sched_rq_remove_task(struct ktcb *task)
 	struct scheduler *sched =
 		&per_cpu_byid(scheduler, task->affinity);
 
-	sched_lock_runqueues(sched, &irqflags);
-
 	/*
 	 * We must lock both, otherwise rqs may swap and
 	 * we may get the wrong rq.
 	 */
-	BUG_ON(list_empty(&task->rq_list));
-	list_remove_init(&task->rq_list);
-
-	task->rq->total--;
-	BUG_ON(task->rq->total < 0);
-	task->rq = 0;
-
+	sched_lock_runqueues(sched, &irqflags);
+	__sched_rq_remove_task(task, sched);
 	sched_unlock_runqueues(sched, irqflags);
 }
 
@@ -197,6 +228,24 @@ void sched_init_task(struct ktcb *task, int prio)
 	task->flags |= TASK_RESUMING;
 }
 
+/*
+ * A task was queued on another cpu, which may be asleep with its
+ * tick stopped. The task is on the runqueue before the flag is
+ * looked at, so the idle cpu either sees the task before it
+ * sleeps, or is seen to be sleeping here and woken up.
+ */
+static inline void sched_wake_cpu(int cpu)
+{
+#if defined (CONFIG_SMP_)
+	if (cpu == smp_get_cpuid())
+		return;
+
+	dmb();
+	if (tick_is_stopped(cpu))
+		smp_send_ipi(CPUID_TO_MASK(cpu), IPI_SCHEDULE);
+#endif
+}
+
 /* Synchronously resumes a task */
 void sched_resume_sync(struct ktcb *task)
 {
@@ -205,6 +254,7 @@ void sched_resume_sync(struct ktcb *task)
 	sched_rq_add_task(task, per_cpu_byid(scheduler,
 					     task->affinity).rq_runnable,
 					     1);
+	sched_wake_cpu(task->affinity);
 	schedule();
 }
 
@@ -213,6 +263,10 @@ void sched_resume_sync(struct ktcb *task)
  * The task will run in the future, but at
  * the scheduler's discretion. It is possible that current
  * task wakes itself up via this function in the scheduler().
+ *
+ * If the task outranks current on this cpu, a reschedule
+ * is requested so that it is dispatched at the next return
+ * from irq or system call rather than at a timeslice boundary.
  */
 void sched_resume_async(struct ktcb *task)
 {
@@ -220,6 +274,10 @@ void sched_resume_async(struct ktcb *task)
 	sched_rq_add_task(task, per_cpu_byid(scheduler,
 					     task->affinity).rq_runnable,
 					     1);
+	if (task->affinity == smp_get_cpuid() &&
+	    task->priority > current->priority)
+		need_resched = 1;
+	sched_wake_cpu(task->affinity);
 }
 
 /*
@@ -279,6 +337,7 @@ static inline void context_switch(struct ktcb *next)
 //	printk("Core:%d (%d) to (%d)\n", smp_get_cpuid(), cur->tid, next->tid);
 
 	system_account_context_switch();
+	trace_event(TRACE_SWITCH, next->tid, next->space->spid, 0, 0);
 
 	/* Flush caches and everything */
 	BUG_ON(!current);
@@ -311,11 +370,160 @@ static inline int sched_recalc_ticks(struct ktcb *task, int prio_total)
 }
 
 
+#if defined(CONFIG_SMP_)
+
+/* Ticks between periodic balancing of each cpu */
+#define SCHED_BALANCE_TICKS	(CONFIG_SCHED_TICKS / 10)
+
+/* Returns the cpu with the most, or the least runnable tasks */
+static int sched_balance_find_cpu(int busiest)
+{
+	int cpu = smp_get_cpuid();
+	int best = per_cpu(scheduler).load;
+	int load;
+
+	for (int i = 0; i < CONFIG_NCPU; i++) {
+		load = per_cpu_byid(scheduler, i).load;
+		if (busiest ? load > best : load < best) {
+			best = load;
+			cpu = i;
+		}
+	}
+	return cpu;
+}
+
+/*
+ * Picks a task of this cpu that may run elsewhere. Expired and
+ * low priority tasks go first, as they would wait the longest
+ * here. Runqueues must be locked.
+ */
+static struct ktcb *sched_balance_pick(struct scheduler *sched)
+{
+	struct runqueue *rq[] = { sched->rq_expired, sched->rq_runnable };
+	struct ktcb *task;
+
+	for (int i = 0; i < 2; i++)
+		for (int prio = 0; prio < SCHED_PRIO_LEVELS; prio++)
+			list_foreach_struct(task, &rq[i]->task_list[prio],
+					    rq_list)
+				if (task != current && !is_idle_task(task) &&
+				    !(task->flags & TASK_PINNED))
+					return task;
+	return 0;
+}
+
+/*
+ * Moves tasks waiting to run here over to the cpus that asked for
+ * them, until loads are about even, and kicks those cpus. Only the
+ * owner cpu moves tasks off its runqueues, since only it knows that
+ * a queued task other than current is not running anywhere.
+ */
+static void sched_balance_push(void)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+	struct scheduler *target;
+	unsigned int request, kick = 0;
+	unsigned long irqflags;
+	struct ktcb *task;
+
+	sched_lock_runqueues(sched, &irqflags);
+	request = sched->balance_request;
+	sched->balance_request = 0;
+	sched_unlock_runqueues(sched, irqflags);
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++) {
+		if (!(request & CPUID_TO_MASK(cpu)))
+			continue;
+
+		target = &per_cpu_byid(scheduler, cpu);
+		while (sched->load - target->load >= 2) {
+			sched_lock_runqueues(sched, &irqflags);
+			if ((task = sched_balance_pick(sched)))
+				__sched_rq_remove_task(task, sched);
+			sched_unlock_runqueues(sched, irqflags);
+
+			if (!task)
+				break;
+
+			/* Not on any runqueue, nobody else touches it */
+			task->affinity = cpu;
+			sched_rq_add_task(task, target->rq_runnable,
+					  RQ_ADD_BEHIND);
+			kick |= CPUID_TO_MASK(cpu);
+		}
+	}
+
+	if (kick)
+		smp_send_ipi(kick, IPI_SCHEDULE);
+}
+
+/*
+ * An idle cpu asks the busiest one to push tasks over to
+ * it, at most once a tick so that it does not flood it.
+ */
+static void sched_balance_idle(void)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+	struct scheduler *busiest;
+	unsigned long irqflags;
+	int cpu;
+
+	if (sched->balance_jiffies == jiffies)
+		return;
+	sched->balance_jiffies = jiffies;
+
+	cpu = sched_balance_find_cpu(1);
+	busiest = &per_cpu_byid(scheduler, cpu);
+	if (busiest->load - sched->load < 2)
+		return;
+
+	sched_lock_runqueues(busiest, &irqflags);
+	busiest->balance_request |= cpu_mask_self();
+	sched_unlock_runqueues(busiest, irqflags);
+
+	smp_send_ipi(CPUID_TO_MASK(cpu), IPI_SCHEDULE);
+}
+
+/*
+ * Called on each timer tick. Now and then checks if this cpu
+ * has much more to run than the least busy one, and if so has
+ * tasks pushed over to it on the way out of the irq.
+ */
+void sched_balance_tick(void)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+	unsigned long irqflags;
+	int cpu;
+
+	if (--sched->balance_ticks > 0)
+		return;
+	sched->balance_ticks = SCHED_BALANCE_TICKS;
+
+	cpu = sched_balance_find_cpu(0);
+	if (sched->load - per_cpu_byid(scheduler, cpu).load < 2)
+		return;
+
+	sched_lock_runqueues(sched, &irqflags);
+	sched->balance_request |= CPUID_TO_MASK(cpu);
+	sched_unlock_runqueues(sched, irqflags);
+
+	need_resched = 1;
+}
+
+#else /* End of CONFIG_SMP_ */
+
+static inline void sched_balance_push(void) { }
+static inline void sched_balance_idle(void) { }
+
+#endif /* End of !CONFIG_SMP_ */
+
 /*
  * Selection happens as follows:
  *
- * A real-time task is chosen %87.5 of the time. This is evenly
- * distributed to a given interval.
+ * The highest priority task in the runnable queue is chosen.
+ * Tasks of equal priority are run in queue order. A task that
+ * uses up its ticks moves to the expired queue, so lower
+ * priority tasks still run before the next queue swap.
  *
  * Idle task is run once when it is explicitly suggested (e.g.
  * for cleanup after a task exited) but only when no real-time
@@ -337,18 +545,20 @@ struct ktcb *sched_select_next(void)
 			next = sched->idle_task;
 			break;
 		} else if (sched->rq_runnable->total > 0) {
-			/* Get a regular runnable task, if available */
-			next = link_to_struct(sched->rq_runnable->task_list.next,
-					      struct ktcb, rq_list);
+			/* Get highest priority runnable task, if available */
+			next = sched_rq_first_task(sched->rq_runnable);
 			break;
 		} else if (sched->rq_expired->total > 0) {
 			/* Swap queues and retry if not */
 			sched_rq_swap_queues();
-			next = link_to_struct(sched->rq_runnable->task_list.next,
-					      struct ktcb, rq_list);
+			next = sched_rq_first_task(sched->rq_runnable);
 			break;
 		} else if (in_process_context()) {
-			/* No runnable task. Do idle if in process context */
+			/*
+			 * No runnable task. Ask for some from a busy
+			 * cpu, and do idle if in process context
+			 */
+			sched_balance_idle();
 			next = sched->idle_task;
 			break;
 		} else {
@@ -364,6 +574,29 @@ struct ktcb *sched_select_next(void)
 }
 
 
+/*
+ * Called by the idle task when it has nothing else to do. Stops
+ * the tick and sleeps the cpu until an irq arrives. Irqs stay
+ * disabled until after the tick is back, so that the irq that
+ * woke the cpu is handled with time already caught up.
+ */
+void sched_idle_wait(void)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+	unsigned long irqflags;
+
+	irq_local_disable_save(&irqflags);
+	tick_stop_idle();
+
+	/* A wakeup may have come before the tick was stopped */
+	if (!sched->load && !(sched->flags & SCHED_RUN_IDLE) &&
+	    !need_resched)
+		cpu_idle_wait();
+
+	tick_restart_idle();
+	irq_local_restore(irqflags);
+}
+
 /* Prepare next runnable task right before switching to it */
 void sched_prepare_next(struct ktcb *next)
 {
@@ -390,6 +623,27 @@ void sched_prepare_next(struct ktcb *next)
 	next->sched_granule = SCHED_GRANULARITY;
 }
 
+/* Moves a runnable current to the back of its runqueue */
+static inline void sched_requeue_current(void)
+{
+	if (current->state != TASK_RUNNABLE)
+		return;
+
+	sched_rq_remove_task(current);
+
+	/* Non-idle tasks go back to a runqueue */
+	if (!is_idle_task(current)) {
+		if (current->ticks_left)
+			sched_rq_add_task(current,
+					  per_cpu(scheduler).rq_runnable,
+					  0);
+		else
+			sched_rq_add_task(current,
+					  per_cpu(scheduler).rq_expired,
+					  0);
+	}
+}
+
 /*
  * Tasks come here, either by setting need_resched (via next irq),
  * or by directly calling it (in process context).
@@ -413,8 +667,12 @@ void sched_prepare_next(struct ktcb *next)
  * task's timeslice is very long. In the future, real-time tasks will
  * be added, and they will be able to ignore SCHED_GRANULARITY.
  *
- * In the future, the tasks will be sorted by priority in their
- * runqueue, as well as having an adjusted timeslice.
+ * Tasks are kept in per-priority lists in their runqueue, and
+ * the highest priority non-empty list is found via a bitmap.
+ *
+ * On smp, each cpu runs its own runqueues. Tasks not pinned to a
+ * cpu are pushed over to idle or lightly loaded cpus when they ask
+ * for them, or when a periodic check finds the loads uneven.
  *
  * Runqueues are swapped at a single second's interval. This implies
  * the timeslice recalculations would also occur at this interval.
@@ -439,20 +697,11 @@ void schedule()
 	need_resched = 0;
 
 	/* Remove runnable task from queue */
-	if (current->state == TASK_RUNNABLE) {
-		sched_rq_remove_task(current);
-		/* Non-idle tasks go back to a runqueue */
-		if (!is_idle_task(current)) {
-			if (current->ticks_left)
-				sched_rq_add_task(current,
-						  per_cpu(scheduler).rq_runnable,
-						  0);
-			else
-				sched_rq_add_task(current,
-						  per_cpu(scheduler).rq_expired,
-						  0);
-		}
-	}
+	sched_requeue_current();
+
+	/* Give away tasks that other cpus asked for */
+	if (per_cpu(scheduler).balance_request)
+		sched_balance_push();
 
 	/*
 	 * FIXME: Are these smp-safe? BB: On first glance they
@@ -495,6 +744,64 @@ void schedule()
 	context_switch(next);
 }
 
+/*
+ * Direct process switch for synchronous ipc.
+ *
+ * Switches straight to @next, which current has just woken up or
+ * is about to block on, without going through runqueue selection.
+ * If current is going to sleep, its remaining ticks are donated to
+ * next, so a call and its reply run on the caller's timeslice.
+ *
+ * This is only done if next is runnable on this cpu and nothing of
+ * higher priority is waiting, no other cpu has asked for tasks, and
+ * current has no pending signals or cleanup for the idle task.
+ * Otherwise it is a plain schedule().
+ */
+void sched_switch_to(struct ktcb *next)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+	int donate;
+
+	BUG_ON(per_cpu(voluntary_preempt));
+	BUG_ON(in_nested_irq_context());
+	BUG_ON(next == current);
+
+	preempt_disable();
+
+	if (next->state != TASK_RUNNABLE ||
+	    next->affinity != smp_get_cpuid() ||
+	    next->rq != sched->rq_runnable ||
+	    is_idle_task(current) || is_idle_task(next) ||
+	    (sched->flags & SCHED_RUN_IDLE) || sched->balance_request ||
+	    (current->flags & (TASK_PENDING_SIGNAL | TASK_EXITED)) ||
+	    (31 - __clz(sched->rq_runnable->prio_map)) > next->priority) {
+		preempt_enable();
+		schedule();
+		return;
+	}
+
+	need_resched = 0;
+
+	/* Only a sleeping caller has ticks to give away */
+	donate = (current->state != TASK_RUNNABLE);
+
+	sched_requeue_current();
+
+	sched_prepare_next(next);
+
+	/* Keep one tick so caller isn't refilled as a fresh task */
+	if (donate && current->ticks_left > 1) {
+		next->ticks_left = min(next->ticks_left +
+				       current->ticks_left - 1,
+				       CONFIG_SCHED_TICKS);
+		current->ticks_left = 1;
+	}
+
+	disable_irqs();
+	preempt_enable();
+	context_switch(next);
+}
+
 /*
  * Start the timer and switch to current task
  * for first-ever scheduling.
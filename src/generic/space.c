@@ -65,6 +65,9 @@ void address_space_delete(struct address_space *space, struct cap_list *clist)
 	/* Traverse the page tables and delete private pmds */
 	delete_page_tables(space, clist);
 
+	/* Return any hardware space tag */
+	arch_space_release(space);
+
 	/* Return the space id */
 	id_del(&kernel_resources.space_ids, space->spid);
 
@@ -72,7 +75,8 @@ void address_space_delete(struct address_space *space, struct cap_list *clist)
 	space_cap_free(space, clist);
 }
 
-struct address_space *address_space_create(struct address_space *orig)
+struct address_space *address_space_create(struct address_space *orig,
+					    int write_protect)
 {
 	struct address_space *space;
 	pgd_table_t *pgd;
@@ -107,7 +111,7 @@ struct address_space *address_space_create(struct address_space *orig)
 	/* If an original space is supplied */
 	if (orig) {
 		/* Copy its user entries/tables */
-		if ((err = copy_user_tables(space, orig)) < 0) {
+		if ((err = copy_user_tables(space, orig, write_protect)) < 0) {
 			pgd_free(pgd);
 			space_cap_free(space, &current->space->cap_list);
 			return PTR_ERR(err);
@@ -42,9 +42,11 @@ void tcb_init(struct ktcb *new)
 	waitqueue_head_init(&new->wqh_send);
 	waitqueue_head_init(&new->wqh_recv);
 	waitqueue_head_init(&new->wqh_pager);
+	new->notify_bits = 0;
 }
 
-struct ktcb *tcb_alloc_init(l4id_t cid)
+/* Allocates a tcb for a thread id already taken, e.g. one of a range */
+struct ktcb *tcb_alloc_init_id(l4id_t cid, int id)
 {
 	struct ktcb *tcb;
 	struct task_ids ids;
@@ -52,7 +54,7 @@ struct ktcb *tcb_alloc_init(l4id_t cid)
 	if (!(tcb = ktcb_cap_alloc(&current->space->cap_list)))
 		return 0;
 
-	ids.tid = id_new(&kernel_resources.ktcb_ids);
+	ids.tid = id;
 	ids.tid |= TASK_CID_MASK & (cid << TASK_CID_SHIFT);
 	ids.tgid = L4_NILTHREAD;
 	ids.spid = L4_NILTHREAD;
@@ -64,6 +66,17 @@ struct ktcb *tcb_alloc_init(l4id_t cid)
 	return tcb;
 }
 
+struct ktcb *tcb_alloc_init(l4id_t cid)
+{
+	struct ktcb *tcb;
+	int id = id_new(&kernel_resources.ktcb_ids);
+
+	if (!(tcb = tcb_alloc_init_id(cid, id)))
+		id_del(&kernel_resources.ktcb_ids, id);
+
+	return tcb;
+}
+
 /*
  * Deletes tcb but moves capability list to struct pager
  * Also the last child wakes up the pager which is absent here.
@@ -196,35 +209,129 @@ struct ktcb *tcb_find_by_space(l4id_t spid)
 	return 0;
 }
 
-struct ktcb *container_find_tcb(struct container *c, l4id_t tid)
+static inline struct ktcb **ktcb_hash_bucket(struct container *c,
+					     l4id_t tid)
 {
-	struct ktcb *task;
+	return &c->ktcb_hash.bucket[(tid & TASK_ID_MASK) & KTCB_HASH_MASK];
+}
 
-	spin_lock(&c->ktcb_list.list_lock);
-	list_foreach_struct(task, &c->ktcb_list.list, task_list) {
-		if (task->tid == tid) {
-			spin_unlock(&c->ktcb_list.list_lock);
-			return task;
+/*
+ * Hash chains are only modified with the container's ktcb_list
+ * lock held. A new thread is fully linked before it is published
+ * at the head of its chain, so lookups may walk chains without
+ * taking any locks.
+ */
+static void ktcb_hash_insert(struct ktcb *task, struct container *c)
+{
+	struct ktcb **bucket = ktcb_hash_bucket(c, task->tid);
+
+	task->tid_hash_next = *bucket;
+
+	/* Chain must be visible before the thread is */
+	dmb();
+
+	*bucket = task;
+}
+
+/*
+ * A removed thread keeps its chain pointer so that a lookup
+ * currently standing on it can still walk to the end of the chain.
+ * Memory is not reused until the zombie is deleted by idle task,
+ * after lookups that may have found it are over.
+ */
+static void ktcb_hash_remove(struct ktcb *task, struct container *c)
+{
+	struct ktcb **link;
+
+	for (link = ktcb_hash_bucket(c, task->tid); *link;
+	     link = &(*link)->tid_hash_next) {
+		if (*link == task) {
+			*link = task->tid_hash_next;
+			return;
 		}
 	}
-	spin_unlock(&c->ktcb_list.list_lock);
+	BUG();
+}
+
+/*
+ * Each cpu's count of lock-free lookups is odd while it walks a
+ * hash chain. Lookups are not preempted, so a zombie that was taken
+ * off its chain may be freed once every other cpu that was in the
+ * middle of a lookup has moved on.
+ */
+DECLARE_PERCPU(static volatile u32, ktcb_lookup_seq);
+
+static inline void ktcb_lookup_begin(void)
+{
+	preempt_disable();
+	per_cpu(ktcb_lookup_seq)++;
+	dmb();
+}
+
+static inline void ktcb_lookup_end(void)
+{
+	dmb();
+	per_cpu(ktcb_lookup_seq)++;
+	preempt_enable();
+}
+
+/* Waits until no lookup on another cpu may still see removed threads */
+static void ktcb_lookups_drain(void)
+{
+	u32 seq;
+
+	dmb();
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++) {
+		if (cpu == smp_get_cpuid())
+			continue;
+		if ((seq = per_cpu_byid(ktcb_lookup_seq, cpu)) & 1)
+			while (per_cpu_byid(ktcb_lookup_seq, cpu) == seq)
+				;
+	}
+	dmb();
+}
+
+static struct ktcb *ktcb_hash_find(struct container *c, l4id_t tid)
+{
+	struct ktcb *task;
+
+	for (task = *ktcb_hash_bucket(c, tid); task;
+	     task = task->tid_hash_next)
+		if (task->tid == tid)
+			return task;
+
 	return 0;
 }
 
+struct ktcb *container_find_tcb(struct container *c, l4id_t tid)
+{
+	struct ktcb *task;
+
+	ktcb_lookup_begin();
+	task = ktcb_hash_find(c, tid);
+	ktcb_lookup_end();
+
+	return task;
+}
+
 struct ktcb *container_find_lock_tcb(struct container *c, l4id_t tid)
 {
 	struct ktcb *task;
 
-	spin_lock(&c->ktcb_list.list_lock);
-	list_foreach_struct(task, &c->ktcb_list.list, task_list) {
-		if (task->tid == tid) {
-			spin_lock(&task->thread_lock);
-			spin_unlock(&c->ktcb_list.list_lock);
-			return task;
-		}
+	ktcb_lookup_begin();
+	if (!(task = ktcb_hash_find(c, tid))) {
+		ktcb_lookup_end();
+		return 0;
 	}
-	spin_unlock(&c->ktcb_list.list_lock);
-	return 0;
+	spin_lock(&task->thread_lock);
+	ktcb_lookup_end();
+
+	/* Check it wasn't removed before we could lock it */
+	if (task->tid != tid || (task->flags & TASK_REMOVED)) {
+		spin_unlock(&task->thread_lock);
+		return 0;
+	}
+	return task;
 }
 
 /*
@@ -289,6 +396,8 @@ void tcb_add(struct ktcb *new)
 	BUG_ON(!list_empty(&new->task_list));
 	BUG_ON(!++c->ktcb_list.count);
 	list_insert(&new->task_list, &c->ktcb_list.list);
+	new->flags &= ~TASK_REMOVED;
+	ktcb_hash_insert(new, c);
 	spin_unlock(&c->ktcb_list.list_lock);
 }
 
@@ -318,6 +427,9 @@ void tcb_delete_zombies(void)
 		spin_unlock(&zombie->thread_lock);
 		spin_unlock(&ktcb_list->list_lock);
 
+		/* Lookups that found it before it was removed must end */
+		ktcb_lookups_drain();
+
 		/* Delete zombie as lock-free */
 		if (thread_is_pager(zombie))
 			tcb_delete_pager(zombie);
@@ -346,6 +458,10 @@ void tcb_remove(struct ktcb *task)
 	spin_lock(&task->thread_lock);
 
 	list_remove_init(&task->task_list);
+	ktcb_hash_remove(task, curcont);
+
+	/* Lookups that found it already will see it's gone once locked */
+	task->flags |= TASK_REMOVED;
 	spin_unlock(&curcont->ktcb_list.list_lock);
 	spin_unlock(&task->thread_lock);
 }
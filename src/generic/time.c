@@ -7,15 +7,19 @@
 #include <l4/types.h>
 #include <l4/lib/mutex.h>
 #include <l4/lib/printk.h>
+#include <l4/lib/seqcount.h>
 #include <l4/generic/irq.h>
 #include <l4/generic/scheduler.h>
 #include <l4/generic/time.h>
+#include <l4/generic/timer.h>
+#include <l4/generic/smp.h>
 #include <l4/generic/preempt.h>
 #include <l4/generic/space.h>
 #include INC_ARCH(exception.h)
 #include <l4/api/syscall.h>
 #include <l4/api/errno.h>
 #include INC_GLUE(ipi.h)	/*FIXME: Remove this */
+#include INC_GLUE(smp.h)
 
 /* TODO:
  * 1) Add RTC support.
@@ -25,50 +29,121 @@
 
 volatile u32 jiffies = 0;
 
-static inline void increase_jiffies(void)
+/*
+ * Internal representation of time since epoch. Only the boot
+ * cpu updates it, on its timer irqs. Readers go lockless and
+ * retry if an update happened as they read.
+ */
+struct time_info {
+	struct seqcount seq;
+	u32 sec;	/* Seconds so far */
+	u32 usec;	/* Microseconds in this second so far */
+	u32 count;	/* Clock source count at last update */
+	u32 tick_usec;	/* Microseconds not yet counted in jiffies */
+};
+
+static struct time_info systime;
+
+static struct clock_source *clock_source;
+static struct clock_event *clock_event;
+
+/* Cpus that have stopped their ticks to idle */
+DECLARE_PERCPU(static volatile int, tick_stopped);
+
+/* Boot cpu's next tick is further out than a tick */
+static volatile int tick_long_sleep;
+
+void clock_source_register(struct clock_source *cs)
 {
-	jiffies++;
+	systime.count = cs->read();
+	clock_source = cs;
 }
 
+/* The tick goes one-shot, each one programs the next */
+void clock_event_register(struct clock_event *ce)
+{
+	clock_event = ce;
+}
 
-/* Internal representation of time since epoch */
-struct time_info {
-	int reader;
-	u32 thz;	/* Ticks in this hertz so far */
-	u64 sec;	/* Seconds so far */
-};
+/* A cheap timestamp, in clock source counts or else in ticks */
+u32 time_stamp(void)
+{
+	return clock_source ? clock_source->read() : jiffies;
+}
 
-static struct time_info systime = { 0 };
+/* Clock source counts in a microsecond, 0 if stamps are ticks */
+u32 time_stamp_rate(void)
+{
+	return clock_source ? clock_source->counts_per_usec : 0;
+}
 
 /*
- * A very basic (probably erroneous)
- * rule-of-thumb time calculation.
+ * Microseconds elapsed since the last update. Without a clock
+ * source, time only moves in ticks.
  */
+static inline u32 clock_source_elapsed(u32 count, u32 *now)
+{
+	if (!clock_source)
+		return 0;
+
+	*now = clock_source->read();
+	return (*now - count) / clock_source->counts_per_usec;
+}
+
+/* Folds the time since the last update into system time and jiffies */
 void update_system_time(void)
 {
-	/* Did we interrupt a reader? Tell it to retry */
-	if (systime.reader)
-		systime.reader = 0;
+	u32 now, usec;
 
-	/* Increase just like jiffies, but reset every second */
-	systime.thz++;
+	write_seqcount_begin(&systime.seq);
 
-	/*
-	 * On every 1 second of timer ticks, increase seconds
-	 *
-	 * TODO: Investigate: how do we make sure timer_irq is
-	 * called SCHED_TICKS times per second?
-	 */
-	if (systime.thz == CONFIG_SCHED_TICKS) {
-		systime.thz = 0;
+	if (clock_source) {
+		usec = clock_source_elapsed(systime.count, &now);
+		systime.count += usec * clock_source->counts_per_usec;
+	} else {
+		usec = TICK_USEC;
+	}
+
+	systime.usec += usec;
+	while (systime.usec >= 1000000) {
+		systime.usec -= 1000000;
 		systime.sec++;
 	}
+
+	/* After a tickless sleep, jiffies catch up all at once */
+	systime.tick_usec += usec;
+	jiffies += systime.tick_usec / TICK_USEC;
+	systime.tick_usec %= TICK_USEC;
+
+	write_seqcount_end(&systime.seq);
+}
+
+/* Reads system time, down to a microsecond with a clock source */
+void time_read(struct timeval *tv)
+{
+	u32 sec, usec, count, now;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&systime.seq);
+		sec = systime.sec;
+		usec = systime.usec;
+		count = systime.count;
+	} while (read_seqcount_retry(&systime.seq, seq));
+
+	usec += clock_source_elapsed(count, &now);
+	while (usec >= 1000000) {
+		usec -= 1000000;
+		sec++;
+	}
+
+	tv->tv_sec = sec;
+	tv->tv_usec = usec;
 }
 
 /* Read system time */
 int sys_time(struct timeval *tv, int set)
 {
-	int retries = 20;
 	int err;
 
 	if ((err = check_access((unsigned long)tv, sizeof(*tv),
@@ -77,24 +152,8 @@ int sys_time(struct timeval *tv, int set)
 
 	/* Get time */
 	if (!set) {
-		while(retries > 0) {
-			systime.reader = 1;
-			tv->tv_sec = systime.sec;
-			tv->tv_usec = 1000000 * systime.thz / CONFIG_SCHED_TICKS;
-
-			retries--;
-			if (systime.reader)
-				break;
-		}
-
-		/*
-		 * No need to reset reader since it will be reset
-		 * on next timer. If no retries return busy.
-		 */
-		if (!retries)
-			return -EBUSY;
-		else
-			return 0;
+		time_read(tv);
+		return 0;
 
 	/* Set */
 	} else {
@@ -105,6 +164,71 @@ int sys_time(struct timeval *tv, int set)
 	}
 }
 
+int tick_is_stopped(int cpu)
+{
+	return per_cpu_byid(tick_stopped, cpu);
+}
+
+/* Secondary cpus get their ticks from the boot cpu */
+static inline int tick_others_stopped(void)
+{
+	for (int cpu = 1; cpu < CONFIG_NCPU; cpu++)
+		if (!per_cpu_byid(tick_stopped, cpu))
+			return 0;
+	return 1;
+}
+
+/*
+ * Called by an idle cpu with irqs disabled, before it sleeps. The
+ * flag is set first, so that a cpu waking a task here after the
+ * check for runnable tasks is sure to see it and send an ipi.
+ *
+ * Secondary cpus get no more tick ipis. The boot cpu, which owns
+ * the clock event, sleeps up to TICK_IDLE_MAX_USEC if no other
+ * cpu needs ticks either.
+ */
+void tick_stop_idle(void)
+{
+	/* Timers on this cpu need the ticks */
+	if (timer_wheel_pending())
+		return;
+
+	per_cpu(tick_stopped) = 1;
+	dmb();
+
+	/* Time can only be caught up with from a clock source */
+	if (smp_get_cpuid() == 0 && clock_event && clock_source &&
+	    tick_others_stopped()) {
+		tick_long_sleep = 1;
+		clock_event->set_next_event(TICK_IDLE_MAX_USEC);
+	}
+}
+
+/*
+ * Called by a cpu on its way out of idle, with irqs disabled. The
+ * boot cpu catches up with the time it slept and ticks again. A
+ * secondary that needs ticks wakes it up if it is in a long sleep.
+ */
+void tick_restart_idle(void)
+{
+	per_cpu(tick_stopped) = 0;
+	dmb();
+
+	if (!tick_long_sleep)
+		return;
+
+	if (smp_get_cpuid() == 0) {
+		tick_long_sleep = 0;
+		update_system_time();
+		clock_event->set_next_event(TICK_USEC);
+	}
+#if defined (CONFIG_SMP_)
+	else {
+		smp_send_ipi(CPUID_TO_MASK(0), IPI_SCHEDULE);
+	}
+#endif
+}
+
 void update_process_times(void)
 {
 	struct ktcb *cur = current;
@@ -140,16 +264,40 @@ void update_process_times(void)
 	/* Task has expired its schedule granularity */
 	if (!cur->sched_granule)
 		need_resched = 1;
+
+	sched_balance_tick();
+}
+
+#if defined (CONFIG_SMP_)
+/* Only secondaries that are not idle need their ticks */
+static inline unsigned int tick_ipi_mask(void)
+{
+	unsigned int mask = 0;
+
+	for (int cpu = 1; cpu < CONFIG_NCPU; cpu++)
+		if (!per_cpu_byid(tick_stopped, cpu))
+			mask |= CPUID_TO_MASK(cpu);
+	return mask;
 }
+#endif
 
 int do_timer_irq(void)
 {
-	increase_jiffies();
-	update_process_times();
+#if defined (CONFIG_SMP_)
+	unsigned int mask;
+#endif
+
 	update_system_time();
+	update_process_times();
+	timer_wheel_tick();
+
+	/* Next tick, unless idle has stopped it meanwhile */
+	if (clock_event && !tick_long_sleep)
+		clock_event->set_next_event(TICK_USEC);
 
 #if defined (CONFIG_SMP_)
-	smp_send_ipi(cpu_mask_others(), IPI_TIMER_EVENT);
+	if ((mask = tick_ipi_mask()))
+		smp_send_ipi(mask, IPI_TIMER_EVENT);
 #endif
 
 	return IRQ_HANDLED;
@@ -159,6 +307,7 @@ int do_timer_irq(void)
 int secondary_timer_irq(void)
 {
 	update_process_times();
+	timer_wheel_tick();
 	return IRQ_HANDLED;
 }
 
@@ -0,0 +1,253 @@
+/*
+ * Kernel timers, and timeouts of blocking system calls.
+ *
+ * Each cpu has a timer wheel that its ticks are run on. Timers
+ * expiring within the next TIMER_WHEEL_ROOT_SIZE ticks are kept
+ * on a slot per tick. Those further out are kept on the coarser
+ * slots of upper levels, and move down a level each time the
+ * level below has gone around once.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/generic/timer.h>
+#include <l4/generic/time.h>
+#include <l4/generic/scheduler.h>
+#include <l4/generic/tcb.h>
+#include <l4/lib/wait.h>
+
+DECLARE_PERCPU(static struct timer_wheel, timer_wheel);
+
+void init_timer_wheel(void)
+{
+	struct timer_wheel *wheel = &per_cpu(timer_wheel);
+
+	spin_lock_init(&wheel->lock);
+	wheel->jiffies = jiffies;
+	wheel->pending = 0;
+	wheel->running = 0;
+
+	for (int i = 0; i < TIMER_WHEEL_ROOT_SIZE; i++)
+		link_init(&wheel->root[i]);
+	for (int i = 0; i < TIMER_WHEEL_LEVELS; i++)
+		for (int j = 0; j < TIMER_WHEEL_SIZE; j++)
+			link_init(&wheel->level[i][j]);
+}
+
+/* Index of the slot that a tick falls on, at a given level */
+static inline int wheel_level_index(u32 ticks, int level)
+{
+	return (ticks >> (TIMER_WHEEL_ROOT_BITS + level * TIMER_WHEEL_BITS))
+	       & TIMER_WHEEL_MASK;
+}
+
+/* Puts a timer on the slot for its expiry, wheel must be locked */
+static void __timer_wheel_insert(struct timer_wheel *wheel,
+				 struct ktimer *timer)
+{
+	u32 delta = timer->expires - wheel->jiffies;
+	struct link *slot;
+	int level;
+
+	/* Already expired ones are run on the next tick */
+	if ((int)delta < 0) {
+		timer->expires = wheel->jiffies;
+		delta = 0;
+	}
+
+	if (delta < TIMER_WHEEL_ROOT_SIZE) {
+		slot = &wheel->root[timer->expires & TIMER_WHEEL_ROOT_MASK];
+	} else {
+		for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+			if (delta < (1 << (TIMER_WHEEL_ROOT_BITS +
+					   (level + 1) * TIMER_WHEEL_BITS)))
+				break;
+		slot = &wheel->level[level][wheel_level_index(timer->expires,
+							      level)];
+	}
+	list_insert_tail(&timer->list, slot);
+}
+
+/*
+ * Adds a timer to expire the given number of ticks from now,
+ * on this cpu. Timer func and data must be set.
+ */
+void timer_add(struct ktimer *timer, u32 ticks)
+{
+	struct timer_wheel *wheel = &per_cpu(timer_wheel);
+	unsigned long irqflags;
+
+	if (ticks > TIMER_WHEEL_MAX_TICKS)
+		ticks = TIMER_WHEEL_MAX_TICKS;
+
+	spin_lock_irq(&wheel->lock, &irqflags);
+
+	/* An empty wheel may not have been run while idle */
+	if (!wheel->pending)
+		wheel->jiffies = jiffies + 1;
+
+	link_init(&timer->list);
+	timer->wheel = wheel;
+	timer->expires = wheel->jiffies + ticks;
+	__timer_wheel_insert(wheel, timer);
+	wheel->pending++;
+	spin_unlock_irq(&wheel->lock, irqflags);
+}
+
+/*
+ * Removes a timer if it has not expired. A timer can be removed
+ * from any cpu. If its func is running meanwhile on the wheel's
+ * cpu, this waits for it to finish, so that the timer can be
+ * freed on return.
+ */
+void timer_del(struct ktimer *timer)
+{
+	struct timer_wheel *wheel = timer->wheel;
+	unsigned long irqflags;
+
+	if (!wheel)
+		return;
+
+	spin_lock_irq(&wheel->lock, &irqflags);
+	if (!list_empty(&timer->list)) {
+		list_remove_init(&timer->list);
+		wheel->pending--;
+	}
+	spin_unlock_irq(&wheel->lock, irqflags);
+
+	while (wheel->running == timer)
+		;
+
+	timer->wheel = 0;
+}
+
+/* Idle cpus with timers still need their ticks */
+int timer_wheel_pending(void)
+{
+	return per_cpu(timer_wheel).pending;
+}
+
+/* Moves all timers on a slot over to an empty list */
+static inline void wheel_slot_take(struct link *list, struct link *slot)
+{
+	link_init(list);
+	if (list_empty(slot))
+		return;
+
+	list->next = slot->next;
+	list->prev = slot->prev;
+	list->next->prev = list;
+	list->prev->next = list;
+	link_init(slot);
+}
+
+/* Moves timers of an upper level slot down to finer slots */
+static int timer_wheel_cascade(struct timer_wheel *wheel, int level)
+{
+	int index = wheel_level_index(wheel->jiffies, level);
+	struct ktimer *timer, *n;
+	struct link slot;
+
+	wheel_slot_take(&slot, &wheel->level[level][index]);
+
+	list_foreach_removable_struct(timer, n, &slot, list) {
+		list_remove_init(&timer->list);
+		__timer_wheel_insert(wheel, timer);
+	}
+
+	return index;
+}
+
+/*
+ * Runs the timers that are due on this cpu, on each tick. After
+ * ticks were stopped, the wheel is run for each one that passed,
+ * unless it has no timers at all.
+ */
+void timer_wheel_tick(void)
+{
+	struct timer_wheel *wheel = &per_cpu(timer_wheel);
+	struct ktimer *timer;
+	struct link expired;
+	unsigned long irqflags;
+	int index, level;
+
+	spin_lock_irq(&wheel->lock, &irqflags);
+
+	if (!wheel->pending) {
+		wheel->jiffies = jiffies + 1;
+		spin_unlock_irq(&wheel->lock, irqflags);
+		return;
+	}
+
+	while ((int)(jiffies - wheel->jiffies) >= 0) {
+		index = wheel->jiffies & TIMER_WHEEL_ROOT_MASK;
+
+		/* Root went around, bring in the next lot */
+		if (!index)
+			for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+				if (timer_wheel_cascade(wheel, level))
+					break;
+
+		wheel->jiffies++;
+
+		wheel_slot_take(&expired, &wheel->root[index]);
+
+		while (!list_empty(&expired)) {
+			timer = link_to_struct(expired.next,
+					       struct ktimer, list);
+			list_remove_init(&timer->list);
+			wheel->pending--;
+			wheel->running = timer;
+			spin_unlock_irq(&wheel->lock, irqflags);
+
+			timer->func(timer);
+
+			spin_lock_irq(&wheel->lock, &irqflags);
+			wheel->running = 0;
+		}
+	}
+
+	spin_unlock_irq(&wheel->lock, irqflags);
+}
+
+/*
+ * Converts a timeout in api/timeout.h encoding to ticks, rounding
+ * up so that a call never times out early.
+ */
+u32 timeout_to_ticks(unsigned int timeout)
+{
+	u32 msec;
+
+	if (timeout == L4_TIMEOUT_NEVER || timeout == L4_TIMEOUT_POLL)
+		return 0;
+
+	msec = 1 << (timeout - L4_TIMEOUT_MSEC_LOG2(0));
+	return (msec * CONFIG_SCHED_TICKS + 999) / 1000;
+}
+
+static void timeout_expire(struct ktimer *timer)
+{
+	wake_up_task(timer->data, WAKEUP_TIMEOUT);
+}
+
+/*
+ * Wakes up current with -ETIMEDOUT if it still sleeps once the
+ * timeout passes. It must already be on the waitqueue, or an early
+ * expiry would have nothing to wake up. Does nothing for timeouts
+ * that never expire.
+ */
+void timeout_start(struct ktimer *timer, unsigned int timeout)
+{
+	timer->wheel = 0;
+	if (timeout == L4_TIMEOUT_NEVER || timeout == L4_TIMEOUT_POLL)
+		return;
+
+	timer->func = timeout_expire;
+	timer->data = current;
+	timer_add(timer, timeout_to_ticks(timeout));
+}
+
+/* Called on the way out of a timed sleep, however it ended */
+void timeout_stop(struct ktimer *timer)
+{
+	timer_del(timer);
+}
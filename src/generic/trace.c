@@ -0,0 +1,108 @@
+/*
+ * Kernel event tracing.
+ *
+ * Each cpu records its kernel entries and exits on a ring of its
+ * own, so records are written without locks, with irqs disabled.
+ * The rings are mapped read-only into every address space, next
+ * to the kip, for tracing and profiling tools to read live.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/generic/trace.h>
+#include <l4/generic/tcb.h>
+#include <l4/generic/time.h>
+#include <l4/generic/smp.h>
+#include <l4/generic/space.h>
+#include <l4/lib/printk.h>
+#include <l4/lib/string.h>
+#include <l4/api/kip.h>
+#include INC_ARCH(irq.h)
+#include INC_SUBARCH(mm.h)
+#include INC_SUBARCH(mmu_ops.h)
+#include INC_GLUE(memlayout.h)
+#include INC_GLUE(mapping.h)
+#include INC_GLUE(smp.h)
+
+#define TRACE_PAGES_SIZE	align_up(TRACE_AREA_SIZE(CONFIG_NCPU), PAGE_SIZE)
+
+/*
+ * Backing pages of the rings. They are only ever accessed through
+ * their uncached mapping at USER_TRACE_AREA, which is the same in
+ * every space, so that userspace sees records as they are written.
+ */
+static char trace_pages[TRACE_PAGES_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static struct trace_area *const trace = (struct trace_area *)USER_TRACE_AREA;
+static int trace_enabled;
+
+/* Seq of the next record on this cpu, userspace may not change it */
+DECLARE_PERCPU(static u32, trace_head);
+
+/*
+ * Called once the clock source is there, as it tells the rate
+ * of the stamps. Other cpus only start recording after this.
+ */
+void trace_init(void)
+{
+	/* Must share the kip's section to be seen by all spaces */
+	BUG_ON(USER_TRACE_AREA + TRACE_PAGES_SIZE >
+	       align_up(USER_KIP_PAGE + PAGE_SIZE, SECTION_SIZE));
+
+	/* No dirty lines of the kernel's alias may be written back over it */
+	arm_clean_invalidate_dcache();
+
+	add_boot_mapping(virt_to_phys(trace_pages), USER_TRACE_AREA,
+			 TRACE_PAGES_SIZE, MAP_USR_RO_IO);
+
+	memset(trace, 0, TRACE_PAGES_SIZE);
+	trace->info.magic = TRACE_MAGIC;
+	trace->info.ncpu = CONFIG_NCPU;
+	trace->info.entries = TRACE_RING_ENTRIES;
+	trace->info.counts_per_usec = time_stamp_rate();
+	trace->info.ticks_per_sec = CONFIG_SCHED_TICKS;
+
+	kip.trace = USER_TRACE_AREA;
+
+	dmb();
+	trace_enabled = 1;
+	printk("%s: Tracing kernel events at 0x%x\n",
+	       __KERNELNAME__, USER_TRACE_AREA);
+}
+
+/* Records an event on this cpu's ring, overwriting the oldest one */
+void trace_event(unsigned int event, u32 arg0, u32 arg1, u32 arg2, u32 arg3)
+{
+	struct trace_ring *ring;
+	struct trace_entry *entry;
+	unsigned long irqflags;
+	u32 seq;
+
+	if (!trace_enabled)
+		return;
+
+	/* An irq would otherwise write its records over this one */
+	irq_local_disable_save(&irqflags);
+
+	ring = &trace->ring[smp_get_cpuid()];
+	seq = per_cpu(trace_head)++;
+	entry = &ring->entry[seq & (TRACE_RING_ENTRIES - 1)];
+
+	/* Readers that copy it meanwhile see the busy seq, and drop it */
+	entry->seq = TRACE_SEQ_BUSY;
+	dmb();
+
+	entry->stamp = time_stamp();
+	entry->event = event;
+	entry->cpu = smp_get_cpuid();
+	entry->tid = current->tid;
+	entry->arg[0] = arg0;
+	entry->arg[1] = arg1;
+	entry->arg[2] = arg2;
+	entry->arg[3] = arg3;
+
+	dmb();
+	entry->seq = seq;
+	ring->head = seq + 1;
+
+	irq_local_restore(irqflags);
+}
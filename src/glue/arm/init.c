@@ -9,12 +9,14 @@
 #include <l4/lib/idpool.h>
 #include <l4/generic/platform.h>
 #include <l4/generic/scheduler.h>
+#include <l4/generic/timer.h>
 #include <l4/generic/space.h>
 #include <l4/generic/tcb.h>
 #include <l4/generic/idle.h>
 #include <l4/generic/bootmem.h>
 #include <l4/generic/resource.h>
 #include <l4/generic/container.h>
+#include <l4/generic/trace.h>
 #include INC_ARCH(linker.h)
 #include INC_ARCH(asm.h)
 #include INC_SUBARCH(mm.h)
@@ -111,6 +113,7 @@ void remove_initial_mapping(void)
 void init_finalize(void)
 {
 	platform_timer_start();
+	trace_init();
 
 #if defined (CONFIG_SMP_)
 	/* Tell other cores to continue */
@@ -165,6 +168,7 @@ void start_kernel(void)
 	system_identify();
 
 	sched_init();
+	init_timer_wheel();
 
 	/*
 	 * Map and enable high vector page.
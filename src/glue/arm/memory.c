@@ -43,6 +43,8 @@ unsigned int space_flags_to_ptflags(unsigned int flags)
 		return __MAP_USR_RX;
 	case MAP_KERN_RX:
 		return __MAP_KERN_RX;
+	case MAP_USR_RO_IO:
+		return __MAP_USR_RO_IO;
 	/*
 	 * Don't remove this, if a flag with
 	 * same value is introduced, compiler will warn us
@@ -55,6 +57,20 @@ unsigned int space_flags_to_ptflags(unsigned int flags)
 	return 0;
 }
 
+/* Tells if generic space flags map executable memory */
+int space_flags_exec(unsigned int flags)
+{
+	switch (flags) {
+	case MAP_USR_RWX:
+	case MAP_KERN_RWX:
+	case MAP_USR_RX:
+	case MAP_KERN_RX:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 void task_init_registers(struct ktcb *task, unsigned long pc)
 {
 	task->context.pc = (u32)pc;
@@ -7,6 +7,7 @@
  */
 
 #include <l4/generic/platform.h>
+#include <l4/generic/timer.h>
 #include INC_GLUE(smp.h)
 #include INC_GLUE(init.h)
 #include INC_GLUE(mapping.h)
@@ -110,6 +111,7 @@ void smp_secondary_init(void)
 	       __KERNELNAME__, smp_get_cpuid());
 
 	sched_init();
+	init_timer_wheel();
 
 	/* Signal primary that we are ready */
 	dmb();
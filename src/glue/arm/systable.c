@@ -9,6 +9,7 @@
 #include <l4/generic/scheduler.h>
 #include <l4/generic/debug.h>
 #include <l4/generic/tcb.h>
+#include <l4/generic/trace.h>
 #include <l4/api/errno.h>
 #include INC_GLUE(memlayout.h)
 #include INC_GLUE(syscall.h)
@@ -175,9 +176,15 @@ int syscall(syscall_context_t *regs, unsigned long swi_addr)
 			/* Start measure syscall timing, if enabled */
 			system_measure_syscall_start();
 
+			trace_event(TRACE_SYSCALL_ENTRY, swi_addr & 0xFF,
+				    regs->r0, regs->r1, regs->r2);
+
 			/* Quick jump, rather than compare each */
 			ret = (*syscall_table[(swi_addr & 0xFF) >> 2])(regs);
 
+			trace_event(TRACE_SYSCALL_EXIT, swi_addr & 0xFF,
+				    ret, 0, 0);
+
 			/* End measure syscall timing, if enabled */
 			system_measure_syscall_end(swi_addr);
 
@@ -198,6 +205,10 @@ int syscall(syscall_context_t *regs, unsigned long swi_addr)
 		sched_suspend_sync();
 	}
 
+	/* A higher priority task may have been woken up */
+	if (need_resched)
+		schedule();
+
 	return ret;
 }
 
@@ -6,36 +6,34 @@
 #include <l4/lib/bit.h>
 #include INC_GLUE(memory.h)
 
-/* Emulation of ARM's CLZ (count leading zeroes) instruction */
+/* Count leading zeroes, a single CLZ instruction on ARMv5 and later */
 unsigned int __clz(unsigned int bitvector)
 {
-	unsigned int x = 0;
-	while((!(bitvector & ((unsigned)1 << 31))) && (x < 32)) {
-		bitvector <<= 1;
-		x++;
-	}
-	return x;
+	if (!bitvector)
+		return 32;
+	return __builtin_clz(bitvector);
 }
 
+/* Scans a word at a time, skipping over full words */
 int find_and_set_first_free_bit(u32 *word, unsigned int limit)
 {
-	int success = 0;
-	int i;
+	unsigned int nwords = BITWISE_GETWORD(limit + WORD_BITS - 1);
+	unsigned int bit;
+
+	for (unsigned int i = 0; i < nwords; i++) {
+		if (word[i] == ~0U)
+			continue;
 
-	for(i = 0; i < limit; i++) {
-		/* Find first unset bit */
-		if (!(word[BITWISE_GETWORD(i)] & BITWISE_GETBIT(i))) {
-			/* Set it */
-			word[BITWISE_GETWORD(i)] |= BITWISE_GETBIT(i);
-			success = 1;
-			break;
-		}
+		/* First unset bit of this word */
+		bit = i * WORD_BITS + __ffs(~word[i]);
+		if (bit >= limit)
+			return -1;
+
+		/* Set it */
+		word[i] |= BITWISE_GETBIT(bit);
+		return bit;
 	}
-	/* Return bit just set */
-	if (success)
-		return i;
-	else
-		return -1;
+	return -1;
 }
 
 int check_and_clear_bit(u32 *word, int bit)
@@ -7,6 +7,45 @@
 #include <l4/lib/idpool.h>
 #include INC_GLUE(memory.h)
 
+/* Marks a bitmap word as full or not in the summary, after it changes */
+static inline void id_pool_summarize(struct id_pool *pool, int word)
+{
+	if (pool->bitmap[word] == ~0U)
+		pool->summary[BITWISE_GETWORD(word)] |= BITWISE_GETBIT(word);
+	else
+		pool->summary[BITWISE_GETWORD(word)] &= ~BITWISE_GETBIT(word);
+}
+
+/* Finds the first non-full bitmap word in [start, end), or -1 */
+static int id_pool_find_word(struct id_pool *pool, int start, int end)
+{
+	u32 free;
+	int word;
+
+	for (int s = BITWISE_GETWORD(start); s * WORD_BITS < end; s++) {
+		free = ~pool->summary[s];
+		if (s == BITWISE_GETWORD(start))
+			free &= ~0U << (start % WORD_BITS);
+		if (free) {
+			word = s * WORD_BITS + __ffs(free);
+			return word < end ? word : -1;
+		}
+	}
+	return -1;
+}
+
+/* Finds nids free ids within a word that is not full, or -1 */
+static inline int id_word_find_run(u32 word, int nids)
+{
+	u32 free = ~word;
+
+	/* A bit stays set if it starts a free run of nids */
+	for (int i = 1; i < nids && free; i++)
+		free &= free >> 1;
+
+	return free ? __ffs(free) : -1;
+}
+
 struct id_pool *id_pool_new_init(int totalbits, void *freebuf)
 {
 	int nwords = BITWISE_GETWORD(totalbits);
@@ -15,28 +54,96 @@ struct id_pool *id_pool_new_init(int totalbits, void *freebuf)
 
 	spin_lock_init(&new->lock);
 	new->nwords = nwords;
+	new->hint = 0;
 	return new;
 }
 
+/*
+ * Allocates from the word of the last allocation onwards,
+ * skipping over full words via the summary, so the search
+ * does not get longer as the ids at the start are used up.
+ */
 int id_new(struct id_pool *pool)
 {
-	int id;
+	int word, id = -1;
 
 	spin_lock(&pool->lock);
-	id = find_and_set_first_free_bit(pool->bitmap,
-					     pool->nwords * WORD_BITS);
+	if ((word = id_pool_find_word(pool, pool->hint,
+				      pool->nwords)) >= 0 ||
+	    (word = id_pool_find_word(pool, 0, pool->hint)) >= 0) {
+		id = word * WORD_BITS + __ffs(~pool->bitmap[word]);
+		pool->bitmap[word] |= BITWISE_GETBIT(id);
+		id_pool_summarize(pool, word);
+		pool->hint = word;
+	}
 	spin_unlock(&pool->lock);
 	BUG_ON(id < 0);
 
 	return id;
 }
 
+/*
+ * Allocates nids contiguous ids, e.g. for a batch of threads,
+ * and returns the first one. Goes a word at a time, carrying
+ * over the free run at the top of each word to the next one.
+ */
+int id_new_range(struct id_pool *pool, int nids)
+{
+	int word = 0, run = 0, first = -1, bit;
+	u32 bits;
+
+	if (nids <= 0)
+		return -1;
+
+	spin_lock(&pool->lock);
+	while (word < pool->nwords) {
+		bits = pool->bitmap[word];
+
+		if (bits == ~0U) {
+			run = 0;
+			if ((word = id_pool_find_word(pool, word,
+						      pool->nwords)) < 0)
+				break;
+			continue;
+		}
+
+		/* Free run from the last word, extended by lowest bits */
+		if (run + (bits ? __ffs(bits) : WORD_BITS) >= nids) {
+			first = word * WORD_BITS - run;
+			break;
+		}
+
+		/* A run within this word */
+		if (nids <= WORD_BITS &&
+		    (bit = id_word_find_run(bits, nids)) >= 0) {
+			first = word * WORD_BITS + bit;
+			break;
+		}
+
+		/* Free run at the top carries over to next word */
+		run = bits ? __clz(bits) : run + WORD_BITS;
+		word++;
+	}
+
+	if (first >= 0) {
+		for (int id = first; id < first + nids; id++)
+			pool->bitmap[BITWISE_GETWORD(id)] |= BITWISE_GETBIT(id);
+		for (word = BITWISE_GETWORD(first);
+		     word <= BITWISE_GETWORD(first + nids - 1); word++)
+			id_pool_summarize(pool, word);
+	}
+	spin_unlock(&pool->lock);
+
+	return first;
+}
+
 int id_del(struct id_pool *pool, int id)
 {
 	int ret;
 
 	spin_lock(&pool->lock);
 	ret = check_and_clear_bit(pool->bitmap, id);
+	id_pool_summarize(pool, BITWISE_GETWORD(id));
 	spin_unlock(&pool->lock);
 
 	BUG_ON(ret < 0);
@@ -50,6 +157,7 @@ int id_get(struct id_pool *pool, int id)
 
 	spin_lock(&pool->lock);
 	ret = check_and_set_bit(pool->bitmap, id);
+	id_pool_summarize(pool, BITWISE_GETWORD(id));
 	spin_unlock(&pool->lock);
 
 	if (ret < 0)
@@ -57,4 +165,3 @@ int id_get(struct id_pool *pool, int id)
 	else
 		return id;
 }
-
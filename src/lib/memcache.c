@@ -8,6 +8,8 @@
 #include <l4/lib/printk.h>
 #include INC_GLUE(memory.h)
 #include <l4/lib/bit.h>
+#include <l4/generic/preempt.h>
+#include <l4/generic/smp.h>
 #include <l4/api/errno.h>
 
 /* Allocate, clear and return element */
@@ -18,36 +20,181 @@ void *mem_cache_zalloc(struct mem_cache *cache)
 	return elem;
 }
 
-/* Allocate another element from given @cache. Returns 0 when full. */
-void *mem_cache_alloc(struct mem_cache *cache)
+/* Locks current cpu's magazine, keeping us on this cpu until unlocked */
+static inline struct mem_cache_magazine *
+mem_cache_mag_lock(struct mem_cache *cache)
+{
+	struct mem_cache_magazine *mag;
+
+	preempt_disable();
+	mag = &per_cpu(cache->mag);
+	spin_lock(&mag->lock);
+
+	return mag;
+}
+
+static inline void mem_cache_mag_unlock(struct mem_cache_magazine *mag)
+{
+	spin_unlock(&mag->lock);
+	preempt_enable();
+}
+
+/* Takes a free element off the bitmap. Cache mutex must be held */
+static void *mem_cache_get_bit(struct mem_cache *cache)
 {
 	int bit;
+
+	if ((bit = find_and_set_first_free_bit(cache->bitmap,
+					       cache->total)) < 0) {
+		printk("Error: Anomaly in cache occupied state.\n"
+		       "Bitmap full although cache->free > 0\n");
+		BUG();
+	}
+	cache->free--;
+
+	return (void *)(cache->start + (cache->struct_size * bit));
+}
+
+/* Returns an element to the bitmap. Cache mutex must be held */
+static int mem_cache_put_bit(struct mem_cache *cache, void *addr)
+{
+	unsigned int bit = ((unsigned int)addr - cache->start) /
+			   cache->struct_size;
+
+	/* Check free/occupied state */
+	if (check_and_clear_bit(cache->bitmap, bit) < 0) {
+		printk("Error: Anomaly in cache occupied state:\n"
+		       "Trying to free already free structure.\n");
+		return -1;
+	}
+	cache->free++;
+	if (cache->free > cache->total) {
+		printk("Error: Anomaly in cache occupied state:\n"
+		       "More free elements than total.\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Takes an element cached on any cpu, for when the bitmap
+ * runs out while other magazines still hold free elements.
+ */
+static void *mem_cache_steal(struct mem_cache *cache)
+{
+	struct mem_cache_magazine *mag;
+	void *elem = 0;
+
+	for (int cpu = 0; cpu < CONFIG_NCPU && !elem; cpu++) {
+		mag = &per_cpu_byid(cache->mag, cpu);
+		spin_lock(&mag->lock);
+		if (mag->count)
+			elem = mag->obj[--mag->count];
+		spin_unlock(&mag->lock);
+	}
+	return elem;
+}
+
+/*
+ * Refills current cpu's magazine with a batch from the
+ * bitmap and returns one of them. Returns 0 when full.
+ */
+static void *mem_cache_refill(struct mem_cache *cache)
+{
+	struct mem_cache_magazine *mag;
+	void *elem = 0;
 	int err;
 
-	if (cache->free > 0) {
-		if ((err = mutex_lock(&cache->mutex)) < 0)
-			return PTR_ERR(err);	/* Interruptible mutex */
-		cache->free--;
-		if ((bit = find_and_set_first_free_bit(cache->bitmap,
-						       cache->total)) < 0) {
-			printk("Error: Anomaly in cache occupied state.\n"
-			       "Bitmap full although cache->free > 0\n");
-			BUG();
-		}
-		mutex_unlock(&cache->mutex);
-		return (void *)(cache->start + (cache->struct_size * bit));
-	} else {
-		/* Cache full */
-		return 0;
+	if ((err = mutex_lock(&cache->mutex)) < 0)
+		return PTR_ERR(err);	/* Interruptible mutex */
+
+	mag = mem_cache_mag_lock(cache);
+	while (cache->free > 0 && mag->count < MEM_CACHE_MAG_BATCH)
+		mag->obj[mag->count++] = mem_cache_get_bit(cache);
+	if (mag->count)
+		elem = mag->obj[--mag->count];
+	mem_cache_mag_unlock(mag);
+
+	if (!elem)
+		elem = mem_cache_steal(cache);
+
+	mutex_unlock(&cache->mutex);
+	return elem;
+}
+
+/*
+ * Returns a batch from current cpu's full magazine
+ * to the bitmap, and caches the freed element.
+ */
+static int mem_cache_flush(struct mem_cache *cache, void *addr)
+{
+	struct mem_cache_magazine *mag;
+	int err;
+
+	if ((err = mutex_lock(&cache->mutex)) < 0)
+		return err; /* Interruptible mutex */
+
+	mag = mem_cache_mag_lock(cache);
+	for (int i = 0; i < MEM_CACHE_MAG_BATCH && mag->count; i++)
+		BUG_ON(mem_cache_put_bit(cache,
+					 mag->obj[--mag->count]) < 0);
+	mag->obj[mag->count++] = addr;
+	mem_cache_mag_unlock(mag);
+
+	mutex_unlock(&cache->mutex);
+	return 0;
+}
+
+/* Allocate another element from given @cache. Returns 0 when full. */
+void *mem_cache_alloc(struct mem_cache *cache)
+{
+	struct mem_cache_magazine *mag;
+	void *elem = 0;
+
+	mag = mem_cache_mag_lock(cache);
+	if (mag->count)
+		elem = mag->obj[--mag->count];
+	mem_cache_mag_unlock(mag);
+
+	if (elem)
+		return elem;
+
+	return mem_cache_refill(cache);
+}
+
+#if defined (CONFIG_DEBUG_MEMCACHE)
+/*
+ * Elements cached in a magazine still have their bit set, so a
+ * second free of one is only caught by looking in the magazines.
+ */
+static int mem_cache_is_cached(struct mem_cache *cache, void *addr)
+{
+	struct mem_cache_magazine *mag;
+	int found = 0;
+
+	for (int cpu = 0; cpu < CONFIG_NCPU && !found; cpu++) {
+		mag = &per_cpu_byid(cache->mag, cpu);
+		spin_lock(&mag->lock);
+		for (int i = 0; i < mag->count; i++)
+			if (mag->obj[i] == addr)
+				found = 1;
+		spin_unlock(&mag->lock);
 	}
+	return found;
 }
+#else
+static inline int mem_cache_is_cached(struct mem_cache *cache, void *addr)
+{
+	return 0;
+}
+#endif
 
 /* Free element at @addr in @cache. Return negative on error. */
 int mem_cache_free(struct mem_cache *cache, void *addr)
 {
+	struct mem_cache_magazine *mag;
 	unsigned int struct_addr = (unsigned int)addr;
 	unsigned int bit;
-	int err = 0;
 
 	/* Check boundary */
 	if (struct_addr < cache->start || struct_addr > cache->end)
@@ -64,30 +211,30 @@ int mem_cache_free(struct mem_cache *cache, void *addr)
 	if (((bit * cache->struct_size) + cache->start) != struct_addr) {
 		printk("Error: This address is not aligned on a predefined "
 		       "structure address in this cache.\n");
-		err = -1;
-		return err;
+		return -1;
 	}
 
-	if ((err = mutex_lock(&cache->mutex)) < 0)
-		return err; /* Interruptible mutex */
-
-	/* Check free/occupied state */
-	if (check_and_clear_bit(cache->bitmap, bit) < 0) {
+	/*
+	 * Allocated elements have their bit set until they
+	 * go back to the bitmap, and only the owner frees it.
+	 * So do those in magazines, which debug builds check.
+	 */
+	if (!(cache->bitmap[BITWISE_GETWORD(bit)] & BITWISE_GETBIT(bit)) ||
+	    mem_cache_is_cached(cache, addr)) {
 		printk("Error: Anomaly in cache occupied state:\n"
 		       "Trying to free already free structure.\n");
-		err = -1;
-		goto out;
+		return -1;
 	}
-	cache->free++;
-	if (cache->free > cache->total) {
-		printk("Error: Anomaly in cache occupied state:\n"
-		       "More free elements than total.\n");
-		err = -1;
-		goto out;
+
+	mag = mem_cache_mag_lock(cache);
+	if (mag->count < MEM_CACHE_MAG_SIZE) {
+		mag->obj[mag->count++] = addr;
+		mem_cache_mag_unlock(mag);
+		return 0;
 	}
-out:
-	mutex_unlock(&cache->mutex);
-	return err;
+	mem_cache_mag_unlock(mag);
+
+	return mem_cache_flush(cache, addr);
 }
 
 /*
@@ -209,6 +356,11 @@ struct mem_cache *mem_cache_init(void *bufstart, int cache_size,
 	mutex_init(&cache->mutex);
 	memset(cache->bitmap, 0, bwords*SZ_WORD);
 
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++) {
+		spin_lock_init(&per_cpu_byid(cache->mag, cpu).lock);
+		per_cpu_byid(cache->mag, cpu).count = 0;
+	}
+
 	return cache;
 }
 
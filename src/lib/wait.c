@@ -59,10 +59,32 @@ int wait_on_prepared_wait(void)
 		current->flags &= ~TASK_INTERRUPTED;
 		return -EINTR;
 	}
+
+	/* Or did we time out */
+	if (current->flags & TASK_TIMEDOUT) {
+		current->flags &= ~TASK_TIMEDOUT;
+		return -ETIMEDOUT;
+	}
 	/* No errors */
 	return 0;
 }
 
+/*
+ * Same as above, but wakes up with -ETIMEDOUT if nobody
+ * else wakes us up before the timeout.
+ */
+int wait_on_prepared_wait_timeout(unsigned int timeout)
+{
+	struct ktimer timer;
+	int ret;
+
+	timeout_start(&timer, timeout);
+	ret = wait_on_prepared_wait();
+	timeout_stop(&timer);
+
+	return ret;
+}
+
 /*
  * Do all preparations to sleep but return without sleeping.
  * This is useful if the task needs to get in the waitqueue before
@@ -112,6 +134,12 @@ int wait_on(struct waitqueue_head *wqh)
 		return -EINTR;
 	}
 
+	/* Or did we time out */
+	if (current->flags & TASK_TIMEDOUT) {
+		current->flags &= ~TASK_TIMEDOUT;
+		return -ETIMEDOUT;
+	}
+
 	return 0;
 }
 
@@ -232,6 +260,8 @@ int wake_up_task(struct ktcb *task, unsigned int flags)
 	task->wq = 0;
 	if (flags & WAKEUP_INTERRUPT)
 		task->flags |= TASK_INTERRUPTED;
+	if (flags & WAKEUP_TIMEOUT)
+		task->flags |= TASK_TIMEDOUT;
 	spin_unlock_irq(&wqh->slock, irqflags[0]);
 	spin_unlock_irq(&task->waitlock, irqflags[1]);
 
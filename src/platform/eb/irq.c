@@ -7,6 +7,8 @@
 #include INC_PLAT(irq.h)
 #include <l4/platform/realview/irq.h>
 #include <l4/generic/irq.h>
+#include <l4/generic/smp.h>
+#include INC_GLUE(ipi.h)
 
 extern struct gic_data gic_data[IRQ_CHIPS_MAX];
 
@@ -63,6 +65,19 @@ struct irq_chip irq_chip_array[IRQ_CHIPS_MAX] = {
 #endif
 
 struct irq_desc irq_desc_array[IRQS_MAX] = {
+#if defined (CONFIG_SMP_)
+	/* Software generated irqs between cores */
+	[IPI_TIMER_EVENT] = {
+		.name = "Timer IPI",
+		.chip = &irq_chip_array[0],
+		.handler = ipi_handler,
+	},
+	[IPI_SCHEDULE] = {
+		.name = "Schedule IPI",
+		.chip = &irq_chip_array[0],
+		.handler = ipi_handler,
+	},
+#endif
 	[IRQ_TIMER0] = {
 		.name = "Timer0",
 		.chip = &irq_chip_array[0],
@@ -7,6 +7,7 @@
 #include <l4/generic/space.h>
 #include <l4/generic/irq.h>
 #include <l4/generic/bootmem.h>
+#include <l4/generic/time.h>
 #include INC_ARCH(linker.h)
 #include INC_SUBARCH(mm.h)
 #include INC_SUBARCH(mmu_ops.h)
@@ -59,18 +60,43 @@ void init_platform_console(void)
 	uart_init(PLATFORM_CONSOLE_VBASE);
 }
 
+/* Free running second half of TIMER0, counting down at 1Mhz */
+static u32 platform_clock_read(void)
+{
+	return ~timer_read(timer_secondary_base(PLATFORM_TIMER0_VBASE));
+}
+
+/* 1 Mhz means a tick per microsecond */
+static void platform_clock_set_next_event(u32 usec)
+{
+	timer_oneshot_irq(PLATFORM_TIMER0_VBASE, usec);
+}
+
+static struct clock_source platform_clock_source = {
+	.name = "sp804-freerun",
+	.counts_per_usec = 1,
+	.read = platform_clock_read,
+};
+
+static struct clock_event platform_clock_event = {
+	.name = "sp804-oneshot",
+	.set_next_event = platform_clock_set_next_event,
+};
+
 /*
  * We are using TIMER0 only, so we map TIMER0 base,
  * incase any other timer is needed we need to map it
- * to userspace or kernel space as needed
+ * to userspace or kernel space as needed.
+ *
+ * Its first half raises ticks one at a time, its second
+ * half counts time in between.
  */
 void init_platform_timer(void)
 {
 	add_boot_mapping(PLATFORM_TIMER0_BASE, PLATFORM_TIMER0_VBASE,
 			 PAGE_SIZE, MAP_IO_DEFAULT);
 
-	/* 1 Mhz means can tick up to 1,000,000 times a second */
-	timer_init(PLATFORM_TIMER0_VBASE, 1000000 / CONFIG_SCHED_TICKS);
+	timer_init_freerun(timer_secondary_base(PLATFORM_TIMER0_VBASE));
 }
 
 void init_platform_irq_controller()
@@ -128,8 +154,12 @@ void platform_timer_start(void)
 	/* Enable irq line for TIMER0 */
 	irq_enable(IRQ_TIMER0);
 
-	/* Enable timer */
-	timer_start(PLATFORM_TIMER0_VBASE);
+	/* Start counting time, then ticking */
+	timer_start(timer_secondary_base(PLATFORM_TIMER0_VBASE));
+	clock_source_register(&platform_clock_source);
+	clock_event_register(&platform_clock_event);
+
+	platform_clock_set_next_event(TICK_USEC);
 }
 
 void platform_init(void)
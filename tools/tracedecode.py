@@ -0,0 +1,189 @@
+#!/usr/bin/env python
+#
+# Decodes a dump of the kernel's event trace rings (see
+# include/l4/api/trace.h) into a time ordered listing of events,
+# and the slowest system calls, faults and irqs.
+#
+# The dump is the raw trace area as mapped at the kip's trace
+# address, e.g. from the debugger:
+#
+#	dump binary memory trace.bin 0xFF001000 0xFF012000
+#
+# Copyright (C) 2010 B Labs Ltd.
+#
+import sys
+import struct
+import getopt
+
+TRACE_MAGIC = 0x54524345
+TRACE_SEQ_BUSY = 0xFFFFFFFF
+
+INFO_FORMAT = "<8I"
+RING_HEAD_FORMAT = "<8I"
+ENTRY_FORMAT = "<IIHHI4I"
+
+events = {
+	1 : "syscall_entry",
+	2 : "syscall_exit",
+	3 : "ipc",
+	4 : "switch",
+	5 : "fault_entry",
+	6 : "fault_exit",
+	7 : "irq_entry",
+	8 : "irq_exit",
+}
+
+# Events that close the one before them, and what pairs them up
+exits = {
+	2 : (1, 0),	# syscall offset
+	6 : (5, 0),	# fault address
+	8 : (7, 0),	# irq number
+}
+
+syscalls = {
+	0x00 : "ipc",
+	0x04 : "thread_switch",
+	0x08 : "thread_control",
+	0x0C : "exchange_registers",
+	0x10 : "schedule",
+	0x14 : "unmap",
+	0x18 : "irq_control",
+	0x1C : "ipc_control",
+	0x20 : "map",
+	0x24 : "getid",
+	0x28 : "capability_control",
+	0x2C : "container_control",
+	0x30 : "time",
+	0x34 : "mutex_control",
+	0x38 : "cache_control",
+}
+
+class trace_entry:
+	def __init__(self, fields):
+		self.seq, self.stamp, self.event, self.cpu, self.tid = fields[:5]
+		self.arg = fields[5:]
+		self.time = 0
+
+	def describe(self):
+		args = " ".join(["0x%x" % a for a in self.arg])
+		if self.event in (1, 2):
+			args = syscalls.get(self.arg[0], "0x%x" % self.arg[0]) + \
+			       " " + " ".join(["0x%x" % a for a in self.arg[1:]])
+		return "%-14s %s" % (events.get(self.event, "event%d" %
+						 self.event), args)
+
+def parse(data):
+	info = struct.unpack_from(INFO_FORMAT, data, 0)
+	magic, ncpu, nentries, counts_per_usec, ticks_per_sec = info[:5]
+	if magic != TRACE_MAGIC:
+		raise ValueError("Not a trace dump, magic is 0x%x" % magic)
+
+	entry_size = struct.calcsize(ENTRY_FORMAT)
+	ring_size = struct.calcsize(RING_HEAD_FORMAT) + nentries * entry_size
+	offset = struct.calcsize(INFO_FORMAT)
+
+	rings = []
+	for cpu in range(ncpu):
+		head = struct.unpack_from(RING_HEAD_FORMAT, data, offset)[0]
+		base = offset + struct.calcsize(RING_HEAD_FORMAT)
+		entries = []
+		for seq in range(max(0, head - nentries), head):
+			at = base + (seq % nentries) * entry_size
+			e = trace_entry(struct.unpack_from(ENTRY_FORMAT, data, at))
+			# Torn or not yet written over
+			if e.seq != seq or e.seq == TRACE_SEQ_BUSY:
+				continue
+			entries.append(e)
+		rings.append(entries)
+		offset += ring_size
+
+	# Stamps wrap around, so they are made monotonic per cpu. All cpus
+	# read the same clock, their times start from the earliest stamp.
+	if counts_per_usec:
+		usec_per_count = 1.0 / counts_per_usec
+	else:
+		usec_per_count = 1000000.0 / ticks_per_sec
+	firsts = [entries[0].stamp for entries in rings if entries]
+	base = firsts and min(firsts) or 0
+	for entries in rings:
+		last = base
+		time = 0
+		for e in entries:
+			time += ((e.stamp - last) & 0xFFFFFFFF) * usec_per_count
+			last = e.stamp
+			e.time = time
+
+	return rings
+
+def print_events(rings):
+	'''Lists events of all cpus in time order'''
+	merged = []
+	for entries in rings:
+		merged.extend(entries)
+	merged.sort(key = lambda e: (e.time, e.cpu, e.seq))
+	for e in merged:
+		print("%12.1f cpu%d tid %-6d %s" % (e.time, e.cpu, e.tid,
+						    e.describe()))
+
+def print_outliers(rings, count):
+	'''Lists the longest calls, faults and irqs on each cpu'''
+	spans = []
+	for entries in rings:
+		open_events = []
+		for e in entries:
+			if e.event in (1, 5, 7):
+				open_events.append(e)
+			elif e.event in exits:
+				start, key = exits[e.event]
+				# Entries are nested on a cpu, irqs in calls
+				for i in range(len(open_events) - 1, -1, -1):
+					o = open_events[i]
+					if o.event == start and \
+					   o.arg[key] == e.arg[key]:
+						spans.append((e.time - o.time, o))
+						del open_events[i:]
+						break
+
+	spans.sort(key = lambda s: s[0], reverse = True)
+	print("Longest %d of %d:" % (min(count, len(spans)), len(spans)))
+	for usec, e in spans[:count]:
+		print("%10.1f usec  cpu%d tid %-6d at %.1f %s" %
+		      (usec, e.cpu, e.tid, e.time, e.describe()))
+
+def usage():
+	print("Usage: %s [-q] [-o count] trace.bin" % sys.argv[0])
+	print("  -q        Do not list events")
+	print("  -o count  List the count longest calls, faults and irqs")
+
+def main():
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], "hqo:")
+	except getopt.GetoptError:
+		usage()
+		sys.exit(2)
+
+	quiet = False
+	outliers = 0
+	for opt, val in opts:
+		if opt == "-q":
+			quiet = True
+		elif opt == "-o":
+			outliers = int(val)
+		else:
+			usage()
+			sys.exit(0)
+
+	if len(args) != 1:
+		usage()
+		sys.exit(2)
+
+	data = open(args[0], "rb").read()
+	rings = parse(data)
+
+	if not quiet:
+		print_events(rings)
+	if outliers:
+		print_outliers(rings, outliers)
+
+if __name__ == "__main__":
+	main()